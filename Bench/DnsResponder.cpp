@@ -0,0 +1,127 @@
+#include "DnsResponder.h"
+#include <cstring>
+
+namespace bench {
+namespace {
+
+constexpr size_t kHeaderSize = 12;
+constexpr uint16_t kTypeA = 1;
+constexpr uint16_t kClassIn = 1;
+
+// The flags of an answer: a response to a recursive query, recursion available.
+constexpr uint8_t kFlagsHigh = 0x81;
+constexpr uint8_t kFlagsLow = 0x80;
+
+// The TTL of the answers, the cache of the server keeps them at least for its min_ttl.
+constexpr uint32_t kTtl = 1;
+
+void PutUint16(uint8_t* data, uint16_t value) {
+  data[0] = static_cast<uint8_t>(value >> 8);
+  data[1] = static_cast<uint8_t>(value);
+}
+
+uint16_t GetUint16(const uint8_t* data) {
+  return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+}  // namespace
+
+DnsResponder::DnsResponder(boost::asio::io_context& context, const net_udp::endpoint& endpoint)
+    : endpoint_{endpoint},
+      socket_{context},
+      sender_{},
+      query_(kBufferSize),
+      answer_(kBufferSize),
+      answered_{0} {}
+
+std::shared_ptr<DnsResponder> DnsResponder::Create(boost::asio::io_context& context,
+                                                   const net_udp::endpoint& endpoint) {
+  return std::shared_ptr<DnsResponder>(new DnsResponder(context, endpoint));
+}
+
+void DnsResponder::Start() {
+  socket_.open(endpoint_.protocol());
+  socket_.set_option(net_udp::socket::reuse_address(true));
+#if defined(SO_REUSEPORT)
+  socket_.set_option(reuse_port(true));
+#endif
+  socket_.bind(endpoint_);
+  DoReceive();
+}
+
+void DnsResponder::Stop() {
+  error_code ecode;
+  socket_.close(ecode);
+}
+
+uint64_t DnsResponder::GetAnswered() const noexcept {
+  return answered_;
+}
+
+void DnsResponder::DoReceive() {
+  socket_.async_receive_from(
+      boost::asio::buffer(query_), sender_,
+      [this, self = shared_from_this()](const error_code& ecode, size_t size)
+      {
+        if (ecode == boost::asio::error::operation_aborted) {
+          return;
+        }
+
+        if (!ecode) {
+          if (const auto answer_size = Answer(size)) {
+            error_code ecode_send;
+            socket_.send_to(boost::asio::buffer(answer_.data(), answer_size), sender_, 0,
+                            ecode_send);
+            answered_ += !ecode_send;
+          }
+        }
+
+        DoReceive();
+      });
+}
+
+size_t DnsResponder::Answer(size_t size) {
+  // The question is copied as it is: the labels of the name, the type and the class.
+  size_t offset = kHeaderSize;
+  if (size < kHeaderSize || GetUint16(query_.data() + 4) != 1) {
+    return 0;
+  }
+
+  while (offset < size && query_[offset] != 0) {
+    offset += 1 + query_[offset];
+  }
+
+  const auto question_end = offset + 1 + 4;
+  if (question_end > size || question_end + 16 > answer_.size()) {
+    return 0;
+  }
+
+  const auto type = GetUint16(query_.data() + offset + 1);
+  std::memcpy(answer_.data(), query_.data(), question_end);
+  answer_[2] = kFlagsHigh | (query_[2] & 0x01);  // Keeps the RD flag.
+  answer_[3] = kFlagsLow;
+  PutUint16(answer_.data() + 6, type == kTypeA ? 1 : 0);
+  PutUint16(answer_.data() + 8, 0);
+  PutUint16(answer_.data() + 10, 0);  // The OPT record of the query is not repeated.
+
+  if (type != kTypeA) {
+    return question_end;
+  }
+
+  // +------+------+-------+-----+----------+-----------+
+  // | NAME | TYPE | CLASS | TTL | RDLENGTH | 127.0.0.1 |
+  // +------+------+-------+-----+----------+-----------+
+  auto record = answer_.data() + question_end;
+  PutUint16(record, 0xc000 | kHeaderSize);  // A pointer to the name of the question.
+  PutUint16(record + 2, kTypeA);
+  PutUint16(record + 4, kClassIn);
+  PutUint16(record + 6, static_cast<uint16_t>(kTtl >> 16));
+  PutUint16(record + 8, static_cast<uint16_t>(kTtl));
+  PutUint16(record + 10, 4);
+  const uint8_t loopback[] = {127, 0, 0, 1};
+  std::memcpy(record + 12, loopback, sizeof(loopback));
+
+  return question_end + 16;
+}
+
+}  // namespace bench
@@ -0,0 +1,61 @@
+#ifndef BENCH_DNS_RESPONDER_H_
+#define BENCH_DNS_RESPONDER_H_
+
+#include <boost/asio/io_context.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Types.h"
+
+namespace bench {
+
+// A stand-in nameserver for the built-in DNS client of the server. It answers every A query
+// with 127.0.0.1 and every AAAA query with no records, so any name leads to the upstream.
+// All responders of the generator share the port (SO_REUSEPORT), the system spreads the queries
+// between them.
+class DnsResponder final : public std::enable_shared_from_this<DnsResponder> {
+  DnsResponder(boost::asio::io_context& context, const net_udp::endpoint& endpoint);
+
+ public:
+  ~DnsResponder() = default;
+
+  DnsResponder(const DnsResponder&) = delete;
+  DnsResponder& operator=(const DnsResponder&) = delete;
+  DnsResponder(DnsResponder&&) noexcept = delete;
+  DnsResponder& operator=(DnsResponder&&) noexcept = delete;
+
+  // Creates a responder on the endpoint.
+  static std::shared_ptr<DnsResponder> Create(boost::asio::io_context& context,
+                                              const net_udp::endpoint& endpoint);
+
+  // Opens the socket. Throws on failure.
+  void Start();
+
+  // Closes the socket.
+  void Stop();
+
+  // Returns the number of answered queries.
+  uint64_t GetAnswered() const noexcept;
+
+ private:
+  // Maximum size of a query and of an answer.
+  static constexpr size_t kBufferSize = 512;
+
+  // Answers the received queries.
+  void DoReceive();
+
+  // Writes the answer to the query into the answer buffer. Returns its size, 0 if the query is
+  // malformed.
+  size_t Answer(size_t size);
+
+  net_udp::endpoint endpoint_;
+  net_udp::socket socket_;
+  net_udp::endpoint sender_;
+  std::vector<uint8_t> query_;
+  std::vector<uint8_t> answer_;
+  uint64_t answered_;
+};
+
+}  // namespace bench
+
+#endif  // !BENCH_DNS_RESPONDER_H_
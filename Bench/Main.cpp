@@ -0,0 +1,416 @@
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Replay.h"
+#include "Runner.h"
+#include "Statistics.h"
+
+// A load generator for a RedProxy server running on the same machine. The applications behind
+// the proxy are stand-ins started by the generator on the loopback, so no network is needed:
+//
+//   redproxy-bench --scenario handshake --protocol socks5 --concurrency 64 --duration 10
+//   redproxy-bench --scenario idle --sessions 100000 --sources 4 --server-pid $(pidof ...)
+//   redproxy-bench --scenario replay --trace trace.bin --speed 2
+//   redproxy-bench --scenario dns --dns-port 5353 --concurrency 256
+//
+// See --help for all options.
+
+using namespace bench;
+namespace po = boost::program_options;
+
+namespace {
+
+struct Options {
+  Settings settings;
+  std::string proxy;
+  uint16_t socks4_port;
+  uint16_t socks5_port;
+  size_t threads;
+  double duration;
+  size_t sessions;
+  int server_pid;
+  bool replay;        // The replay scenario, which is not played by runners.
+  std::string trace;  // The trace file of the replay scenario.
+  double speed;
+};
+
+// Parses the command line. Returns false if the program should exit.
+bool ParseOptions(int argc, char** argv, Options& options) {
+  std::string scenario;
+  std::string protocol;
+  std::string command;
+  std::string upstream;
+  size_t accept_delay = 0;
+
+  po::options_description description("redproxy-bench options");
+  description.add_options()("help", "Prints the options.");
+  description.add_options()("scenario", po::value(&scenario)->default_value("handshake"),
+                            "handshake, upload, download, echo, udp, idle, dns or replay.");
+  description.add_options()("protocol", po::value(&protocol)->default_value("socks5"),
+                            "socks4, socks4a or socks5.");
+  description.add_options()("command", po::value(&command)->default_value("connect"),
+                            "The command of the handshake scenario: connect, bind or udp.");
+  description.add_options()("proxy", po::value(&options.proxy)->default_value("127.0.0.1"),
+                            "Address of the proxy.");
+  description.add_options()("socks4-port", po::value(&options.socks4_port)->default_value(1080),
+                            "Port of the SOCKS4 server.");
+  description.add_options()("socks5-port", po::value(&options.socks5_port)->default_value(1081),
+                            "Port of the SOCKS5 server.");
+  description.add_options()("user-id", po::value(&options.settings.client.user_id),
+                            "SOCKS4 USER-ID.");
+  description.add_options()("username", po::value(&options.settings.client.username),
+                            "SOCKS5 username, no authentication if it is not set.");
+  description.add_options()("password", po::value(&options.settings.client.password),
+                            "SOCKS5 password.");
+  description.add_options()("pipeline", po::bool_switch(&options.settings.client.pipeline),
+                            "Sends the SOCKS5 greeting, authentication and request in one write.");
+  description.add_options()("domain", po::value(&options.settings.domain),
+                            "Requests this name instead of the address of the upstream, it has "
+                            "to resolve to 127.0.0.1. SOCKS4a requests 'localhost' by default. "
+                            "The dns and replay scenarios request the subdomains of this name, "
+                            "'redproxy.test' by default.");
+  description.add_options()("threads", po::value(&options.threads)->default_value(1),
+                            "Number of runners, each with its own thread and upstream.");
+  description.add_options()("concurrency",
+                            po::value(&options.settings.concurrency)->default_value(64),
+                            "Connections or associations of a runner, sessions opened at a time "
+                            "by a runner in the idle scenario.");
+  description.add_options()("duration", po::value(&options.duration)->default_value(10),
+                            "Duration of the run in seconds.");
+  description.add_options()("size", po::value(&options.settings.message_size)->default_value(64),
+                            "Size of the echo messages and UDP datagrams.");
+  description.add_options()("window", po::value(&options.settings.window)->default_value(16),
+                            "UDP datagrams in flight per association.");
+  description.add_options()("upstream", po::value(&upstream)->default_value("echo"),
+                            "The upstream of the handshake scenario: echo or delayed-accept.");
+  description.add_options()("accept-delay", po::value(&accept_delay)->default_value(10),
+                            "Milliseconds the delayed-accept upstream waits before it answers.");
+  description.add_options()("upstream-ports",
+                            po::value(&options.settings.upstream_ports)->default_value(1),
+                            "Listeners of an upstream, the proxy can open ~28k connections to "
+                            "each.");
+  description.add_options()("sources", po::value(&options.settings.sources)->default_value(1),
+                            "Connect from 127.0.0.1 to 127.0.0.N, ~28k connections per address.");
+  description.add_options()("sessions", po::value(&options.sessions)->default_value(10000),
+                            "Sessions of the idle scenario, the RSS is reported at 10k, 100k, "
+                            "1M and the last one.");
+  description.add_options()("server-pid", po::value(&options.server_pid)->default_value(0),
+                            "PID of the server, for the RSS of the idle scenario.");
+  description.add_options()("dns-port", po::value(&options.settings.dns_port)->default_value(5353),
+                            "Port of the stand-in nameserver of the dns and replay scenarios on "
+                            "127.0.0.1, the server has to use it with resolver=native.");
+  description.add_options()("trace", po::value(&options.trace),
+                            "The trace file recorded by the server, for the replay scenario.");
+  description.add_options()("speed", po::value(&options.speed)->default_value(1),
+                            "Speed of the replay, 2 plays the trace in half of its time.");
+
+  po::variables_map variables;
+  try {
+    po::store(po::parse_command_line(argc, argv, description), variables);
+    po::notify(variables);
+  } catch (const po::error& exception) {
+    std::cerr << exception.what() << "\n" << description;
+    return false;
+  }
+
+  if (variables.count("help")) {
+    std::cout << description;
+    return false;
+  }
+
+  const std::pair<const char*, Scenario> scenarios[] = {
+      {"handshake", Scenario::kHandshake}, {"upload", Scenario::kUpload},
+      {"download", Scenario::kDownload},   {"echo", Scenario::kEcho},
+      {"udp", Scenario::kUdp},             {"idle", Scenario::kIdle},
+      {"dns", Scenario::kDns}};
+  const std::pair<const char*, Protocol> protocols[] = {
+      {"socks4", Protocol::kSocks4},
+      {"socks4a", Protocol::kSocks4a},
+      {"socks5", Protocol::kSocks5}};
+  const std::pair<const char*, Command> commands[] = {
+      {"connect", Command::kConnect}, {"bind", Command::kBind}, {"udp", Command::kUdpAssociate}};
+  const std::pair<const char*, Upstream::Kind> upstreams[] = {
+      {"echo", Upstream::Kind::kEcho}, {"delayed-accept", Upstream::Kind::kDelayedAccept}};
+
+  // Looks the name up in the table, reports an unknown one.
+  auto find = [](const auto& table, const std::string& name, const char* option, auto& value)
+  {
+    for (const auto& [key, item] : table) {
+      if (name == key) {
+        value = item;
+        return true;
+      }
+    }
+
+    std::cerr << "Unknown " << option << " '" << name << "'.\n";
+    return false;
+  };
+
+  auto& settings = options.settings;
+  options.replay = scenario == "replay";
+  if ((!options.replay && !find(scenarios, scenario, "scenario", settings.scenario)) ||
+      !find(protocols, protocol, "protocol", settings.client.protocol) ||
+      !find(commands, command, "command", settings.command) ||
+      !find(upstreams, upstream, "upstream", settings.upstream)) {
+    return false;
+  }
+
+  const bool udp = settings.scenario == Scenario::kUdp ||
+                   (settings.scenario == Scenario::kHandshake &&
+                    settings.command == Command::kUdpAssociate);
+  if (udp && settings.client.protocol != Protocol::kSocks5) {
+    std::cerr << "UDP ASSOCIATE is only supported by SOCKS5.\n";
+    return false;
+  }
+
+  if (settings.scenario == Scenario::kDns) {
+    if (settings.client.protocol == Protocol::kSocks4) {
+      std::cerr << "The dns scenario needs a protocol which requests names: socks4a or socks5.\n";
+      return false;
+    }
+
+    settings.command = Command::kConnect;
+  }
+
+  if ((settings.scenario == Scenario::kDns || options.replay) && settings.domain.empty()) {
+    settings.domain = "redproxy.test";
+  }
+
+  error_code ecode;
+  const auto proxy = boost::asio::ip::make_address(options.proxy, ecode);
+  if (ecode) {
+    std::cerr << "Invalid proxy address '" << options.proxy << "'.\n";
+    return false;
+  }
+
+  if (options.replay && (options.trace.empty() || !(options.speed > 0))) {
+    std::cerr << "The replay scenario needs a --trace and a positive --speed.\n";
+    return false;
+  }
+
+  settings.accept_delay = std::chrono::milliseconds(accept_delay);
+  settings.client.proxy = {
+      proxy,
+      settings.client.protocol == Protocol::kSocks5 ? options.socks5_port : options.socks4_port};
+  options.threads = std::max<size_t>(options.threads, 1);
+  return true;
+}
+
+void PrintLatency(const char* name, const LatencyHistogram& latency) {
+  std::printf("%s: p50=%s p99=%s p999=%s (%llu samples)\n", name,
+              FormatDuration(latency.GetQuantile(0.5)).c_str(),
+              FormatDuration(latency.GetQuantile(0.99)).c_str(),
+              FormatDuration(latency.GetQuantile(0.999)).c_str(),
+              static_cast<unsigned long long>(latency.GetCount()));
+}
+
+// Opens the idle sessions in steps and reports the memory of the server per session.
+void RunIdle(const Options& options, const std::vector<std::shared_ptr<Runner>>& runners) {
+  const auto baseline = options.server_pid ? GetResidentSetSize(options.server_pid) : 0;
+  if (options.server_pid == 0) {
+    std::printf("No --server-pid, the RSS of the server is not reported.\n");
+  }
+
+  std::vector<size_t> checkpoints;
+  for (size_t count = 10000; count < options.sessions; count *= 10) {
+    checkpoints.push_back(count);
+  }
+  checkpoints.push_back(options.sessions);
+
+  size_t requested = 0;
+  for (const auto checkpoint : checkpoints) {
+    // Every runner opens its share of the sessions.
+    for (size_t index = 0; index < runners.size(); ++index) {
+      const auto total = checkpoint / runners.size() + (index < checkpoint % runners.size());
+      const auto previous = requested / runners.size() + (index < requested % runners.size());
+      runners[index]->OpenIdleSessions(total - previous);
+    }
+    requested = checkpoint;
+
+    for (;;) {
+      size_t done = 0;
+      for (const auto& runner : runners) {
+        done += runner->GetIdleSessionsDone();
+      }
+      if (done >= checkpoint) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    // The server frees the memory of the handshakes lazily.
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    if (options.server_pid) {
+      const auto rss = GetResidentSetSize(options.server_pid);
+      std::printf("sessions=%zu rss=%.1fMiB per-session=%.0fB\n", checkpoint, rss / 1048576.0,
+                  rss > baseline ? static_cast<double>(rss - baseline) / checkpoint : 0.0);
+    } else {
+      std::printf("sessions=%zu\n", checkpoint);
+    }
+    std::fflush(stdout);
+  }
+}
+
+// Replays the trace with a replayer per thread until all of its sessions are played.
+int RunReplay(const Options& options) {
+  auto sessions = std::make_shared<std::vector<TraceSession>>();
+  std::string error;
+  if (!LoadTrace(options.trace, *sessions, error)) {
+    std::cerr << "Failed to read the trace " << options.trace << ": " << error << ".\n";
+    return 1;
+  }
+
+  ReplaySettings settings;
+  settings.client = options.settings.client;
+  settings.socks4_proxy = {options.settings.client.proxy.address(), options.socks4_port};
+  settings.socks5_proxy = {options.settings.client.proxy.address(), options.socks5_port};
+  settings.domain = options.settings.domain;
+  settings.dns_port = options.settings.dns_port;
+  settings.speed = options.speed;
+  settings.sources = options.settings.sources;
+  settings.upstream_ports = options.settings.upstream_ports;
+
+  std::vector<std::shared_ptr<Replayer>> replayers;
+  for (size_t index = 0; index < options.threads; ++index) {
+    replayers.push_back(Replayer::Create(settings, sessions, index, options.threads));
+  }
+
+  const auto started = std::chrono::steady_clock::now();
+  try {
+    for (auto& replayer : replayers) {
+      replayer->Start(started);
+    }
+  } catch (const boost::system::system_error& exception) {
+    std::cerr << "Failed to start the upstreams: " << exception.what() << ".\n";
+    for (auto& replayer : replayers) {
+      replayer->Stop();
+    }
+    return 1;
+  }
+
+  auto done = [](const std::shared_ptr<Replayer>& replayer) { return replayer->IsDone(); };
+  while (!std::all_of(replayers.begin(), replayers.end(), done)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  for (auto& replayer : replayers) {
+    replayer->Stop();
+  }
+  const auto seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+  Statistics statistics;
+  for (const auto& replayer : replayers) {
+    statistics.Merge(replayer->GetStatistics());
+  }
+
+  std::printf("sessions=%llu errors=%llu bytes=%llu in %.1fs (requests over %.1fs, speed %g)\n",
+              static_cast<unsigned long long>(statistics.operations),
+              static_cast<unsigned long long>(statistics.errors),
+              static_cast<unsigned long long>(statistics.bytes), seconds,
+              sessions->empty() ? 0.0 : sessions->back().request.time / 1e6, options.speed);
+  PrintLatency("handshake latency", statistics.handshake);
+  PrintLatency("lateness", statistics.lateness);
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    return 1;
+  }
+
+  if (options.replay) {
+    return RunReplay(options);
+  }
+
+  std::vector<std::shared_ptr<Runner>> runners;
+  try {
+    for (size_t index = 0; index < options.threads; ++index) {
+      runners.push_back(Runner::Create(options.settings, index));
+      runners.back()->Start();
+    }
+  } catch (const boost::system::system_error& exception) {
+    std::cerr << "Failed to start the upstreams: " << exception.what() << ".\n";
+    for (auto& runner : runners) {
+      runner->Stop();
+    }
+    return 1;
+  }
+
+  const auto started = std::chrono::steady_clock::now();
+  if (options.settings.scenario == Scenario::kIdle) {
+    RunIdle(options, runners);
+  } else {
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+  }
+
+  for (auto& runner : runners) {
+    runner->Stop();
+  }
+  const auto seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+  Statistics statistics;
+  for (const auto& runner : runners) {
+    statistics.Merge(runner->GetStatistics());
+  }
+
+  const auto rate = statistics.operations / seconds;
+  const auto gbits = statistics.bytes * 8 / seconds / 1e9;
+  switch (options.settings.scenario) {
+    case Scenario::kHandshake:
+      std::printf("handshakes=%llu (%.0f/s) errors=%llu\n",
+                  static_cast<unsigned long long>(statistics.operations), rate,
+                  static_cast<unsigned long long>(statistics.errors));
+      PrintLatency("handshake latency", statistics.handshake);
+      break;
+    case Scenario::kUpload:
+    case Scenario::kDownload:
+      std::printf("throughput=%.3f Gbit/s errors=%llu\n", gbits,
+                  static_cast<unsigned long long>(statistics.errors));
+      PrintLatency("handshake latency", statistics.handshake);
+      break;
+    case Scenario::kEcho:
+      std::printf("messages=%llu (%.0f/s) throughput=%.3f Gbit/s errors=%llu\n",
+                  static_cast<unsigned long long>(statistics.operations), rate, gbits,
+                  static_cast<unsigned long long>(statistics.errors));
+      PrintLatency("round trip", statistics.round_trip);
+      break;
+    case Scenario::kUdp:
+      std::printf("datagrams=%llu (%.0f pps) throughput=%.3f Gbit/s errors=%llu lost=%llu "
+                  "stalled=%llu/%zu\n",
+                  static_cast<unsigned long long>(statistics.operations), rate, gbits,
+                  static_cast<unsigned long long>(statistics.errors),
+                  static_cast<unsigned long long>(statistics.lost),
+                  static_cast<unsigned long long>(statistics.stalled),
+                  options.settings.concurrency * options.threads);
+      PrintLatency("round trip", statistics.round_trip);
+      break;
+    case Scenario::kDns:
+      std::printf("lookups=%llu (%.0f/s) errors=%llu queries=%llu\n",
+                  static_cast<unsigned long long>(statistics.operations), rate,
+                  static_cast<unsigned long long>(statistics.errors),
+                  static_cast<unsigned long long>(statistics.queries));
+      PrintLatency("handshake latency", statistics.handshake);
+      break;
+    case Scenario::kIdle:
+      std::printf("sessions=%llu errors=%llu\n",
+                  static_cast<unsigned long long>(statistics.operations),
+                  static_cast<unsigned long long>(statistics.errors));
+      PrintLatency("handshake latency", statistics.handshake);
+      break;
+  }
+
+  return 0;
+}
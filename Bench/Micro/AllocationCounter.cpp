@@ -0,0 +1,14 @@
+#include "AllocationCounter.h"
+
+namespace bench {
+
+AllocationCounter::AllocationCounter(benchmark::State& state) noexcept
+    : state_{state}, started_{GetAllocationCount()} {}
+
+AllocationCounter::~AllocationCounter() {
+  state_.counters["allocs/op"] =
+      benchmark::Counter(static_cast<double>(GetAllocationCount() - started_),
+                         benchmark::Counter::kAvgIterations);
+}
+
+}  // namespace bench
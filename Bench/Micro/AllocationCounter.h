@@ -0,0 +1,28 @@
+#ifndef BENCH_MICRO_ALLOCATION_COUNTER_H_
+#define BENCH_MICRO_ALLOCATION_COUNTER_H_
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include "Allocations.h"
+
+namespace bench {
+
+// Counts the allocations of the benchmark loop it spans, reported as allocs/op.
+class AllocationCounter {
+ public:
+  explicit AllocationCounter(benchmark::State& state) noexcept;
+  ~AllocationCounter();
+
+  AllocationCounter(const AllocationCounter&) = delete;
+  AllocationCounter& operator=(const AllocationCounter&) = delete;
+  AllocationCounter(AllocationCounter&&) noexcept = delete;
+  AllocationCounter& operator=(AllocationCounter&&) noexcept = delete;
+
+ private:
+  benchmark::State& state_;
+  uint64_t started_;
+};
+
+}  // namespace bench
+
+#endif  // !BENCH_MICRO_ALLOCATION_COUNTER_H_
@@ -0,0 +1,51 @@
+#include "Allocations.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+thread_local uint64_t allocation_count = 0;
+
+void* Allocate(size_t size) {
+  ++allocation_count;
+  if (auto pointer = std::malloc(size ? size : 1)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+}  // namespace
+
+// The replaced global allocation functions count every allocation of the process. The aligned and
+// the nothrow forms are left to the standard library, the code under test does not use them.
+void* operator new(size_t size) {
+  return Allocate(size);
+}
+
+void* operator new[](size_t size) {
+  return Allocate(size);
+}
+
+void operator delete(void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+  std::free(pointer);
+}
+
+namespace bench {
+
+uint64_t GetAllocationCount() noexcept {
+  return allocation_count;
+}
+
+}  // namespace bench
@@ -0,0 +1,13 @@
+#ifndef BENCH_MICRO_ALLOCATIONS_H_
+#define BENCH_MICRO_ALLOCATIONS_H_
+
+#include <cstdint>
+
+namespace bench {
+
+// Returns the number of calls of the global operator new on the current thread.
+uint64_t GetAllocationCount() noexcept;
+
+}  // namespace bench
+
+#endif  // !BENCH_MICRO_ALLOCATIONS_H_
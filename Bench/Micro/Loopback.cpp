@@ -0,0 +1,116 @@
+#include "Loopback.h"
+#include <boost/asio/write.hpp>
+#include "Common/Logger.h"
+#include "Configuration.h"
+
+namespace bench {
+
+Loopback::Loopback()
+    : context_{1},
+      work_guard_{context_.get_executor()},
+      server_{},
+      application_acceptor_{context_, {boost::asio::ip::address_v4::loopback(), 0}} {
+  auto config = Configuration::GetInstance();
+  if (!config->IsLoaded()) {
+    config->Load();
+  }
+
+  // The messages of the sessions would be formatted and written on the calling thread.
+  common::Logger::SetLevel(common::LogLevel::warning);
+
+  server_ = Server::Create(context_, {boost::asio::ip::address_v4::loopback(), 0},
+                           Server::Version::kSocks5);
+  server_->Start();
+  application_acceptor_.non_blocking(true);
+}
+
+Loopback::~Loopback() {
+  server_->Stop();
+  context_.poll();
+}
+
+bool Loopback::Connect(net_tcp::socket& client, net_tcp::socket& application) {
+  const auto server = server_->GetLocalEndpoint();
+  const auto target = application_acceptor_.local_endpoint();
+  const auto address = target.address().to_v4().to_bytes();
+  error_code ecode;
+
+  client.connect(server, ecode);
+  if (ecode) {
+    return false;
+  }
+
+  // The greeting and the request in one write, the server reads them in turn.
+  const std::array<char, 13> handshake = {
+      0x05, 0x01, 0x00, 0x05, 0x01, 0x00, 0x01,
+      static_cast<char>(address[0]), static_cast<char>(address[1]),
+      static_cast<char>(address[2]), static_cast<char>(address[3]),
+      static_cast<char>(target.port() >> 8), static_cast<char>(target.port() & 0xff)};
+  boost::asio::write(client, boost::asio::buffer(handshake), ecode);
+  if (ecode) {
+    return false;
+  }
+
+  // The method selection and the reply with an IPv4 address.
+  std::array<char, 12> replies;
+  size_t received = 0;
+  client.non_blocking(true);
+
+  while (received < replies.size()) {
+    context_.poll();
+
+    if (!application.is_open()) {
+      application_acceptor_.accept(application, ecode);
+    }
+
+    received += client.read_some(boost::asio::buffer(replies.data() + received,
+                                                     replies.size() - received),
+                                 ecode);
+    if (ecode && ecode != boost::asio::error::would_block) {
+      return false;
+    }
+  }
+
+  application.non_blocking(true);
+  return replies[1] == 0x00 && replies[3] == 0x00;
+}
+
+bool Loopback::RoundTrip(net_tcp::socket& client, net_tcp::socket& application) {
+  error_code ecode;
+  client.write_some(boost::asio::buffer(message_), ecode);
+  if (ecode) {
+    return false;
+  }
+
+  size_t received = 0;
+  while (received < kMessageSize) {
+    context_.poll();
+
+    const auto size = application.read_some(boost::asio::buffer(echo_), ecode);
+    if (!ecode) {
+      application.write_some(boost::asio::buffer(echo_.data(), size), ecode);
+    }
+    if (ecode && ecode != boost::asio::error::would_block) {
+      return false;
+    }
+
+    received += client.read_some(boost::asio::buffer(message_), ecode);
+    if (ecode && ecode != boost::asio::error::would_block) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void Loopback::Close(net_tcp::socket& client, net_tcp::socket& application) {
+  error_code ecode;
+  client.close(ecode);
+  application.close(ecode);
+
+  while (server_->GetSessionCount() != 0) {
+    context_.poll();
+  }
+}
+
+}  // namespace bench
@@ -0,0 +1,57 @@
+#ifndef BENCH_MICRO_LOOPBACK_H_
+#define BENCH_MICRO_LOOPBACK_H_
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include "Server.h"
+#include "Types.h"
+
+namespace bench {
+
+// A SOCKS5 server and the listener of the application on the loopback, both run on the calling
+// thread. The application is an echo driven by the caller, with non-blocking calls which do not
+// allocate, so every allocation made while the calls run is one of the server.
+class Loopback {
+ public:
+  // Size of the messages echoed through the tunnel.
+  static constexpr size_t kMessageSize = 100;
+  // Round trips or sessions before the counting starts, they fill the buffer pool and the
+  // handler caches.
+  static constexpr size_t kWarmupCycles = 64;
+
+  Loopback();
+  ~Loopback();
+
+  Loopback(const Loopback&) = delete;
+  Loopback& operator=(const Loopback&) = delete;
+  Loopback(Loopback&&) noexcept = delete;
+  Loopback& operator=(Loopback&&) noexcept = delete;
+
+  // Connects the client through a CONNECT tunnel to the application, which is accepted into the
+  // application socket. Returns false if the server did not reply with success.
+  bool Connect(net_tcp::socket& client, net_tcp::socket& application);
+
+  // Sends a message from the client and runs the server and the echo until it came back.
+  // Returns false if a socket has failed.
+  bool RoundTrip(net_tcp::socket& client, net_tcp::socket& application);
+
+  // Closes the sockets and runs the server until the session is deleted.
+  void Close(net_tcp::socket& client, net_tcp::socket& application);
+
+  boost::asio::io_context& GetContext() noexcept { return context_; }
+
+ private:
+  boost::asio::io_context context_;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard_;
+  std::shared_ptr<Server> server_;
+  net_tcp::acceptor application_acceptor_;
+  std::array<char, kMessageSize> message_{};
+  std::array<char, kMessageSize> echo_{};
+};
+
+}  // namespace bench
+
+#endif  // !BENCH_MICRO_LOOPBACK_H_
@@ -0,0 +1,210 @@
+#include <benchmark/benchmark.h>
+#include <array>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "AllocationCounter.h"
+#include "Common/AddressResolve.h"
+#include "Common/Strings.h"
+#include "Session/Socks4/Socks4Types.h"
+#include "Session/Socks5/Authentication/UsernamePassword.h"
+#include "Session/Socks5/Request.h"
+#include "Session/Socks5/Udp/Header.h"
+
+// Microbenchmarks of the parsing and the encoding which runs for every request, reported in
+// ns/op and allocs/op. The inputs are the messages a client sends, with the address types and
+// the sizes seen in practice.
+
+using namespace session;
+using namespace bench;
+
+namespace {
+
+// Server addresses of the requests.
+const auto kIPv4Address = boost::asio::ip::make_address("93.184.216.34");
+const auto kIPv6Address = boost::asio::ip::make_address("2606:2800:220:1:248:1893:25c8:1946");
+const std::string kDomain = "edge-star-mini-shv-01-fra3.facebook.com";
+constexpr uint16_t kPort = 443;
+
+// Appends the SOCKS5 address of the destination: an IP address, or the domain if it is set.
+void AppendAddress(std::vector<char>& message, const boost::asio::ip::address& address,
+                   const std::string& domain) {
+  if (!domain.empty()) {
+    message.push_back(static_cast<char>(socks5::AddressType::kDomainName));
+    message.push_back(static_cast<char>(domain.size()));
+    message.insert(message.end(), domain.begin(), domain.end());
+  } else if (address.is_v4()) {
+    const auto bytes = address.to_v4().to_bytes();
+    message.push_back(static_cast<char>(socks5::AddressType::kIPv4));
+    message.insert(message.end(), bytes.begin(), bytes.end());
+  } else {
+    const auto bytes = address.to_v6().to_bytes();
+    message.push_back(static_cast<char>(socks5::AddressType::kIPv6));
+    message.insert(message.end(), bytes.begin(), bytes.end());
+  }
+
+  message.push_back(static_cast<char>(kPort >> 8));
+  message.push_back(static_cast<char>(kPort & 0xff));
+}
+
+// Returns a SOCKS5 CONNECT request.
+std::vector<char> MakeTcpRequest(const boost::asio::ip::address& address,
+                                 const std::string& domain) {
+  std::vector<char> message = {0x05, static_cast<char>(socks5::Command::kConnect), 0x00};
+  AppendAddress(message, address, domain);
+  return message;
+}
+
+// Returns a SOCKS5 UDP datagram with a 64 byte payload.
+std::vector<char> MakeUdpDatagram(const boost::asio::ip::address& address,
+                                  const std::string& domain) {
+  std::vector<char> message = {0x00, 0x00, 0x00};
+  AppendAddress(message, address, domain);
+  message.resize(message.size() + 64, 'x');
+  return message;
+}
+
+// The work of Socks5Session::DoResolveAddress_ up to the callback or the DNS cache: the
+// destination is read and turned into an endpoint, or its name is copied for the resolver.
+void BM_Socks5ResolveAddress(benchmark::State& state, std::vector<char> request) {
+  AllocationCounter allocations(state);
+
+  for (auto _ : state) {
+    auto message = reinterpret_cast<const socks5::TcpMessage*>(request.data());
+    socks5::detail::RequestDestination destination;
+
+    socks5::detail::GetRequestDestination(
+        message->address_type, request.data() + sizeof(socks5::TcpMessage), destination);
+    if (destination.type == socks5::AddressType::kDomainName) {
+      std::string name(destination.domain);
+      benchmark::DoNotOptimize(name);
+    } else {
+      net_tcp::endpoint endpoint(destination.endpoint.address(), destination.endpoint.port());
+      benchmark::DoNotOptimize(endpoint);
+    }
+  }
+}
+BENCHMARK_CAPTURE(BM_Socks5ResolveAddress, ipv4, MakeTcpRequest(kIPv4Address, {}));
+BENCHMARK_CAPTURE(BM_Socks5ResolveAddress, ipv6, MakeTcpRequest(kIPv6Address, {}));
+BENCHMARK_CAPTURE(BM_Socks5ResolveAddress, domain, MakeTcpRequest({}, kDomain));
+
+// The framing of a request by the handshake buffer, which runs after every read of the request:
+// once per byte of a request which arrives a byte at a time, the worst case.
+void BM_Socks5RequestSize(benchmark::State& state, std::vector<char> request) {
+  AllocationCounter allocations(state);
+
+  for (auto _ : state) {
+    for (size_t size = 1; size <= request.size(); ++size) {
+      benchmark::DoNotOptimize(socks5::detail::GetRequestSize({request.data(), size}));
+    }
+  }
+}
+BENCHMARK_CAPTURE(BM_Socks5RequestSize, ipv4, MakeTcpRequest(kIPv4Address, {}));
+BENCHMARK_CAPTURE(BM_Socks5RequestSize, ipv6, MakeTcpRequest(kIPv6Address, {}));
+BENCHMARK_CAPTURE(BM_Socks5RequestSize, domain, MakeTcpRequest({}, kDomain));
+
+// The encoding of Socks5Session::DoSendReply_.
+void BM_Socks5SendReply(benchmark::State& state, boost::asio::ip::address address) {
+  const net_tcp::endpoint endpoint(address, kPort);
+  std::array<char, socks5::detail::kMaxReplySize> reply;
+  AllocationCounter allocations(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(socks5::detail::WriteReply(socks5::ReplyCode::kOk,
+                                                        {endpoint.address(), endpoint.port()},
+                                                        reply.data()));
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK_CAPTURE(BM_Socks5SendReply, ipv4, kIPv4Address);
+BENCHMARK_CAPTURE(BM_Socks5SendReply, ipv6, kIPv6Address);
+
+// The header of a client datagram: its size, then its destination (a name goes to the resolver).
+void BM_Socks5UdpHeader(benchmark::State& state, std::vector<char> datagram) {
+  net_udp::endpoint endpoint;
+  AllocationCounter allocations(state);
+
+  for (auto _ : state) {
+    const auto header_size = socks5::detail::GetUdpHeaderSize(datagram.data(), datagram.size());
+    benchmark::DoNotOptimize(header_size);
+    benchmark::DoNotOptimize(socks5::detail::GetUdpHeaderEndpoint(datagram.data(), endpoint));
+  }
+}
+BENCHMARK_CAPTURE(BM_Socks5UdpHeader, ipv4, MakeUdpDatagram(kIPv4Address, {}));
+BENCHMARK_CAPTURE(BM_Socks5UdpHeader, ipv6, MakeUdpDatagram(kIPv6Address, {}));
+BENCHMARK_CAPTURE(BM_Socks5UdpHeader, domain, MakeUdpDatagram({}, kDomain));
+
+// The header of an answer to the client, which replaced CreateUdpMessage.
+void BM_Socks5PrependUdpHeader(benchmark::State& state, boost::asio::ip::address address) {
+  const net_udp::endpoint endpoint(address, kPort);
+  std::array<char, socks5::detail::kMaxUdpHeaderSize + 64> datagram;
+  AllocationCounter allocations(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(socks5::detail::PrependUdpHeader(
+        endpoint, datagram.data() + socks5::detail::kMaxUdpHeaderSize));
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK_CAPTURE(BM_Socks5PrependUdpHeader, ipv4, kIPv4Address);
+BENCHMARK_CAPTURE(BM_Socks5PrependUdpHeader, ipv6, kIPv6Address);
+
+void BM_GetIPv4Endpoint(benchmark::State& state) {
+  const auto bytes = kIPv4Address.to_v4().to_bytes();
+  uint32_t address;
+  std::memcpy(&address, bytes.data(), sizeof(address));
+  const auto port = boost::endian::native_to_big(kPort);
+  AllocationCounter allocations(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(address);
+    benchmark::DoNotOptimize(common::GetIPv4Endpoint(address, port));
+  }
+}
+BENCHMARK(BM_GetIPv4Endpoint);
+
+void BM_GetIPv6Endpoint(benchmark::State& state) {
+  const auto bytes = kIPv6Address.to_v6().to_bytes();
+  const auto port = boost::endian::native_to_big(kPort);
+  AllocationCounter allocations(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bytes);
+    benchmark::DoNotOptimize(common::GetIPv6Endpoint(bytes.data(), port));
+  }
+}
+BENCHMARK(BM_GetIPv6Endpoint);
+
+// The USER-ID of a SOCKS4 request, as read by Socks4Session::DoProcessAuthentication.
+void BM_Socks4UserId(benchmark::State& state) {
+  std::vector<char> request(sizeof(socks4::Message), 0x00);
+  request[0] = 0x04;
+  request[1] = static_cast<char>(socks4::Command::kConnect);
+  request.insert(request.end(), static_cast<size_t>(state.range(0)), 'u');
+  request.push_back('\0');
+  AllocationCounter allocations(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(common::GetStringFromArray(request, sizeof(socks4::Message)));
+  }
+}
+BENCHMARK(BM_Socks4UserId)->ArgName("user_id")->Arg(0)->Arg(8)->Arg(15)->Arg(64)->Arg(255);
+
+// The username and the password of the SOCKS5 negotiation, both of the same length.
+void BM_Socks5GetCredentials(benchmark::State& state) {
+  const auto length = static_cast<size_t>(state.range(0));
+  std::vector<char> message = {0x01, static_cast<char>(length)};
+  message.insert(message.end(), length, 'u');
+  message.push_back(static_cast<char>(length));
+  message.insert(message.end(), length, 'p');
+  AllocationCounter allocations(state);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(socks5::detail::UsernamePassword::GetCredentials(message));
+  }
+}
+BENCHMARK(BM_Socks5GetCredentials)->ArgName("length")->Arg(8)->Arg(15)->Arg(64)->Arg(255);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,73 @@
+#include <benchmark/benchmark.h>
+#include "AllocationCounter.h"
+#include "Loopback.h"
+
+// The allocations of a SOCKS5 session, served by a server on the loopback which runs on the
+// benchmark thread. The same cycles are checked against fixed limits by redproxy-tests.
+
+using namespace bench;
+
+namespace {
+
+// A round trip of a message through an established CONNECT tunnel. The relay borrows its
+// buffers and recycles its handlers, so it must not allocate at all.
+void BM_Socks5RelayCycle(benchmark::State& state) {
+  Loopback loopback;
+  net_tcp::socket client{loopback.GetContext()};
+  net_tcp::socket application{loopback.GetContext()};
+
+  if (!loopback.Connect(client, application)) {
+    state.SkipWithError("The CONNECT failed.");
+    return;
+  }
+
+  for (size_t cycle = 0; cycle < Loopback::kWarmupCycles; ++cycle) {
+    loopback.RoundTrip(client, application);
+  }
+
+  {
+    AllocationCounter allocations(state);
+    const auto started = GetAllocationCount();
+
+    for (auto _ : state) {
+      if (!loopback.RoundTrip(client, application)) {
+        state.SkipWithError("The tunnel failed.");
+        break;
+      }
+    }
+
+    if (GetAllocationCount() != started) {
+      state.SkipWithError("The relay allocated in the steady state.");
+    }
+  }
+
+  loopback.Close(client, application);
+}
+BENCHMARK(BM_Socks5RelayCycle);
+
+// A whole CONNECT session: the handshake of a pipelined request, a round trip and the close.
+// The count is the fixed cost of a session.
+void BM_Socks5ConnectSession(benchmark::State& state) {
+  Loopback loopback;
+  net_tcp::socket client{loopback.GetContext()};
+  net_tcp::socket application{loopback.GetContext()};
+
+  for (size_t cycle = 0; cycle < Loopback::kWarmupCycles; ++cycle) {
+    loopback.Connect(client, application);
+    loopback.Close(client, application);
+  }
+
+  AllocationCounter allocations(state);
+
+  for (auto _ : state) {
+    if (!loopback.Connect(client, application) || !loopback.RoundTrip(client, application)) {
+      state.SkipWithError("The CONNECT failed.");
+      break;
+    }
+
+    loopback.Close(client, application);
+  }
+}
+BENCHMARK(BM_Socks5ConnectSession);
+
+}  // namespace
@@ -0,0 +1,481 @@
+#include "Replay.h"
+#include <boost/asio/write.hpp>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+namespace bench {
+namespace {
+
+// Size of the SOCKS5 UDP header with an IPv4 address.
+constexpr size_t kUdpHeaderSize = 10;
+
+// Maximum length of a label of a domain name.
+constexpr size_t kMaxLabelLength = 63;
+
+// Returns a subdomain of the domain of the length, the labels in front of it are made of the hex
+// digits of the destination so the sessions to one destination request one name. Returns the
+// domain if it is not shorter than the length.
+std::string GetPaddedName(const std::string& domain, size_t length, uint64_t destination) {
+  constexpr char kDigits[] = "0123456789abcdef";
+  if (length <= domain.size() + 1) {
+    return domain;
+  }
+
+  // Every label takes its length and a dot, a label cannot be empty.
+  auto remaining = length - domain.size();
+  std::string name;
+  name.reserve(length);
+
+  while (remaining > 1) {
+    auto label = std::min(remaining - 1, kMaxLabelLength);
+    if (remaining - label - 1 == 1) {
+      --label;
+    }
+
+    for (size_t index = 0; index < label; ++index) {
+      name += kDigits[(destination >> (index % 16 * 4)) & 0xf];
+    }
+    name += '.';
+    remaining -= label + 1;
+  }
+
+  return name + domain;
+}
+
+}  // namespace
+
+bool LoadTrace(const std::string& path, std::vector<TraceSession>& sessions, std::string& error) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    error = "cannot open the file";
+    return false;
+  }
+
+  common::TraceHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, common::kTraceMagic, sizeof(header.magic)) != 0) {
+    error = "not a trace file";
+    return false;
+  }
+  if (header.version != common::kTraceVersion ||
+      header.record_size != sizeof(common::TraceRecord)) {
+    error = "unsupported trace version";
+    return false;
+  }
+
+  // The records of the sessions are interleaved, and the bursts of the two directions of a
+  // session are written when they end.
+  std::unordered_map<uint64_t, TraceSession> traced;
+  common::TraceRecord record;
+  while (file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+    auto& session = traced[record.session];
+    switch (record.event) {
+      case common::TraceEvent::kRequest:
+        session.request = record;
+        break;
+      case common::TraceEvent::kBurst:
+        session.bursts.push_back(record);
+        break;
+      case common::TraceEvent::kClose:
+        session.close = record.time;
+        break;
+    }
+  }
+
+  sessions.clear();
+  for (auto& [id, session] : traced) {
+    if (session.request.event != common::TraceEvent::kRequest) {
+      continue;
+    }
+
+    std::sort(session.bursts.begin(), session.bursts.end(),
+              [](const common::TraceRecord& left, const common::TraceRecord& right)
+              { return left.time < right.time; });
+    sessions.push_back(std::move(session));
+  }
+
+  std::sort(sessions.begin(), sessions.end(),
+            [](const TraceSession& left, const TraceSession& right)
+            {
+              return left.request.time != right.request.time
+                         ? left.request.time < right.request.time
+                         : left.request.session < right.request.session;
+            });
+
+  const uint64_t origin = sessions.empty() ? 0 : sessions.front().request.time;
+  for (auto& session : sessions) {
+    session.request.time -= origin;
+    for (auto& burst : session.bursts) {
+      burst.time = burst.time > origin ? burst.time - origin : 0;
+    }
+    if (session.close != UINT64_MAX) {
+      session.close = session.close > origin ? session.close - origin : 0;
+    }
+  }
+
+  return true;
+}
+
+Replayer::Replayer(const ReplaySettings& settings,
+                   const std::shared_ptr<const std::vector<TraceSession>>& sessions, size_t index,
+                   size_t count)
+    : settings_{settings},
+      sessions_{sessions},
+      next_session_{index},
+      count_{std::max<size_t>(count, 1)},
+      context_{1},
+      work_guard_{context_.get_executor()},
+      upstream_{},
+      dns_responder_{},
+      start_timer_{context_},
+      thread_{},
+      started_{},
+      zeros_(kChunkSize),
+      next_source_{index},
+      active_{0},
+      statistics_{},
+      done_{false} {}
+
+std::shared_ptr<Replayer> Replayer::Create(
+    const ReplaySettings& settings,
+    const std::shared_ptr<const std::vector<TraceSession>>& sessions, size_t index,
+    size_t count) {
+  return std::shared_ptr<Replayer>(new Replayer(settings, sessions, index, count));
+}
+
+void Replayer::Start(std::chrono::steady_clock::time_point started) {
+  started_ = started;
+  upstream_ = Upstream::Create(context_, Upstream::Kind::kScripted, settings_.upstream_ports, {});
+  upstream_->Start();
+
+  dns_responder_ = DnsResponder::Create(
+      context_, {boost::asio::ip::address_v4::loopback(), settings_.dns_port});
+  dns_responder_->Start();
+
+  DoStartNext();
+  thread_ = std::thread([this]() { context_.run(); });
+}
+
+void Replayer::Stop() {
+  context_.stop();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool Replayer::IsDone() const noexcept {
+  return done_.load(std::memory_order_acquire);
+}
+
+const Statistics& Replayer::GetStatistics() const noexcept {
+  return statistics_;
+}
+
+std::chrono::steady_clock::time_point Replayer::GetTime(uint64_t time) const noexcept {
+  return started_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double, std::micro>(time / settings_.speed));
+}
+
+void Replayer::RecordLateness(uint64_t time) {
+  const auto lateness = std::chrono::steady_clock::now() - GetTime(time);
+  statistics_.lateness.Record(std::max(lateness, std::chrono::steady_clock::duration::zero()));
+}
+
+void Replayer::DoStartNext() {
+  if (next_session_ >= sessions_->size()) {
+    if (active_ == 0) {
+      done_.store(true, std::memory_order_release);
+    }
+    return;
+  }
+
+  const auto& trace = (*sessions_)[next_session_];
+  start_timer_.expires_at(GetTime(trace.request.time));
+  start_timer_.async_wait(
+      [this, &trace](const error_code& ecode)
+      {
+        if (ecode) {
+          return;
+        }
+
+        RecordLateness(trace.request.time);
+        next_session_ += count_;
+        ++active_;
+
+        auto session = std::make_shared<Session>(context_);
+        session->trace = &trace;
+        DoRequest(session);
+        DoStartNext();
+      });
+}
+
+void Replayer::DoRequest(const std::shared_ptr<Session>& session) {
+  const auto& request = session->trace->request.request;
+  const bool domain = request.address_type == common::TraceAddressType::kDomainName;
+  const auto command = static_cast<Command>(request.command);
+  auto options = settings_.client;
+
+  if (request.protocol == 4) {
+    options.protocol = domain ? Protocol::kSocks4a : Protocol::kSocks4;
+    options.proxy = settings_.socks4_proxy;
+    if (options.user_id.empty()) {
+      options.user_id.assign(request.user_length, 'u');
+    }
+  } else {
+    options.protocol = Protocol::kSocks5;
+    options.proxy = settings_.socks5_proxy;
+  }
+
+  Destination destination{{}, upstream_->GetEndpoint(request.port)};
+  if (command == Command::kUdpAssociate) {
+    // The association is requested for the address the datagrams will come from.
+    error_code ecode;
+    session->udp_socket.open(net_udp::v4(), ecode);
+    session->udp_socket.bind({boost::asio::ip::address_v4::loopback(), 0}, ecode);
+    const auto local = session->udp_socket.local_endpoint(ecode);
+    if (ecode) {
+      Finish(*session, true);
+      return;
+    }
+    destination.endpoint = {local.address(), local.port()};
+  } else if (domain && command == Command::kConnect) {
+    destination.domain =
+        GetPaddedName(settings_.domain, request.name_length, request.destination);
+  }
+
+  // 127.0.0.1 + n, every source address has its own range of ephemeral ports.
+  boost::asio::ip::address source;
+  if (settings_.sources > 1) {
+    source = boost::asio::ip::address_v4{
+        static_cast<uint32_t>(0x7f000001 + next_source_++ % settings_.sources)};
+  }
+
+  session->requested = std::chrono::steady_clock::now();
+  session->client = SocksClient::Create(context_, options);
+  session->client->Request(
+      source, command, destination,
+      [this, session, command](const error_code& ecode)
+      {
+        if (ecode) {
+          Finish(*session, true);
+          return;
+        }
+
+        if (command == Command::kBind) {
+          DoBindApplication(session);
+          return;
+        }
+
+        if (command == Command::kUdpAssociate) {
+          const auto& relay = session->client->GetReplyEndpoint();
+          session->relay = {relay.address(), relay.port()};
+        }
+
+        statistics_.handshake.Record(std::chrono::steady_clock::now() - session->requested);
+        DoReceive(session);
+        DoPlay(session);
+      });
+}
+
+void Replayer::DoBindApplication(const std::shared_ptr<Session>& session) {
+  auto application = std::make_shared<net_tcp::socket>(context_);
+
+  auto play = [this, session, application]()
+  {
+    statistics_.handshake.Record(std::chrono::steady_clock::now() - session->requested);
+    upstream_->Serve(std::move(*application));
+    DoReceive(session);
+    DoPlay(session);
+  };
+
+  application->async_connect(
+      session->client->GetReplyEndpoint(),
+      [this, session, play](const error_code& ecode)
+      {
+        if (ecode) {
+          Finish(*session, true);
+        } else if (session->trace->request.request.protocol == 5) {
+          // The server starts the tunnel right after the accept, without a second reply.
+          play();
+        } else {
+          session->client->ReadReply(
+              [this, session, play](const error_code& ecode)
+              {
+                if (ecode) {
+                  Finish(*session, true);
+                } else {
+                  play();
+                }
+              });
+        }
+      });
+}
+
+void Replayer::DoPlay(const std::shared_ptr<Session>& session) {
+  const auto& trace = *session->trace;
+  const bool close = session->next_burst >= trace.bursts.size();
+  uint64_t time = close ? trace.close : trace.bursts[session->next_burst].time;
+
+  // The trace was stopped before the session was closed, it ends with its last burst.
+  if (time == UINT64_MAX) {
+    time = trace.bursts.empty()
+               ? trace.request.time + trace.request.request.handshake
+               : trace.bursts.back().time + trace.bursts.back().burst.duration;
+  }
+
+  session->timer.expires_at(GetTime(time));
+  session->timer.async_wait(
+      [this, session, close, time](const error_code& ecode)
+      {
+        if (ecode || session->finished) {
+          return;
+        }
+
+        RecordLateness(time);
+        if (close) {
+          Finish(*session, false);
+          return;
+        }
+
+        const auto& burst = session->trace->bursts[session->next_burst++];
+        if (session->udp_socket.is_open()) {
+          SendBurstDatagrams(*session, burst);
+          DoPlay(session);
+        } else {
+          DoWriteBurst(session, burst);
+        }
+      });
+}
+
+void Replayer::DoWriteBurst(const std::shared_ptr<Session>& session,
+                            const common::TraceRecord& burst) {
+  const bool upload = burst.burst.direction == common::TraceDirection::kUpload;
+  const auto size = static_cast<uint32_t>(std::min<uint64_t>(burst.burst.bytes, UINT32_MAX));
+  auto frame = std::make_shared<std::array<char, Upstream::kFrameSize>>();
+
+  (*frame)[0] = upload ? Upstream::kUploadFrame : Upstream::kDownloadFrame;
+  std::memcpy(frame->data() + 1, &size, sizeof(size));
+
+  boost::asio::async_write(session->client->GetSocket(), boost::asio::buffer(*frame),
+                           [this, session, frame, upload, size](const error_code& ecode, size_t)
+                           {
+                             if (ecode) {
+                               Finish(*session, true);
+                             } else if (upload) {
+                               DoWriteData(session, size);
+                             } else {
+                               DoPlay(session);
+                             }
+                           });
+}
+
+void Replayer::DoWriteData(const std::shared_ptr<Session>& session, uint64_t size) {
+  if (size == 0) {
+    DoPlay(session);
+    return;
+  }
+
+  boost::asio::async_write(
+      session->client->GetSocket(),
+      boost::asio::buffer(zeros_.data(), std::min<uint64_t>(size, zeros_.size())),
+      [this, session, size](const error_code& ecode, size_t written)
+      {
+        if (ecode) {
+          Finish(*session, true);
+          return;
+        }
+
+        statistics_.bytes += written;
+        DoWriteData(session, size - written);
+      });
+}
+
+void Replayer::SendBurstDatagrams(Session& session, const common::TraceRecord& burst) {
+  // +----+------+------+----------+----------+----------+
+  // |RSV | FRAG | ATYP | DST.ADDR | DST.PORT |   DATA   |
+  // +----+------+------+----------+----------+----------+
+  const auto destination = upstream_->GetUdpEndpoint();
+  const auto address = destination.address().to_v4().to_bytes();
+  const uint32_t count = std::max<uint32_t>(burst.burst.datagrams, 1);
+  const auto size = static_cast<uint32_t>(
+      std::clamp<uint64_t>(burst.burst.bytes / count, 1, kChunkSize - kUdpHeaderSize));
+  std::vector<char> datagram(kUdpHeaderSize);
+
+  datagram[3] = 0x01;
+  std::memcpy(datagram.data() + 4, address.data(), address.size());
+  datagram[8] = static_cast<char>(destination.port() >> 8);
+  datagram[9] = static_cast<char>(destination.port());
+
+  error_code ecode;
+  if (burst.burst.direction == common::TraceDirection::kDownload) {
+    // One datagram asks the upstream for the datagrams of the burst.
+    datagram.resize(kUdpHeaderSize + Upstream::kFrameSize + sizeof(count));
+    datagram[kUdpHeaderSize] = Upstream::kDownloadFrame;
+    std::memcpy(datagram.data() + kUdpHeaderSize + 1, &size, sizeof(size));
+    std::memcpy(datagram.data() + kUdpHeaderSize + Upstream::kFrameSize, &count, sizeof(count));
+    session.udp_socket.send_to(boost::asio::buffer(datagram), session.relay, 0, ecode);
+    return;
+  }
+
+  datagram.resize(kUdpHeaderSize + size, Upstream::kUploadFrame);
+  for (uint32_t index = 0; index < count; ++index) {
+    // A full socket buffer drops the datagram, as the network would.
+    session.udp_socket.send_to(boost::asio::buffer(datagram), session.relay, 0, ecode);
+    if (!ecode) {
+      statistics_.bytes += size;
+    }
+  }
+}
+
+void Replayer::DoReceive(const std::shared_ptr<Session>& session) {
+  auto handler = [this, session](const error_code& ecode, size_t size)
+  {
+    if (session->finished) {
+      return;
+    }
+
+    if (ecode) {
+      Finish(*session, true);
+      return;
+    }
+
+    statistics_.bytes += session->udp_socket.is_open() ? size - std::min(size, kUdpHeaderSize)
+                                                       : size;
+    DoReceive(session);
+  };
+
+  if (session->udp_socket.is_open()) {
+    session->udp_socket.async_receive(boost::asio::buffer(session->buffer), handler);
+  } else {
+    session->client->GetSocket().async_read_some(boost::asio::buffer(session->buffer), handler);
+  }
+}
+
+void Replayer::Finish(Session& session, bool failed) {
+  if (session.finished) {
+    return;
+  }
+
+  error_code ecode;
+  session.finished = true;
+  session.timer.cancel();
+  session.udp_socket.close(ecode);
+  if (session.client) {
+    session.client->GetSocket().close(ecode);
+  }
+
+  if (failed) {
+    ++statistics_.errors;
+  } else {
+    ++statistics_.operations;
+  }
+
+  if (--active_ == 0 && next_session_ >= sessions_->size()) {
+    done_.store(true, std::memory_order_release);
+  }
+}
+
+}  // namespace bench
@@ -0,0 +1,157 @@
+#ifndef BENCH_REPLAY_H_
+#define BENCH_REPLAY_H_
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Common/Trace.h"
+#include "DnsResponder.h"
+#include "SocksClient.h"
+#include "Statistics.h"
+#include "Upstream.h"
+
+namespace bench {
+
+// A session of a traffic trace recorded by the server.
+struct TraceSession {
+  common::TraceRecord request;
+  std::vector<common::TraceRecord> bursts;  // In the order of their time.
+  uint64_t close = UINT64_MAX;              // Time of the close, UINT64_MAX if it was not traced.
+};
+
+// Reads the sessions of the trace file in the order of their requests, without the sessions
+// whose request was not traced. The times are moved so the first session starts at 0. Returns
+// false with the reason if the file cannot be read.
+bool LoadTrace(const std::string& path, std::vector<TraceSession>& sessions, std::string& error);
+
+struct ReplaySettings {
+  SocksClient::Options client;     // The protocol and the proxy are taken from the trace.
+  net_tcp::endpoint socks4_proxy;  // The proxy of the SOCKS4 sessions.
+  net_tcp::endpoint socks5_proxy;  // The proxy of the SOCKS5 sessions.
+  std::string domain;              // The domain names are padded subdomains of it.
+  uint16_t dns_port;               // Port of the stand-in nameserver on 127.0.0.1.
+  double speed;                    // The times of the trace are divided by it.
+  size_t sources;                  // The clients connect from 127.0.0.1 to 127.0.0.N.
+  size_t upstream_ports;           // Number of listeners of the upstream.
+};
+
+// Replays a share of the sessions of a trace on its own thread, like a runner. Each session is
+// requested at the time of its request with the recorded protocol and command. The destinations
+// are replaced by a scripted upstream on the loopback, the listener is chosen by the recorded
+// port, a domain name by a subdomain of the domain padded to the recorded length, which the
+// stand-in nameserver answers. The bursts are played at their times in one write, a download
+// burst asks the upstream for its bytes. The UDP bursts send the recorded number of datagrams.
+class Replayer final {
+  Replayer(const ReplaySettings& settings,
+           const std::shared_ptr<const std::vector<TraceSession>>& sessions, size_t index,
+           size_t count);
+
+ public:
+  ~Replayer() = default;
+
+  Replayer(const Replayer&) = delete;
+  Replayer& operator=(const Replayer&) = delete;
+  Replayer(Replayer&&) noexcept = delete;
+  Replayer& operator=(Replayer&&) noexcept = delete;
+
+  // Creates the replayer of every count-th session, starting with the index.
+  static std::shared_ptr<Replayer> Create(
+      const ReplaySettings& settings,
+      const std::shared_ptr<const std::vector<TraceSession>>& sessions, size_t index,
+      size_t count);
+
+  // Starts the upstream and the thread, the trace starts at the time. Throws if the upstream
+  // cannot be started.
+  void Start(std::chrono::steady_clock::time_point started);
+
+  // Stops the thread. The connections are closed.
+  void Stop();
+
+  // Returns true if all sessions of the share have been played.
+  bool IsDone() const noexcept;
+
+  // Returns the statistics. Only to be used after the replayer is stopped.
+  const Statistics& GetStatistics() const noexcept;
+
+ private:
+  // Size of the buffer of the written and the received data.
+  static constexpr size_t kChunkSize = 65536;
+
+  // A session being played.
+  struct Session {
+    explicit Session(boost::asio::io_context& context)
+        : timer{context}, udp_socket{context}, buffer(kChunkSize) {}
+
+    const TraceSession* trace = nullptr;
+    std::shared_ptr<SocksClient> client;
+    boost::asio::steady_timer timer;
+    net_udp::socket udp_socket;  // The socket of a UDP association.
+    net_udp::endpoint relay;
+    size_t next_burst = 0;
+    std::chrono::steady_clock::time_point requested;
+    std::vector<char> buffer;  // Receives the downloaded data.
+    bool finished = false;
+  };
+
+  // Returns the time of the trace on the clock.
+  std::chrono::steady_clock::time_point GetTime(uint64_t time) const noexcept;
+
+  // Records how late the event of the time is.
+  void RecordLateness(uint64_t time);
+
+  // Waits for the request of the next session of the share, then starts it.
+  void DoStartNext();
+
+  // Requests the session.
+  void DoRequest(const std::shared_ptr<Session>& session);
+
+  // Completes a BIND: connects to the bound endpoint as the application, which is served by the
+  // upstream, then plays the session.
+  void DoBindApplication(const std::shared_ptr<Session>& session);
+
+  // Waits for the next burst or the close, then plays it.
+  void DoPlay(const std::shared_ptr<Session>& session);
+
+  // Writes the burst into the tunnel, then plays the next one.
+  void DoWriteBurst(const std::shared_ptr<Session>& session, const common::TraceRecord& burst);
+
+  // Writes the size of zeros, then plays the next burst.
+  void DoWriteData(const std::shared_ptr<Session>& session, uint64_t size);
+
+  // Sends the datagrams of the burst through the association.
+  void SendBurstDatagrams(Session& session, const common::TraceRecord& burst);
+
+  // Reads from the tunnel or the association until it is closed.
+  void DoReceive(const std::shared_ptr<Session>& session);
+
+  // Closes the session and counts it as played or failed.
+  void Finish(Session& session, bool failed);
+
+  ReplaySettings settings_;
+  std::shared_ptr<const std::vector<TraceSession>> sessions_;
+  size_t next_session_;  // Index of the next session of the share.
+  size_t count_;         // Number of replayers, the share is every count-th session.
+  boost::asio::io_context context_;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard_;
+  std::shared_ptr<Upstream> upstream_;
+  std::shared_ptr<DnsResponder> dns_responder_;
+  boost::asio::steady_timer start_timer_;
+  std::thread thread_;
+  std::chrono::steady_clock::time_point started_;
+  std::vector<char> zeros_;  // The written data.
+  size_t next_source_;
+  size_t active_;  // Sessions started and not finished.
+  Statistics statistics_;
+  std::atomic<bool> done_;
+};
+
+}  // namespace bench
+
+#endif  // !BENCH_REPLAY_H_
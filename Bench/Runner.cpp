@@ -0,0 +1,522 @@
+#include "Runner.h"
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace bench {
+namespace {
+
+// Size of the SOCKS5 UDP header with an IPv4 address.
+constexpr size_t kUdpHeaderSize = 10;
+
+// The delay before a failed connection is retried.
+constexpr std::chrono::milliseconds kRetryDelay{10};
+
+int64_t GetTime() noexcept {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+Runner::Runner(const Settings& settings, size_t index)
+    : settings_{settings},
+      context_{1},
+      work_guard_{context_.get_executor()},
+      upstream_{},
+      dns_responder_{},
+      thread_{},
+      index_{index},
+      next_source_{index},
+      next_port_{index},
+      next_name_{0},
+      statistics_{},
+      idle_pending_{0},
+      idle_openers_{0},
+      idle_{},
+      idle_done_{0} {}
+
+std::shared_ptr<Runner> Runner::Create(const Settings& settings, size_t index) {
+  return std::shared_ptr<Runner>(new Runner(settings, index));
+}
+
+void Runner::Start() {
+  auto kind = Upstream::Kind::kEcho;
+  switch (settings_.scenario) {
+    case Scenario::kHandshake:
+      kind = settings_.upstream;
+      break;
+    case Scenario::kUpload:
+      kind = Upstream::Kind::kSink;
+      break;
+    case Scenario::kDownload:
+      kind = Upstream::Kind::kSource;
+      break;
+    default:
+      break;
+  }
+
+  upstream_ = Upstream::Create(context_, kind, settings_.upstream_ports, settings_.accept_delay);
+  upstream_->Start();
+
+  if (settings_.scenario == Scenario::kDns) {
+    dns_responder_ = DnsResponder::Create(
+        context_, {boost::asio::ip::address_v4::loopback(), settings_.dns_port});
+    dns_responder_->Start();
+  }
+
+  for (size_t index = 0; index < settings_.concurrency; ++index) {
+    switch (settings_.scenario) {
+      case Scenario::kHandshake:
+      case Scenario::kDns:
+        DoHandshake();
+        break;
+      case Scenario::kUpload:
+        DoOpenTunnel(
+            [this](const std::shared_ptr<SocksClient>& client)
+            { DoUpload(client, std::make_shared<std::vector<char>>(kChunkSize)); });
+        break;
+      case Scenario::kDownload:
+        DoOpenTunnel(
+            [this](const std::shared_ptr<SocksClient>& client)
+            { DoDownload(client, std::make_shared<std::vector<char>>(kChunkSize)); });
+        break;
+      case Scenario::kEcho:
+        DoOpenTunnel(
+            [this](const std::shared_ptr<SocksClient>& client)
+            { DoEcho(client, std::make_shared<std::vector<char>>(settings_.message_size)); });
+        break;
+      case Scenario::kUdp:
+        DoAssociate();
+        break;
+      case Scenario::kIdle:
+        break;
+    }
+  }
+
+  thread_ = std::thread([this]() { context_.run(); });
+}
+
+void Runner::Stop() {
+  context_.stop();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+
+  if (dns_responder_) {
+    statistics_.queries = dns_responder_->GetAnswered();
+  }
+}
+
+void Runner::OpenIdleSessions(size_t count) {
+  boost::asio::post(context_,
+                    [this, count]()
+                    {
+                      idle_pending_ += count;
+                      while (idle_openers_ < settings_.concurrency && idle_pending_ > 0) {
+                        ++idle_openers_;
+                        --idle_pending_;
+                        DoOpenIdleSession();
+                      }
+                    });
+}
+
+size_t Runner::GetIdleSessionsDone() const noexcept {
+  return idle_done_.load(std::memory_order_acquire);
+}
+
+const Statistics& Runner::GetStatistics() const noexcept {
+  return statistics_;
+}
+
+boost::asio::ip::address Runner::GetNextSource() {
+  if (settings_.sources <= 1) {
+    return {};
+  }
+
+  // 127.0.0.1 + n, every source address has its own range of ephemeral ports.
+  return boost::asio::ip::address_v4{
+      static_cast<uint32_t>(0x7f000001 + next_source_++ % settings_.sources)};
+}
+
+Destination Runner::GetNextDestination() {
+  if (settings_.scenario == Scenario::kDns) {
+    // <name>.<runner>.<domain>, a miss of the DNS cache of the server.
+    return {std::to_string(next_name_++) + '.' + std::to_string(index_) + '.' + settings_.domain,
+            upstream_->GetEndpoint(next_port_++)};
+  }
+
+  return {settings_.domain, upstream_->GetEndpoint(next_port_++)};
+}
+
+void Runner::DoRetry(std::function<void()> handler) {
+  ++statistics_.errors;
+
+  auto timer = std::make_shared<boost::asio::steady_timer>(context_, kRetryDelay);
+  timer->async_wait([timer, handler = std::move(handler)](const error_code&) { handler(); });
+}
+
+void Runner::DoOpenTunnel(std::function<void(const std::shared_ptr<SocksClient>&)> handler) {
+  const auto started = std::chrono::steady_clock::now();
+  auto client = SocksClient::Create(context_, settings_.client);
+
+  client->Request(GetNextSource(), Command::kConnect, GetNextDestination(),
+                  [this, client, started, handler](const error_code& ecode)
+                  {
+                    if (ecode) {
+                      DoRetry([this, handler]() { DoOpenTunnel(handler); });
+                      return;
+                    }
+
+                    statistics_.handshake.Record(std::chrono::steady_clock::now() - started);
+                    handler(client);
+                  });
+}
+
+void Runner::DoHandshake() {
+  const auto started = std::chrono::steady_clock::now();
+  auto client = SocksClient::Create(context_, settings_.client);
+  auto destination = GetNextDestination();
+  std::shared_ptr<net_udp::socket> udp_socket;
+
+  if (settings_.command == Command::kUdpAssociate) {
+    // The association is requested for the address the datagrams will come from.
+    error_code ecode;
+    udp_socket = std::make_shared<net_udp::socket>(context_);
+    udp_socket->open(net_udp::v4(), ecode);
+    udp_socket->bind({boost::asio::ip::address_v4::loopback(), 0}, ecode);
+    destination = {{}, {udp_socket->local_endpoint(ecode).address(),
+                        udp_socket->local_endpoint(ecode).port()}};
+  } else if (settings_.command == Command::kBind) {
+    // The application will connect from the loopback.
+    destination.domain.clear();
+  }
+
+  client->Request(GetNextSource(), settings_.command, destination,
+                  [this, client, started, udp_socket](const error_code& ecode)
+                  {
+                    if (ecode) {
+                      DoRetry([this]() { DoHandshake(); });
+                      return;
+                    }
+
+                    switch (settings_.command) {
+                      case Command::kConnect:
+                        statistics_.handshake.Record(std::chrono::steady_clock::now() - started);
+                        DoCheckTunnel(client);
+                        break;
+                      case Command::kBind:
+                        DoBindApplication(client, started);
+                        break;
+                      case Command::kUdpAssociate:
+                        statistics_.handshake.Record(std::chrono::steady_clock::now() - started);
+                        ++statistics_.operations;
+                        DoHandshake();
+                        break;
+                    }
+                  });
+}
+
+void Runner::DoBindApplication(const std::shared_ptr<SocksClient>& client,
+                               std::chrono::steady_clock::time_point started) {
+  auto application = std::make_shared<net_tcp::socket>(context_);
+  auto byte = std::make_shared<char>('b');
+
+  // Once the application sends a byte and the client receives it, the tunnel is up.
+  auto receive = [this, client, application, byte, started]()
+  {
+    boost::asio::async_write(
+        *application, boost::asio::buffer(byte.get(), 1),
+        [this, client, application, byte, started](const error_code& ecode, size_t)
+        {
+          if (ecode) {
+            DoRetry([this]() { DoHandshake(); });
+            return;
+          }
+
+          boost::asio::async_read(
+              client->GetSocket(), boost::asio::buffer(byte.get(), 1),
+              [this, client, application, byte, started](const error_code& ecode, size_t)
+              {
+                if (ecode) {
+                  DoRetry([this]() { DoHandshake(); });
+                  return;
+                }
+
+                statistics_.handshake.Record(std::chrono::steady_clock::now() - started);
+                ++statistics_.operations;
+                DoHandshake();
+              });
+        });
+  };
+
+  application->async_connect(
+      client->GetReplyEndpoint(),
+      [this, client, receive](const error_code& ecode)
+      {
+        if (ecode) {
+          DoRetry([this]() { DoHandshake(); });
+        } else if (settings_.client.protocol == Protocol::kSocks5) {
+          // The server starts the tunnel right after the accept, without a second reply.
+          receive();
+        } else {
+          client->ReadReply(
+              [this, receive](const error_code& ecode)
+              {
+                if (ecode) {
+                  DoRetry([this]() { DoHandshake(); });
+                } else {
+                  receive();
+                }
+              });
+        }
+      });
+}
+
+void Runner::DoCheckTunnel(const std::shared_ptr<SocksClient>& client) {
+  auto byte = std::make_shared<char>('c');
+
+  boost::asio::async_write(
+      client->GetSocket(), boost::asio::buffer(byte.get(), 1),
+      [this, client, byte](const error_code& ecode, size_t)
+      {
+        if (ecode) {
+          DoRetry([this]() { DoHandshake(); });
+          return;
+        }
+
+        boost::asio::async_read(client->GetSocket(), boost::asio::buffer(byte.get(), 1),
+                                [this, client, byte](const error_code& ecode, size_t)
+                                {
+                                  if (ecode) {
+                                    DoRetry([this]() { DoHandshake(); });
+                                    return;
+                                  }
+
+                                  ++statistics_.operations;
+                                  DoHandshake();
+                                });
+      });
+}
+
+void Runner::DoUpload(const std::shared_ptr<SocksClient>& client,
+                      const std::shared_ptr<std::vector<char>>& buffer) {
+  client->GetSocket().async_write_some(boost::asio::buffer(*buffer),
+                                       [this, client, buffer](const error_code& ecode, size_t size)
+                                       {
+                                         if (ecode) {
+                                           ++statistics_.errors;
+                                           return;
+                                         }
+
+                                         statistics_.bytes += size;
+                                         DoUpload(client, buffer);
+                                       });
+}
+
+void Runner::DoDownload(const std::shared_ptr<SocksClient>& client,
+                        const std::shared_ptr<std::vector<char>>& buffer) {
+  client->GetSocket().async_read_some(boost::asio::buffer(*buffer),
+                                      [this, client, buffer](const error_code& ecode, size_t size)
+                                      {
+                                        if (ecode) {
+                                          ++statistics_.errors;
+                                          return;
+                                        }
+
+                                        statistics_.bytes += size;
+                                        DoDownload(client, buffer);
+                                      });
+}
+
+void Runner::DoEcho(const std::shared_ptr<SocksClient>& client,
+                    const std::shared_ptr<std::vector<char>>& buffer) {
+  const auto started = std::chrono::steady_clock::now();
+
+  boost::asio::async_write(
+      client->GetSocket(), boost::asio::buffer(*buffer),
+      [this, client, buffer, started](const error_code& ecode, size_t)
+      {
+        if (ecode) {
+          ++statistics_.errors;
+          return;
+        }
+
+        boost::asio::async_read(client->GetSocket(), boost::asio::buffer(*buffer),
+                                [this, client, buffer, started](const error_code& ecode,
+                                                                size_t size)
+                                {
+                                  if (ecode) {
+                                    ++statistics_.errors;
+                                    return;
+                                  }
+
+                                  statistics_.round_trip.Record(
+                                      std::chrono::steady_clock::now() - started);
+                                  ++statistics_.operations;
+                                  statistics_.bytes += size;
+                                  DoEcho(client, buffer);
+                                });
+      });
+}
+
+void Runner::DoAssociate() {
+  auto association = std::make_shared<Association>(context_);
+  association->client = SocksClient::Create(context_, settings_.client);
+
+  error_code ecode;
+  association->socket.open(net_udp::v4(), ecode);
+  association->socket.bind({boost::asio::ip::address_v4::loopback(), 0}, ecode);
+  const auto local = association->socket.local_endpoint(ecode);
+  if (ecode) {
+    ++statistics_.errors;
+    return;
+  }
+
+  association->client->Request(
+      GetNextSource(), Command::kUdpAssociate, {{}, {local.address(), local.port()}},
+      [this, association](const error_code& ecode)
+      {
+        if (ecode) {
+          DoRetry([this]() { DoAssociate(); });
+          return;
+        }
+
+        const auto& relay = association->client->GetReplyEndpoint();
+        association->relay = {relay.address(), relay.port()};
+        DoReceiveDatagrams(association);
+        DoSendDatagrams(association);
+        DoRecoverWindow(association);
+      });
+}
+
+void Runner::DoSendDatagrams(const std::shared_ptr<Association>& association) {
+  // +----+------+------+----------+----------+----------+
+  // |RSV | FRAG | ATYP | DST.ADDR | DST.PORT |   DATA   |
+  // +----+------+------+----------+----------+----------+
+  // The data starts with the time it was sent at and its sequence number.
+  const auto destination = upstream_->GetUdpEndpoint();
+  const auto address = destination.address().to_v4().to_bytes();
+  const auto size =
+      kUdpHeaderSize + std::max(settings_.message_size, sizeof(int64_t) + sizeof(uint64_t));
+  std::vector<char> datagram(size);
+
+  datagram[3] = 0x01;
+  std::memcpy(datagram.data() + 4, address.data(), address.size());
+  datagram[8] = static_cast<char>(destination.port() >> 8);
+  datagram[9] = static_cast<char>(destination.port());
+
+  while (association->in_flight < settings_.window) {
+    const auto time = GetTime();
+    std::memcpy(datagram.data() + kUdpHeaderSize, &time, sizeof(time));
+    std::memcpy(datagram.data() + kUdpHeaderSize + sizeof(time), &association->sent,
+                sizeof(association->sent));
+
+    error_code ecode;
+    association->socket.send_to(boost::asio::buffer(datagram), association->relay, 0, ecode);
+    if (ecode) {
+      break;
+    }
+
+    ++association->in_flight;
+    ++association->sent;
+  }
+}
+
+void Runner::DoReceiveDatagrams(const std::shared_ptr<Association>& association) {
+  association->socket.async_receive(
+      boost::asio::buffer(association->buffer),
+      [this, association](const error_code& ecode, size_t size)
+      {
+        if (ecode) {
+          ++statistics_.errors;
+          return;
+        }
+
+        if (size >= kUdpHeaderSize + sizeof(int64_t) + sizeof(uint64_t)) {
+          int64_t time;
+          uint64_t sequence;
+          std::memcpy(&time, association->buffer.data() + kUdpHeaderSize, sizeof(time));
+          std::memcpy(&sequence, association->buffer.data() + kUdpHeaderSize + sizeof(time),
+                      sizeof(sequence));
+          statistics_.round_trip.Record(std::chrono::nanoseconds(GetTime() - time));
+          statistics_.bytes += size - kUdpHeaderSize;
+          ++statistics_.operations;
+
+          // The echo keeps the order, the datagrams skipped over were lost and leave the window.
+          if (sequence >= association->expected) {
+            const auto skipped = sequence - association->expected;
+            statistics_.lost += skipped;
+            association->in_flight -= std::min<size_t>(association->in_flight, skipped);
+            association->expected = sequence + 1;
+          }
+        }
+
+        association->received = true;
+        if (association->in_flight > 0) {
+          --association->in_flight;
+        }
+
+        DoSendDatagrams(association);
+        DoReceiveDatagrams(association);
+      });
+}
+
+void Runner::DoRecoverWindow(const std::shared_ptr<Association>& association) {
+  association->timer.expires_after(kUdpRecoveryPeriod);
+  association->timer.async_wait(
+      [this, association](const error_code& ecode)
+      {
+        if (ecode) {
+          return;
+        }
+
+        if (!association->received) {
+          // Nothing came back for a whole period, the window is lost.
+          if (association->in_flight > 0) {
+            statistics_.lost += association->in_flight;
+            association->expected = association->sent;
+            if (!association->stalled) {
+              association->stalled = true;
+              ++statistics_.stalled;
+            }
+          }
+
+          association->in_flight = 0;
+          DoSendDatagrams(association);
+        }
+
+        association->received = false;
+        DoRecoverWindow(association);
+      });
+}
+
+void Runner::DoOpenIdleSession() {
+  const auto started = std::chrono::steady_clock::now();
+  auto client = SocksClient::Create(context_, settings_.client);
+
+  client->Request(GetNextSource(), Command::kConnect, GetNextDestination(),
+                  [this, client, started](const error_code& ecode)
+                  {
+                    if (ecode) {
+                      ++statistics_.errors;
+                    } else {
+                      statistics_.handshake.Record(std::chrono::steady_clock::now() - started);
+                      ++statistics_.operations;
+                      idle_.push_back(client);
+                    }
+
+                    idle_done_.fetch_add(1, std::memory_order_release);
+                    if (idle_pending_ > 0) {
+                      --idle_pending_;
+                      DoOpenIdleSession();
+                    } else {
+                      --idle_openers_;
+                    }
+                  });
+}
+
+}  // namespace bench
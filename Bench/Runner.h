@@ -0,0 +1,171 @@
+#ifndef BENCH_RUNNER_H_
+#define BENCH_RUNNER_H_
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "DnsResponder.h"
+#include "SocksClient.h"
+#include "Statistics.h"
+#include "Upstream.h"
+
+namespace bench {
+
+enum class Scenario {
+  kHandshake,  // Repeats the handshake of the command, checks the tunnel with one byte, closes.
+  kUpload,     // Writes into CONNECT tunnels to a sink as fast as possible.
+  kDownload,   // Reads from CONNECT tunnels to a source as fast as possible.
+  kEcho,       // Sends messages through CONNECT tunnels to an echo and waits for each answer.
+  kUdp,        // Sends datagrams through UDP associations to an echo, a window at a time.
+  kIdle,       // Opens CONNECT tunnels to an echo and keeps them idle.
+  kDns,        // Repeats the CONNECT handshake to a new name each time, resolved by a stand-in.
+};
+
+struct Settings {
+  Scenario scenario;
+  Command command;  // The command of the handshake scenario.
+  SocksClient::Options client;
+  std::string domain;                      // Requested instead of the upstream address if set.
+  size_t concurrency;                      // Connections or associations of a runner.
+  size_t message_size;                     // Size of the echo messages and datagrams.
+  size_t window;                           // Datagrams in flight per association.
+  size_t sources;                          // The clients connect from 127.0.0.1 to 127.0.0.N.
+  size_t upstream_ports;                   // Number of listeners of the upstream.
+  Upstream::Kind upstream;                 // The upstream of the handshake scenario.
+  std::chrono::milliseconds accept_delay;  // The delay of the delayed-accept upstream.
+  uint16_t dns_port;                       // Port of the stand-in nameserver of the dns scenario.
+};
+
+// Runs a scenario on its own thread with its own io_context and its own upstream, so the runners
+// share nothing until their statistics are merged. The handlers only hold the runner by pointer,
+// they are destroyed with its io_context.
+class Runner final {
+  Runner(const Settings& settings, size_t index);
+
+ public:
+  ~Runner() = default;
+
+  Runner(const Runner&) = delete;
+  Runner& operator=(const Runner&) = delete;
+  Runner(Runner&&) noexcept = delete;
+  Runner& operator=(Runner&&) noexcept = delete;
+
+  // Creates the runner with the index among all runners.
+  static std::shared_ptr<Runner> Create(const Settings& settings, size_t index);
+
+  // Starts the upstream and the thread. Except for the idle scenario, the load starts as well.
+  void Start();
+
+  // Stops the load, then the thread. The connections are closed.
+  void Stop();
+
+  // Opens that many idle sessions more.
+  void OpenIdleSessions(size_t count);
+
+  // Returns the number of idle sessions which were opened or failed to open.
+  size_t GetIdleSessionsDone() const noexcept;
+
+  // Returns the statistics. Only to be used after the runner is stopped.
+  const Statistics& GetStatistics() const noexcept;
+
+ private:
+  // Size of the buffers of the throughput scenarios.
+  static constexpr size_t kChunkSize = 65536;
+  // Period of the check for a stalled UDP window.
+  static constexpr std::chrono::milliseconds kUdpRecoveryPeriod{200};
+
+  // A UDP association of the UDP scenario.
+  struct Association {
+    explicit Association(boost::asio::io_context& context)
+        : socket{context}, timer{context}, buffer(kChunkSize) {}
+
+    std::shared_ptr<SocksClient> client;
+    net_udp::socket socket;
+    net_udp::endpoint relay;
+    boost::asio::steady_timer timer;
+    std::vector<char> buffer;
+    size_t in_flight = 0;
+    uint64_t sent = 0;        // The sequence number of the next datagram.
+    uint64_t expected = 0;    // The sequence number of the next datagram to come back.
+    bool received = false;    // A datagram was received since the last check.
+    bool stalled = false;     // The whole window was lost at least once.
+  };
+
+  // Returns the source address of the next connection.
+  boost::asio::ip::address GetNextSource();
+
+  // Returns the destination of the next request to the upstream. In the dns scenario, the name
+  // was not requested before.
+  Destination GetNextDestination();
+
+  // Counts the failure, then calls the handler after a short delay, so a missing proxy does not
+  // spin the runner.
+  void DoRetry(std::function<void()> handler);
+
+  // Opens a CONNECT tunnel to the upstream and records the handshake, retrying on failure.
+  void DoOpenTunnel(std::function<void(const std::shared_ptr<SocksClient>&)> handler);
+
+  // Runs one handshake of the handshake scenario, then starts the next one.
+  void DoHandshake();
+
+  // Completes a BIND: connects to the bound endpoint as the application and sends one byte to
+  // the client through the tunnel, then starts the next handshake.
+  void DoBindApplication(const std::shared_ptr<SocksClient>& client,
+                         std::chrono::steady_clock::time_point started);
+
+  // Checks the tunnel with one byte sent by the client, then starts the next handshake.
+  void DoCheckTunnel(const std::shared_ptr<SocksClient>& client);
+
+  // Writes into the tunnel until it fails.
+  void DoUpload(const std::shared_ptr<SocksClient>& client,
+                const std::shared_ptr<std::vector<char>>& buffer);
+
+  // Reads from the tunnel until it fails.
+  void DoDownload(const std::shared_ptr<SocksClient>& client,
+                  const std::shared_ptr<std::vector<char>>& buffer);
+
+  // Sends a message through the tunnel and reads the answer, then the next one.
+  void DoEcho(const std::shared_ptr<SocksClient>& client,
+              const std::shared_ptr<std::vector<char>>& buffer);
+
+  // Opens a UDP association.
+  void DoAssociate();
+
+  // Fills the window of the association.
+  void DoSendDatagrams(const std::shared_ptr<Association>& association);
+
+  // Receives the answers of the association.
+  void DoReceiveDatagrams(const std::shared_ptr<Association>& association);
+
+  // Refills a window whose datagrams were all lost.
+  void DoRecoverWindow(const std::shared_ptr<Association>& association);
+
+  // Opens the next idle session while there are sessions left to open.
+  void DoOpenIdleSession();
+
+  Settings settings_;
+  boost::asio::io_context context_;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard_;
+  std::shared_ptr<Upstream> upstream_;
+  std::shared_ptr<DnsResponder> dns_responder_;  // Set in the dns scenario.
+  std::thread thread_;
+  size_t index_;
+  size_t next_source_;
+  size_t next_port_;
+  uint64_t next_name_;
+  Statistics statistics_;
+  size_t idle_pending_;                             // Sessions left to open.
+  size_t idle_openers_;                             // Sessions being opened.
+  std::vector<std::shared_ptr<SocksClient>> idle_;  // The open idle sessions.
+  std::atomic<size_t> idle_done_;
+};
+
+}  // namespace bench
+
+#endif  // !BENCH_RUNNER_H_
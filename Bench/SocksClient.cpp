@@ -0,0 +1,334 @@
+#include "SocksClient.h"
+#include <boost/asio/connect.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <cstring>
+
+namespace bench {
+
+SocksClient::SocksClient(boost::asio::io_context& context, const Options& options)
+    : options_{options},
+      socket_{context},
+      command_{Command::kConnect},
+      destination_{},
+      callback_{},
+      reply_endpoint_{},
+      buffer_{} {}
+
+std::shared_ptr<SocksClient> SocksClient::Create(boost::asio::io_context& context,
+                                                 const Options& options) {
+  return std::shared_ptr<SocksClient>(new SocksClient(context, options));
+}
+
+void SocksClient::Request(const boost::asio::ip::address& source, Command command,
+                          const Destination& destination, Callback callback) {
+  command_ = command;
+  destination_ = destination;
+  callback_ = std::move(callback);
+
+  error_code ecode;
+  socket_.open(options_.proxy.protocol(), ecode);
+  if (!ecode && !source.is_unspecified()) {
+    socket_.bind({source, 0}, ecode);
+  }
+  if (ecode) {
+    Finish(ecode);
+    return;
+  }
+
+  socket_.set_option(net_tcp::no_delay(true), ecode);
+  socket_.async_connect(options_.proxy,
+                        [this, self = shared_from_this()](const error_code& ecode)
+                        {
+                          if (ecode) {
+                            Finish(ecode);
+                          } else if (options_.protocol == Protocol::kSocks5) {
+                            DoGreeting();
+                          } else {
+                            DoSendRequest();
+                          }
+                        });
+}
+
+void SocksClient::ReadReply(Callback callback) {
+  callback_ = std::move(callback);
+  if (options_.protocol == Protocol::kSocks5) {
+    DoReadSocks5Reply();
+  } else {
+    DoReadSocks4Reply();
+  }
+}
+
+net_tcp::socket& SocksClient::GetSocket() noexcept {
+  return socket_;
+}
+
+const net_tcp::endpoint& SocksClient::GetReplyEndpoint() const noexcept {
+  return reply_endpoint_;
+}
+
+void SocksClient::DoGreeting() {
+  if (options_.pipeline) {
+    DoSendPipelined();
+    return;
+  }
+
+  DoExchange(WriteGreeting(0), 2,
+             [this]()
+             {
+               if (buffer_[1] == 0x02) {
+                 DoAuthentication();
+               } else if (buffer_[1] == 0x00) {
+                 DoSendRequest();
+               } else {
+                 Finish(boost::asio::error::access_denied);
+               }
+             });
+}
+
+void SocksClient::DoAuthentication() {
+  DoExchange(WriteAuthentication(0), 2,
+             [this]()
+             {
+               if (buffer_[1] == 0x00) {
+                 DoSendRequest();
+               } else {
+                 Finish(boost::asio::error::access_denied);
+               }
+             });
+}
+
+void SocksClient::DoSendRequest() {
+  const bool socks5 = options_.protocol == Protocol::kSocks5;
+  const auto size = socks5 ? WriteSocks5Request(0) : WriteSocks4Request(0);
+
+  boost::asio::async_write(socket_, boost::asio::buffer(buffer_.data(), size),
+                           [this, self = shared_from_this(), socks5](const error_code& ecode,
+                                                                     size_t)
+                           {
+                             if (ecode) {
+                               Finish(ecode);
+                             } else if (socks5) {
+                               DoReadSocks5Reply();
+                             } else {
+                               DoReadSocks4Reply();
+                             }
+                           });
+}
+
+void SocksClient::DoSendPipelined() {
+  const bool authenticate = !options_.username.empty();
+  auto size = WriteGreeting(0);
+  if (authenticate) {
+    size += WriteAuthentication(size);
+  }
+  size += WriteSocks5Request(size);
+
+  // The method reply and the authentication reply are 2 bytes each.
+  const size_t answer_size = authenticate ? 4 : 2;
+  DoExchange(size, answer_size,
+             [this, authenticate]()
+             {
+               if (buffer_[1] != (authenticate ? 0x02 : 0x00) ||
+                   (authenticate && buffer_[3] != 0x00)) {
+                 Finish(boost::asio::error::access_denied);
+               } else {
+                 DoReadSocks5Reply();
+               }
+             });
+}
+
+size_t SocksClient::WriteGreeting(size_t offset) {
+  // +-----+----------+----------+
+  // | VER | NMETHODS |  METHODS |
+  // +-----+----------+----------+
+  buffer_[offset] = 0x05;
+  buffer_[offset + 1] = 0x01;
+  buffer_[offset + 2] = options_.username.empty() ? 0x00 : 0x02;
+  return 3;
+}
+
+size_t SocksClient::WriteAuthentication(size_t offset) {
+  // +-----+------+----------+------+----------+
+  // | VER | ULEN |  UNAME   | PLEN |  PASSWD  |
+  // +-----+------+----------+------+----------+
+  size_t size = offset;
+  buffer_[size++] = 0x01;
+  buffer_[size++] = static_cast<uint8_t>(options_.username.size());
+  std::memcpy(buffer_.data() + size, options_.username.data(), options_.username.size());
+  size += options_.username.size();
+  buffer_[size++] = static_cast<uint8_t>(options_.password.size());
+  std::memcpy(buffer_.data() + size, options_.password.data(), options_.password.size());
+  size += options_.password.size();
+  return size - offset;
+}
+
+size_t SocksClient::WriteSocks5Request(size_t offset) {
+  // +-----+-----+-------+------+----------+----------+
+  // | VER | CMD |  RSV  | ATYP | DST.ADDR | DST.PORT |
+  // +-----+-----+-------+------+----------+----------+
+  const auto port = destination_.endpoint.port();
+  size_t size = offset;
+  buffer_[size++] = 0x05;
+  buffer_[size++] = static_cast<uint8_t>(command_);
+  buffer_[size++] = 0x00;
+
+  const auto address = destination_.endpoint.address();
+  if (!destination_.domain.empty()) {
+    buffer_[size++] = 0x03;
+    buffer_[size++] = static_cast<uint8_t>(destination_.domain.size());
+    std::memcpy(buffer_.data() + size, destination_.domain.data(), destination_.domain.size());
+    size += destination_.domain.size();
+  } else if (address.is_v4()) {
+    buffer_[size++] = 0x01;
+    const auto bytes = address.to_v4().to_bytes();
+    std::memcpy(buffer_.data() + size, bytes.data(), bytes.size());
+    size += bytes.size();
+  } else {
+    buffer_[size++] = 0x04;
+    const auto bytes = address.to_v6().to_bytes();
+    std::memcpy(buffer_.data() + size, bytes.data(), bytes.size());
+    size += bytes.size();
+  }
+  buffer_[size++] = static_cast<uint8_t>(port >> 8);
+  buffer_[size++] = static_cast<uint8_t>(port);
+  return size - offset;
+}
+
+size_t SocksClient::WriteSocks4Request(size_t offset) {
+  // +----+----+----+----+----+----+----+----+----+----+....+----+
+  // | VN | CD | DSTPORT |      DSTIP        | USERID       |NULL|
+  // +----+----+----+----+----+----+----+----+----+----+....+----+
+  // SOCKS4a sends the IP address 0.0.0.1 and the domain name after the USER-ID.
+  const auto port = destination_.endpoint.port();
+  const bool domain = options_.protocol == Protocol::kSocks4a;
+  const auto address = domain ? boost::asio::ip::address_v4{1}.to_bytes()
+                              : destination_.endpoint.address().to_v4().to_bytes();
+
+  size_t size = offset;
+  buffer_[size++] = 0x04;
+  buffer_[size++] = static_cast<uint8_t>(command_);
+  buffer_[size++] = static_cast<uint8_t>(port >> 8);
+  buffer_[size++] = static_cast<uint8_t>(port);
+  std::memcpy(buffer_.data() + size, address.data(), address.size());
+  size += address.size();
+  std::memcpy(buffer_.data() + size, options_.user_id.data(), options_.user_id.size());
+  size += options_.user_id.size();
+  buffer_[size++] = 0x00;
+  if (domain) {
+    const auto& name = destination_.domain.empty() ? std::string("localhost")
+                                                   : destination_.domain;
+    std::memcpy(buffer_.data() + size, name.data(), name.size());
+    size += name.size();
+    buffer_[size++] = 0x00;
+  }
+  return size - offset;
+}
+
+void SocksClient::DoReadSocks4Reply() {
+  // +----+----+----+----+----+----+----+----+
+  // | VN | CD | DSTPORT |      DSTIP        |
+  // +----+----+----+----+----+----+----+----+
+  boost::asio::async_read(
+      socket_, boost::asio::buffer(buffer_.data(), 8),
+      [this, self = shared_from_this()](const error_code& ecode, size_t)
+      {
+        if (ecode) {
+          Finish(ecode);
+          return;
+        }
+
+        boost::asio::ip::address_v4::bytes_type address;
+        std::memcpy(address.data(), buffer_.data() + 4, address.size());
+        reply_endpoint_ = {boost::asio::ip::address_v4{address},
+                           static_cast<uint16_t>(buffer_[2] << 8 | buffer_[3])};
+        if (reply_endpoint_.address().is_unspecified()) {
+          reply_endpoint_.address(options_.proxy.address());
+        }
+
+        Finish(buffer_[1] == 90 ? error_code{} : boost::asio::error::connection_refused);
+      });
+}
+
+void SocksClient::DoReadSocks5Reply() {
+  // +-----+-----+-------+------+----------+----------+
+  // | VER | REP |  RSV  | ATYP | BND.ADDR | BND.PORT |
+  // +-----+-----+-------+------+----------+----------+
+  boost::asio::async_read(
+      socket_, boost::asio::buffer(buffer_.data(), 4),
+      [this, self = shared_from_this()](const error_code& ecode, size_t)
+      {
+        if (ecode) {
+          Finish(ecode);
+          return;
+        }
+
+        if (buffer_[1] != 0x00) {
+          Finish(boost::asio::error::connection_refused);
+          return;
+        }
+
+        const bool v4 = buffer_[3] == 0x01;
+        if (!v4 && buffer_[3] != 0x04) {
+          Finish(boost::asio::error::address_family_not_supported);
+          return;
+        }
+
+        boost::asio::async_read(
+            socket_, boost::asio::buffer(buffer_.data(), v4 ? 6 : 18),
+            [this, self, v4](const error_code& ecode, size_t size)
+            {
+              if (ecode) {
+                Finish(ecode);
+                return;
+              }
+
+              boost::asio::ip::address address;
+              if (v4) {
+                boost::asio::ip::address_v4::bytes_type bytes;
+                std::memcpy(bytes.data(), buffer_.data(), bytes.size());
+                address = boost::asio::ip::address_v4{bytes};
+              } else {
+                boost::asio::ip::address_v6::bytes_type bytes;
+                std::memcpy(bytes.data(), buffer_.data(), bytes.size());
+                address = boost::asio::ip::address_v6{bytes};
+              }
+
+              reply_endpoint_ = {address.is_unspecified() ? options_.proxy.address() : address,
+                                 static_cast<uint16_t>(buffer_[size - 2] << 8 | buffer_[size - 1])};
+              Finish({});
+            });
+      });
+}
+
+void SocksClient::DoExchange(size_t size, size_t answer_size, std::function<void()> handler) {
+  boost::asio::async_write(
+      socket_, boost::asio::buffer(buffer_.data(), size),
+      [this, self = shared_from_this(), answer_size, handler](const error_code& ecode, size_t)
+      {
+        if (ecode) {
+          Finish(ecode);
+          return;
+        }
+
+        boost::asio::async_read(socket_, boost::asio::buffer(buffer_.data(), answer_size),
+                                [this, self, handler](const error_code& ecode, size_t)
+                                {
+                                  if (ecode) {
+                                    Finish(ecode);
+                                  } else {
+                                    handler();
+                                  }
+                                });
+      });
+}
+
+void SocksClient::Finish(const error_code& ecode) {
+  auto callback = std::move(callback_);
+  callback_ = nullptr;
+  if (callback) {
+    callback(ecode);
+  }
+}
+
+}  // namespace bench
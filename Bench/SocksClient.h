@@ -0,0 +1,116 @@
+#ifndef BENCH_SOCKS_CLIENT_H_
+#define BENCH_SOCKS_CLIENT_H_
+
+#include <boost/asio/io_context.hpp>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include "Types.h"
+
+namespace bench {
+
+enum class Protocol { kSocks4, kSocks4a, kSocks5 };
+
+enum class Command : uint8_t { kConnect = 0x01, kBind = 0x02, kUdpAssociate = 0x03 };
+
+// The destination of a request. The domain name is sent instead of the address if it is set,
+// the port of the endpoint is used in both cases.
+struct Destination {
+  std::string domain;
+  net_tcp::endpoint endpoint;
+};
+
+// The client side of a SOCKS handshake. The stages are sent one at a time, each after the reply
+// to the previous one, as a client which does not pipeline its requests. With the pipeline
+// option, the SOCKS5 greeting, authentication and request are sent in one write instead, and the
+// replies are read after it.
+class SocksClient final : public std::enable_shared_from_this<SocksClient> {
+ public:
+  // Called when the reply is read. A failure reply is reported as connection_refused, a rejected
+  // authentication as access_denied.
+  using Callback = std::function<void(const error_code&)>;
+
+  struct Options {
+    Protocol protocol;
+    net_tcp::endpoint proxy;
+    std::string user_id;   // SOCKS4 USER-ID.
+    std::string username;  // SOCKS5 user, no authentication is offered if it is empty.
+    std::string password;
+    bool pipeline = false;  // Sends the SOCKS5 stages without waiting for the replies.
+  };
+
+ private:
+  SocksClient(boost::asio::io_context& context, const Options& options);
+
+ public:
+  ~SocksClient() = default;
+
+  SocksClient(const SocksClient&) = delete;
+  SocksClient& operator=(const SocksClient&) = delete;
+  SocksClient(SocksClient&&) noexcept = delete;
+  SocksClient& operator=(SocksClient&&) noexcept = delete;
+
+  // Creates a client of the proxy.
+  static std::shared_ptr<SocksClient> Create(boost::asio::io_context& context,
+                                             const Options& options);
+
+  // Connects to the proxy from the source address (any if it is unspecified), authenticates and
+  // sends the request. The callback is called once the reply is read.
+  void Request(const boost::asio::ip::address& source, Command command,
+               const Destination& destination, Callback callback);
+
+  // Reads the next reply, the second reply of BIND is sent once the application has connected.
+  void ReadReply(Callback callback);
+
+  // Returns the connection to the proxy.
+  net_tcp::socket& GetSocket() noexcept;
+
+  // Returns the endpoint of the last reply. The unspecified address is replaced by the address
+  // of the proxy.
+  const net_tcp::endpoint& GetReplyEndpoint() const noexcept;
+
+ private:
+  // Sends the method selection of SOCKS5.
+  void DoGreeting();
+
+  // Sends the username and password of SOCKS5.
+  void DoAuthentication();
+
+  // Sends the request of the command.
+  void DoSendRequest();
+
+  // Sends the SOCKS5 greeting, authentication and request at once, then reads the replies.
+  void DoSendPipelined();
+
+  // Write a stage into the buffer at the offset and return its size.
+  size_t WriteGreeting(size_t offset);
+  size_t WriteAuthentication(size_t offset);
+  size_t WriteSocks5Request(size_t offset);
+  size_t WriteSocks4Request(size_t offset);
+
+  // Reads the SOCKS4 reply.
+  void DoReadSocks4Reply();
+
+  // Reads the SOCKS5 reply, then its address.
+  void DoReadSocks5Reply();
+
+  // Writes the size bytes of the buffer, then reads the size of the answer into the buffer.
+  void DoExchange(size_t size, size_t answer_size, std::function<void()> handler);
+
+  // Calls the callback of the request with the error and forgets it.
+  void Finish(const error_code& ecode);
+
+  Options options_;
+  net_tcp::socket socket_;
+  Command command_;
+  Destination destination_;
+  Callback callback_;
+  net_tcp::endpoint reply_endpoint_;
+  std::array<uint8_t, 600> buffer_;
+};
+
+}  // namespace bench
+
+#endif  // !BENCH_SOCKS_CLIENT_H_
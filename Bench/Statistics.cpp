@@ -0,0 +1,86 @@
+#include "Statistics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include "Common/Metrics.h"
+
+namespace bench {
+
+LatencyHistogram::LatencyHistogram() : buckets_(common::Metrics::kBucketCount), count_{0} {}
+
+void LatencyHistogram::Record(std::chrono::steady_clock::duration duration) noexcept {
+  const auto value = std::max<int64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), 0);
+  ++buckets_[common::Metrics::GetBucket(static_cast<uint64_t>(value))];
+  ++count_;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  for (size_t bucket = 0; bucket < buckets_.size(); ++bucket) {
+    buckets_[bucket] += other.buckets_[bucket];
+  }
+  count_ += other.count_;
+}
+
+uint64_t LatencyHistogram::GetCount() const noexcept {
+  return count_;
+}
+
+uint64_t LatencyHistogram::GetQuantile(double quantile) const noexcept {
+  if (count_ == 0) {
+    return 0;
+  }
+
+  const auto rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(quantile * count_)), 1);
+  size_t bucket = 0;
+  uint64_t seen = buckets_[0];
+  while (seen < rank) {
+    seen += buckets_[++bucket];
+  }
+
+  return common::Metrics::GetBucketLimit(bucket);
+}
+
+void Statistics::Merge(const Statistics& other) {
+  operations += other.operations;
+  errors += other.errors;
+  bytes += other.bytes;
+  queries += other.queries;
+  lost += other.lost;
+  stalled += other.stalled;
+  handshake.Merge(other.handshake);
+  round_trip.Merge(other.round_trip);
+  lateness.Merge(other.lateness);
+}
+
+uint64_t GetResidentSetSize(int pid) {
+  // VmRSS:	   12345 kB
+  std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+  std::string line;
+
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmRSS:") == 0) {
+      return std::stoull(line.substr(6)) * 1024;
+    }
+  }
+
+  return 0;
+}
+
+std::string FormatDuration(uint64_t nanoseconds) {
+  char text[32];
+  if (nanoseconds < 1000) {
+    std::snprintf(text, sizeof(text), "%lluns", static_cast<unsigned long long>(nanoseconds));
+  } else if (nanoseconds < 1000000) {
+    std::snprintf(text, sizeof(text), "%.2fus", nanoseconds / 1e3);
+  } else if (nanoseconds < 1000000000) {
+    std::snprintf(text, sizeof(text), "%.2fms", nanoseconds / 1e6);
+  } else {
+    std::snprintf(text, sizeof(text), "%.2fs", nanoseconds / 1e9);
+  }
+
+  return text;
+}
+
+}  // namespace bench
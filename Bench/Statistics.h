@@ -0,0 +1,57 @@
+#ifndef BENCH_STATISTICS_H_
+#define BENCH_STATISTICS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+// A latency histogram with the log-linear buckets of the metrics of the server.
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+
+  // Records the duration.
+  void Record(std::chrono::steady_clock::duration duration) noexcept;
+
+  // Adds the values of the other histogram.
+  void Merge(const LatencyHistogram& other);
+
+  // Returns the number of recorded values.
+  uint64_t GetCount() const noexcept;
+
+  // Returns the largest value of the bucket of the quantile, in nanoseconds. 0 if empty.
+  uint64_t GetQuantile(double quantile) const noexcept;
+
+ private:
+  std::vector<uint64_t> buckets_;
+  uint64_t count_;
+};
+
+// The results of a runner.
+struct Statistics {
+  uint64_t operations = 0;  // Completed handshakes, messages, datagrams or replayed sessions.
+  uint64_t errors = 0;      // Failed handshakes or connections.
+  uint64_t bytes = 0;       // Payload bytes moved through the tunnels.
+  uint64_t queries = 0;     // Queries answered by the stand-in nameserver.
+  uint64_t lost = 0;        // UDP datagrams which did not come back.
+  uint64_t stalled = 0;     // UDP associations whose whole window was lost at least once.
+  LatencyHistogram handshake;   // Handshakes until the tunnel or the association is up.
+  LatencyHistogram round_trip;  // Round trips of the echo messages and datagrams.
+  LatencyHistogram lateness;    // Delays of the replayed events behind their time in the trace.
+
+  // Adds the results of the other runner.
+  void Merge(const Statistics& other);
+};
+
+// Returns the resident set size of the process in bytes, 0 if it cannot be read.
+uint64_t GetResidentSetSize(int pid);
+
+// Returns the nanoseconds as a short human readable duration, such as "1.25ms".
+std::string FormatDuration(uint64_t nanoseconds);
+
+}  // namespace bench
+
+#endif  // !BENCH_STATISTICS_H_
@@ -0,0 +1,259 @@
+#include "Upstream.h"
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace bench {
+
+Upstream::Upstream(boost::asio::io_context& context, Kind kind, size_t ports,
+                   std::chrono::milliseconds accept_delay)
+    : kind_{kind},
+      accept_delay_{accept_delay},
+      acceptors_{},
+      udp_socket_{context},
+      udp_sender_{},
+      udp_buffer_(kBufferSize) {
+  for (size_t index = 0; index < std::max<size_t>(ports, 1); ++index) {
+    acceptors_.emplace_back(context);
+  }
+}
+
+std::shared_ptr<Upstream> Upstream::Create(boost::asio::io_context& context, Kind kind,
+                                           size_t ports, std::chrono::milliseconds accept_delay) {
+  return std::shared_ptr<Upstream>(new Upstream(context, kind, ports, accept_delay));
+}
+
+void Upstream::Start() {
+  const net_tcp::endpoint endpoint{boost::asio::ip::address_v4::loopback(), 0};
+
+  for (auto& acceptor : acceptors_) {
+    acceptor.open(endpoint.protocol());
+    acceptor.bind(endpoint);
+    acceptor.listen(net_tcp::acceptor::max_listen_connections);
+    DoAccept(acceptor);
+  }
+
+  udp_socket_.open(net_udp::v4());
+  udp_socket_.bind({boost::asio::ip::address_v4::loopback(), 0});
+  if (kind_ == Kind::kScripted) {
+    DoUdpScript();
+  } else {
+    DoUdpEcho();
+  }
+}
+
+void Upstream::Stop() {
+  error_code ecode;
+  for (auto& acceptor : acceptors_) {
+    acceptor.close(ecode);
+  }
+  udp_socket_.close(ecode);
+}
+
+void Upstream::Serve(net_tcp::socket&& socket) {
+  error_code ignored;
+  socket.set_option(net_tcp::no_delay(true), ignored);
+  DoServe(std::make_shared<Connection>(std::move(socket)));
+}
+
+net_tcp::endpoint Upstream::GetEndpoint(size_t index) const {
+  return acceptors_[index % acceptors_.size()].local_endpoint();
+}
+
+net_udp::endpoint Upstream::GetUdpEndpoint() const {
+  return udp_socket_.local_endpoint();
+}
+
+void Upstream::DoAccept(net_tcp::acceptor& acceptor) {
+  acceptor.async_accept(
+      [this, self = shared_from_this(), &acceptor](const error_code& ecode, net_tcp::socket socket)
+      {
+        if (ecode == boost::asio::error::operation_aborted) {
+          return;
+        }
+
+        if (!ecode) {
+          error_code ignored;
+          socket.set_option(net_tcp::no_delay(true), ignored);
+          DoServe(std::make_shared<Connection>(std::move(socket)));
+        }
+
+        DoAccept(acceptor);
+      });
+}
+
+void Upstream::DoServe(const std::shared_ptr<Connection>& connection) {
+  switch (kind_) {
+    case Kind::kEcho:
+      DoEcho(connection);
+      break;
+    case Kind::kSink:
+      DoSink(connection);
+      break;
+    case Kind::kSource:
+      DoSource(connection);
+      break;
+    case Kind::kDelayedAccept:
+      connection->timer.expires_after(accept_delay_);
+      connection->timer.async_wait(
+          [this, self = shared_from_this(), connection](const error_code& ecode)
+          {
+            if (!ecode) {
+              DoEcho(connection);
+            }
+          });
+      break;
+    case Kind::kScripted:
+      DoScript(connection);
+      break;
+  }
+}
+
+void Upstream::DoEcho(const std::shared_ptr<Connection>& connection) {
+  connection->socket.async_read_some(
+      boost::asio::buffer(connection->buffer),
+      [this, self = shared_from_this(), connection](const error_code& ecode, size_t size)
+      {
+        if (ecode) {
+          return;
+        }
+
+        boost::asio::async_write(connection->socket,
+                                 boost::asio::buffer(connection->buffer.data(), size),
+                                 [this, self, connection](const error_code& ecode, size_t)
+                                 {
+                                   if (!ecode) {
+                                     DoEcho(connection);
+                                   }
+                                 });
+      });
+}
+
+void Upstream::DoSink(const std::shared_ptr<Connection>& connection) {
+  connection->socket.async_read_some(boost::asio::buffer(connection->buffer),
+                                     [this, self = shared_from_this(), connection](
+                                         const error_code& ecode, size_t)
+                                     {
+                                       if (!ecode) {
+                                         DoSink(connection);
+                                       }
+                                     });
+}
+
+void Upstream::DoSource(const std::shared_ptr<Connection>& connection) {
+  boost::asio::async_write(connection->socket, boost::asio::buffer(connection->buffer),
+                           [this, self = shared_from_this(), connection](const error_code& ecode,
+                                                                         size_t)
+                           {
+                             if (!ecode) {
+                               DoSource(connection);
+                             }
+                           });
+}
+
+void Upstream::DoScript(const std::shared_ptr<Connection>& connection) {
+  boost::asio::async_read(
+      connection->socket, boost::asio::buffer(connection->buffer.data(), kFrameSize),
+      [this, self = shared_from_this(), connection](const error_code& ecode, size_t)
+      {
+        if (ecode) {
+          return;
+        }
+
+        uint32_t size;
+        std::memcpy(&size, connection->buffer.data() + 1, sizeof(size));
+        if (connection->buffer[0] == kUploadFrame) {
+          DoDiscard(connection, size);
+        } else if (connection->buffer[0] == kDownloadFrame) {
+          DoSend(connection, size);
+        }
+      });
+}
+
+void Upstream::DoDiscard(const std::shared_ptr<Connection>& connection, uint64_t size) {
+  if (size == 0) {
+    DoScript(connection);
+    return;
+  }
+
+  connection->socket.async_read_some(
+      boost::asio::buffer(connection->buffer.data(),
+                          std::min<uint64_t>(size, connection->buffer.size())),
+      [this, self = shared_from_this(), connection, size](const error_code& ecode,
+                                                          size_t read)
+      {
+        if (!ecode) {
+          DoDiscard(connection, size - read);
+        }
+      });
+}
+
+void Upstream::DoSend(const std::shared_ptr<Connection>& connection, uint64_t size) {
+  if (size == 0) {
+    DoScript(connection);
+    return;
+  }
+
+  boost::asio::async_write(
+      connection->socket,
+      boost::asio::buffer(connection->buffer.data(),
+                          std::min<uint64_t>(size, connection->buffer.size())),
+      [this, self = shared_from_this(), connection, size](const error_code& ecode,
+                                                          size_t written)
+      {
+        if (!ecode) {
+          DoSend(connection, size - written);
+        }
+      });
+}
+
+void Upstream::DoUdpEcho() {
+  udp_socket_.async_receive_from(
+      boost::asio::buffer(udp_buffer_), udp_sender_,
+      [this, self = shared_from_this()](const error_code& ecode, size_t size)
+      {
+        if (ecode == boost::asio::error::operation_aborted) {
+          return;
+        }
+
+        if (!ecode) {
+          // A full socket buffer drops the datagram, as the network would.
+          error_code ignored;
+          udp_socket_.send_to(boost::asio::buffer(udp_buffer_.data(), size), udp_sender_, 0,
+                              ignored);
+        }
+
+        DoUdpEcho();
+      });
+}
+
+void Upstream::DoUdpScript() {
+  udp_socket_.async_receive_from(
+      boost::asio::buffer(udp_buffer_), udp_sender_,
+      [this, self = shared_from_this()](const error_code& ecode, size_t size)
+      {
+        if (ecode == boost::asio::error::operation_aborted) {
+          return;
+        }
+
+        if (!ecode && size >= kFrameSize + sizeof(uint32_t) && udp_buffer_[0] == kDownloadFrame) {
+          uint32_t datagram_size;
+          uint32_t count;
+          std::memcpy(&datagram_size, udp_buffer_.data() + 1, sizeof(datagram_size));
+          std::memcpy(&count, udp_buffer_.data() + kFrameSize, sizeof(count));
+          datagram_size = std::min<uint32_t>(datagram_size, udp_buffer_.size());
+
+          // A full socket buffer drops the datagrams, as the network would.
+          error_code ignored;
+          for (uint32_t index = 0; index < count; ++index) {
+            udp_socket_.send_to(boost::asio::buffer(udp_buffer_.data(), datagram_size),
+                                udp_sender_, 0, ignored);
+          }
+        }
+
+        DoUdpScript();
+      });
+}
+
+}  // namespace bench
@@ -0,0 +1,121 @@
+#ifndef BENCH_UPSTREAM_H_
+#define BENCH_UPSTREAM_H_
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Types.h"
+
+namespace bench {
+
+// A local stand-in for the applications behind the proxy. It listens on the loopback on several
+// ports, so more connections can be made from the proxy than one port has ephemeral ports for,
+// and answers UDP datagrams on one more port.
+class Upstream final : public std::enable_shared_from_this<Upstream> {
+ public:
+  enum class Kind {
+    kEcho,           // Sends back everything it receives, UDP datagrams included.
+    kSink,           // Reads and discards everything.
+    kSource,         // Sends data as fast as it is read, never reads.
+    kDelayedAccept,  // Accepts, but starts echoing only after a delay, like an overloaded server.
+    kScripted,       // Follows the frames sent by the client, see kUploadFrame.
+  };
+
+  // The frames of the scripted upstream: a type and a length of 4 bytes in the byte order of the
+  // machine. The length of data following an upload frame is discarded, a download frame asks
+  // the upstream to send the length of data. A UDP datagram which starts with a download frame
+  // and a count of 4 bytes asks for the count of datagrams of the length, the other datagrams
+  // are discarded.
+  static constexpr char kUploadFrame = 'U';
+  static constexpr char kDownloadFrame = 'D';
+  static constexpr size_t kFrameSize = 5;
+
+ private:
+  Upstream(boost::asio::io_context& context, Kind kind, size_t ports,
+           std::chrono::milliseconds accept_delay);
+
+ public:
+  ~Upstream() = default;
+
+  Upstream(const Upstream&) = delete;
+  Upstream& operator=(const Upstream&) = delete;
+  Upstream(Upstream&&) noexcept = delete;
+  Upstream& operator=(Upstream&&) noexcept = delete;
+
+  // Creates an upstream of the kind with the number of TCP listeners.
+  static std::shared_ptr<Upstream> Create(boost::asio::io_context& context, Kind kind,
+                                          size_t ports, std::chrono::milliseconds accept_delay);
+
+  // Opens the listeners on ephemeral ports of 127.0.0.1. Throws on failure.
+  void Start();
+
+  // Closes the listeners, the open connections are closed when the context is stopped.
+  void Stop();
+
+  // Serves a connection the generator opened itself, such as the application of a BIND.
+  void Serve(net_tcp::socket&& socket);
+
+  // Returns the endpoint of a listener, the index is spread over the listeners.
+  net_tcp::endpoint GetEndpoint(size_t index) const;
+
+  // Returns the endpoint of the UDP echo.
+  net_udp::endpoint GetUdpEndpoint() const;
+
+ private:
+  // Size of the buffers of a connection.
+  static constexpr size_t kBufferSize = 65536;
+
+  // An accepted connection.
+  struct Connection {
+    explicit Connection(net_tcp::socket&& socket)
+        : socket{std::move(socket)}, timer{this->socket.get_executor()}, buffer(kBufferSize) {}
+
+    net_tcp::socket socket;
+    boost::asio::steady_timer timer;
+    std::vector<char> buffer;
+  };
+
+  // Accepts the next connection of the listener.
+  void DoAccept(net_tcp::acceptor& acceptor);
+
+  // Serves the connection according to the kind of the upstream.
+  void DoServe(const std::shared_ptr<Connection>& connection);
+
+  // Reads and writes back until the peer closes the connection.
+  void DoEcho(const std::shared_ptr<Connection>& connection);
+
+  // Reads until the peer closes the connection.
+  void DoSink(const std::shared_ptr<Connection>& connection);
+
+  // Writes until the peer closes the connection.
+  void DoSource(const std::shared_ptr<Connection>& connection);
+
+  // Reads the next frame of the scripted upstream and follows it.
+  void DoScript(const std::shared_ptr<Connection>& connection);
+
+  // Reads and discards the size of data, then reads the next frame.
+  void DoDiscard(const std::shared_ptr<Connection>& connection, uint64_t size);
+
+  // Writes the size of data, then reads the next frame.
+  void DoSend(const std::shared_ptr<Connection>& connection, uint64_t size);
+
+  // Sends the received datagrams back to their senders.
+  void DoUdpEcho();
+
+  // Answers the download frames of the received datagrams.
+  void DoUdpScript();
+
+  Kind kind_;
+  std::chrono::milliseconds accept_delay_;
+  std::vector<net_tcp::acceptor> acceptors_;
+  net_udp::socket udp_socket_;
+  net_udp::endpoint udp_sender_;
+  std::vector<char> udp_buffer_;
+};
+
+}  // namespace bench
+
+#endif  // !BENCH_UPSTREAM_H_
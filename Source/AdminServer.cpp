@@ -0,0 +1,305 @@
+#include "AdminServer.h"
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+#include <sys/stat.h>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/write.hpp>
+#include <charconv>
+#include <cstdio>
+#include "Common/Logger.h"
+#include "Common/Metrics.h"
+
+namespace {
+
+constexpr const char* kHelp =
+    "list                          - lists the sessions of all workers.\n"
+    "kill <worker>.<version>.<id>  - deletes the session, the ID is printed by 'list'.\n"
+    "stats                         - prints the counters of the process.\n"
+    "help                          - prints the commands.\n"
+    "\n";
+
+// Parses the number at the start of the text and the separator after it, and removes both from
+// the text. Without a separator (0) the number has to end the text. Returns false on failure.
+template <typename Integer>
+bool ParseNumber(std::string_view& text, char separator, Integer& value) {
+  const auto [end, ecode] = std::from_chars(text.data(), text.data() + text.size(), value);
+  if (ecode != std::errc{} || end == text.data()) {
+    return false;
+  }
+
+  text.remove_prefix(end - text.data());
+  if (separator) {
+    if (text.empty() || text.front() != separator) {
+      return false;
+    }
+    text.remove_prefix(1);
+  }
+
+  return text.empty() == (separator == 0);
+}
+
+}  // namespace
+
+AdminServer::AdminServer(boost::asio::io_context& context, const std::string& path,
+                         const std::vector<std::shared_ptr<Worker>>& workers)
+    : context_{context},
+      path_{path},
+      workers_{workers},
+      acceptor_{context},
+      retry_timer_{context} {}
+
+std::shared_ptr<AdminServer> AdminServer::Create(
+    boost::asio::io_context& context, const std::string& path,
+    const std::vector<std::shared_ptr<Worker>>& workers) {
+  return std::shared_ptr<AdminServer>(new AdminServer(context, path, workers));
+}
+
+bool AdminServer::Start() {
+  error_code ecode;
+  local_stream::endpoint endpoint;
+
+  try {
+    endpoint = local_stream::endpoint{path_};
+  } catch (const boost::system::system_error& exception) {
+    ecode = exception.code();
+  }
+
+  // A socket left by a previous run would fail the bind. Any other file is kept, the bind fails
+  // on it instead.
+  struct stat status;
+  if (!ecode && ::lstat(path_.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+    std::remove(path_.c_str());
+  }
+
+  if (!ecode) {
+    acceptor_.open(endpoint.protocol(), ecode);
+  }
+  if (!ecode) {
+    // The socket file is created accessible to the owner only, it is never open to others.
+    const auto mask = ::umask(S_IRWXG | S_IRWXO);
+    acceptor_.bind(endpoint, ecode);
+    ::umask(mask);
+  }
+  if (!ecode) {
+    acceptor_.listen(local_stream::acceptor::max_listen_connections, ecode);
+  }
+  if (ecode) {
+    WLOGGER(error) << "Failed to open the admin socket: " << ecode.message() << ".";
+    acceptor_.close(ecode);
+    return false;
+  }
+
+  DoAccept();
+  return true;
+}
+
+void AdminServer::Stop() {
+  error_code ecode;
+  if (acceptor_.is_open()) {
+    acceptor_.close(ecode);
+    std::remove(path_.c_str());
+  }
+  retry_timer_.cancel();
+}
+
+void AdminServer::DoAccept() {
+  acceptor_.async_accept(
+      [this, self = shared_from_this()](const error_code& ecode, local_stream::socket socket)
+      {
+        if (ecode == boost::asio::error::operation_aborted) {
+          return;
+        }
+
+        if (ecode) {
+          // Accepting again at once would spin while the error lasts, e.g. out of descriptors.
+          retry_timer_.expires_after(kAcceptRetryDelay);
+          retry_timer_.async_wait(
+              [this, self = shared_from_this()](const error_code& ecode_wait)
+              {
+                if (!ecode_wait && acceptor_.is_open()) {
+                  DoAccept();
+                }
+              });
+          return;
+        }
+
+        DoReadCommand(std::make_shared<Connection>(std::move(socket)));
+        DoAccept();
+      });
+}
+
+void AdminServer::DoReadCommand(const std::shared_ptr<Connection>& connection) {
+  boost::asio::async_read_until(
+      connection->socket, boost::asio::dynamic_buffer(connection->request, kMaxCommandSize), '\n',
+      [this, self = shared_from_this(), connection](const error_code& ecode, size_t size)
+      {
+        if (ecode) {
+          return;
+        }
+
+        std::string command = connection->request.substr(0, size - 1);
+        connection->request.erase(0, size);
+        if (!command.empty() && command.back() == '\r') {
+          command.pop_back();
+        }
+
+        ExecuteCommand(connection, command);
+      });
+}
+
+void AdminServer::ExecuteCommand(const std::shared_ptr<Connection>& connection,
+                                 std::string_view command) {
+  const auto separator = command.find(' ');
+  const auto name = command.substr(0, separator);
+  const auto argument =
+      separator == std::string_view::npos ? std::string_view{} : command.substr(separator + 1);
+
+  connection->response.clear();
+
+  if (name.empty()) {
+    DoReadCommand(connection);
+  } else if (name == "list") {
+    connection->worker = 0;
+    connection->server = 0;
+    connection->position = 0;
+    connection->response.append("ID PROTOCOL COMMAND CLIENT DESTINATION AGE BYTES_IN BYTES_OUT "
+                                "STATE\n");
+    DoSendResponse(connection, false);
+  } else if (name == "kill") {
+    DoKillSession(connection, argument);
+  } else if (name == "stats") {
+    AppendStatistics(connection->response);
+    DoSendResponse(connection, true);
+  } else if (name == "help") {
+    connection->response.append(kHelp);
+    DoSendResponse(connection, true);
+  } else {
+    connection->response.append("ERROR unknown command, see 'help'.\n\n");
+    DoSendResponse(connection, true);
+  }
+}
+
+void AdminServer::DoListSessions(const std::shared_ptr<Connection>& connection) {
+  if (connection->worker >= workers_.size()) {
+    connection->response.assign("\n");
+    DoSendResponse(connection, true);
+    return;
+  }
+
+  // The cursor is only used by one thread at a time, the posts order the accesses.
+  auto& worker = workers_[connection->worker];
+  boost::asio::post(
+      worker->GetContext(),
+      [this, self = shared_from_this(), connection, worker]
+      {
+        const auto& servers = worker->GetServers();
+        std::string chunk;
+
+        if (connection->server < servers.size()) {
+          const auto& server = servers[connection->server];
+          std::string prefix = std::to_string(worker->GetIndex());
+          prefix.append(server->GetVersion() == Server::Version::kSocks4 ? ".4." : ".5.");
+
+          connection->position =
+              server->DescribeSessions(connection->position, kListChunkSize, prefix, chunk);
+          if (connection->position >= server->GetSessionCount()) {
+            ++connection->server;
+            connection->position = 0;
+          }
+        } else {
+          ++connection->worker;
+          connection->server = 0;
+          connection->position = 0;
+        }
+
+        boost::asio::post(context_,
+                          [this, self, connection, chunk = std::move(chunk)]() mutable
+                          {
+                            if (chunk.empty()) {
+                              DoListSessions(connection);
+                            } else {
+                              connection->response = std::move(chunk);
+                              DoSendResponse(connection, false);
+                            }
+                          });
+      });
+}
+
+void AdminServer::DoKillSession(const std::shared_ptr<Connection>& connection,
+                                std::string_view id) {
+  size_t index = 0;
+  unsigned version = 0;
+  Server::session_id session_id = 0;
+
+  if (!ParseNumber(id, '.', index) || !ParseNumber(id, '.', version) ||
+      !ParseNumber(id, 0, session_id) || index >= workers_.size() ||
+      (version != 4 && version != 5)) {
+    connection->response.append("ERROR invalid session ID, expected <worker>.<version>.<id>.\n\n");
+    DoSendResponse(connection, true);
+    return;
+  }
+
+  auto& worker = workers_[index];
+  boost::asio::post(
+      worker->GetContext(),
+      [this, self = shared_from_this(), connection, worker, version, session_id]
+      {
+        const auto server_version = version == 4 ? Server::Version::kSocks4
+                                                 : Server::Version::kSocks5;
+        bool killed = false;
+
+        for (const auto& server : worker->GetServers()) {
+          if (server->GetVersion() == server_version) {
+            killed = server->KillSession(session_id);
+          }
+        }
+
+        boost::asio::post(context_,
+                          [this, self, connection, killed]
+                          {
+                            connection->response.append(killed ? "OK\n\n"
+                                                               : "ERROR no such session.\n\n");
+                            DoSendResponse(connection, true);
+                          });
+      });
+}
+
+void AdminServer::AppendStatistics(std::string& response) const {
+  response.append("workers ").append(std::to_string(workers_.size())).append("\n");
+
+  // The samples of the metrics, without the comments of the text format.
+  const auto metrics = common::Metrics::Export();
+  for (size_t begin = 0, end; begin < metrics.size(); begin = end + 1) {
+    end = metrics.find('\n', begin);
+    if (end == std::string::npos) {
+      end = metrics.size();
+    }
+
+    if (metrics[begin] != '#') {
+      response.append(metrics, begin, end - begin).push_back('\n');
+    }
+  }
+
+  response.push_back('\n');
+}
+
+void AdminServer::DoSendResponse(const std::shared_ptr<Connection>& connection, bool finished) {
+  boost::asio::async_write(connection->socket, boost::asio::buffer(connection->response),
+                           [this, self = shared_from_this(), connection, finished](
+                               const error_code& ecode, size_t)
+                           {
+                             if (ecode) {
+                               return;
+                             }
+
+                             if (finished) {
+                               DoReadCommand(connection);
+                             } else {
+                               DoListSessions(connection);
+                             }
+                           });
+}
+
+#endif  // BOOST_ASIO_HAS_LOCAL_SOCKETS
@@ -0,0 +1,103 @@
+#ifndef ADMIN_SERVER_H_
+#define ADMIN_SERVER_H_
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Types.h"
+#include "Worker.h"
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+// A Unix domain socket which accepts line based commands of an administrator:
+//   list                          - lists the sessions of all workers.
+//   kill <worker>.<version>.<id>  - deletes the session, the ID is printed by 'list'.
+//   stats                         - prints the counters of the process.
+//   help                          - prints the commands.
+// Every response ends with an empty line. The sessions are only touched on the threads of their
+// workers, a listing is collected from them in small chunks, each written to the connection
+// before the next one is requested, so the workers are never blocked for long and the listing is
+// never held in memory as a whole.
+class AdminServer final : public std::enable_shared_from_this<AdminServer> {
+  using local_stream = boost::asio::local::stream_protocol;
+
+  AdminServer(boost::asio::io_context& context, const std::string& path,
+              const std::vector<std::shared_ptr<Worker>>& workers);
+
+ public:
+  ~AdminServer() = default;
+
+  AdminServer(const AdminServer&) = delete;
+  AdminServer& operator=(const AdminServer&) = delete;
+  AdminServer(AdminServer&&) noexcept = delete;
+  AdminServer& operator=(AdminServer&&) noexcept = delete;
+
+  // Creates an instance of the class listening on the socket file, serving the workers.
+  static std::shared_ptr<AdminServer> Create(boost::asio::io_context& context,
+                                             const std::string& path,
+                                             const std::vector<std::shared_ptr<Worker>>& workers);
+
+  // Starts the listener, replacing a stale socket file. Returns false if it could not be opened.
+  bool Start();
+
+  // Stops the listener and removes the socket file.
+  void Stop();
+
+ private:
+  // Maximum size of a command, a longer one closes the connection.
+  static constexpr size_t kMaxCommandSize = 1024;
+  // Number of sessions described by a worker at a time.
+  static constexpr size_t kListChunkSize = 256;
+  // Delay before accepting again after a failure, e.g. when out of file descriptors.
+  static constexpr std::chrono::milliseconds kAcceptRetryDelay{100};
+
+  // A connection of an administrator.
+  struct Connection {
+    explicit Connection(local_stream::socket&& socket) : socket{std::move(socket)} {}
+
+    local_stream::socket socket;
+    std::string request;
+    std::string response;
+    // The position of the listing: the index of the worker, of its server, and in its sessions.
+    size_t worker = 0;
+    size_t server = 0;
+    size_t position = 0;
+  };
+
+  // Accepts the next connection.
+  void DoAccept();
+
+  // Reads the next command of the connection.
+  void DoReadCommand(const std::shared_ptr<Connection>& connection);
+
+  // Executes the command, the response is sent by the command.
+  void ExecuteCommand(const std::shared_ptr<Connection>& connection, std::string_view command);
+
+  // Collects the next chunk of the listing from its worker and sends it.
+  void DoListSessions(const std::shared_ptr<Connection>& connection);
+
+  // Deletes the session on the thread of its worker and sends the result.
+  void DoKillSession(const std::shared_ptr<Connection>& connection, std::string_view id);
+
+  // Appends the counters of the process to the response.
+  void AppendStatistics(std::string& response) const;
+
+  // Sends the response. Once it is sent, the listing is continued if it is not finished,
+  // otherwise the next command is read.
+  void DoSendResponse(const std::shared_ptr<Connection>& connection, bool finished);
+
+  boost::asio::io_context& context_;
+  std::string path_;
+  std::vector<std::shared_ptr<Worker>> workers_;
+  local_stream::acceptor acceptor_;
+  boost::asio::steady_timer retry_timer_;
+};
+
+#endif  // BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+#endif  // !ADMIN_SERVER_H_
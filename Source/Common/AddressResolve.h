@@ -7,6 +7,9 @@
 #include <boost/endian.hpp>
 #include <cstdint>
 #include <functional>
+#include <string>
+#include <vector>
+#include "DnsCache.h"
 #include "Types.h"
 
 namespace common {
@@ -16,6 +19,8 @@ namespace common {
 
 using DomainResolverCallbackTCP = std::function<void(const error_code&, const net_tcp::endpoint&)>;
 using DomainResolverCallbackUDP = std::function<void(const error_code&, const net_udp::endpoint&)>;
+using DomainEndpointsCallbackTCP =
+    std::function<void(const error_code&, const std::string&, std::vector<net_tcp::endpoint>)>;
 
 // An auxiliary function for generating an IPv4 endpoint based on the specified address and port.
 // Supports TCP and UDP protocols.
@@ -61,17 +66,39 @@ TEndpoint GetIPv6Endpoint(const uint8_t* address, uint16_t port, bool big_endian
 }
 
 // Asynchronous function for domain name resolution.
-// Supports TCP and UDP protocols.
+// Supports TCP and UDP protocols. The names are resolved through the shared DnsCache.
 template <typename TResolver = net_tcp::resolver, typename TCallback = DomainResolverCallbackTCP>
 void ResolveDomainAddress(const boost::asio::any_io_executor& executor, const std::string& address,
                           uint16_t port, TCallback callback) {
-  auto resolver = std::make_shared<TResolver>(executor);
-  resolver->async_resolve(
-      address, std::to_string(port),
-      [resolver, callback](const error_code& ecode, typename TResolver::iterator iterator)
+  DnsCache::GetInstance()->Resolve(
+      executor, address,
+      [port, callback](const error_code& ecode, const DnsAddresses& addresses)
       {
-        const auto& endpoint = *iterator;
-        callback(ecode, endpoint);
+        if (ecode) {
+          callback(ecode, typename TResolver::endpoint_type{});
+        } else {
+          callback(ecode, typename TResolver::endpoint_type(addresses.front(), port));
+        }
+      });
+}
+
+// Asynchronous function for domain name resolution which returns all addresses of the name,
+// ordered for HappyEyeballs. The callback also receives the domain name.
+inline void ResolveDomainEndpoints(const boost::asio::any_io_executor& executor,
+                                   const std::string& address, uint16_t port,
+                                   DomainEndpointsCallbackTCP callback) {
+  DnsCache::GetInstance()->Resolve(
+      executor, address,
+      [address, port, callback](const error_code& ecode, const DnsAddresses& addresses)
+      {
+        std::vector<net_tcp::endpoint> endpoints;
+
+        endpoints.reserve(addresses.size());
+        for (const auto& item : addresses) {
+          endpoints.emplace_back(item, port);
+        }
+
+        callback(ecode, address, std::move(endpoints));
       });
 }
 
@@ -0,0 +1,98 @@
+#include "BufferPool.h"
+#include <array>
+#include <utility>
+
+namespace common {
+namespace {
+
+// Buffers are grouped into power-of-two size classes from 1 KiB to 64 KiB.
+constexpr size_t kMinClassShift = 10;
+constexpr size_t kClassesCount = 7;
+
+// The maximum number of idle buffers kept by a thread in each size class.
+constexpr size_t kMaxCachedBuffers = 64;
+
+// The idle buffers of a size class. The storage is fixed, so returning a buffer never allocates.
+struct FreeList {
+  std::array<std::unique_ptr<char[]>, kMaxCachedBuffers> buffers;
+  size_t count = 0;
+};
+
+using ThreadPool = std::array<FreeList, kClassesCount>;
+
+ThreadPool& GetThreadPool() {
+  thread_local ThreadPool pool;
+  return pool;
+}
+
+// Returns the index of the size class of the specified size, or kClassesCount if the buffer
+// is too large to be pooled.
+size_t GetSizeClass(size_t size) {
+  size_t index = 0;
+  while (index < kClassesCount && (size_t{1} << (index + kMinClassShift)) < size) {
+    ++index;
+  }
+
+  return index;
+}
+
+}  // namespace
+
+PooledBuffer::PooledBuffer() noexcept : data_{}, size_{0} {}
+
+PooledBuffer::PooledBuffer(std::unique_ptr<char[]> data, size_t size) noexcept
+    : data_{std::move(data)}, size_{size} {}
+
+PooledBuffer::~PooledBuffer() {
+  Reset();
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept
+    : data_{std::move(other.data_)}, size_{std::exchange(other.size_, 0)} {}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+  if (this != &other) {
+    Reset();
+    data_ = std::move(other.data_);
+    size_ = std::exchange(other.size_, 0);
+  }
+
+  return *this;
+}
+
+void PooledBuffer::Reset() noexcept {
+  if (data_) {
+    BufferPool::Return(std::move(data_), size_);
+    size_ = 0;
+  }
+}
+
+PooledBuffer BufferPool::Borrow(size_t size) {
+  const auto index = GetSizeClass(size);
+  if (index == kClassesCount) {
+    return {std::unique_ptr<char[]>(new char[size]), size};
+  }
+
+  const size_t class_size = size_t{1} << (index + kMinClassShift);
+  auto& free_list = GetThreadPool()[index];
+
+  if (free_list.count == 0) {
+    return {std::unique_ptr<char[]>(new char[class_size]), class_size};
+  }
+
+  return {std::move(free_list.buffers[--free_list.count]), class_size};
+}
+
+void BufferPool::Return(std::unique_ptr<char[]> data, size_t size) noexcept {
+  const auto index = GetSizeClass(size);
+  if (index == kClassesCount || (size_t{1} << (index + kMinClassShift)) != size) {
+    return;
+  }
+
+  auto& free_list = GetThreadPool()[index];
+  if (free_list.count < kMaxCachedBuffers) {
+    free_list.buffers[free_list.count++] = std::move(data);
+  }
+}
+
+}  // namespace common
@@ -0,0 +1,56 @@
+#ifndef COMMON_BUFFER_POOL_H_
+#define COMMON_BUFFER_POOL_H_
+
+#include <cstddef>
+#include <memory>
+
+namespace common {
+
+// A buffer borrowed from the pool of the current thread.
+// The buffer is returned to the pool when the object is destroyed or reset.
+class PooledBuffer {
+ public:
+  PooledBuffer() noexcept;
+  PooledBuffer(std::unique_ptr<char[]> data, size_t size) noexcept;
+  ~PooledBuffer();
+
+  PooledBuffer(const PooledBuffer&) = delete;
+  PooledBuffer& operator=(const PooledBuffer&) = delete;
+  PooledBuffer(PooledBuffer&& other) noexcept;
+  PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+
+  // Returns true if the buffer holds memory.
+  explicit operator bool() const noexcept { return data_ != nullptr; }
+
+  // Returns a pointer to the memory of the buffer.
+  char* data() const noexcept { return data_.get(); }
+
+  // Returns the size of the buffer.
+  size_t size() const noexcept { return size_; }
+
+  // Returns the memory to the pool of the current thread.
+  void Reset() noexcept;
+
+ private:
+  std::unique_ptr<char[]> data_;
+  size_t size_;
+};
+
+// A per-thread pool of I/O buffers. Sessions borrow a buffer only for the duration of a
+// read/write, so an idle session does not pin any buffer memory.
+class BufferPool {
+ public:
+  // Takes a buffer of at least the specified size from the pool of the current thread, or
+  // allocates a new one.
+  static PooledBuffer Borrow(size_t size);
+
+ private:
+  friend class PooledBuffer;
+
+  // Returns the memory to the pool of the current thread.
+  static void Return(std::unique_ptr<char[]> data, size_t size) noexcept;
+};
+
+}  // namespace common
+
+#endif  // !COMMON_BUFFER_POOL_H_
@@ -0,0 +1,240 @@
+#include "DnsCache.h"
+#include <algorithm>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <cctype>
+#include <utility>
+#include "Configuration.h"
+#include "DnsClient.h"
+
+namespace common {
+namespace {
+
+// A cached answer is refreshed in the background once this share of its lifetime has passed.
+constexpr uint32_t kRefreshPercent = 80;
+
+// Returns the domain name in the form used as a key of the cache.
+std::string NormalizeHost(const std::string& host) {
+  std::string key(host);
+  std::transform(key.begin(), key.end(), key.begin(),
+                 [](unsigned char symbol) { return std::tolower(symbol); });
+
+  if (!key.empty() && key.back() == '.') {
+    key.pop_back();
+  }
+
+  return key;
+}
+
+// Returns true if the error means the name does not exist, rather than a failure of the resolver.
+bool IsNegativeAnswer(const error_code& ecode) {
+  return ecode == boost::asio::error::host_not_found || ecode == boost::asio::error::no_data;
+}
+
+// Reorders the addresses so that the families alternate, starting with the preferred one.
+// The relative order of the addresses within a family is kept.
+void InterleaveFamilies(DnsAddresses& addresses, bool prefer_v6) {
+  DnsAddresses preferred;
+  DnsAddresses other;
+
+  for (const auto& address : addresses) {
+    (address.is_v6() == prefer_v6 ? preferred : other).push_back(address);
+  }
+
+  addresses.clear();
+  for (size_t index = 0; index < preferred.size() || index < other.size(); ++index) {
+    if (index < preferred.size()) {
+      addresses.push_back(preferred[index]);
+    }
+    if (index < other.size()) {
+      addresses.push_back(other[index]);
+    }
+  }
+}
+
+}  // namespace
+
+std::shared_ptr<DnsCache> DnsCache::GetInstance() {
+  static auto instance = std::shared_ptr<DnsCache>(new DnsCache);
+  return instance;
+}
+
+void DnsCache::Resolve(const boost::asio::any_io_executor& executor, const std::string& host,
+                       DnsCallback callback) {
+  const auto key = NormalizeHost(host);
+  const auto now = Clock::now();
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  auto [iterator, inserted] = entries_.try_emplace(key);
+  auto& entry = iterator->second;
+
+  if (inserted) {
+    entry.position = lru_.insert(lru_.begin(), &iterator->first);
+  } else {
+    lru_.splice(lru_.begin(), lru_, entry.position);
+  }
+
+  if (entry.valid && now < entry.expires) {
+    const auto refresh = !entry.error && !entry.resolving && now >= entry.refresh;
+    auto addresses = entry.addresses;
+    const auto ecode = entry.error;
+
+    ++(ecode ? statistics_.negative_hits : statistics_.hits);
+    if (refresh) {
+      entry.resolving = true;
+      ++statistics_.refreshes;
+    }
+
+    lock.unlock();
+
+    if (refresh) {
+      StartQuery(executor, key);
+    }
+
+    callback(ecode, addresses);
+    return;
+  }
+
+  entry.waiters.push_back({executor, std::move(callback)});
+
+  if (entry.resolving) {
+    ++statistics_.coalesced;
+    return;
+  }
+
+  entry.resolving = true;
+  ++statistics_.misses;
+
+  if (inserted) {
+    Evict(now);
+  }
+
+  lock.unlock();
+  StartQuery(executor, key);
+}
+
+void DnsCache::RememberFamily(const std::string& host, bool is_v6) {
+  const auto key = NormalizeHost(host);
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto iterator = entries_.find(key);
+  if (iterator != entries_.end() && iterator->second.prefer_v6 != is_v6) {
+    iterator->second.prefer_v6 = is_v6;
+    InterleaveFamilies(iterator->second.addresses, is_v6);
+  }
+}
+
+DnsCache::Statistics DnsCache::GetStatistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return statistics_;
+}
+
+void DnsCache::StartQuery(const boost::asio::any_io_executor& executor, const std::string& host) {
+  if (Configuration::GetInstance()->GetDns().resolver == "native") {
+    DnsClient::GetThreadInstance(executor)->Resolve(
+        host,
+        [self = shared_from_this(), host](const error_code& ecode, DnsAddresses addresses,
+                                          uint32_t ttl)
+        { self->OnQueryFinished(host, ecode, std::move(addresses), ttl); });
+    return;
+  }
+
+  auto resolver = std::make_shared<net_tcp::resolver>(executor);
+
+  resolver->async_resolve(
+      host, "",
+      [self = shared_from_this(), resolver, host](const error_code& ecode,
+                                                   const net_tcp::resolver::results_type& results)
+      {
+        DnsAddresses addresses;
+
+        if (!ecode) {
+          for (const auto& result : results) {
+            const auto address = result.endpoint().address();
+            if (std::find(addresses.begin(), addresses.end(), address) == addresses.end()) {
+              addresses.push_back(address);
+            }
+          }
+        }
+
+        // The system resolver does not report the lifetime of the records.
+        self->OnQueryFinished(host, ecode, std::move(addresses), 0);
+      });
+}
+
+void DnsCache::OnQueryFinished(const std::string& host, const error_code& query_ecode,
+                               DnsAddresses addresses, uint32_t ttl) {
+  const auto& config = Configuration::GetInstance()->GetDns();
+  const auto now = Clock::now();
+  auto ecode = query_ecode;
+  std::vector<Waiter> waiters;
+
+  if (!ecode && addresses.empty()) {
+    ecode = boost::asio::error::host_not_found;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto iterator = entries_.find(host);
+    if (iterator == entries_.end()) {
+      return;
+    }
+
+    auto& entry = iterator->second;
+    entry.resolving = false;
+    waiters.swap(entry.waiters);
+    InterleaveFamilies(addresses, entry.prefer_v6);
+
+    if (!ecode || IsNegativeAnswer(ecode)) {
+      const auto lifetime =
+          ecode ? config.negative_ttl : std::clamp(ttl, config.min_ttl, config.max_ttl);
+
+      entry.addresses = ecode ? DnsAddresses{} : addresses;
+      entry.error = ecode;
+      entry.expires = now + std::chrono::seconds(lifetime);
+      entry.refresh = now + std::chrono::seconds(lifetime) * kRefreshPercent / 100;
+      entry.valid = true;
+    } else if (entry.valid && now < entry.expires) {
+      // A transient failure of a background refresh, keep serving the cached answer until it
+      // expires instead of retrying on every hit.
+      entry.refresh = entry.expires;
+    } else {
+      entry.valid = false;
+    }
+  }
+
+  for (auto& waiter : waiters) {
+    boost::asio::post(waiter.executor,
+                      [callback = std::move(waiter.callback), ecode, addresses]
+                      {
+                        callback(ecode, addresses);
+                      });
+  }
+}
+
+void DnsCache::Evict(Clock::time_point now) {
+  const auto& config = Configuration::GetInstance()->GetDns();
+
+  // The names being resolved have waiters, they are passed over to the front of the list. Each
+  // name is looked at once at most.
+  for (size_t visited = 0; entries_.size() > config.cache_size && visited < entries_.size();
+       ++visited) {
+    auto iterator = entries_.find(*lru_.back());
+    auto& entry = iterator->second;
+
+    if (entry.resolving) {
+      lru_.splice(lru_.begin(), lru_, entry.position);
+      continue;
+    }
+
+    if (entry.valid && now < entry.expires) {
+      ++statistics_.evictions;
+    }
+
+    lru_.erase(entry.position);
+    entries_.erase(iterator);
+  }
+}
+
+}  // namespace common
@@ -0,0 +1,103 @@
+#ifndef COMMON_DNS_CACHE_H_
+#define COMMON_DNS_CACHE_H_
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/ip/address.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Types.h"
+
+namespace common {
+
+using DnsAddresses = std::vector<boost::asio::ip::address>;
+using DnsCallback = std::function<void(const error_code&, const DnsAddresses&)>;
+
+// A cache of resolved domain names shared by all workers.
+// Concurrent lookups of the same name are coalesced into a single query, names which do not exist
+// are cached for a short time, and popular names are refreshed in the background shortly before
+// they expire, so the sessions rarely wait for the resolver.
+// The addresses are ordered for Happy Eyeballs (RFC 8305): the families alternate, starting with
+// the family of the last successful connection to the host (IPv6 until one is known).
+class DnsCache : public std::enable_shared_from_this<DnsCache> {
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  DnsCache() = default;
+
+ public:
+  struct Statistics {
+    uint64_t hits;           // Lookups answered from the cache.
+    uint64_t negative_hits;  // Lookups answered with a cached error.
+    uint64_t misses;         // Lookups which started a query.
+    uint64_t coalesced;      // Lookups which joined a query already in flight.
+    uint64_t refreshes;      // Background queries for names that are about to expire.
+    uint64_t evictions;      // Names removed from the full cache before they expired.
+  };
+
+  ~DnsCache() = default;
+
+  DnsCache(const DnsCache&) = delete;
+  DnsCache(DnsCache&&) = delete;
+  DnsCache& operator=(const DnsCache&) = delete;
+  DnsCache& operator=(DnsCache&&) = delete;
+
+  // Returns an instance of the class.
+  static std::shared_ptr<DnsCache> GetInstance();
+
+  // Resolves the domain name. A cached answer is passed to the callback immediately, otherwise the
+  // callback is invoked through the executor once the query is finished.
+  void Resolve(const boost::asio::any_io_executor& executor, const std::string& host,
+               DnsCallback callback);
+
+  // Remembers the address family of a successful connection to the host.
+  void RememberFamily(const std::string& host, bool is_v6);
+
+  // Returns the cache counters.
+  Statistics GetStatistics() const;
+
+ private:
+  struct Waiter {
+    boost::asio::any_io_executor executor;
+    DnsCallback callback;
+  };
+
+  struct Entry {
+    DnsAddresses addresses;
+    error_code error;
+    Clock::time_point expires;
+    Clock::time_point refresh;  // The moment after which a hit triggers a background query.
+    bool valid = false;         // The entry holds an answer.
+    bool resolving = false;     // A query for the name is in flight.
+    bool prefer_v6 = true;      // The family the addresses start with.
+    std::vector<Waiter> waiters;
+    std::list<const std::string*>::iterator position;  // The place of the name in the LRU list.
+  };
+
+  // Starts a query for the name on the executor, with the resolver selected by the configuration.
+  void StartQuery(const boost::asio::any_io_executor& executor, const std::string& host);
+
+  // Stores the answer of the query and notifies the waiters.
+  // A zero ttl means the resolver did not report the lifetime of the answer.
+  void OnQueryFinished(const std::string& host, const error_code& ecode, DnsAddresses addresses,
+                       uint32_t ttl);
+
+  // Removes the least recently used names which are not being resolved until the cache fits its
+  // size. Must be called with the mutex held.
+  void Evict(Clock::time_point now);
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::list<const std::string*> lru_;  // The keys of the entries, the most recently used first.
+  Statistics statistics_{};
+};
+
+}  // namespace common
+
+#endif  // !COMMON_DNS_CACHE_H_
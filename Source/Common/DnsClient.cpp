@@ -0,0 +1,472 @@
+#include "DnsClient.h"
+#include <algorithm>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include "Configuration.h"
+#include "HandlerAllocator.h"
+
+namespace common {
+namespace {
+
+constexpr uint16_t kDnsPort = 53;
+
+// The receive buffer is larger than the advertised payload size, in case a nameserver ignores it.
+constexpr size_t kReceiveBufferSize = 4096;
+
+using HostsTable = std::unordered_map<std::string, std::vector<boost::asio::ip::address>>;
+
+std::string ToLower(std::string value) {
+  std::transform(value.begin(), value.end(), value.begin(),
+                 [](unsigned char symbol) { return std::tolower(symbol); });
+  return value;
+}
+
+// Parses a nameserver in the form 'address', 'ipv4:port' or '[ipv6]:port'.
+bool ParseNameserver(const std::string& value, net_udp::endpoint& endpoint) {
+  std::string address = value;
+  unsigned long port = kDnsPort;
+
+  if (!value.empty() && value.front() == '[') {
+    const auto close = value.find(']');
+    if (close == std::string::npos) {
+      return false;
+    }
+
+    address = value.substr(1, close - 1);
+    if (close + 1 < value.size() && value[close + 1] == ':') {
+      port = std::strtoul(value.c_str() + close + 2, nullptr, 10);
+    }
+  } else if (std::count(value.begin(), value.end(), ':') == 1) {
+    const auto colon = value.find(':');
+
+    address = value.substr(0, colon);
+    port = std::strtoul(value.c_str() + colon + 1, nullptr, 10);
+  }
+
+  error_code ecode;
+  const auto ip = boost::asio::ip::make_address(address, ecode);
+
+  if (ecode || port == 0 || port > std::numeric_limits<uint16_t>::max()) {
+    return false;
+  }
+
+  endpoint = net_udp::endpoint(ip, static_cast<uint16_t>(port));
+  return true;
+}
+
+// Returns the nameservers from the configuration, or from /etc/resolv.conf if none are configured.
+std::vector<net_udp::endpoint> LoadNameservers() {
+  std::vector<net_udp::endpoint> nameservers;
+  net_udp::endpoint endpoint;
+  std::string token;
+
+  auto list = Configuration::GetInstance()->GetDns().nameservers;
+  std::replace(list.begin(), list.end(), ',', ' ');
+
+  std::istringstream stream(list);
+  while (stream >> token) {
+    if (ParseNameserver(token, endpoint)) {
+      nameservers.push_back(endpoint);
+    }
+  }
+
+  if (nameservers.empty()) {
+    std::ifstream file("/etc/resolv.conf");
+    std::string line;
+
+    while (std::getline(file, line)) {
+      std::istringstream line_stream(line);
+      std::string keyword;
+
+      if (line_stream >> keyword >> token && keyword == "nameserver" &&
+          ParseNameserver(token, endpoint)) {
+        nameservers.push_back(endpoint);
+      }
+    }
+  }
+
+  if (nameservers.empty()) {
+    nameservers.emplace_back(boost::asio::ip::address_v4::loopback(), kDnsPort);
+  }
+
+  return nameservers;
+}
+
+// Returns the names from /etc/hosts, the file is read once.
+const HostsTable& GetHostsTable() {
+  static const HostsTable table = []
+  {
+    HostsTable hosts;
+    std::ifstream file("/etc/hosts");
+    std::string line;
+
+    while (std::getline(file, line)) {
+      std::istringstream stream(line.substr(0, line.find('#')));
+      std::string value;
+      error_code ecode;
+
+      if (!(stream >> value)) {
+        continue;
+      }
+
+      const auto address = boost::asio::ip::make_address(value, ecode);
+      if (ecode) {
+        continue;
+      }
+
+      while (stream >> value) {
+        auto& addresses = hosts[ToLower(value)];
+        if (std::find(addresses.begin(), addresses.end(), address) == addresses.end()) {
+          addresses.push_back(address);
+        }
+      }
+    }
+
+    return hosts;
+  }();
+
+  return table;
+}
+
+}  // namespace
+
+DnsClient::DnsClient(const boost::asio::any_io_executor& executor)
+    : executor_{executor},
+      nameservers_{LoadNameservers()},
+      timeout_{std::max<uint32_t>(Configuration::GetInstance()->GetDns().timeout, 1)},
+      attempts_{std::max<uint32_t>(Configuration::GetInstance()->GetDns().attempts, 1)},
+      queries_{},
+      random_{std::random_device{}()} {}
+
+std::shared_ptr<DnsClient> DnsClient::GetThreadInstance(
+    const boost::asio::any_io_executor& executor) {
+  thread_local std::shared_ptr<DnsClient> instance;
+
+  if (!instance) {
+    instance = std::shared_ptr<DnsClient>(new DnsClient(executor));
+  }
+
+  return instance;
+}
+
+void DnsClient::Resolve(const std::string& host, Callback callback) {
+  error_code ecode;
+  auto name = ToLower(host);
+
+  if (!name.empty() && name.back() == '.') {
+    name.pop_back();
+  }
+
+  const auto literal = boost::asio::ip::make_address(name, ecode);
+  if (!ecode) {
+    callback({}, {literal}, 0);
+    return;
+  }
+
+  const auto& hosts = GetHostsTable();
+  if (auto iterator = hosts.find(name); iterator != hosts.end()) {
+    callback({}, iterator->second, 0);
+    return;
+  }
+
+  // A flood of names must not exhaust the query IDs, nor the descriptors of the thread.
+  if (queries_.size() + 2 > kMaxQueries) {
+    callback(boost::asio::error::no_buffer_space, {}, 0);
+    return;
+  }
+
+  auto lookup = std::make_shared<Lookup>();
+  lookup->host = std::move(name);
+  lookup->callback = std::move(callback);
+  lookup->ttl = std::numeric_limits<uint32_t>::max();
+  lookup->pending = 2;
+
+  StartQuery(lookup, DnsType::kAaaa);
+  StartQuery(lookup, DnsType::kA);
+}
+
+void DnsClient::StartQuery(const std::shared_ptr<Lookup>& lookup, DnsType type) {
+  auto query = std::make_shared<Query>(executor_);
+
+  query->lookup = lookup;
+  query->type = type;
+  query->id = GenerateId();
+  query->attempt = 0;
+
+  if (!EncodeDnsQuery(query->id, lookup->host, type, query->packet)) {
+    FinishQuery(query, boost::asio::error::host_not_found, nullptr);
+    return;
+  }
+
+  queries_.emplace(query->id, query);
+  SendQuery(query);
+}
+
+void DnsClient::SendQuery(const std::shared_ptr<Query>& query) {
+  query->server = nameservers_[query->attempt % nameservers_.size()];
+  ++query->attempt;
+
+  // A new socket gets a new random source port from the system, and a connected socket only
+  // receives the datagrams of the nameserver.
+  error_code ecode;
+  query->udp_socket.close(ecode);
+  query->udp_socket.open(query->server.protocol(), ecode);
+  if (!ecode) {
+    query->udp_socket.connect(query->server, ecode);
+  }
+
+  StartTimer(query);
+
+  if (ecode) {
+    // The failure is reported like a failed send, after the timer is armed for the retry.
+    boost::asio::post(executor_, BindHandlerAllocator(
+                                     [self = shared_from_this(), query, ecode,
+                                      attempt = query->attempt]()
+                                     {
+                                       if (self->IsActive(query) && query->attempt == attempt) {
+                                         self->RetryQuery(query, ecode);
+                                       }
+                                     }));
+    return;
+  }
+
+  query->udp_socket.async_send(
+      boost::asio::buffer(query->packet),
+      BindHandlerAllocator(
+          [self = shared_from_this(), query, attempt = query->attempt](const error_code& ecode,
+                                                                       size_t)
+          {
+            // A failed send is retried at once instead of waiting for the timer.
+            if (ecode && self->IsActive(query) && query->attempt == attempt &&
+                !query->tcp_socket) {
+              self->RetryQuery(query, ecode);
+            }
+          }));
+
+  DoReceive(query);
+}
+
+void DnsClient::SendQueryOverTcp(const std::shared_ptr<Query>& query) {
+  auto socket = std::make_shared<net_tcp::socket>(executor_);
+  const auto size = query->packet.size();
+
+  query->tcp_socket = socket;
+  query->tcp_buffer.clear();
+  query->tcp_buffer.push_back(static_cast<uint8_t>(size >> 8));
+  query->tcp_buffer.push_back(static_cast<uint8_t>(size));
+  query->tcp_buffer.insert(query->tcp_buffer.end(), query->packet.begin(), query->packet.end());
+
+  StartTimer(query);
+
+  socket->async_connect(
+      net_tcp::endpoint(query->server.address(), query->server.port()),
+      BindHandlerAllocator(
+          [self = shared_from_this(), query, socket](const error_code& ecode)
+          {
+            if (!self->IsActive(query) || query->tcp_socket != socket) {
+              return;
+            }
+
+            if (ecode) {
+              self->RetryQuery(query, ecode);
+              return;
+            }
+
+            boost::asio::async_write(
+                *socket, boost::asio::buffer(query->tcp_buffer),
+                BindHandlerAllocator(
+                    [self, query, socket](const error_code& ecode, size_t)
+                    {
+                      if (!self->IsActive(query) || query->tcp_socket != socket) {
+                        return;
+                      }
+
+                      if (ecode) {
+                        self->RetryQuery(query, ecode);
+                      } else {
+                        self->DoReadTcpResponse(query, socket);
+                      }
+                    }));
+          }));
+}
+
+void DnsClient::DoReadTcpResponse(const std::shared_ptr<Query>& query,
+                                  const std::shared_ptr<net_tcp::socket>& socket) {
+  query->tcp_buffer.resize(2);
+
+  boost::asio::async_read(
+      *socket, boost::asio::buffer(query->tcp_buffer),
+      BindHandlerAllocator(
+          [self = shared_from_this(), query, socket](const error_code& ecode, size_t)
+          {
+            if (!self->IsActive(query) || query->tcp_socket != socket) {
+              return;
+            }
+
+            if (ecode) {
+              self->RetryQuery(query, ecode);
+              return;
+            }
+
+            query->tcp_buffer.resize((query->tcp_buffer[0] << 8) | query->tcp_buffer[1]);
+
+            boost::asio::async_read(
+                *socket, boost::asio::buffer(query->tcp_buffer),
+                BindHandlerAllocator(
+                    [self, query, socket](const error_code& ecode, size_t size)
+                    {
+                      if (!self->IsActive(query) || query->tcp_socket != socket) {
+                        return;
+                      }
+
+                      DnsResponse response;
+
+                      if (ecode) {
+                        self->RetryQuery(query, ecode);
+                      } else if (!DecodeDnsResponse(query->tcp_buffer.data(), size, response) ||
+                                 response.id != query->id || response.question_type != query->type ||
+                                 response.question_name != query->lookup->host) {
+                        self->RetryQuery(query, boost::asio::error::host_not_found_try_again);
+                      } else {
+                        self->OnResponse(query, response);
+                      }
+                    }));
+          }));
+}
+
+void DnsClient::DoReceive(const std::shared_ptr<Query>& query) {
+  query->udp_buffer.resize(kReceiveBufferSize);
+
+  query->udp_socket.async_receive(
+      boost::asio::buffer(query->udp_buffer),
+      BindHandlerAllocator(
+          [self = shared_from_this(), query, attempt = query->attempt](const error_code& ecode,
+                                                                       size_t size)
+          {
+            // The socket of an earlier attempt is closed, its answer is no longer awaited.
+            if (!self->IsActive(query) || query->attempt != attempt || query->tcp_socket) {
+              return;
+            }
+
+            DnsResponse response;
+
+            if (ecode) {
+              // Such as an ICMP port unreachable from the nameserver.
+              self->RetryQuery(query, ecode);
+            } else if (DecodeDnsResponse(query->udp_buffer.data(), size, response) &&
+                       response.id == query->id && response.question_type == query->type &&
+                       response.question_name == query->lookup->host) {
+              self->OnResponse(query, response);
+            } else {
+              // Not an answer to the question, the real one may still come.
+              self->DoReceive(query);
+            }
+          }));
+}
+
+void DnsClient::OnResponse(const std::shared_ptr<Query>& query, const DnsResponse& response) {
+  if (response.truncated && !query->tcp_socket) {
+    SendQueryOverTcp(query);
+    return;
+  }
+
+  switch (response.code) {
+    case DnsResponseCode::kNoError:
+      FinishQuery(query, response.addresses.empty() ? boost::asio::error::no_data : error_code{},
+                  &response);
+      break;
+    case DnsResponseCode::kNameError:
+      FinishQuery(query, boost::asio::error::host_not_found, nullptr);
+      break;
+    default:
+      RetryQuery(query, boost::asio::error::host_not_found_try_again);
+      break;
+  }
+}
+
+void DnsClient::RetryQuery(const std::shared_ptr<Query>& query, const error_code& ecode) {
+  if (query->tcp_socket) {
+    error_code ecode_ignore;
+    query->tcp_socket->close(ecode_ignore);
+    query->tcp_socket.reset();
+  }
+
+  if (query->attempt < attempts_ * nameservers_.size()) {
+    SendQuery(query);
+  } else {
+    FinishQuery(query, ecode, nullptr);
+  }
+}
+
+void DnsClient::FinishQuery(const std::shared_ptr<Query>& query, const error_code& ecode,
+                            const DnsResponse* response) {
+  auto iterator = queries_.find(query->id);
+  if (iterator != queries_.end() && iterator->second == query) {
+    queries_.erase(iterator);
+  }
+
+  error_code ecode_ignore;
+  query->timer.cancel();
+  query->udp_socket.close(ecode_ignore);
+  if (query->tcp_socket) {
+    query->tcp_socket->close(ecode_ignore);
+    query->tcp_socket.reset();
+  }
+
+  auto& lookup = *query->lookup;
+
+  if (!ecode && response) {
+    lookup.addresses.insert(lookup.addresses.end(), response->addresses.begin(),
+                            response->addresses.end());
+    lookup.ttl = std::min(lookup.ttl, response->ttl);
+  } else if (!lookup.error || ecode == boost::asio::error::host_not_found) {
+    lookup.error = ecode;
+  }
+
+  if (--lookup.pending == 0) {
+    auto callback = std::move(lookup.callback);
+
+    if (!lookup.addresses.empty()) {
+      callback({}, std::move(lookup.addresses), lookup.ttl);
+    } else {
+      callback(lookup.error, {}, 0);
+    }
+  }
+}
+
+void DnsClient::StartTimer(const std::shared_ptr<Query>& query) {
+  query->timer.expires_after(timeout_);
+  query->timer.async_wait(BindHandlerAllocator(
+      [self = shared_from_this(), query](const error_code& ecode)
+      {
+        if (!ecode && self->IsActive(query)) {
+          self->RetryQuery(query, boost::asio::error::timed_out);
+        }
+      }));
+}
+
+bool DnsClient::IsActive(const std::shared_ptr<Query>& query) const {
+  auto iterator = queries_.find(query->id);
+  return iterator != queries_.end() && iterator->second == query;
+}
+
+uint16_t DnsClient::GenerateId() {
+  // At most kMaxQueries of the IDs are in use, so a free one is found after a few draws.
+  std::uniform_int_distribution<uint32_t> distribution(0, std::numeric_limits<uint16_t>::max());
+  uint16_t id;
+
+  do {
+    id = static_cast<uint16_t>(distribution(random_));
+  } while (queries_.count(id) != 0);
+
+  return id;
+}
+
+}  // namespace common
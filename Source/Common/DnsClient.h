@@ -0,0 +1,133 @@
+#ifndef COMMON_DNS_CLIENT_H_
+#define COMMON_DNS_CLIENT_H_
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/ip/address.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "DnsMessage.h"
+#include "Types.h"
+
+namespace common {
+
+// An asynchronous stub resolver. The queries are sent to the nameservers on the io_context of
+// the calling thread, so a slow answer does not hold back the other lookups the way
+// getaddrinfo on the single resolver thread of asio does.
+// A and AAAA records are queried in parallel over UDP, a truncated answer is repeated over TCP.
+// A query which is not answered in time, or is answered with a server failure, is sent to the
+// next nameserver. Literal addresses and names from the hosts file are answered locally.
+// Every attempt of a query is sent from a socket of its own, so a spoofed answer has to guess
+// the random source port as well as the random ID. The number of queries in flight is limited,
+// a lookup beyond it fails at once.
+// Every worker thread has its own client.
+class DnsClient final : public std::enable_shared_from_this<DnsClient> {
+  explicit DnsClient(const boost::asio::any_io_executor& executor);
+
+ public:
+  // The callback receives the addresses and the smallest TTL of their records in seconds,
+  // zero if the lifetime is not known.
+  using Callback =
+      std::function<void(const error_code&, std::vector<boost::asio::ip::address>, uint32_t)>;
+
+  ~DnsClient() = default;
+
+  DnsClient(const DnsClient&) = delete;
+  DnsClient(DnsClient&&) = delete;
+  DnsClient& operator=(const DnsClient&) = delete;
+  DnsClient& operator=(DnsClient&&) = delete;
+
+  // Returns the client of the current thread, the client is created on the executor at the
+  // first call.
+  static std::shared_ptr<DnsClient> GetThreadInstance(
+      const boost::asio::any_io_executor& executor);
+
+  // Maximum number of queries in flight per thread, a lookup makes two of them.
+  static constexpr size_t kMaxQueries = 1024;
+
+  // Resolves the IPv4 and IPv6 addresses of the name. Fails with no_buffer_space if the client
+  // has too many queries in flight.
+  void Resolve(const std::string& host, Callback callback);
+
+ private:
+  // The A and AAAA queries of a single name.
+  struct Lookup {
+    std::string host;
+    Callback callback;
+    std::vector<boost::asio::ip::address> addresses;
+    uint32_t ttl;
+    error_code error;
+    size_t pending;
+  };
+
+  // A single question, sent to the nameservers in turn until it is answered.
+  struct Query {
+    explicit Query(const boost::asio::any_io_executor& executor)
+        : timer{executor}, udp_socket{executor} {}
+
+    std::shared_ptr<Lookup> lookup;
+    DnsType type;
+    uint16_t id;
+    std::vector<uint8_t> packet;
+    size_t attempt;  // The number of times the question was sent.
+    net_udp::endpoint server;
+    boost::asio::steady_timer timer;
+    net_udp::socket udp_socket;  // Connected to the server, opened again for every attempt.
+    std::vector<uint8_t> udp_buffer;
+    std::shared_ptr<net_tcp::socket> tcp_socket;  // Set when the UDP answer was truncated.
+    std::vector<uint8_t> tcp_buffer;
+  };
+
+  // Creates and sends the query of the specified type for the lookup.
+  void StartQuery(const std::shared_ptr<Lookup>& lookup, DnsType type);
+
+  // Sends the query to the next nameserver over UDP and arms the timer.
+  void SendQuery(const std::shared_ptr<Query>& query);
+
+  // Repeats the query over TCP, to the nameserver which sent the truncated answer.
+  void SendQueryOverTcp(const std::shared_ptr<Query>& query);
+
+  // Reads the length-prefixed answer to the query from the TCP connection.
+  void DoReadTcpResponse(const std::shared_ptr<Query>& query,
+                         const std::shared_ptr<net_tcp::socket>& socket);
+
+  // Receives the answer to the current attempt of the query.
+  void DoReceive(const std::shared_ptr<Query>& query);
+
+  // Processes the answer to the query.
+  void OnResponse(const std::shared_ptr<Query>& query, const DnsResponse& response);
+
+  // Sends the query to the next nameserver, or finishes it with the error if all attempts are
+  // used up.
+  void RetryQuery(const std::shared_ptr<Query>& query, const error_code& ecode);
+
+  // Finishes the query and completes the lookup when both of its queries are finished.
+  void FinishQuery(const std::shared_ptr<Query>& query, const error_code& ecode,
+                   const DnsResponse* response);
+
+  // Arms the timer of the current attempt of the query.
+  void StartTimer(const std::shared_ptr<Query>& query);
+
+  // Returns true if the query is still waiting for an answer.
+  bool IsActive(const std::shared_ptr<Query>& query) const;
+
+  // Returns an unused query identifier.
+  uint16_t GenerateId();
+
+  boost::asio::any_io_executor executor_;
+  std::vector<net_udp::endpoint> nameservers_;
+  std::chrono::milliseconds timeout_;
+  size_t attempts_;  // The number of rounds over all nameservers.
+  std::unordered_map<uint16_t, std::shared_ptr<Query>> queries_;
+  std::mt19937 random_;
+};
+
+}  // namespace common
+
+#endif  // !COMMON_DNS_CLIENT_H_
@@ -0,0 +1,217 @@
+#include "DnsMessage.h"
+#include <algorithm>
+#include <cctype>
+#include <limits>
+
+namespace common {
+namespace {
+
+constexpr size_t kHeaderSize = 12;
+constexpr size_t kMaxNameSize = 255;
+constexpr size_t kMaxLabelSize = 63;
+constexpr uint16_t kClassIn = 1;
+
+// Header flags.
+constexpr uint16_t kFlagResponse = 0x8000;
+constexpr uint16_t kFlagTruncated = 0x0200;
+constexpr uint16_t kFlagRecursionDesired = 0x0100;
+constexpr uint16_t kResponseCodeMask = 0x000f;
+
+// A compression pointer is marked by the two upper bits of the length byte.
+constexpr uint8_t kPointerMask = 0xc0;
+// Limits the number of pointers followed in a name, so a loop of pointers cannot hang the parser.
+constexpr size_t kMaxPointers = 64;
+
+void PutUint16(std::vector<uint8_t>& packet, uint16_t value) {
+  packet.push_back(static_cast<uint8_t>(value >> 8));
+  packet.push_back(static_cast<uint8_t>(value));
+}
+
+uint16_t GetUint16(const uint8_t* data) {
+  return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+uint32_t GetUint32(const uint8_t* data) {
+  return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+         (static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+}
+
+// Reads the (possibly compressed) name at the offset and moves the offset past it.
+// The name is stored in 'name' if it is not nullptr.
+bool ReadName(const uint8_t* data, size_t size, size_t& offset, std::string* name) {
+  size_t position = offset;
+  size_t pointers = 0;
+  bool jumped = false;
+
+  if (name) {
+    name->clear();
+  }
+
+  while (true) {
+    if (position >= size) {
+      return false;
+    }
+
+    const uint8_t length = data[position];
+
+    if ((length & kPointerMask) == kPointerMask) {
+      if (position + 1 >= size || ++pointers > kMaxPointers) {
+        return false;
+      }
+      if (!jumped) {
+        offset = position + 2;
+        jumped = true;
+      }
+
+      position = GetUint16(data + position) & ~(uint16_t{kPointerMask} << 8);
+      continue;
+    }
+
+    if (length > kMaxLabelSize || position + 1 + length > size) {
+      return false;
+    }
+
+    if (length == 0) {
+      if (!jumped) {
+        offset = position + 1;
+      }
+      return true;
+    }
+
+    if (name) {
+      if (!name->empty()) {
+        name->push_back('.');
+      }
+
+      for (size_t index = 0; index < length; ++index) {
+        name->push_back(
+            static_cast<char>(std::tolower(static_cast<unsigned char>(data[position + 1 + index]))));
+      }
+
+      if (name->size() > kMaxNameSize) {
+        return false;
+      }
+    }
+
+    position += 1 + length;
+  }
+}
+
+}  // namespace
+
+bool EncodeDnsQuery(uint16_t id, const std::string& name, DnsType type,
+                    std::vector<uint8_t>& packet) {
+  packet.clear();
+  packet.reserve(kHeaderSize + name.size() + 2 + 4 + 11);
+
+  // Header: one question and the EDNS(0) record in the additional section.
+  PutUint16(packet, id);
+  PutUint16(packet, kFlagRecursionDesired);
+  PutUint16(packet, 1);
+  PutUint16(packet, 0);
+  PutUint16(packet, 0);
+  PutUint16(packet, 1);
+
+  // Question name as a sequence of labels.
+  size_t label_begin = 0;
+  const size_t name_size = !name.empty() && name.back() == '.' ? name.size() - 1 : name.size();
+
+  if (name_size == 0 || name_size > kMaxNameSize - 2) {
+    return false;
+  }
+
+  while (label_begin <= name_size) {
+    const auto label_end = std::min(name.find('.', label_begin), name_size);
+    const auto label_size = label_end - label_begin;
+
+    if (label_size == 0 || label_size > kMaxLabelSize) {
+      return false;
+    }
+
+    packet.push_back(static_cast<uint8_t>(label_size));
+    packet.insert(packet.end(), name.begin() + label_begin, name.begin() + label_end);
+    label_begin = label_end + 1;
+  }
+
+  packet.push_back(0);
+  PutUint16(packet, static_cast<uint16_t>(type));
+  PutUint16(packet, kClassIn);
+
+  // OPT pseudo-record: root name, type, UDP payload size, extended flags and no options.
+  packet.push_back(0);
+  PutUint16(packet, static_cast<uint16_t>(DnsType::kOpt));
+  PutUint16(packet, kDnsUdpPayloadSize);
+  PutUint16(packet, 0);
+  PutUint16(packet, 0);
+  PutUint16(packet, 0);
+
+  return true;
+}
+
+bool DecodeDnsResponse(const uint8_t* data, size_t size, DnsResponse& response) {
+  if (size < kHeaderSize) {
+    return false;
+  }
+
+  const auto flags = GetUint16(data + 2);
+  const auto questions = GetUint16(data + 4);
+  const auto answers = GetUint16(data + 6);
+
+  if (!(flags & kFlagResponse) || questions != 1) {
+    return false;
+  }
+
+  response.id = GetUint16(data);
+  response.truncated = (flags & kFlagTruncated) != 0;
+  response.code = static_cast<DnsResponseCode>(flags & kResponseCodeMask);
+  response.addresses.clear();
+  response.ttl = std::numeric_limits<uint32_t>::max();
+
+  size_t offset = kHeaderSize;
+  if (!ReadName(data, size, offset, &response.question_name) || offset + 4 > size) {
+    return false;
+  }
+
+  response.question_type = static_cast<DnsType>(GetUint16(data + offset));
+  offset += 4;
+
+  // A truncated response may end in the middle of the answer section.
+  for (size_t index = 0; index < answers && !response.truncated; ++index) {
+    if (!ReadName(data, size, offset, nullptr) || offset + 10 > size) {
+      return false;
+    }
+
+    const auto type = static_cast<DnsType>(GetUint16(data + offset));
+    const auto record_class = GetUint16(data + offset + 2);
+    const auto ttl = GetUint32(data + offset + 4);
+    const auto length = GetUint16(data + offset + 8);
+
+    offset += 10;
+    if (offset + length > size) {
+      return false;
+    }
+
+    // CNAME records are followed by the records of the canonical name in the same section.
+    if (record_class == kClassIn && type == response.question_type) {
+      if (type == DnsType::kA && length == 4) {
+        response.addresses.emplace_back(boost::asio::ip::address_v4(GetUint32(data + offset)));
+        response.ttl = std::min(response.ttl, ttl);
+      } else if (type == DnsType::kAaaa && length == 16) {
+        boost::asio::ip::address_v6::bytes_type bytes;
+        std::copy(data + offset, data + offset + 16, bytes.begin());
+        response.addresses.emplace_back(boost::asio::ip::address_v6(bytes));
+        response.ttl = std::min(response.ttl, ttl);
+      }
+    }
+
+    offset += length;
+  }
+
+  if (response.addresses.empty()) {
+    response.ttl = 0;
+  }
+
+  return true;
+}
+
+}  // namespace common
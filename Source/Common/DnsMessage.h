@@ -0,0 +1,55 @@
+#ifndef COMMON_DNS_MESSAGE_H_
+#define COMMON_DNS_MESSAGE_H_
+
+#include <boost/asio/ip/address.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace common {
+
+// Record types used by the resolver (RFC 1035, RFC 3596, RFC 6891).
+enum class DnsType : uint16_t {
+  kA = 1,
+  kCname = 5,
+  kAaaa = 28,
+  kOpt = 41,
+};
+
+// Response codes of the header.
+enum class DnsResponseCode : uint8_t {
+  kNoError = 0,
+  kFormatError = 1,
+  kServerFailure = 2,
+  kNameError = 3,
+  kNotImplemented = 4,
+  kRefused = 5,
+};
+
+// The fields of a response the resolver is interested in.
+struct DnsResponse {
+  uint16_t id;
+  bool truncated;
+  DnsResponseCode code;
+  std::string question_name;  // Lowercase, without the trailing dot.
+  DnsType question_type;
+  std::vector<boost::asio::ip::address> addresses;  // Addresses of the question type.
+  uint32_t ttl;                                     // The smallest TTL of the addresses.
+};
+
+// The UDP payload size advertised with EDNS(0), large enough for most answers and small enough
+// to avoid IP fragmentation.
+constexpr uint16_t kDnsUdpPayloadSize = 1232;
+
+// Encodes a recursive query for the name into the packet.
+// Returns false if the name is not a valid domain name.
+bool EncodeDnsQuery(uint16_t id, const std::string& name, DnsType type,
+                    std::vector<uint8_t>& packet);
+
+// Decodes the response. Returns false if the packet is malformed or is not a response.
+bool DecodeDnsResponse(const uint8_t* data, size_t size, DnsResponse& response);
+
+}  // namespace common
+
+#endif  // !COMMON_DNS_MESSAGE_H_
@@ -0,0 +1,63 @@
+#include "HandlerAllocator.h"
+#include <new>
+
+namespace common {
+namespace {
+
+// Blocks are grouped into size classes with a step of 64 bytes, up to 1 KiB.
+constexpr size_t kClassStep = 64;
+constexpr size_t kClassesCount = 16;
+
+// The maximum number of idle blocks kept by a thread in each size class.
+constexpr size_t kMaxCachedBlocks = 1024;
+
+struct FreeBlock {
+  FreeBlock* next;
+};
+
+// The cache is trivially destructible, so blocks released while the thread is exiting
+// are still handled correctly.
+struct ThreadCache {
+  FreeBlock* heads[kClassesCount];
+  size_t counts[kClassesCount];
+};
+
+thread_local ThreadCache cache;
+
+// Returns the index of the size class of the specified size, or kClassesCount if the block
+// is too large to be cached.
+size_t GetSizeClass(size_t size) {
+  return size == 0 ? 0 : (size - 1) / kClassStep;
+}
+
+}  // namespace
+
+void* HandlerMemory::Allocate(size_t size) {
+  const auto index = GetSizeClass(size);
+  if (index >= kClassesCount) {
+    return ::operator new(size);
+  }
+
+  if (auto block = cache.heads[index]) {
+    cache.heads[index] = block->next;
+    --cache.counts[index];
+    return block;
+  }
+
+  return ::operator new((index + 1) * kClassStep);
+}
+
+void HandlerMemory::Deallocate(void* pointer, size_t size) noexcept {
+  const auto index = GetSizeClass(size);
+  if (index >= kClassesCount || cache.counts[index] >= kMaxCachedBlocks) {
+    ::operator delete(pointer);
+    return;
+  }
+
+  auto block = static_cast<FreeBlock*>(pointer);
+  block->next = cache.heads[index];
+  cache.heads[index] = block;
+  ++cache.counts[index];
+}
+
+}  // namespace common
@@ -0,0 +1,77 @@
+#ifndef COMMON_HANDLER_ALLOCATOR_H_
+#define COMMON_HANDLER_ALLOCATOR_H_
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace common {
+
+// Per-thread cache of memory blocks for asynchronous operations and their completion handlers.
+// Blocks are grouped into size classes and reused by the next operation of a similar size,
+// so a steady stream of operations does not touch the heap.
+class HandlerMemory {
+ public:
+  // Returns a block of at least the specified size.
+  static void* Allocate(size_t size);
+
+  // Returns the block to the cache of the current thread.
+  static void Deallocate(void* pointer, size_t size) noexcept;
+};
+
+// Allocator over HandlerMemory, associated with completion handlers by BindHandlerAllocator.
+template <typename T>
+class HandlerAllocator {
+ public:
+  using value_type = T;
+
+  HandlerAllocator() noexcept = default;
+
+  template <typename U>
+  HandlerAllocator(const HandlerAllocator<U>&) noexcept {}
+
+  T* allocate(size_t count) { return static_cast<T*>(HandlerMemory::Allocate(sizeof(T) * count)); }
+
+  void deallocate(T* pointer, size_t count) noexcept {
+    HandlerMemory::Deallocate(pointer, sizeof(T) * count);
+  }
+
+  template <typename U>
+  bool operator==(const HandlerAllocator<U>&) const noexcept {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!=(const HandlerAllocator<U>&) const noexcept {
+    return false;
+  }
+};
+
+// Completion handler wrapper which makes asio allocate the operation with HandlerAllocator.
+template <typename THandler>
+class AllocatedHandler {
+ public:
+  using allocator_type = HandlerAllocator<void>;
+
+  explicit AllocatedHandler(THandler handler) : handler_{std::move(handler)} {}
+
+  allocator_type get_allocator() const noexcept { return {}; }
+
+  template <typename... TArgs>
+  void operator()(TArgs&&... args) {
+    handler_(std::forward<TArgs>(args)...);
+  }
+
+ private:
+  THandler handler_;
+};
+
+// Associates the recycling HandlerAllocator with the completion handler.
+template <typename THandler>
+AllocatedHandler<std::decay_t<THandler>> BindHandlerAllocator(THandler&& handler) {
+  return AllocatedHandler<std::decay_t<THandler>>(std::forward<THandler>(handler));
+}
+
+}  // namespace common
+
+#endif  // !COMMON_HANDLER_ALLOCATOR_H_
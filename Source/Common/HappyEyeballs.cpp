@@ -0,0 +1,122 @@
+#include "HappyEyeballs.h"
+#include <boost/asio/error.hpp>
+#include <utility>
+#include "DnsCache.h"
+#include "HandlerAllocator.h"
+
+namespace common {
+
+HappyEyeballs::HappyEyeballs(const boost::asio::any_io_executor& executor)
+    : executor_{executor},
+      timer_{executor},
+      host_{},
+      endpoints_{},
+      attempts_{},
+      callback_{},
+      last_error_{},
+      next_attempt_{0},
+      pending_attempts_{0} {}
+
+std::shared_ptr<HappyEyeballs> HappyEyeballs::Create(
+    const boost::asio::any_io_executor& executor) {
+  return std::shared_ptr<HappyEyeballs>(new HappyEyeballs(executor));
+}
+
+void HappyEyeballs::Connect(const std::string& host, std::vector<net_tcp::endpoint> endpoints,
+                            Callback callback) {
+  host_ = host;
+  endpoints_ = std::move(endpoints);
+  attempts_.clear();
+  attempts_.resize(endpoints_.size());
+  callback_ = std::move(callback);
+  last_error_ = boost::asio::error::host_not_found;
+  next_attempt_ = 0;
+  pending_attempts_ = 0;
+
+  if (endpoints_.empty()) {
+    auto callback_copy = std::move(callback_);
+    callback_copy(last_error_, net_tcp::socket(executor_), {});
+  } else {
+    StartAttempt();
+  }
+}
+
+void HappyEyeballs::Cancel() {
+  callback_ = nullptr;
+  timer_.cancel();
+  CloseAttempts();
+}
+
+void HappyEyeballs::StartAttempt() {
+  const auto index = next_attempt_++;
+  auto& socket = attempts_[index];
+
+  socket = std::make_unique<net_tcp::socket>(executor_);
+  ++pending_attempts_;
+
+  socket->async_connect(
+      endpoints_[index],
+      BindHandlerAllocator([self = shared_from_this(), index](const error_code& ecode)
+                           { self->OnAttemptFinished(index, ecode); }));
+
+  if (next_attempt_ < endpoints_.size()) {
+    timer_.expires_after(kConnectionAttemptDelay);
+    timer_.async_wait(BindHandlerAllocator(
+        [self = shared_from_this()](const error_code& ecode)
+        {
+          if (!ecode && self->callback_ && self->next_attempt_ < self->endpoints_.size()) {
+            self->StartAttempt();
+          }
+        }));
+  }
+}
+
+void HappyEyeballs::OnAttemptFinished(size_t index, const error_code& ecode) {
+  --pending_attempts_;
+
+  if (!callback_) {
+    return;  // Cancelled, or another attempt has already won.
+  }
+
+  if (!ecode) {
+    auto callback = std::move(callback_);
+    auto socket = std::move(*attempts_[index]);
+    const auto& endpoint = endpoints_[index];
+
+    callback_ = nullptr;
+    timer_.cancel();
+    CloseAttempts();
+
+    if (!host_.empty()) {
+      DnsCache::GetInstance()->RememberFamily(host_, endpoint.address().is_v6());
+    }
+
+    callback(ecode, std::move(socket), endpoint);
+    return;
+  }
+
+  last_error_ = ecode;
+  attempts_[index].reset();
+
+  if (next_attempt_ < endpoints_.size()) {
+    // Do not wait for the timer when the attempt has already failed.
+    timer_.cancel();
+    StartAttempt();
+  } else if (pending_attempts_ == 0) {
+    auto callback = std::move(callback_);
+
+    callback_ = nullptr;
+    callback(last_error_, net_tcp::socket(executor_), endpoints_[index]);
+  }
+}
+
+void HappyEyeballs::CloseAttempts() {
+  for (auto& socket : attempts_) {
+    if (socket) {
+      error_code ecode;
+      socket->close(ecode);
+    }
+  }
+}
+
+}  // namespace common
@@ -0,0 +1,72 @@
+#ifndef COMMON_HAPPY_EYEBALLS_H_
+#define COMMON_HAPPY_EYEBALLS_H_
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Types.h"
+
+namespace common {
+
+// Establishes a TCP connection to the first endpoint of the list that answers (RFC 8305).
+// The attempts are started one after another with a short delay, or immediately after the
+// previous attempt fails, and run concurrently; the first established connection wins and the
+// other attempts are cancelled. The address family of the winner is remembered by the DnsCache,
+// so the next connection to the same host starts with it.
+class HappyEyeballs final : public std::enable_shared_from_this<HappyEyeballs> {
+  explicit HappyEyeballs(const boost::asio::any_io_executor& executor);
+
+ public:
+  using Callback =
+      std::function<void(const error_code&, net_tcp::socket&&, const net_tcp::endpoint&)>;
+
+  // The delay before the next attempt is started while the previous ones are in progress.
+  static constexpr std::chrono::milliseconds kConnectionAttemptDelay{250};
+
+  ~HappyEyeballs() = default;
+
+  HappyEyeballs(const HappyEyeballs&) = delete;
+  HappyEyeballs(HappyEyeballs&&) = delete;
+  HappyEyeballs& operator=(const HappyEyeballs&) = delete;
+  HappyEyeballs& operator=(HappyEyeballs&&) = delete;
+
+  // Creates an instance of the connector.
+  static std::shared_ptr<HappyEyeballs> Create(const boost::asio::any_io_executor& executor);
+
+  // Connects to one of the endpoints, which are tried in the specified order.
+  // 'host' is the domain name the endpoints were resolved from, empty for a literal address.
+  // The callback receives the connected socket and its endpoint, or the error of the last attempt.
+  void Connect(const std::string& host, std::vector<net_tcp::endpoint> endpoints,
+               Callback callback);
+
+  // Cancels all attempts. The callback is not invoked after that.
+  void Cancel();
+
+ private:
+  // Starts the attempt for the next endpoint, and arms the timer for the one after it.
+  void StartAttempt();
+
+  // Processes the result of the attempt with the specified index.
+  void OnAttemptFinished(size_t index, const error_code& ecode);
+
+  // Closes all attempts in progress.
+  void CloseAttempts();
+
+  boost::asio::any_io_executor executor_;
+  boost::asio::steady_timer timer_;
+  std::string host_;
+  std::vector<net_tcp::endpoint> endpoints_;
+  std::vector<std::unique_ptr<net_tcp::socket>> attempts_;
+  Callback callback_;
+  error_code last_error_;
+  size_t next_attempt_;
+  size_t pending_attempts_;
+};
+
+}  // namespace common
+
+#endif  // !COMMON_HAPPY_EYEBALLS_H_
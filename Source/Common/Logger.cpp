@@ -0,0 +1,295 @@
+#include "Logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+#include "RingWriter.h"
+
+namespace common {
+namespace {
+
+// The header of a record in a ring buffer, followed by the message.
+struct RecordHeader {
+  int64_t time;  // Microseconds since the epoch.
+  uint32_t size;
+  LogLevel level;
+};
+
+// The size of a header which tells the writer to continue at the start of the buffer.
+constexpr uint32_t kWrapSize = UINT32_MAX;
+
+static_assert(Logger::kBufferSize % alignof(RecordHeader) == 0);
+
+// Returns the size of the record of a message, the records are aligned.
+constexpr size_t GetRecordSize(size_t message_size) {
+  return (sizeof(RecordHeader) + message_size + alignof(RecordHeader) - 1) &
+         ~(alignof(RecordHeader) - 1);
+}
+
+// A message read by the writer.
+struct Entry {
+  int64_t time;
+  uint64_t thread_id;
+  LogLevel level;
+  std::string message;
+};
+
+// A stream buffer over a fixed array, the characters beyond its end are discarded.
+class MessageBuffer final : public std::streambuf {
+ public:
+  MessageBuffer() { Reset(); }
+
+  void Reset() noexcept { setp(data_, data_ + sizeof(data_)); }
+
+  std::string_view GetMessage() const noexcept {
+    return {pbase(), static_cast<size_t>(pptr() - pbase())};
+  }
+
+ protected:
+  int_type overflow(int_type) override { return traits_type::eof(); }
+
+ private:
+  char data_[Logger::kMaxMessageSize];
+};
+
+// The logging state of a thread.
+struct ThreadState {
+  ThreadState() : buffer{}, stream{&buffer}, ring{} {}
+
+  MessageBuffer buffer;
+  std::ostream stream;
+  ThreadRingHandle ring;  // Created by the first record while the writer is running.
+};
+
+// How long the writer sleeps unless a ring is filled past half.
+constexpr std::chrono::milliseconds kWriterInterval{10};
+
+constexpr const char* kLevelNames[] = {"trace", "debug", "info", "warning", "error", "fatal"};
+
+RingWriter& GetWriter() {
+  static RingWriter writer{Logger::kBufferSize, kWriterInterval};
+  return writer;
+}
+
+// Serializes the synchronous writes.
+std::mutex& GetOutputMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+ThreadState& GetThreadState() {
+  static thread_local ThreadState state;
+  return state;
+}
+
+uint64_t GetThreadId() noexcept {
+#if defined(_WIN32)
+  return std::hash<std::thread::id>{}(std::this_thread::get_id());
+#else
+  return (uint64_t)(uintptr_t)pthread_self();
+#endif
+}
+
+int64_t GetTime() noexcept {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// Appends the line of the record in the format of the previous Boost.Log output:
+// [2024-01-01 12:00:00.000000] [0x00007f0000000000] [info]    message
+void AppendLine(std::string& output, int64_t time, uint64_t thread_id, LogLevel level,
+                std::string_view message) {
+  // The local time of the last second is kept, the records come in bursts.
+  static thread_local std::time_t cached_seconds = -1;
+  static thread_local std::tm local{};
+
+  const std::time_t seconds = time / 1000000;
+  if (seconds != cached_seconds) {
+    cached_seconds = seconds;
+#if defined(_WIN32)
+    localtime_s(&local, &seconds);
+#else
+    localtime_r(&seconds, &local);
+#endif
+  }
+
+  char prefix[96];
+  const auto name = kLevelNames[static_cast<size_t>(level)];
+  const int size = std::snprintf(
+      prefix, sizeof(prefix), "[%04d-%02d-%02d %02d:%02d:%02d.%06lld] [0x%016llx] [%s]%*s",
+      local.tm_year + 1900, local.tm_mon + 1, local.tm_mday, local.tm_hour, local.tm_min,
+      local.tm_sec, static_cast<long long>(time % 1000000),
+      static_cast<unsigned long long>(thread_id), name,
+      static_cast<int>(sizeof("warning") - std::char_traits<char>::length(name)), "");
+
+  output.append(prefix, std::max(size, 0));
+  output.append(message);
+  output.push_back('\n');
+}
+
+// Moves the records of the ring to the entries.
+void ReadRing(ThreadRing& ring, std::vector<Entry>& entries) {
+  auto head = ring.head.load(std::memory_order_relaxed);
+  const auto tail = ring.tail.load(std::memory_order_acquire);
+
+  while (head != tail) {
+    const auto offset = head % Logger::kBufferSize;
+    const auto to_end = Logger::kBufferSize - offset;
+    if (to_end < sizeof(RecordHeader)) {
+      head += to_end;
+      continue;
+    }
+
+    RecordHeader header;
+    std::memcpy(&header, ring.data.get() + offset, sizeof(header));
+    if (header.size == kWrapSize) {
+      head += to_end;
+      continue;
+    }
+
+    entries.push_back({header.time, ring.thread_id, header.level,
+                       std::string(ring.data.get() + offset + sizeof(header), header.size)});
+    head += GetRecordSize(header.size);
+  }
+
+  ring.head.store(head, std::memory_order_release);
+
+  if (const auto dropped = ring.dropped.exchange(0, std::memory_order_relaxed)) {
+    entries.push_back({GetTime(), ring.thread_id, LogLevel::warning,
+                       std::to_string(dropped) + " log messages were dropped, the buffer of the "
+                                                 "thread was full."});
+  }
+}
+
+// Writes the records of all rings in the order of their time. Returns the number of records.
+size_t WriteRings(const std::vector<std::shared_ptr<ThreadRing>>& rings,
+                std::vector<Entry>& entries, std::string& output) {
+  entries.clear();
+  for (const auto& ring : rings) {
+    ReadRing(*ring, entries);
+  }
+
+  if (entries.empty()) {
+    return 0;
+  }
+
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const Entry& left, const Entry& right) { return left.time < right.time; });
+
+  output.clear();
+  for (const auto& entry : entries) {
+    AppendLine(output, entry.time, entry.thread_id, entry.level, entry.message);
+  }
+
+  std::fwrite(output.data(), 1, output.size(), stderr);
+  std::fflush(stderr);
+  return entries.size();
+}
+
+// Copies the record to the ring, or counts it as dropped if the ring is full.
+// Returns true if the record filled the ring past half, the writer should not wait any longer.
+bool PushRecord(ThreadRing& ring, LogLevel level, std::string_view message) noexcept {
+  const auto size = static_cast<uint32_t>(message.size());
+  const auto record_size = GetRecordSize(size);
+  auto tail = ring.tail.load(std::memory_order_relaxed);
+  const auto head = ring.head.load(std::memory_order_acquire);
+
+  // A record is never split, it starts over at the beginning of the buffer if it does not fit
+  // before the end.
+  const auto to_end = Logger::kBufferSize - tail % Logger::kBufferSize;
+  const auto skip = to_end < record_size ? to_end : 0;
+  if (Logger::kBufferSize - (tail - head) < skip + record_size) {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  if (skip >= sizeof(RecordHeader)) {
+    const RecordHeader wrap{0, kWrapSize, level};
+    std::memcpy(ring.data.get() + tail % Logger::kBufferSize, &wrap, sizeof(wrap));
+  }
+
+  tail += skip;
+  const RecordHeader header{GetTime(), size, level};
+  auto data = ring.data.get() + tail % Logger::kBufferSize;
+  std::memcpy(data, &header, sizeof(header));
+  std::memcpy(data + sizeof(header), message.data(), message.size());
+
+  ring.tail.store(tail + record_size, std::memory_order_release);
+
+  const auto used = tail + record_size - head;
+  return used >= Logger::kBufferSize / 2 && used - skip - record_size < Logger::kBufferSize / 2;
+}
+
+}  // namespace
+
+bool Logger::ParseLevel(std::string_view name, LogLevel& level) noexcept {
+  for (size_t index = 0; index < std::size(kLevelNames); ++index) {
+    if (name == kLevelNames[index]) {
+      level = static_cast<LogLevel>(index);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void Logger::Start() {
+  GetWriter().Start([entries = std::vector<Entry>{}, output = std::string{}](
+                        const std::vector<std::shared_ptr<ThreadRing>>& rings) mutable {
+    return WriteRings(rings, entries, output);
+  });
+}
+
+void Logger::Stop() {
+  // The new messages are written synchronously, the writer writes the recorded ones and exits.
+  GetWriter().Stop();
+}
+
+void Logger::Write(LogLevel level, std::string_view message) {
+  message = message.substr(0, kMaxMessageSize);
+
+  auto& writer = GetWriter();
+  if (writer.IsRunning()) {
+    if (PushRecord(GetThreadState().ring.Get(writer, GetThreadId()), level, message)) {
+      writer.Wake();
+    }
+    return;
+  }
+
+  std::string output;
+  AppendLine(output, GetTime(), GetThreadId(), level, message);
+
+  std::lock_guard<std::mutex> lock{GetOutputMutex()};
+  std::fwrite(output.data(), 1, output.size(), stderr);
+  std::fflush(stderr);
+}
+
+LogRecord::LogRecord(LogLevel level) noexcept
+    : level_{level}, stream_{GetThreadState().stream} {
+  auto& state = GetThreadState();
+  state.buffer.Reset();
+  stream_.clear();
+  stream_.flags(std::ios_base::dec | std::ios_base::skipws);
+  stream_.width(0);
+  stream_.precision(6);
+  stream_.fill(' ');
+}
+
+LogRecord::~LogRecord() {
+  Logger::Write(level_, GetThreadState().buffer.GetMessage());
+}
+
+}  // namespace common
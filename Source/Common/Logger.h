@@ -1,8 +1,100 @@
 #ifndef COMMON_LOGGER_H_
 #define COMMON_LOGGER_H_
 
-#include <boost/log/trivial.hpp>
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <string_view>
 
-#define WLOGGER(level) BOOST_LOG_TRIVIAL(level) << "[" << __FUNCTION__ << ":" << __LINE__ << "]: "
+// The lowest level compiled in (0 - trace ... 5 - fatal), the log statements below it are
+// removed by the compiler.
+#if !defined(REDPROXY_LOG_LEVEL)
+#define REDPROXY_LOG_LEVEL 0
+#endif
+
+namespace common {
+
+enum class LogLevel {
+  trace,
+  debug,
+  info,
+  warning,
+  error,
+  fatal,
+};
+
+// The log of the process. A thread records its messages into a lock-free ring buffer of its own,
+// a background thread formats the records (time, thread, level) and writes them to stderr in the
+// order of their time. A thread never waits for the writer: when its buffer is full, the message
+// is dropped and the writer reports the number of dropped messages.
+// While the writer is not running (before Start and after Stop), the messages are written
+// synchronously.
+class Logger {
+ public:
+  // The size of the ring buffer of a thread.
+  static constexpr size_t kBufferSize = 64 * 1024;
+  // The maximum size of a message, a longer one is truncated.
+  static constexpr size_t kMaxMessageSize = 1024;
+
+  // Returns true if the messages of the level are written.
+  static bool IsEnabled(LogLevel level) noexcept {
+    return static_cast<int>(level) >= REDPROXY_LOG_LEVEL &&
+           level >= level_.load(std::memory_order_relaxed);
+  }
+
+  // Sets the lowest level of the written messages.
+  static void SetLevel(LogLevel level) noexcept { level_.store(level, std::memory_order_relaxed); }
+
+  // Parses the level name (trace, debug, info, warning, error, fatal). Returns false if the name
+  // is unknown.
+  static bool ParseLevel(std::string_view name, LogLevel& level) noexcept;
+
+  // Starts the background writer.
+  static void Start();
+
+  // Writes the remaining records and stops the background writer. The other threads are expected
+  // to have stopped logging.
+  static void Stop();
+
+  // Records the message of the level, which is expected to be enabled.
+  static void Write(LogLevel level, std::string_view message);
+
+ private:
+  static inline std::atomic<LogLevel> level_{LogLevel::info};
+};
+
+// A message being streamed, recorded when the object is destroyed. The message is built in a
+// buffer of the thread, so streaming does not allocate. Only one record of a thread can be
+// alive at a time.
+class LogRecord {
+ public:
+  explicit LogRecord(LogLevel level) noexcept;
+  ~LogRecord();
+
+  LogRecord(const LogRecord&) = delete;
+  LogRecord(LogRecord&&) = delete;
+  LogRecord& operator=(const LogRecord&) = delete;
+  LogRecord& operator=(LogRecord&&) = delete;
+
+  // Returns the stream of the message.
+  std::ostream& GetStream() noexcept { return stream_; }
+
+ private:
+  LogLevel level_;
+  std::ostream& stream_;
+};
+
+}  // namespace common
+
+// Streams a message of the level (a common::LogLevel value). The operands are only evaluated if
+// the level is enabled.
+#define COMMON_LOG(severity)                     \
+  if (!::common::Logger::IsEnabled(severity)) { \
+  } else                                         \
+    ::common::LogRecord(severity).GetStream()
+
+#define LOGGER(level) COMMON_LOG(::common::LogLevel::level)
+
+#define WLOGGER(level) LOGGER(level) << "[" << __FUNCTION__ << ":" << __LINE__ << "]: "
 
 #endif  // !COMMON_LOGGER_H_
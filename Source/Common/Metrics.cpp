@@ -0,0 +1,331 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <mutex>
+#include <vector>
+#include "Common/DnsCache.h"
+
+namespace common {
+namespace {
+
+constexpr size_t kCounterCount = static_cast<size_t>(Metrics::Counter::kCount);
+constexpr size_t kLatencyCount = static_cast<size_t>(Metrics::Latency::kCount);
+constexpr size_t kHistogramsSize = kLatencyCount * Metrics::kHistogramSize;
+
+// The counters and histograms of a thread, on cache lines of their own.
+struct alignas(64) Block {
+  std::array<std::atomic<uint64_t>, kCounterCount> values{};
+  std::array<std::atomic<uint64_t>, kHistogramsSize> histograms{};
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<Block*> blocks;
+  // The counts of the exited threads.
+  std::array<uint64_t, kCounterCount> retired{};
+  std::array<uint64_t, kHistogramsSize> retired_histograms{};
+};
+
+Registry& GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+// Owns the block of a thread, its counts are kept when the thread exits.
+struct BlockOwner {
+  ~BlockOwner() {
+    if (!block) {
+      return;
+    }
+
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    for (size_t index = 0; index < kCounterCount; ++index) {
+      registry.retired[index] += block->values[index].load(std::memory_order_relaxed);
+    }
+    for (size_t index = 0; index < kHistogramsSize; ++index) {
+      registry.retired_histograms[index] +=
+          block->histograms[index].load(std::memory_order_relaxed);
+    }
+
+    registry.blocks.erase(std::find(registry.blocks.begin(), registry.blocks.end(), block));
+    delete block;
+  }
+
+  Block* block = nullptr;
+};
+
+struct Family {
+  const char* name;
+  const char* type;
+  const char* help;
+};
+
+// A counter in the export, the families are written in the order of their first counter.
+struct Series {
+  size_t family;
+  const char* labels;
+};
+
+constexpr Family kFamilies[] = {
+    {"redproxy_accepted_connections_total", "counter",
+     "Connections accepted by the SOCKS servers."},
+    {"redproxy_sessions", "gauge",
+     "Active sessions by protocol and command, 'handshake' until the request is read."},
+    {"redproxy_handshake_failures_total", "counter",
+     "Requests answered with a failure reply, by reply code."},
+    {"redproxy_relayed_bytes_total", "counter",
+     "Bytes relayed by the TCP tunnels, upload is client to application."},
+    {"redproxy_udp_datagrams_total", "counter",
+     "UDP datagrams received to be relayed, upload is client to application."},
+    {"redproxy_udp_queued_datagrams_total", "counter",
+     "UDP datagrams which had to wait in a send queue."},
+    {"redproxy_udp_dropped_datagrams_total", "counter", "UDP datagrams dropped, by reason."},
+    {"redproxy_timeouts_total", "counter", "Sessions closed by a timeout, by timeout."},
+};
+
+// In the order of Metrics::Counter.
+constexpr Series kSeries[] = {
+    {0, R"(protocol="socks4")"},
+    {0, R"(protocol="socks5")"},
+    {1, R"(protocol="socks4",command="handshake")"},
+    {1, R"(protocol="socks4",command="connect")"},
+    {1, R"(protocol="socks4",command="bind")"},
+    {1, R"(protocol="socks5",command="handshake")"},
+    {1, R"(protocol="socks5",command="connect")"},
+    {1, R"(protocol="socks5",command="bind")"},
+    {1, R"(protocol="socks5",command="udp_associate")"},
+    {2, R"(protocol="socks4",reply="rejected")"},
+    {2, R"(protocol="socks4",reply="connection_failed")"},
+    {2, R"(protocol="socks4",reply="client_conflict")"},
+    {2, R"(protocol="socks5",reply="general_failure")"},
+    {2, R"(protocol="socks5",reply="not_allowed")"},
+    {2, R"(protocol="socks5",reply="network_unreachable")"},
+    {2, R"(protocol="socks5",reply="host_unreachable")"},
+    {2, R"(protocol="socks5",reply="connection_refused")"},
+    {2, R"(protocol="socks5",reply="ttl_expired")"},
+    {2, R"(protocol="socks5",reply="command_not_supported")"},
+    {2, R"(protocol="socks5",reply="address_type_not_supported")"},
+    {2, R"(protocol="socks5",reply="unassigned")"},
+    {3, R"(direction="upload")"},
+    {3, R"(direction="download")"},
+    {4, R"(direction="upload")"},
+    {4, R"(direction="download")"},
+    {5, ""},
+    {6, R"(reason="queue_full")"},
+    {6, R"(reason="send_error")"},
+    {6, R"(reason="rejected")"},
+    {6, R"(reason="relay_busy")"},
+    {6, R"(reason="unresolved")"},
+    {7, R"(timeout="handshake")"},
+    {7, R"(timeout="connect")"},
+    {7, R"(timeout="idle")"},
+    {7, R"(timeout="write_stall")"},
+};
+
+static_assert(std::size(kSeries) == kCounterCount, "Every counter needs a series.");
+
+constexpr Family kLatencyFamilies[] = {
+    {"redproxy_handshake_phase_seconds", "summary",
+     "Duration of the handshake phases by protocol and phase, resolve to reply only of CONNECT."},
+    {"redproxy_tunnel_first_byte_seconds", "summary",
+     "Time from the CONNECT reply until the first byte of the application is relayed."},
+};
+
+// In the order of Metrics::Latency.
+constexpr Series kLatencySeries[] = {
+    {0, R"(protocol="socks4",phase="request")"},
+    {0, R"(protocol="socks4",phase="resolve")"},
+    {0, R"(protocol="socks4",phase="connect")"},
+    {0, R"(protocol="socks4",phase="reply")"},
+    {1, R"(protocol="socks4")"},
+    {0, R"(protocol="socks5",phase="greeting")"},
+    {0, R"(protocol="socks5",phase="authentication")"},
+    {0, R"(protocol="socks5",phase="request")"},
+    {0, R"(protocol="socks5",phase="resolve")"},
+    {0, R"(protocol="socks5",phase="connect")"},
+    {0, R"(protocol="socks5",phase="reply")"},
+    {1, R"(protocol="socks5")"},
+};
+
+static_assert(std::size(kLatencySeries) == kLatencyCount, "Every histogram needs a series.");
+
+struct Quantile {
+  const char* label;
+  double value;
+};
+
+constexpr Quantile kQuantiles[] = {{"0.5", 0.5}, {"0.9", 0.9}, {"0.99", 0.99}, {"0.999", 0.999}};
+
+void AppendFamily(std::string& output, const Family& family) {
+  output.append("# HELP ").append(family.name).append(" ").append(family.help).append("\n");
+  output.append("# TYPE ").append(family.name).append(" ").append(family.type).append("\n");
+}
+
+void AppendSample(std::string& output, std::string_view name, std::string_view labels,
+                  std::string_view value) {
+  output.append(name);
+  if (!labels.empty()) {
+    output.append("{").append(labels).append("}");
+  }
+  output.append(" ").append(value).append("\n");
+}
+
+void AppendSample(std::string& output, std::string_view name, std::string_view labels,
+                  uint64_t value) {
+  AppendSample(output, name, labels, std::to_string(value));
+}
+
+// Returns the nanoseconds in seconds.
+std::string FormatSeconds(uint64_t nanoseconds) {
+  char value[32];
+  const int size = std::snprintf(value, sizeof(value), "%.9g", nanoseconds / 1e9);
+  return std::string(value, std::max(size, 0));
+}
+
+// Appends the quantiles, the sum and the count of the histogram as a summary. The quantiles are
+// the largest values of their buckets.
+void AppendSummary(std::string& output, const char* name, const char* labels,
+                   const uint64_t* histogram) {
+  uint64_t count = 0;
+  for (size_t bucket = 0; bucket < Metrics::kBucketCount; ++bucket) {
+    count += histogram[bucket];
+  }
+
+  for (const auto& quantile : kQuantiles) {
+    const std::string quantile_labels =
+        std::string(labels).append(R"(,quantile=")").append(quantile.label).append("\"");
+    if (count == 0) {
+      AppendSample(output, name, quantile_labels, "NaN");
+      continue;
+    }
+
+    // The rank of the quantile, at least the first value.
+    const auto rank =
+        std::max<uint64_t>(static_cast<uint64_t>(std::ceil(quantile.value * count)), 1);
+    size_t bucket = 0;
+    uint64_t seen = histogram[0];
+    while (seen < rank) {
+      seen += histogram[++bucket];
+    }
+
+    AppendSample(output, name, quantile_labels, FormatSeconds(Metrics::GetBucketLimit(bucket)));
+  }
+
+  AppendSample(output, std::string(name).append("_sum"), labels,
+               FormatSeconds(histogram[Metrics::kBucketCount]));
+  AppendSample(output, std::string(name).append("_count"), labels, count);
+}
+
+}  // namespace
+
+void Metrics::CountSocks4Reply(uint8_t code) noexcept {
+  // 90 - granted, 91..93 - the failures.
+  if (code >= 91 && code <= 93) {
+    Add(static_cast<Counter>(static_cast<size_t>(Counter::kSocks4Rejected) + code - 91));
+  }
+}
+
+void Metrics::CountSocks5Reply(uint8_t code) noexcept {
+  // 0 - succeeded, 1..8 - the failures, the rest is unassigned.
+  if (code != 0) {
+    Add(static_cast<Counter>(static_cast<size_t>(Counter::kSocks5Error) +
+                             std::min<size_t>(code, 9) - 1));
+  }
+}
+
+uint64_t Metrics::Get(Counter counter) {
+  const auto index = static_cast<size_t>(counter);
+  auto& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock{registry.mutex};
+  uint64_t value = registry.retired[index];
+
+  for (auto block : registry.blocks) {
+    value += block->values[index].load(std::memory_order_relaxed);
+  }
+
+  return value;
+}
+
+std::string Metrics::Export() {
+  std::array<uint64_t, kCounterCount> values;
+  std::vector<uint64_t> histograms;
+  {
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    values = registry.retired;
+    histograms.assign(registry.retired_histograms.begin(), registry.retired_histograms.end());
+
+    for (auto block : registry.blocks) {
+      for (size_t index = 0; index < kCounterCount; ++index) {
+        values[index] += block->values[index].load(std::memory_order_relaxed);
+      }
+      for (size_t index = 0; index < kHistogramsSize; ++index) {
+        histograms[index] += block->histograms[index].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::string output;
+  size_t family = std::size(kFamilies);
+
+  for (size_t index = 0; index < kCounterCount; ++index) {
+    if (kSeries[index].family != family) {
+      family = kSeries[index].family;
+      AppendFamily(output, kFamilies[family]);
+    }
+
+    AppendSample(output, kFamilies[family].name, kSeries[index].labels, values[index]);
+  }
+
+  // The series of a family have to be adjacent.
+  for (size_t family = 0; family < std::size(kLatencyFamilies); ++family) {
+    AppendFamily(output, kLatencyFamilies[family]);
+    for (size_t index = 0; index < kLatencyCount; ++index) {
+      if (kLatencySeries[index].family == family) {
+        AppendSummary(output, kLatencyFamilies[family].name, kLatencySeries[index].labels,
+                      histograms.data() + index * kHistogramSize);
+      }
+    }
+  }
+
+  const auto dns = DnsCache::GetInstance()->GetStatistics();
+  const Family lookups{"redproxy_dns_lookups_total", "counter",
+                       "Lookups of the DNS cache, by result."};
+  const Family refreshes{"redproxy_dns_refreshes_total", "counter",
+                         "Background queries for names that are about to expire."};
+  const Family evictions{"redproxy_dns_evictions_total", "counter",
+                         "Names removed from the full DNS cache before they expired."};
+
+  AppendFamily(output, lookups);
+  AppendSample(output, lookups.name, R"(result="hit")", dns.hits);
+  AppendSample(output, lookups.name, R"(result="negative_hit")", dns.negative_hits);
+  AppendSample(output, lookups.name, R"(result="miss")", dns.misses);
+  AppendSample(output, lookups.name, R"(result="coalesced")", dns.coalesced);
+  AppendFamily(output, refreshes);
+  AppendSample(output, refreshes.name, "", dns.refreshes);
+  AppendFamily(output, evictions);
+  AppendSample(output, evictions.name, "", dns.evictions);
+
+  return output;
+}
+
+std::atomic<uint64_t>* Metrics::CreateThreadBlock() noexcept {
+  static thread_local BlockOwner owner;
+
+  owner.block = new Block;
+  {
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    registry.blocks.push_back(owner.block);
+  }
+
+  thread_block_ = owner.block->values.data();
+  thread_histograms_ = owner.block->histograms.data();
+  return thread_block_;
+}
+
+}  // namespace common
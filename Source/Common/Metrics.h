@@ -0,0 +1,189 @@
+#ifndef COMMON_METRICS_H_
+#define COMMON_METRICS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace common {
+
+// The counters of the process, exported in the Prometheus text format.
+// Each thread counts into a block of its own, so counting never writes to a cache line shared
+// with another thread; the blocks are only summed when the counters are read. The gauges are
+// counters which are also decremented.
+// The latencies are recorded into log-linear histograms in the manner of HdrHistogram: every
+// power of two is split into 16 buckets, so a value is known to within 1/16 of itself. Recording
+// is a couple of relaxed stores into the block of the thread.
+class Metrics {
+ public:
+  enum class Counter : size_t {
+    // Accepted connections.
+    kSocks4Accepted,
+    kSocks5Accepted,
+    // Active sessions (gauges), by protocol and command.
+    kSocks4Handshake,
+    kSocks4Connect,
+    kSocks4Bind,
+    kSocks5Handshake,
+    kSocks5Connect,
+    kSocks5Bind,
+    kSocks5UdpAssociate,
+    // Requests answered with a failure reply, by reply code.
+    kSocks4Rejected,
+    kSocks4ConnectionFailed,
+    kSocks4ClientConflict,
+    kSocks5Error,
+    kSocks5NotAllowed,
+    kSocks5ErrorNet,
+    kSocks5ErrorHost,
+    kSocks5Refused,
+    kSocks5TTL,
+    kSocks5UnknownCommand,
+    kSocks5UnknownAddress,
+    kSocks5Unknown,
+    // Bytes relayed by the TCP tunnels.
+    kUploadBytes,    // client -> application
+    kDownloadBytes,  // application -> client
+    // UDP datagrams.
+    kUdpUploadDatagrams,    // Received from the clients to be relayed.
+    kUdpDownloadDatagrams,  // Received from the applications to be relayed.
+    kUdpQueuedDatagrams,    // Had to wait in a send queue.
+    kUdpDroppedFull,        // Dropped because a send queue was full.
+    kUdpDroppedError,       // Dropped because of a send error.
+    kUdpDroppedRejected,    // Invalid header or unknown sender.
+    kUdpDroppedBusy,        // Every relay socket carries the application for another association.
+    kUdpDroppedUnresolved,  // The destination name failed to resolve or could not wait for it.
+    // Sessions closed by a timeout.
+    kTimeoutHandshake,   // The request was not read in time.
+    kTimeoutConnect,     // The command did not connect the application in time.
+    kTimeoutIdle,        // No data moved through the tunnel or the association.
+    kTimeoutWriteStall,  // A socket of the tunnel did not accept data.
+
+    kCount
+  };
+
+  enum class Latency : size_t {
+    // The phases of a SOCKS4 CONNECT, each from the end of the previous one.
+    kSocks4Request,    // From the accept until the request is read.
+    kSocks4Resolve,    // Resolving the destination.
+    kSocks4Connect,    // Connecting to the application.
+    kSocks4Reply,      // Sending the reply.
+    kSocks4FirstByte,  // From the reply until the first byte of the application is relayed.
+    // The phases of a SOCKS5 CONNECT, each from the end of the previous one.
+    kSocks5Greeting,        // From the accept until the method selection is read.
+    kSocks5Authentication,  // Selecting the method and authenticating the client.
+    kSocks5Request,         // Reading the request.
+    kSocks5Resolve,         // Resolving the destination.
+    kSocks5Connect,         // Connecting to the application.
+    kSocks5Reply,           // Sending the reply.
+    kSocks5FirstByte,       // From the reply until the first byte of the application is relayed.
+
+    kCount
+  };
+
+  // Number of buckets of a power of two.
+  static constexpr size_t kSubBucketCount = 16;
+  // Larger values (about 18 minutes in nanoseconds) are counted in the last bucket.
+  static constexpr uint64_t kMaxLatency = (uint64_t{1} << 40) - 1;
+  // Number of buckets of a histogram.
+  static constexpr size_t kBucketCount = (40 - 3) * kSubBucketCount;
+  // Number of values of a histogram: the buckets, then the sum of the recorded values.
+  static constexpr size_t kHistogramSize = kBucketCount + 1;
+
+  // Adds the value to the counter of the current thread.
+  static void Add(Counter counter, uint64_t value = 1) noexcept {
+    auto& item = GetThreadBlock()[static_cast<size_t>(counter)];
+    item.store(item.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+
+  // Subtracts the value from the gauge. The blocks of the threads may wrap around, their sum
+  // does not.
+  static void Subtract(Counter counter, uint64_t value = 1) noexcept { Add(counter, 0 - value); }
+
+  // Records the duration into the histogram of the current thread.
+  static void Record(Latency latency, std::chrono::steady_clock::duration duration) noexcept {
+    const auto value = static_cast<uint64_t>(std::max<int64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), 0));
+    auto histogram = GetThreadHistograms() + static_cast<size_t>(latency) * kHistogramSize;
+
+    auto& bucket = histogram[GetBucket(value)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    auto& sum = histogram[kBucketCount];
+    sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+
+  // Returns the bucket of the value in nanoseconds.
+  static size_t GetBucket(uint64_t value) noexcept {
+    if (value < kSubBucketCount) {
+      return static_cast<size_t>(value);
+    }
+
+    // The buckets of [2^n, 2^(n+1)) are 2^(n-4) wide.
+    value = std::min(value, kMaxLatency);
+    const auto exponent = GetHighestBit(value);
+    return (exponent - 3) * kSubBucketCount + ((value >> (exponent - 4)) & (kSubBucketCount - 1));
+  }
+
+  // Returns the largest value of the bucket.
+  static uint64_t GetBucketLimit(size_t bucket) noexcept {
+    if (bucket < kSubBucketCount) {
+      return bucket;
+    }
+
+    const auto shift = bucket / kSubBucketCount - 1;
+    return ((kSubBucketCount + bucket % kSubBucketCount + 1) << shift) - 1;
+  }
+
+  // Counts the failure reply of a SOCKS4 request. The success code is ignored.
+  static void CountSocks4Reply(uint8_t code) noexcept;
+
+  // Counts the failure reply of a SOCKS5 request. The success code is ignored.
+  static void CountSocks5Reply(uint8_t code) noexcept;
+
+  // Returns the sum of the counter over all threads.
+  static uint64_t Get(Counter counter);
+
+  // Returns all counters, the latency histograms and the DNS cache statistics in the Prometheus
+  // text format.
+  static std::string Export();
+
+ private:
+  // Returns the counters of the current thread, creating them on first use.
+  static std::atomic<uint64_t>* GetThreadBlock() noexcept {
+    return thread_block_ ? thread_block_ : CreateThreadBlock();
+  }
+
+  // Returns the histograms of the current thread, creating them on first use.
+  static std::atomic<uint64_t>* GetThreadHistograms() noexcept {
+    if (!thread_histograms_) {
+      CreateThreadBlock();
+    }
+    return thread_histograms_;
+  }
+
+  // Returns the index of the highest set bit of the non-zero value.
+  static size_t GetHighestBit(uint64_t value) noexcept {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return index;
+#else
+    return 63 - static_cast<size_t>(__builtin_clzll(value));
+#endif
+  }
+
+  static std::atomic<uint64_t>* CreateThreadBlock() noexcept;
+
+  static inline thread_local std::atomic<uint64_t>* thread_block_ = nullptr;
+  static inline thread_local std::atomic<uint64_t>* thread_histograms_ = nullptr;
+};
+
+}  // namespace common
+
+#endif  // !COMMON_METRICS_H_
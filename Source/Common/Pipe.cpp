@@ -0,0 +1,89 @@
+#include "Pipe.h"
+
+#if defined(COMMON_HAS_SPLICE)
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace common {
+namespace {
+
+// The maximum number of idle pipes kept by a thread.
+constexpr size_t kMaxCachedPipes = 256;
+
+std::vector<Pipe>& GetThreadPool() {
+  thread_local std::vector<Pipe> pool;
+  return pool;
+}
+
+}  // namespace
+
+Pipe::Pipe() noexcept : descriptors_{-1, -1} {}
+
+Pipe::~Pipe() {
+  Close();
+}
+
+Pipe::Pipe(Pipe&& other) noexcept : descriptors_{-1, -1} {
+  std::swap(descriptors_, other.descriptors_);
+}
+
+Pipe& Pipe::operator=(Pipe&& other) noexcept {
+  if (this != &other) {
+    Close();
+    std::swap(descriptors_, other.descriptors_);
+  }
+
+  return *this;
+}
+
+Pipe Pipe::Acquire() {
+  auto& pool = GetThreadPool();
+  Pipe pipe;
+
+  if (!pool.empty()) {
+    pipe = std::move(pool.back());
+    pool.pop_back();
+  } else if (::pipe2(pipe.descriptors_, O_NONBLOCK | O_CLOEXEC) != 0) {
+    pipe.descriptors_[0] = pipe.descriptors_[1] = -1;
+  }
+
+  return pipe;
+}
+
+void Pipe::Release(Pipe&& pipe, size_t bytes_in_pipe) {
+  auto& pool = GetThreadPool();
+
+  if (pipe.IsOpen() && bytes_in_pipe == 0 && pool.size() < kMaxCachedPipes) {
+    pool.push_back(std::move(pipe));
+  } else {
+    pipe.Close();
+  }
+}
+
+bool Pipe::IsOpen() const noexcept {
+  return descriptors_[0] != -1;
+}
+
+int Pipe::GetReadDescriptor() const noexcept {
+  return descriptors_[0];
+}
+
+int Pipe::GetWriteDescriptor() const noexcept {
+  return descriptors_[1];
+}
+
+void Pipe::Close() noexcept {
+  for (auto& descriptor : descriptors_) {
+    if (descriptor != -1) {
+      ::close(descriptor);
+      descriptor = -1;
+    }
+  }
+}
+
+}  // namespace common
+
+#endif  // COMMON_HAS_SPLICE
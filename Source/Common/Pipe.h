@@ -0,0 +1,54 @@
+#ifndef COMMON_PIPE_H_
+#define COMMON_PIPE_H_
+
+#if defined(__linux__)
+#define COMMON_HAS_SPLICE 1
+#endif
+
+#if defined(COMMON_HAS_SPLICE)
+
+#include <cstddef>
+
+namespace common {
+
+// A pair of connected pipe descriptors, used as an in-kernel buffer for splice(2).
+// The pipes are cached per thread, so a tunnel does not pay for pipe(2)/close(2) calls.
+class Pipe {
+ public:
+  Pipe() noexcept;
+  ~Pipe();
+
+  Pipe(const Pipe&) = delete;
+  Pipe& operator=(const Pipe&) = delete;
+  Pipe(Pipe&& other) noexcept;
+  Pipe& operator=(Pipe&& other) noexcept;
+
+  // Takes a pipe from the pool of the current thread, or creates a new one.
+  // Returns a closed pipe in case of failure.
+  static Pipe Acquire();
+
+  // Returns the pipe to the pool of the current thread. The pipe must be empty, otherwise
+  // it is closed.
+  static void Release(Pipe&& pipe, size_t bytes_in_pipe);
+
+  // Returns true if the pipe is open.
+  bool IsOpen() const noexcept;
+
+  // Returns the read end of the pipe.
+  int GetReadDescriptor() const noexcept;
+
+  // Returns the write end of the pipe.
+  int GetWriteDescriptor() const noexcept;
+
+  // Closes both ends of the pipe.
+  void Close() noexcept;
+
+ private:
+  int descriptors_[2];
+};
+
+}  // namespace common
+
+#endif  // COMMON_HAS_SPLICE
+
+#endif  // !COMMON_PIPE_H_
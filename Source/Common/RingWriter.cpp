@@ -0,0 +1,103 @@
+#include "RingWriter.h"
+#include <algorithm>
+
+namespace common {
+
+ThreadRingHandle::~ThreadRingHandle() {
+  if (ring_) {
+    ring_->closed.store(true, std::memory_order_release);
+  }
+}
+
+ThreadRing& ThreadRingHandle::Get(RingWriter& writer, uint64_t thread_id) {
+  if (!ring_) {
+    ring_ = std::make_shared<ThreadRing>(writer.ring_size_, thread_id);
+    writer.Register(ring_);
+  }
+
+  return *ring_;
+}
+
+RingWriter::RingWriter(size_t ring_size, std::chrono::milliseconds interval)
+    : ring_size_{ring_size},
+      interval_{interval},
+      mutex_{},
+      wakeup_{},
+      rings_{},
+      thread_{},
+      drain_{},
+      stopping_{false},
+      running_{false},
+      pending_{false} {}
+
+bool RingWriter::Start(Drain drain) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (running_) {
+    return false;
+  }
+
+  drain_ = std::move(drain);
+  stopping_ = false;
+  thread_ = std::thread(&RingWriter::Run, this);
+  running_.store(true, std::memory_order_release);
+  return true;
+}
+
+void RingWriter::Stop() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (!running_) {
+      return;
+    }
+
+    running_.store(false, std::memory_order_release);
+    stopping_ = true;
+  }
+
+  wakeup_.notify_one();
+  thread_.join();
+}
+
+void RingWriter::Wake() noexcept {
+  pending_.store(true, std::memory_order_relaxed);
+  wakeup_.notify_one();
+}
+
+void RingWriter::Register(const std::shared_ptr<ThreadRing>& ring) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  rings_.push_back(ring);
+}
+
+void RingWriter::Run() {
+  std::vector<std::shared_ptr<ThreadRing>> rings;
+  std::unique_lock<std::mutex> lock{mutex_};
+
+  for (;;) {
+    const bool stopping = stopping_;
+    rings = rings_;
+    pending_.store(false, std::memory_order_relaxed);
+    lock.unlock();
+
+    const auto count = drain_(rings);
+
+    lock.lock();
+    rings_.erase(std::remove_if(rings_.begin(), rings_.end(),
+                                [](const std::shared_ptr<ThreadRing>& ring) {
+                                  return ring->closed.load(std::memory_order_acquire) &&
+                                         ring->head.load(std::memory_order_relaxed) ==
+                                             ring->tail.load(std::memory_order_acquire);
+                                }),
+                 rings_.end());
+
+    if (stopping) {
+      break;
+    }
+
+    if (count == 0) {
+      wakeup_.wait_for(lock, interval_,
+                       [this] { return stopping_ || pending_.load(std::memory_order_relaxed); });
+    }
+  }
+}
+
+}  // namespace common
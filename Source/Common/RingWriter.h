@@ -0,0 +1,105 @@
+#ifndef COMMON_RING_WRITER_H_
+#define COMMON_RING_WRITER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace common {
+
+// The records of a thread, written by the thread and read by the writer. The positions grow
+// monotonically, the offset in the buffer is the position modulo the buffer size.
+struct ThreadRing {
+  ThreadRing(size_t buffer_size, uint64_t id) : data{new char[buffer_size]}, size{buffer_size},
+                                                thread_id{id} {}
+
+  std::unique_ptr<char[]> data;
+  const size_t size;
+  const uint64_t thread_id;  // Passed by the thread when the ring was created.
+  alignas(64) std::atomic<size_t> head{0};  // The position of the first unread record.
+  alignas(64) std::atomic<size_t> tail{0};  // The position after the last record.
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<bool> closed{false};  // The thread has exited.
+};
+
+class RingWriter;
+
+// The ring of a thread for a writer, created by the first record of the thread and closed when
+// the thread exits. It is expected to be a thread_local variable.
+class ThreadRingHandle {
+ public:
+  ThreadRingHandle() = default;
+  ~ThreadRingHandle();
+
+  ThreadRingHandle(const ThreadRingHandle&) = delete;
+  ThreadRingHandle(ThreadRingHandle&&) = delete;
+  ThreadRingHandle& operator=(const ThreadRingHandle&) = delete;
+  ThreadRingHandle& operator=(ThreadRingHandle&&) = delete;
+
+  // Returns the ring of the thread, registering it with the writer first.
+  ThreadRing& Get(RingWriter& writer, uint64_t thread_id = 0);
+
+ private:
+  std::shared_ptr<ThreadRing> ring_;
+};
+
+// A background thread which drains the rings of the threads into an output. The rings are
+// drained again right away while they had records, else every interval or when a thread wakes
+// the writer up, so a thread never waits for the output. The rings of the exited threads are
+// forgotten once they are empty.
+class RingWriter {
+ public:
+  // Reads the records of the rings and writes them to the output. Returns the number of records,
+  // the writer waits for the next interval only when there were none.
+  using Drain = std::function<size_t(const std::vector<std::shared_ptr<ThreadRing>>& rings)>;
+
+  RingWriter(size_t ring_size, std::chrono::milliseconds interval);
+
+  RingWriter(const RingWriter&) = delete;
+  RingWriter(RingWriter&&) = delete;
+  RingWriter& operator=(const RingWriter&) = delete;
+  RingWriter& operator=(RingWriter&&) = delete;
+
+  // Returns true if the background thread is running.
+  bool IsRunning() const noexcept { return running_.load(std::memory_order_acquire); }
+
+  // Starts the background thread, which calls 'drain'. Returns false if it is already running.
+  bool Start(Drain drain);
+
+  // Drains the rings a last time and stops the background thread. The records added from then
+  // on are left in the rings.
+  void Stop();
+
+  // Makes the writer drain the rings without waiting for the end of the interval.
+  void Wake() noexcept;
+
+ private:
+  friend class ThreadRingHandle;
+
+  // Adds the ring of a thread.
+  void Register(const std::shared_ptr<ThreadRing>& ring);
+
+  void Run();
+
+  const size_t ring_size_;
+  const std::chrono::milliseconds interval_;
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::vector<std::shared_ptr<ThreadRing>> rings_;
+  std::thread thread_;
+  Drain drain_;
+  bool stopping_;
+  std::atomic<bool> running_;
+  std::atomic<bool> pending_;  // Woken up, the writer does not wait.
+};
+
+}  // namespace common
+
+#endif  // !COMMON_RING_WRITER_H_
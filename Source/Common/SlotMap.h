@@ -0,0 +1,167 @@
+#ifndef COMMON_SLOT_MAP_H_
+#define COMMON_SLOT_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace common {
+
+// A table of values addressed by generation-checked keys.
+// Insert, lookup and erase are O(1). The values are stored contiguously, so iteration is
+// cache-friendly. Slots of erased values are reused through a free list, and the generation of
+// a slot changes on every erase, so the key of an erased value never matches a newer value
+// stored in the same slot.
+// The key consists of the generation (high 32 bits) and the slot index (low 32 bits).
+template <typename T>
+class SlotMap {
+ public:
+  using key_type = uint64_t;
+  using iterator = typename std::vector<T>::iterator;
+  using const_iterator = typename std::vector<T>::const_iterator;
+
+  // A value indicating an invalid key.
+  static constexpr key_type kInvalidKey = std::numeric_limits<key_type>::max();
+
+  SlotMap() = default;
+
+  // Inserts the value and returns its key. Returns kInvalidKey if there are no free slots.
+  key_type Insert(T value);
+
+  // Returns a pointer to the value with the specified key, or nullptr if there is none.
+  T* Find(key_type key);
+  const T* Find(key_type key) const;
+
+  // Erases the value with the specified key. Returns false if there is no such value.
+  bool Erase(key_type key);
+
+  // Erases all values. Keys issued before remain invalid.
+  void Clear();
+
+  // Returns the number of values.
+  size_t Size() const noexcept { return values_.size(); }
+
+  // Returns true if there are no values.
+  bool Empty() const noexcept { return values_.empty(); }
+
+  iterator begin() noexcept { return values_.begin(); }
+  iterator end() noexcept { return values_.end(); }
+  const_iterator begin() const noexcept { return values_.begin(); }
+  const_iterator end() const noexcept { return values_.end(); }
+
+ private:
+  static constexpr uint32_t kNoSlot = std::numeric_limits<uint32_t>::max();
+
+  struct Slot {
+    uint32_t index;       // Index of the value, or the next free slot if the slot is free.
+    uint32_t generation;  // Changes every time the value of the slot is erased.
+  };
+
+  // Returns the slot of the key, or nullptr if the key does not refer to a stored value.
+  const Slot* GetSlot(key_type key) const;
+
+  static key_type MakeKey(uint32_t slot, uint32_t generation) {
+    return (static_cast<key_type>(generation) << 32) | slot;
+  }
+
+  std::vector<T> values_;
+  std::vector<uint32_t> value_slots_;  // Slot of each value.
+  std::vector<Slot> slots_;
+  uint32_t free_head_ = kNoSlot;
+};
+
+template <typename T>
+typename SlotMap<T>::key_type SlotMap<T>::Insert(T value) {
+  uint32_t slot = free_head_;
+
+  if (slot != kNoSlot) {
+    free_head_ = slots_[slot].index;
+  } else if (slots_.size() < kNoSlot) {
+    slot = static_cast<uint32_t>(slots_.size());
+    slots_.push_back({0, 0});
+  } else {
+    return kInvalidKey;
+  }
+
+  slots_[slot].index = static_cast<uint32_t>(values_.size());
+  values_.push_back(std::move(value));
+  value_slots_.push_back(slot);
+
+  return MakeKey(slot, slots_[slot].generation);
+}
+
+template <typename T>
+T* SlotMap<T>::Find(key_type key) {
+  auto slot = GetSlot(key);
+  return slot ? &values_[slot->index] : nullptr;
+}
+
+template <typename T>
+const T* SlotMap<T>::Find(key_type key) const {
+  auto slot = GetSlot(key);
+  return slot ? &values_[slot->index] : nullptr;
+}
+
+template <typename T>
+bool SlotMap<T>::Erase(key_type key) {
+  auto slot = GetSlot(key);
+  if (!slot) {
+    return false;
+  }
+
+  // The last value takes the place of the erased one.
+  const auto slot_index = static_cast<uint32_t>(key);
+  const auto index = slot->index;
+  const auto last = values_.size() - 1;
+
+  if (index != last) {
+    values_[index] = std::move(values_[last]);
+    value_slots_[index] = value_slots_[last];
+    slots_[value_slots_[index]].index = index;
+  }
+
+  values_.pop_back();
+  value_slots_.pop_back();
+
+  slots_[slot_index].index = free_head_;
+  ++slots_[slot_index].generation;
+  free_head_ = slot_index;
+
+  return true;
+}
+
+template <typename T>
+void SlotMap<T>::Clear() {
+  for (auto slot_index : value_slots_) {
+    slots_[slot_index].index = free_head_;
+    ++slots_[slot_index].generation;
+    free_head_ = slot_index;
+  }
+
+  values_.clear();
+  value_slots_.clear();
+}
+
+template <typename T>
+const typename SlotMap<T>::Slot* SlotMap<T>::GetSlot(key_type key) const {
+  const auto slot_index = static_cast<uint32_t>(key);
+  const auto generation = static_cast<uint32_t>(key >> 32);
+
+  if (slot_index >= slots_.size()) {
+    return nullptr;
+  }
+
+  const auto& slot = slots_[slot_index];
+  if (slot.generation != generation || slot.index >= values_.size() ||
+      value_slots_[slot.index] != slot_index) {
+    return nullptr;
+  }
+
+  return &slot;
+}
+
+}  // namespace common
+
+#endif  // !COMMON_SLOT_MAP_H_
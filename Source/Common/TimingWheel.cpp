@@ -0,0 +1,149 @@
+#include "TimingWheel.h"
+#include <algorithm>
+#include "HandlerAllocator.h"
+
+namespace common {
+
+TimingWheel::Timer::Timer(const boost::asio::any_io_executor& executor,
+                          std::function<void()> callback)
+    : wheel_{TimingWheel::GetThreadInstance(executor)},
+      callback_{std::move(callback)},
+      deadline_{0},
+      walk_{0} {}
+
+void TimingWheel::Timer::Arm(Clock::duration timeout) noexcept {
+  const auto deadline = std::max(wheel_->GetTick(Clock::now() + timeout), wheel_->tick_ + 1);
+
+  if (IsArmed()) {
+    if (deadline >= walk_) {
+      // The walk of the slot moves the timer.
+      deadline_ = deadline;
+      return;
+    }
+
+    wheel_->Remove(*this);
+  }
+
+  deadline_ = deadline;
+  wheel_->Insert(*this);
+}
+
+void TimingWheel::Timer::Cancel() noexcept {
+  if (IsArmed()) {
+    wheel_->Remove(*this);
+  }
+}
+
+TimingWheel::TimingWheel(const boost::asio::any_io_executor& executor)
+    : started_{Clock::now()},
+      tick_{0},
+      slots_(kSlotCount),
+      count_{0},
+      timer_{executor},
+      running_{false} {
+  for (auto& slot : slots_) {
+    slot.previous = &slot;
+    slot.next = &slot;
+  }
+}
+
+std::shared_ptr<TimingWheel> TimingWheel::GetThreadInstance(
+    const boost::asio::any_io_executor& executor) {
+  thread_local std::shared_ptr<TimingWheel> instance;
+
+  if (!instance) {
+    instance = std::shared_ptr<TimingWheel>(new TimingWheel(executor));
+  }
+
+  return instance;
+}
+
+uint64_t TimingWheel::GetTick(Clock::time_point time) const noexcept {
+  const auto elapsed = std::max(time - started_, Clock::duration::zero());
+  return static_cast<uint64_t>((elapsed + kTick - Clock::duration(1)) / kTick);
+}
+
+void TimingWheel::Insert(Timer& timer) noexcept {
+  if (!running_) {
+    // The wheel was empty, the ticks it stood still are skipped.
+    const auto now = GetTick(Clock::now());
+    if (now > tick_ + 1) {
+      tick_ = now - 1;
+    }
+  }
+
+  const auto slot = timer.deadline_ % kSlotCount;
+  timer.walk_ = tick_ + 1 + (slot + kSlotCount - (tick_ + 1) % kSlotCount) % kSlotCount;
+
+  auto& head = slots_[slot];
+  timer.previous = head.previous;
+  timer.next = &head;
+  head.previous->next = &timer;
+  head.previous = &timer;
+  ++count_;
+
+  if (!running_) {
+    running_ = true;
+    DoTick();
+  }
+}
+
+void TimingWheel::Remove(Timer& timer) noexcept {
+  timer.previous->next = timer.next;
+  timer.next->previous = timer.previous;
+  timer.previous = nullptr;
+  timer.next = nullptr;
+  --count_;
+}
+
+void TimingWheel::DoTick() {
+  timer_.expires_at(started_ + (tick_ + 1) * kTick);
+  timer_.async_wait(BindHandlerAllocator(
+      [this, self = shared_from_this()](const error_code& ecode)
+      {
+        if (ecode) {
+          running_ = false;
+          return;
+        }
+
+        for (const auto now = GetTick(Clock::now()); tick_ < now && count_ != 0;) {
+          Walk(++tick_);
+        }
+
+        if (count_ == 0) {
+          running_ = false;
+        } else {
+          DoTick();
+        }
+      }));
+}
+
+void TimingWheel::Walk(uint64_t tick) {
+  auto& head = slots_[tick % kSlotCount];
+  if (head.next == &head) {
+    return;
+  }
+
+  // The timers are moved to a list of their own first, so the callbacks can arm and cancel
+  // timers of the slot while it is walked.
+  Link walked;
+  walked.next = head.next;
+  walked.previous = head.previous;
+  walked.next->previous = &walked;
+  walked.previous->next = &walked;
+  head.next = &head;
+  head.previous = &head;
+
+  while (walked.next != &walked) {
+    auto& timer = static_cast<Timer&>(*walked.next);
+    Remove(timer);
+
+    if (timer.deadline_ > tick) {
+      Insert(timer);
+    } else {
+      timer.callback_();
+    }
+  }
+}
+
+}  // namespace common
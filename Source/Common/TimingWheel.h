@@ -0,0 +1,114 @@
+#ifndef COMMON_TIMING_WHEEL_H_
+#define COMMON_TIMING_WHEEL_H_
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Types.h"
+
+namespace common {
+
+// The timeouts of a thread on a hashed timing wheel. The time is cut into ticks and a timer is
+// linked into the slot of its deadline tick, modulo the number of slots; at every tick the timers
+// of one slot are walked. Arming, re-arming and cancelling a timer are O(1) and do not allocate,
+// and a single steady_timer runs for the whole thread, only while timers are armed.
+// A timer whose deadline is more than a turn of the wheel away is passed over by the walks of its
+// slot until its turn comes. A timer armed again with a later deadline is not moved, the walk of
+// its slot moves it, so pushing a deadline back is a store.
+// Every worker thread has its own wheel.
+class TimingWheel final : public std::enable_shared_from_this<TimingWheel> {
+  explicit TimingWheel(const boost::asio::any_io_executor& executor);
+
+  // A node of the circular list of a slot.
+  struct Link {
+    Link* previous = nullptr;
+    Link* next = nullptr;
+  };
+
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // The resolution of the timers, a timer expires at most a tick late.
+  static constexpr std::chrono::milliseconds kTick{100};
+  // Number of slots, a turn of the wheel is about 7 minutes.
+  static constexpr size_t kSlotCount = 4096;
+
+  // A timeout on the wheel of the thread which created it. Only to be used on that thread.
+  class Timer final : private Link {
+   public:
+    // Creates a disarmed timer which calls the callback when it expires. The callback may
+    // destroy the timer.
+    Timer(const boost::asio::any_io_executor& executor, std::function<void()> callback);
+    ~Timer() { Cancel(); }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+    Timer(Timer&&) noexcept = delete;
+    Timer& operator=(Timer&&) noexcept = delete;
+
+    // Arms the timer to expire after the timeout, instead of its previous deadline.
+    void Arm(Clock::duration timeout) noexcept;
+
+    // Disarms the timer.
+    void Cancel() noexcept;
+
+    // Returns true if the timer is armed.
+    bool IsArmed() const noexcept { return next != nullptr; }
+
+   private:
+    friend class TimingWheel;
+
+    std::shared_ptr<TimingWheel> wheel_;
+    std::function<void()> callback_;
+    uint64_t deadline_;  // The tick the timer expires at.
+    uint64_t walk_;      // The tick its slot is walked next, not later than the deadline.
+  };
+
+  ~TimingWheel() = default;
+
+  TimingWheel(const TimingWheel&) = delete;
+  TimingWheel& operator=(const TimingWheel&) = delete;
+  TimingWheel(TimingWheel&&) noexcept = delete;
+  TimingWheel& operator=(TimingWheel&&) noexcept = delete;
+
+  // Returns the wheel of the current thread, the wheel is created on the executor at the first
+  // call.
+  static std::shared_ptr<TimingWheel> GetThreadInstance(
+      const boost::asio::any_io_executor& executor);
+
+  // Returns the number of armed timers.
+  size_t GetCount() const noexcept { return count_; }
+
+ private:
+  // Returns the first tick which starts at or after the time.
+  uint64_t GetTick(Clock::time_point time) const noexcept;
+
+  // Links the timer into the slot of its deadline and starts the ticks, if they are stopped.
+  void Insert(Timer& timer) noexcept;
+
+  // Unlinks the timer from its slot.
+  void Remove(Timer& timer) noexcept;
+
+  // Waits for the next tick, then walks the slots of the ticks which have passed.
+  void DoTick();
+
+  // Expires the timers of the slot whose deadline is the tick, the others are moved to the slot
+  // of their deadline.
+  void Walk(uint64_t tick);
+
+  Clock::time_point started_;  // The start of tick 0.
+  uint64_t tick_;              // The last walked tick.
+  std::vector<Link> slots_;    // The heads of the lists.
+  size_t count_;
+  boost::asio::steady_timer timer_;
+  bool running_;
+};
+
+}  // namespace common
+
+#endif  // !COMMON_TIMING_WHEEL_H_
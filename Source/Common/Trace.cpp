@@ -0,0 +1,239 @@
+#include "Trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "Logger.h"
+#include "RingWriter.h"
+
+namespace common {
+namespace {
+
+// The size of the ring buffer of a thread, a whole number of records.
+constexpr size_t kRingSize = Trace::kBufferSize * sizeof(TraceRecord);
+
+// How often the writer writes the records.
+constexpr std::chrono::milliseconds kWriterInterval{100};
+
+struct Registry {
+  std::mutex mutex;  // Serializes Start and Stop.
+  RingWriter writer{kRingSize, kWriterInterval};
+  std::FILE* file = nullptr;
+  Trace::Clock::time_point started;
+  uint64_t key[2] = {};  // The key of the destination hashes.
+};
+
+Registry& GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+uint64_t RotateLeft(uint64_t value, int bits) noexcept {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+void SipRound(uint64_t (&v)[4]) noexcept {
+  v[0] += v[1];
+  v[1] = RotateLeft(v[1], 13) ^ v[0];
+  v[0] = RotateLeft(v[0], 32);
+  v[2] += v[3];
+  v[3] = RotateLeft(v[3], 16) ^ v[2];
+  v[0] += v[3];
+  v[3] = RotateLeft(v[3], 21) ^ v[0];
+  v[2] += v[1];
+  v[1] = RotateLeft(v[1], 17) ^ v[2];
+  v[2] = RotateLeft(v[2], 32);
+}
+
+// SipHash-2-4 of the data with the key.
+uint64_t SipHash(const uint64_t (&key)[2], const uint8_t* data, size_t size) noexcept {
+  uint64_t v[4] = {key[0] ^ 0x736f6d6570736575ULL, key[1] ^ 0x646f72616e646f6dULL,
+                   key[0] ^ 0x6c7967656e657261ULL, key[1] ^ 0x7465646279746573ULL};
+  const auto end = data + size - size % 8;
+
+  for (; data != end; data += 8) {
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    v[3] ^= word;
+    SipRound(v);
+    SipRound(v);
+    v[0] ^= word;
+  }
+
+  uint64_t last = static_cast<uint64_t>(size) << 56;
+  for (size_t index = 0; index < size % 8; ++index) {
+    last |= static_cast<uint64_t>(data[index]) << (index * 8);
+  }
+
+  v[3] ^= last;
+  SipRound(v);
+  SipRound(v);
+  v[0] ^= last;
+  v[2] ^= 0xff;
+  for (int round = 0; round < 4; ++round) {
+    SipRound(v);
+  }
+
+  return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+// Writes the records of the ring to the file. Returns the number of records.
+size_t WriteRing(ThreadRing& ring, std::FILE* file) {
+  const auto started = ring.head.load(std::memory_order_relaxed);
+  const auto tail = ring.tail.load(std::memory_order_acquire);
+  auto head = started;
+
+  while (head != tail) {
+    const auto offset = head % ring.size;
+    const auto size = std::min(tail - head, ring.size - offset);
+
+    std::fwrite(ring.data.get() + offset, 1, size, file);
+    head += size;
+  }
+
+  ring.head.store(head, std::memory_order_release);
+
+  if (const auto dropped = ring.dropped.exchange(0, std::memory_order_relaxed)) {
+    LOGGER(warning) << dropped << " trace records were dropped, a thread buffer was full.";
+  }
+
+  return (tail - started) / sizeof(TraceRecord);
+}
+
+// Returns the ring of the current thread.
+ThreadRing& GetThreadRing() {
+  static thread_local ThreadRingHandle ring;
+  return ring.Get(GetRegistry().writer);
+}
+
+}  // namespace
+
+bool Trace::Start(const std::string& path) {
+  auto& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock{registry.mutex};
+  if (registry.file) {
+    return true;
+  }
+
+  registry.file = std::fopen(path.c_str(), "wb");
+  if (!registry.file) {
+    return false;
+  }
+
+  std::random_device random;
+  for (auto& word : registry.key) {
+    word = static_cast<uint64_t>(random()) << 32 | random();
+  }
+
+  TraceHeader header{};
+  std::memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+  header.version = kTraceVersion;
+  header.record_size = sizeof(TraceRecord);
+  header.started = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+  std::fwrite(&header, sizeof(header), 1, registry.file);
+
+  registry.started = Clock::now();
+  registry.writer.Start(
+      [file = registry.file](const std::vector<std::shared_ptr<ThreadRing>>& rings) {
+        size_t count = 0;
+        for (const auto& ring : rings) {
+          count += WriteRing(*ring, file);
+        }
+        std::fflush(file);
+        return count;
+      });
+  enabled_.store(true, std::memory_order_release);
+  return true;
+}
+
+void Trace::Stop() {
+  auto& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock{registry.mutex};
+  if (!registry.file) {
+    return;
+  }
+
+  // The new records are dropped, the writer writes the recorded ones and exits.
+  enabled_.store(false, std::memory_order_release);
+  registry.writer.Stop();
+
+  std::fclose(registry.file);
+  registry.file = nullptr;
+}
+
+void Trace::Record(const TraceRecord& record) noexcept {
+  auto& ring = GetThreadRing();
+  const auto tail = ring.tail.load(std::memory_order_relaxed);
+
+  if (tail - ring.head.load(std::memory_order_acquire) == ring.size) {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  std::memcpy(ring.data.get() + tail % ring.size, &record, sizeof(record));
+  ring.tail.store(tail + sizeof(record), std::memory_order_release);
+}
+
+uint64_t Trace::GetTime(Clock::time_point time) noexcept {
+  const auto started = GetRegistry().started;
+  return time > started
+             ? std::chrono::duration_cast<std::chrono::microseconds>(time - started).count()
+             : 0;
+}
+
+uint64_t Trace::HashDestination(const void* data, size_t size) noexcept {
+  return SipHash(GetRegistry().key, static_cast<const uint8_t*>(data), size);
+}
+
+void TraceFlow::Add(TraceDirection direction, size_t bytes, size_t datagrams) noexcept {
+  const auto now = Trace::Clock::now();
+  auto& burst = bursts_[static_cast<size_t>(direction)];
+
+  if (burst.active &&
+      (now - burst.last > Trace::kBurstGap || now - burst.first > Trace::kMaxBurstLength)) {
+    Flush(direction);
+  }
+
+  if (!burst.active) {
+    burst = {now, now, 0, 0, true};
+  }
+
+  burst.last = now;
+  burst.bytes += bytes;
+  burst.datagrams += static_cast<uint32_t>(datagrams);
+}
+
+void TraceFlow::Flush() noexcept {
+  Flush(TraceDirection::kUpload);
+  Flush(TraceDirection::kDownload);
+}
+
+void TraceFlow::Flush(TraceDirection direction) noexcept {
+  auto& burst = bursts_[static_cast<size_t>(direction)];
+  if (!burst.active) {
+    return;
+  }
+
+  burst.active = false;
+  if (!Trace::IsEnabled()) {
+    return;
+  }
+
+  TraceRecord record{};
+  record.time = Trace::GetTime(burst.first);
+  record.session = session_;
+  record.event = TraceEvent::kBurst;
+  record.burst.direction = direction;
+  record.burst.duration = static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(burst.last - burst.first).count());
+  record.burst.datagrams = burst.datagrams;
+  record.burst.bytes = burst.bytes;
+  Trace::Record(record);
+}
+
+}  // namespace common
@@ -0,0 +1,155 @@
+#ifndef COMMON_TRACE_H_
+#define COMMON_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace common {
+
+#pragma pack(push, 1)
+
+// The start of a trace file, followed by the records. The numbers are in the byte order of the
+// machine which recorded the trace.
+struct TraceHeader {
+  char magic[8];         // kTraceMagic.
+  uint32_t version;      // kTraceVersion.
+  uint32_t record_size;  // sizeof(TraceRecord).
+  int64_t started;       // Microseconds since the epoch when the trace was started.
+};
+
+enum class TraceEvent : uint8_t {
+  kRequest = 1,  // The request of a session, at the time the connection was accepted.
+  kBurst = 2,    // Data moved in one direction of a session without a long pause.
+  kClose = 3,    // The session was closed.
+};
+
+// The address types of the requests, the values of SOCKS5.
+enum class TraceAddressType : uint8_t {
+  kIPv4 = 0x01,
+  kDomainName = 0x03,
+  kIPv6 = 0x04,
+};
+
+enum class TraceDirection : uint8_t {
+  kUpload = 0,    // From the client to the application.
+  kDownload = 1,  // From the application to the client.
+};
+
+// A record of the trace. The records of a session are in the order of their time, the sessions
+// are interleaved in the order the threads wrote them.
+struct TraceRecord {
+  uint64_t time;     // Microseconds since the trace was started.
+  uint64_t session;  // ID of the session in the trace.
+  TraceEvent event;
+  union {
+    struct {
+      uint8_t protocol;               // 4 or 5.
+      uint8_t command;                // 1 - CONNECT, 2 - BIND, 3 - UDP ASSOCIATE.
+      TraceAddressType address_type;  // SOCKS4a requests have a domain name.
+      uint8_t name_length;            // Length of the domain name, 0 for an address.
+      uint8_t user_length;            // Length of the SOCKS4 USER-ID or of the SOCKS5 username.
+      uint16_t port;                  // Port of the destination.
+      uint32_t handshake;             // Microseconds from the accept to the request.
+      uint64_t destination;           // Keyed hash of the address or name of the destination.
+    } request;
+    struct {
+      TraceDirection direction;
+      uint32_t duration;   // Microseconds from the first to the last transfer.
+      uint32_t datagrams;  // Number of datagrams, 0 for a TCP tunnel.
+      uint64_t bytes;      // Payload bytes.
+    } burst;
+  };
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(TraceRecord) == 36, "The trace records are written as they are.");
+
+constexpr char kTraceMagic[8] = {'R', 'P', 'T', 'R', 'A', 'C', 'E', '\0'};
+constexpr uint32_t kTraceVersion = 1;
+
+// The opt-in traffic trace of the sessions: when they arrive, what they request and how their
+// data moves, without the payloads. The destinations are replaced by a hash keyed with a random
+// key of the process, which is not written, so equal destinations can be told apart from the
+// others but not recovered.
+// Like the log, a thread records into a ring buffer of its own and a background thread writes
+// the records to the file. A record is dropped when the ring of its thread is full.
+class Trace {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // The number of records of the ring buffer of a thread.
+  static constexpr size_t kBufferSize = 8192;
+  // A burst ends when its direction has been idle for that long.
+  static constexpr std::chrono::milliseconds kBurstGap{10};
+  // A burst longer than that is split, so the rate of a long transfer is kept.
+  static constexpr std::chrono::milliseconds kMaxBurstLength{100};
+
+  // Returns true if the trace is being recorded.
+  static bool IsEnabled() noexcept { return enabled_.load(std::memory_order_relaxed); }
+
+  // Creates the file and starts the background writer. Returns false if the file cannot be
+  // created.
+  static bool Start(const std::string& path);
+
+  // Writes the remaining records and closes the file.
+  static void Stop();
+
+  // Records the record, which is expected to be enabled.
+  static void Record(const TraceRecord& record) noexcept;
+
+  // Returns the time of the trace, in microseconds since it was started.
+  static uint64_t GetTime(Clock::time_point time) noexcept;
+
+  // Returns a new ID of a session in the trace. The IDs of the sessions of the server are only
+  // unique within their listener.
+  static uint64_t CreateSessionId() noexcept {
+    return next_session_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Returns the keyed hash of the address or name of a destination.
+  static uint64_t HashDestination(const void* data, size_t size) noexcept;
+
+ private:
+  static inline std::atomic<bool> enabled_{false};
+  static inline std::atomic<uint64_t> next_session_{1};
+};
+
+// Accumulates the transfers of a traced session into bursts, one direction at a time.
+class TraceFlow {
+ public:
+  // Creates the flow of the session with the ID from Trace::CreateSessionId.
+  explicit TraceFlow(uint64_t session) noexcept : session_{session} {}
+
+  // Returns the ID of the session in the trace.
+  uint64_t GetSession() const noexcept { return session_; }
+
+  // Adds a transfer of the direction. The burst in progress of the direction is recorded first
+  // if the transfer does not belong to it.
+  void Add(TraceDirection direction, size_t bytes, size_t datagrams) noexcept;
+
+  // Records the bursts in progress.
+  void Flush() noexcept;
+
+ private:
+  struct Burst {
+    Trace::Clock::time_point first;
+    Trace::Clock::time_point last;
+    uint64_t bytes = 0;
+    uint32_t datagrams = 0;
+    bool active = false;
+  };
+
+  // Records the burst of the direction, if it is in progress.
+  void Flush(TraceDirection direction) noexcept;
+
+  uint64_t session_;
+  Burst bursts_[2];
+};
+
+}  // namespace common
+
+#endif  // !COMMON_TRACE_H_
@@ -0,0 +1,268 @@
+#include "UdpBatch.h"
+#include <boost/asio/error.hpp>
+#include <cerrno>
+#include <cstring>
+
+namespace common {
+namespace {
+
+// The maximum size of the datagrams of one segmented send together.
+constexpr size_t kMaxSegmentedSize = 65507;
+
+}  // namespace
+
+UdpBatch::UdpBatch()
+    : buffers_{new char[kCapacity * (kHeadroom + kDatagramSize)]},
+      received_{},
+      outgoing_{},
+      segments_{},
+      outgoing_count_{0},
+      segment_count_{0},
+      segmentation_{false} {
+  for (size_t index = 0; index < kCapacity; ++index) {
+    received_[index].data = buffers_.get() + index * (kHeadroom + kDatagramSize) + kHeadroom;
+  }
+}
+
+UdpBatch& UdpBatch::GetThreadInstance() {
+  // The buffers are only touched as far as the datagrams reach, so the resident memory stays
+  // small for short datagrams.
+  thread_local UdpBatch batch;
+  return batch;
+}
+
+bool UdpBatch::EnableOffload(net_udp::socket& socket) noexcept {
+#if defined(COMMON_HAS_MMSG) && defined(UDP_SEGMENT) && defined(UDP_GRO)
+  // Kernels without UDP_SEGMENT (before 4.18) do not know the option, so reading it fails.
+  int value = 0;
+  socklen_t size = sizeof(value);
+
+  if (::getsockopt(socket.native_handle(), SOL_UDP, UDP_SEGMENT, &value, &size) != 0) {
+    return false;
+  }
+
+  value = 1;
+  return ::setsockopt(socket.native_handle(), SOL_UDP, UDP_GRO, &value, sizeof(value)) == 0;
+#else
+  return false;
+#endif
+}
+
+bool UdpBatch::IsTransientError(const error_code& ecode) noexcept {
+  return ecode == boost::asio::error::would_block || ecode == boost::asio::error::interrupted ||
+         ecode == boost::asio::error::connection_refused ||
+         ecode == boost::asio::error::connection_reset ||
+         ecode == boost::asio::error::host_unreachable ||
+         ecode == boost::asio::error::network_unreachable ||
+         ecode == boost::asio::error::no_buffer_space ||
+         ecode == boost::asio::error::no_memory || ecode == boost::asio::error::message_size;
+}
+
+size_t UdpBatch::Receive(net_udp::socket& socket, error_code& ecode) {
+  ecode.clear();
+
+#if defined(COMMON_HAS_MMSG)
+  for (size_t index = 0; index < kCapacity; ++index) {
+    auto& datagram = received_[index];
+    auto& header = headers_[index].msg_hdr;
+
+    vectors_[index] = {datagram.data, kDatagramSize};
+    std::memset(&header, 0, sizeof(header));
+    header.msg_name = datagram.endpoint.data();
+    header.msg_namelen = static_cast<socklen_t>(datagram.endpoint.capacity());
+    header.msg_iov = &vectors_[index];
+    header.msg_iovlen = 1;
+    header.msg_control = controls_[index].data;
+    header.msg_controllen = sizeof(controls_[index].data);
+  }
+
+  const auto result = ::recvmmsg(socket.native_handle(), headers_.data(), kCapacity, 0, nullptr);
+  if (result < 0) {
+    ecode = error_code(errno, boost::asio::error::get_system_category());
+    return 0;
+  }
+
+  for (size_t index = 0; index < static_cast<size_t>(result); ++index) {
+    auto& datagram = received_[index];
+    auto& header = headers_[index].msg_hdr;
+
+    datagram.size = headers_[index].msg_len;
+    datagram.segment_size = datagram.size;
+    datagram.endpoint.resize(header.msg_namelen);
+
+#if defined(UDP_GRO)
+    for (auto control = CMSG_FIRSTHDR(&header); control; control = CMSG_NXTHDR(&header, control)) {
+      if (control->cmsg_level == SOL_UDP && control->cmsg_type == UDP_GRO) {
+        int segment_size;
+        std::memcpy(&segment_size, CMSG_DATA(control), sizeof(segment_size));
+        datagram.segment_size = segment_size > 0 ? segment_size : datagram.size;
+      }
+    }
+#endif
+  }
+
+  return static_cast<size_t>(result);
+#else
+  size_t count = 0;
+
+  for (; count < kCapacity; ++count) {
+    auto& datagram = received_[count];
+    error_code ecode_receive;
+
+    datagram.size = socket.receive_from(boost::asio::buffer(datagram.data, kDatagramSize),
+                                        datagram.endpoint, 0, ecode_receive);
+    datagram.segment_size = datagram.size;
+    if (ecode_receive) {
+      if (count == 0) {
+        ecode = ecode_receive;
+      }
+      break;
+    }
+  }
+
+  return count;
+#endif
+}
+
+bool UdpBatch::Add(const net_udp::endpoint& endpoint, boost::asio::const_buffer header,
+                   boost::asio::const_buffer payload) {
+  if (segment_count_ == kSegmentCapacity) {
+    return false;
+  }
+
+  const auto size = header.size() + payload.size();
+
+  // The kernel cuts a segmented send into datagrams of the size of the first one, only the last
+  // datagram may be shorter.
+  if (segmentation_ && outgoing_count_ != 0 && size != 0) {
+    auto& outgoing = outgoing_[outgoing_count_ - 1];
+    const auto& first = outgoing.segments[0];
+    const auto& last = outgoing.segments[outgoing.count - 1];
+    const auto segment_size = first.header.size() + first.payload.size();
+
+    if (outgoing.endpoint == endpoint && outgoing.count < kMaxSegments && size <= segment_size &&
+        last.header.size() + last.payload.size() == segment_size &&
+        (outgoing.count + 1) * segment_size <= kMaxSegmentedSize) {
+      segments_[segment_count_++] = {header, payload};
+      ++outgoing.count;
+      return true;
+    }
+  }
+
+  if (outgoing_count_ == kCapacity) {
+    return false;
+  }
+
+  auto& outgoing = outgoing_[outgoing_count_++];
+  outgoing.endpoint = endpoint;
+  outgoing.segments = &segments_[segment_count_];
+  outgoing.count = 1;
+  segments_[segment_count_++] = {header, payload};
+  return true;
+}
+
+size_t UdpBatch::Send(net_udp::socket& socket, size_t first, error_code& ecode) {
+  ecode.clear();
+
+#if defined(COMMON_HAS_MMSG)
+  for (size_t index = first; index < outgoing_count_; ++index) {
+    auto& outgoing = outgoing_[index];
+    auto& header = headers_[index].msg_hdr;
+    // The vectors of an entry follow those of the previous one, two per datagram at most.
+    auto vectors = &vectors_[(outgoing.segments - segments_.data()) * 2];
+    size_t vector_count = 0;
+
+    for (size_t segment = 0; segment < outgoing.count; ++segment) {
+      const auto& buffers = outgoing.segments[segment];
+
+      // A datagram without a separate header is sent from a single vector.
+      if (buffers.header.size() != 0) {
+        vectors[vector_count++] = {const_cast<void*>(buffers.header.data()), buffers.header.size()};
+      }
+      vectors[vector_count++] = {const_cast<void*>(buffers.payload.data()),
+                                 buffers.payload.size()};
+    }
+
+    std::memset(&header, 0, sizeof(header));
+    header.msg_name = outgoing.endpoint.data();
+    header.msg_namelen = static_cast<socklen_t>(outgoing.endpoint.size());
+    header.msg_iov = vectors;
+    header.msg_iovlen = vector_count;
+
+#if defined(UDP_SEGMENT)
+    if (outgoing.count > 1) {
+      const uint16_t segment_size = static_cast<uint16_t>(outgoing.segments[0].header.size() +
+                                                          outgoing.segments[0].payload.size());
+
+      header.msg_control = controls_[index].data;
+      header.msg_controllen = CMSG_SPACE(sizeof(segment_size));
+
+      auto control = CMSG_FIRSTHDR(&header);
+      control->cmsg_level = SOL_UDP;
+      control->cmsg_type = UDP_SEGMENT;
+      control->cmsg_len = CMSG_LEN(sizeof(segment_size));
+      std::memcpy(CMSG_DATA(control), &segment_size, sizeof(segment_size));
+    }
+#endif
+  }
+
+  size_t sent = 0;
+  while (first + sent < outgoing_count_) {
+    // sendmmsg reports an error only for the first datagram of the call, so the call is repeated
+    // from the datagram which was not sent.
+    const auto result = ::sendmmsg(socket.native_handle(), headers_.data() + first + sent,
+                                   static_cast<unsigned int>(outgoing_count_ - first - sent), 0);
+    if (result >= 0) {
+      sent += static_cast<size_t>(result);
+      continue;
+    }
+
+    ecode = error_code(errno, boost::asio::error::get_system_category());
+
+    // A segmented send is refused if the device cannot offload it or a datagram exceeds the MTU.
+    const auto& outgoing = outgoing_[first + sent];
+    if (outgoing.count == 1 || ecode == boost::asio::error::would_block) {
+      break;
+    }
+
+    ecode = SendSegments(socket, outgoing);
+    if (ecode) {
+      break;
+    }
+    ++sent;
+  }
+
+  return sent;
+#else
+  size_t sent = 0;
+
+  for (; first + sent < outgoing_count_; ++sent) {
+    ecode = SendSegments(socket, outgoing_[first + sent]);
+    if (ecode) {
+      break;
+    }
+  }
+
+  return sent;
+#endif
+}
+
+error_code UdpBatch::SendSegments(net_udp::socket& socket, const Outgoing& outgoing) {
+  error_code result;
+
+  for (size_t segment = 0; segment < outgoing.count; ++segment) {
+    const auto& buffers = outgoing.segments[segment];
+    const std::array<boost::asio::const_buffer, 2> sequence{buffers.header, buffers.payload};
+    error_code ecode;
+
+    socket.send_to(sequence, outgoing.endpoint, 0, ecode);
+    if (ecode && segment == 0) {
+      result = ecode;
+      break;
+    }
+  }
+
+  return result;
+}
+
+}  // namespace common
@@ -0,0 +1,134 @@
+#ifndef COMMON_UDP_BATCH_H_
+#define COMMON_UDP_BATCH_H_
+
+#include <boost/asio/buffer.hpp>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include "Types.h"
+
+#if defined(__linux__)
+#define COMMON_HAS_MMSG 1
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#endif
+
+namespace common {
+
+// Datagrams received or sent with a single recvmmsg(2)/sendmmsg(2) call, or with one call per
+// datagram where these are not available.
+// A batch belongs to a thread and is reused for every UDP socket the thread serves, so its
+// buffers do not grow with the number of sockets. The received datagrams are valid until the
+// next Receive call on the same thread.
+// On a socket with offload enabled, the kernel may deliver several datagrams of a sender
+// coalesced into one (UDP_GRO), and datagrams of the same size to the same endpoint can be sent
+// with one segmented send (UDP_SEGMENT).
+class UdpBatch {
+  UdpBatch();
+
+ public:
+  // The maximum number of datagrams received or sent at once.
+  static constexpr size_t kCapacity = 32;
+  // The receive buffer size of each datagram.
+  static constexpr size_t kDatagramSize = 65535;
+  // The free bytes in front of each received datagram, so a header can be prepended in place.
+  static constexpr size_t kHeadroom = 32;
+  // The maximum number of datagrams sent with one segmented send.
+  static constexpr size_t kMaxSegments = 64;
+  // The maximum number of datagrams in the send list.
+  static constexpr size_t kSegmentCapacity = kCapacity * 4;
+
+  struct Datagram {
+    char* data;  // Preceded by kHeadroom free bytes.
+    size_t size;
+    size_t segment_size;  // Less than size if the datagram is coalesced, the last may be shorter.
+    net_udp::endpoint endpoint;  // The sender.
+  };
+
+  struct Segment {
+    boost::asio::const_buffer header;
+    boost::asio::const_buffer payload;
+  };
+
+  struct Outgoing {
+    net_udp::endpoint endpoint;
+    const Segment* segments;  // The datagrams, more than one are sent with one segmented send.
+    size_t count;
+  };
+
+  ~UdpBatch() = default;
+
+  UdpBatch(const UdpBatch&) = delete;
+  UdpBatch(UdpBatch&&) = delete;
+  UdpBatch& operator=(const UdpBatch&) = delete;
+  UdpBatch& operator=(UdpBatch&&) = delete;
+
+  // Returns the batch of the current thread.
+  static UdpBatch& GetThreadInstance();
+
+  // Enables receiving coalesced datagrams on the socket, if the kernel supports both UDP_GRO and
+  // UDP_SEGMENT. Returns false if it does not.
+  static bool EnableOffload(net_udp::socket& socket) noexcept;
+
+  // Returns true if the error of a receive or a send leaves the socket usable, e.g. the ICMP
+  // error of an earlier datagram (connection_refused) or a full buffer (no_buffer_space).
+  static bool IsTransientError(const error_code& ecode) noexcept;
+
+  // Receives up to kCapacity datagrams from the non-blocking socket.
+  // Returns the number of received datagrams, or 0 and the error (would_block if there is no data).
+  size_t Receive(net_udp::socket& socket, error_code& ecode);
+
+  // Returns the received datagram with the specified index.
+  const Datagram& GetDatagram(size_t index) const noexcept { return received_[index]; }
+
+  // Adds the datagram made of the header and the payload to the send list. The header may be
+  // empty. The memory must stay valid until the list is sent. Returns false if the list is full.
+  bool Add(const net_udp::endpoint& endpoint, boost::asio::const_buffer header,
+           boost::asio::const_buffer payload);
+
+  // Returns the number of entries in the send list.
+  size_t GetPendingCount() const noexcept { return outgoing_count_; }
+
+  // Returns the entry of the send list with the specified index.
+  const Outgoing& GetPending(size_t index) const noexcept { return outgoing_[index]; }
+
+  // Sends the entries of the send list, starting with 'first', through the non-blocking socket.
+  // Returns the number of sent entries. If not all of them were sent, 'ecode' holds the error
+  // of the first entry which was not.
+  size_t Send(net_udp::socket& socket, size_t first, error_code& ecode);
+
+  // Empties the send list. With 'segmentation', Add appends a datagram to the previous entry if
+  // they can be sent with one segmented send, the socket must have offload enabled.
+  void Clear(bool segmentation = false) noexcept {
+    outgoing_count_ = 0;
+    segment_count_ = 0;
+    segmentation_ = segmentation;
+  }
+
+ private:
+  // Sends the datagrams of the entry one by one, when the segmented send failed.
+  // Returns the error of the first datagram, the errors of the others are ignored.
+  error_code SendSegments(net_udp::socket& socket, const Outgoing& outgoing);
+
+  std::unique_ptr<char[]> buffers_;
+  std::array<Datagram, kCapacity> received_;
+  std::array<Outgoing, kCapacity> outgoing_;
+  std::array<Segment, kSegmentCapacity> segments_;
+  size_t outgoing_count_;
+  size_t segment_count_;
+  bool segmentation_;
+#if defined(COMMON_HAS_MMSG)
+  // Holds the segment size of a coalesced datagram (UDP_GRO) or of a segmented send (UDP_SEGMENT).
+  struct alignas(cmsghdr) Control {
+    char data[CMSG_SPACE(sizeof(int))];
+  };
+
+  std::array<mmsghdr, kCapacity> headers_;
+  std::array<iovec, kSegmentCapacity * 2> vectors_;
+  std::array<Control, kCapacity> controls_;
+#endif
+};
+
+}  // namespace common
+
+#endif  // !COMMON_UDP_BATCH_H_
@@ -3,7 +3,16 @@
 
 using namespace boost::program_options;
 
-Configuration::Configuration() : is_loaded_{false}, socks4_config_{}, socks5_config_{} {}
+Configuration::Configuration()
+    : is_loaded_{false},
+      general_config_{},
+      socks4_config_{},
+      socks5_config_{},
+      dns_config_{},
+      timeouts_config_{},
+      metrics_config_{},
+      admin_config_{},
+      trace_config_{} {}
 
 std::shared_ptr<Configuration> Configuration::GetInstance() {
   static auto instance = std::shared_ptr<Configuration>(new Configuration);
@@ -25,6 +34,10 @@ bool Configuration::IsLoaded() const {
   return is_loaded_;
 }
 
+const Configuration::General& Configuration::GetGeneral() const noexcept {
+  return general_config_;
+}
+
 const Configuration::Socks4& Configuration::GetSocks4() const noexcept {
   return socks4_config_;
 }
@@ -33,9 +46,39 @@ const Configuration::Socks5& Configuration::GetSocks5() const noexcept {
   return socks5_config_;
 }
 
+const Configuration::Dns& Configuration::GetDns() const noexcept {
+  return dns_config_;
+}
+
+const Configuration::Timeouts& Configuration::GetTimeouts() const noexcept {
+  return timeouts_config_;
+}
+
+const Configuration::Metrics& Configuration::GetMetrics() const noexcept {
+  return metrics_config_;
+}
+
+const Configuration::Admin& Configuration::GetAdmin() const noexcept {
+  return admin_config_;
+}
+
+const Configuration::Trace& Configuration::GetTrace() const noexcept {
+  return trace_config_;
+}
+
 options_description Configuration::CreateOptionsDescription() {
   options_description options;
 
+  // General options.
+  {
+    options.add_options()("general.workers",
+                          value<size_t>(&general_config_.workers)->default_value(0));
+    options.add_options()("general.splice",
+                          value<bool>(&general_config_.splice)->default_value(false));
+    options.add_options()("general.log_level",
+                          value<std::string>(&general_config_.log_level)->default_value("info"));
+  }
+
   // Socks4 options.
   {
     options.add_options()("socks4.enable",
@@ -70,6 +113,71 @@ options_description Configuration::CreateOptionsDescription() {
                           value<std::string>(&socks5_config_.address)->default_value("127.0.0.1"));
     options.add_options()("socks5.port",
                           value<uint16_t>(&socks5_config_.port)->default_value(1081));
+    options.add_options()("socks5.udp_queue_size",
+                          value<size_t>(&socks5_config_.udp_queue_size)->default_value(256));
+    options.add_options()(
+        "socks5.udp_drop_policy",
+        value<std::string>(&socks5_config_.udp_drop_policy)->default_value("tail"));
+    options.add_options()("socks5.udp_offload",
+                          value<bool>(&socks5_config_.udp_offload)->default_value(false));
+    options.add_options()("socks5.udp_relay_port",
+                          value<uint16_t>(&socks5_config_.udp_relay_port)->default_value(0));
+    options.add_options()("socks5.udp_relay_sockets",
+                          value<size_t>(&socks5_config_.udp_relay_sockets)->default_value(64));
+  }
+
+  // DNS options.
+  {
+    options.add_options()("dns.resolver",
+                          value<std::string>(&dns_config_.resolver)->default_value("system"));
+    options.add_options()("dns.nameservers",
+                          value<std::string>(&dns_config_.nameservers)->default_value(""));
+    options.add_options()("dns.timeout",
+                          value<uint32_t>(&dns_config_.timeout)->default_value(2000));
+    options.add_options()("dns.attempts",
+                          value<uint32_t>(&dns_config_.attempts)->default_value(2));
+    options.add_options()("dns.min_ttl",
+                          value<uint32_t>(&dns_config_.min_ttl)->default_value(30));
+    options.add_options()("dns.max_ttl",
+                          value<uint32_t>(&dns_config_.max_ttl)->default_value(300));
+    options.add_options()("dns.negative_ttl",
+                          value<uint32_t>(&dns_config_.negative_ttl)->default_value(10));
+    options.add_options()("dns.cache_size",
+                          value<size_t>(&dns_config_.cache_size)->default_value(10000));
+  }
+
+  // Timeouts options.
+  {
+    options.add_options()("timeouts.handshake",
+                          value<uint32_t>(&timeouts_config_.handshake)->default_value(10));
+    options.add_options()("timeouts.connect",
+                          value<uint32_t>(&timeouts_config_.connect)->default_value(30));
+    options.add_options()("timeouts.idle",
+                          value<uint32_t>(&timeouts_config_.idle)->default_value(3600));
+    options.add_options()("timeouts.write_stall",
+                          value<uint32_t>(&timeouts_config_.write_stall)->default_value(120));
+  }
+
+  // Metrics options.
+  {
+    options.add_options()("metrics.enable",
+                          value<bool>(&metrics_config_.enable)->default_value(false));
+    options.add_options()("metrics.address", value<std::string>(&metrics_config_.address)
+                                                 ->default_value("127.0.0.1"));
+    options.add_options()("metrics.port",
+                          value<uint16_t>(&metrics_config_.port)->default_value(9100));
+  }
+
+  // Admin socket options.
+  {
+    options.add_options()("admin.socket",
+                          value<std::string>(&admin_config_.socket)->default_value(""));
+  }
+
+  // Traffic trace options.
+  {
+    options.add_options()("trace.file",
+                          value<std::string>(&trace_config_.file)->default_value(""));
   }
 
   return options;
@@ -12,6 +12,12 @@ class Configuration {
   Configuration();
 
  public:
+  struct General {
+    size_t workers;         // Number of worker threads, 0 - one per hardware thread.
+    bool splice;            // Relay TCP tunnels with splice(2) where it is supported.
+    std::string log_level;  // The lowest level of the written log messages.
+  };
+
   struct Socks4 {
     bool enable;
     bool enable_connect;  // Enable CONNECT command.
@@ -30,6 +36,44 @@ class Configuration {
     std::string password;  // Authentication password.
     std::string address;   // Address.
     uint16_t port;         // Port.
+    size_t udp_queue_size;        // Datagrams an association queues while its socket is busy.
+    std::string udp_drop_policy;  // 'tail' or 'oldest', which datagram a full queue drops.
+    bool udp_offload;             // Use UDP_GRO and UDP_SEGMENT where the kernel supports them.
+    uint16_t udp_relay_port;      // The first port of the shared UDP relays, 0 - disabled.
+    size_t udp_relay_sockets;     // Maximum outbound sockets of a shared relay per address family.
+  };
+
+  struct Dns {
+    std::string resolver;     // 'system' - getaddrinfo, 'native' - the built-in DNS client.
+    std::string nameservers;  // Nameservers of the built-in client, /etc/resolv.conf if empty.
+    uint32_t timeout;         // Time to wait for an answer of a nameserver, in milliseconds.
+    uint32_t attempts;        // Number of rounds over the nameservers.
+    uint32_t min_ttl;       // Minimum lifetime of a resolved name in the cache, in seconds.
+    uint32_t max_ttl;       // Maximum lifetime of a resolved name in the cache, in seconds.
+    uint32_t negative_ttl;  // Lifetime of a non-existent name in the cache, in seconds.
+    size_t cache_size;      // Maximum number of names in the cache.
+  };
+
+  // The timeouts in seconds, 0 - never.
+  struct Timeouts {
+    uint32_t handshake;    // From the accept until the request is read.
+    uint32_t connect;      // From the request until the command has connected the application.
+    uint32_t idle;         // Without data in a tunnel or a UDP association.
+    uint32_t write_stall;  // A socket of a tunnel does not accept the pending data.
+  };
+
+  struct Metrics {
+    bool enable;
+    std::string address;  // Address of the HTTP listener.
+    uint16_t port;        // Port of the HTTP listener.
+  };
+
+  struct Admin {
+    std::string socket;  // Path of the Unix domain socket, empty if disabled.
+  };
+
+  struct Trace {
+    std::string file;  // Path of the traffic trace, empty if disabled.
   };
 
   ~Configuration() = default;
@@ -43,18 +87,36 @@ class Configuration {
   // Returns true if the configuration has been loaded.
   bool IsLoaded() const;
 
+  // Returns the general configuration.
+  const General& GetGeneral() const noexcept;
   // Returns the socks4 configuration
   const Socks4& GetSocks4() const noexcept;
   // Returns the socks5 configuration.
   const Socks5& GetSocks5() const noexcept;
+  // Returns the DNS configuration.
+  const Dns& GetDns() const noexcept;
+  // Returns the timeouts configuration.
+  const Timeouts& GetTimeouts() const noexcept;
+  // Returns the metrics configuration.
+  const Metrics& GetMetrics() const noexcept;
+  // Returns the admin socket configuration.
+  const Admin& GetAdmin() const noexcept;
+  // Returns the traffic trace configuration.
+  const Trace& GetTrace() const noexcept;
 
  private:
   // Initializes and returns options_description.
   boost::program_options::options_description CreateOptionsDescription();
 
   bool is_loaded_;
+  General general_config_;
   Socks4 socks4_config_;
   Socks5 socks5_config_;
+  Dns dns_config_;
+  Timeouts timeouts_config_;
+  Metrics metrics_config_;
+  Admin admin_config_;
+  Trace trace_config_;
 };
 
 #endif  // !CONFIGURATION_H_
@@ -1,53 +1,141 @@
 #include <boost/asio/signal_set.hpp>
+#include <csignal>
+#include <thread>
+#include <vector>
+#include "AdminServer.h"
+#include "Common/DnsCache.h"
 #include "Common/Logger.h"
+#include "Common/Trace.h"
 #include "Configuration.h"
-#include "Server.h"
+#include "MetricsServer.h"
+#include "Session/Socks5/Udp/SendQueue.h"
+#include "Worker.h"
 
 using namespace boost;
 
-static std::shared_ptr<Server> CreateAndStartServer(asio::io_context& io_context,
-                                                    Server::Version version) {
+// Returns the number of workers to run.
+static size_t GetWorkersCount() {
+  auto config = Configuration::GetInstance();
+  size_t count = config->GetGeneral().workers;
+
+  if (count == 0) {
+    count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  }
+
+#if !defined(SO_REUSEPORT)
+  if (count > 1) {
+    WLOGGER(warning) << "SO_REUSEPORT is not supported on this platform, only one worker is used.";
+    count = 1;
+  }
+#endif
+
+  return count;
+}
+
+int main(int argc, char** argv) {
   auto config = Configuration::GetInstance();
   if (!config->IsLoaded()) {
     config->Load();
   }
 
-  if ((version == Server::Version::kSocks4 && config->GetSocks4().enable) ||
-      (version == Server::Version::kSocks5 && config->GetSocks5().enable)) {
-    net_tcp::endpoint endpoint;
+  common::LogLevel log_level;
+  if (common::Logger::ParseLevel(config->GetGeneral().log_level, log_level)) {
+    common::Logger::SetLevel(log_level);
+  } else {
+    WLOGGER(warning) << "Unknown log level '" << config->GetGeneral().log_level
+                     << "', 'info' is used.";
+  }
+
+  common::Logger::Start();
 
-    endpoint.address(asio::ip::address::from_string(version == Server::Version::kSocks4
-                                                        ? config->GetSocks4().address
-                                                        : config->GetSocks5().address));
-    endpoint.port(version == Server::Version::kSocks4 ? config->GetSocks4().port
-                                                      : config->GetSocks5().port);
+#if defined(BOOST_ASIO_HAS_IO_URING) && defined(BOOST_ASIO_DISABLE_EPOLL)
+  WLOGGER(info) << "Running on the io_uring backend.";
+#endif
 
-    auto server = Server::Create(io_context, endpoint, version);
-    server->Start();
-    if (server->IsOpen()) {
-      WLOGGER(info) << (version == Server::Version::kSocks4 ? "SOCKS4" : "SOCKS5") << " running at "
-                    << endpoint.address().to_string() << ":" << endpoint.port() << ".";
+#if defined(SIGPIPE)
+  // Writing to a socket closed by the peer must fail with EPIPE instead of killing the process
+  // (splice(2) does not support MSG_NOSIGNAL).
+  std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+  // The trace is started before the workers, so it covers all sessions.
+  if (!config->GetTrace().file.empty()) {
+    if (common::Trace::Start(config->GetTrace().file)) {
+      WLOGGER(info) << "Recording the traffic trace to " << config->GetTrace().file << ".";
     } else {
-      WLOGGER(error) << (version == Server::Version::kSocks4 ? "SOCKS4" : "SOCKS5")
-                     << " was not running.";
+      WLOGGER(warning) << "Cannot create the traffic trace " << config->GetTrace().file
+                       << ", tracing is disabled.";
     }
-  } else {
-    WLOGGER(info) << (version == Server::Version::kSocks4 ? "SOCKS4" : "SOCKS5")
-                  << " disabled in configuration.";
   }
 
-  return nullptr;
-}
-
-int main(int argc, char** argv) {
   asio::io_context context;
   asio::signal_set signal{context, SIGINT, SIGTERM};
+  std::vector<std::shared_ptr<Worker>> workers;
+
+  for (size_t index = 0, count = GetWorkersCount(); index < count; ++index) {
+    auto worker = Worker::Create(index);
+    worker->Start();
+    workers.push_back(worker);
+  }
 
-  auto socks4 = CreateAndStartServer(context, Server::Version::kSocks4);
-  auto socks5 = CreateAndStartServer(context, Server::Version::kSocks5);
+  // The metrics are served from the main thread, away from the workers.
+  std::shared_ptr<MetricsServer> metrics;
+  if (config->GetMetrics().enable) {
+    const net_tcp::endpoint endpoint{asio::ip::address::from_string(config->GetMetrics().address),
+                                     config->GetMetrics().port};
+
+    metrics = MetricsServer::Create(context, endpoint);
+    if (metrics->Start()) {
+      WLOGGER(info) << "Metrics running at " << endpoint << ".";
+    }
+  }
+
+  // The admin socket is served from the main thread as well, it reaches the sessions through the
+  // contexts of their workers.
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  std::shared_ptr<AdminServer> admin;
+  if (!config->GetAdmin().socket.empty()) {
+    admin = AdminServer::Create(context, config->GetAdmin().socket, workers);
+    if (admin->Start()) {
+      WLOGGER(info) << "Admin socket running at " << config->GetAdmin().socket << ".";
+    }
+  }
+#else
+  if (!config->GetAdmin().socket.empty()) {
+    WLOGGER(warning) << "Unix domain sockets are not supported on this platform, the admin socket "
+                        "is disabled.";
+  }
+#endif
 
   signal.async_wait([&context](auto, auto) { context.stop(); });
   context.run();
 
+  if (metrics) {
+    metrics->Stop();
+  }
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  if (admin) {
+    admin->Stop();
+  }
+#endif
+
+  for (auto& worker : workers) {
+    worker->Stop();
+  }
+
+  common::Trace::Stop();
+
+  const auto dns = common::DnsCache::GetInstance()->GetStatistics();
+  WLOGGER(info) << "DNS cache: " << dns.hits << " hits, " << dns.negative_hits
+                << " negative hits, " << dns.misses << " misses, " << dns.coalesced
+                << " coalesced, " << dns.refreshes << " refreshes, " << dns.evictions
+                << " evictions.";
+
+  const auto udp = session::socks5::detail::UdpSendQueue::GetStatistics();
+  WLOGGER(info) << "UDP send queues: " << udp.queued << " queued, " << udp.dropped_full
+                << " dropped (queue full), " << udp.dropped_error << " dropped (send errors).";
+
+  common::Logger::Stop();
   return 0;
-}
\ No newline at end of file
+}
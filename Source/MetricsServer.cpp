@@ -0,0 +1,103 @@
+#include "MetricsServer.h"
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/write.hpp>
+#include "Common/Logger.h"
+#include "Common/Metrics.h"
+
+MetricsServer::MetricsServer(boost::asio::io_context& context, const net_tcp::endpoint& endpoint)
+    : tcp_endpoint_{endpoint}, tcp_acceptor_{context}, retry_timer_{context} {}
+
+std::shared_ptr<MetricsServer> MetricsServer::Create(boost::asio::io_context& context,
+                                                     const net_tcp::endpoint& endpoint) {
+  return std::shared_ptr<MetricsServer>(new MetricsServer(context, endpoint));
+}
+
+bool MetricsServer::Start() {
+  error_code ecode;
+
+  tcp_acceptor_.open(tcp_endpoint_.protocol(), ecode);
+  if (!ecode) {
+    tcp_acceptor_.set_option(net_tcp::acceptor::reuse_address(true), ecode);
+  }
+  if (!ecode) {
+    tcp_acceptor_.bind(tcp_endpoint_, ecode);
+  }
+  if (!ecode) {
+    tcp_acceptor_.listen(net_tcp::acceptor::max_listen_connections, ecode);
+  }
+  if (ecode) {
+    WLOGGER(error) << "Failed to open the metrics listener: " << ecode.message() << ".";
+    tcp_acceptor_.close(ecode);
+    return false;
+  }
+
+  DoAccept();
+  return true;
+}
+
+void MetricsServer::Stop() {
+  error_code ecode;
+  tcp_acceptor_.close(ecode);
+  retry_timer_.cancel();
+}
+
+void MetricsServer::DoAccept() {
+  tcp_acceptor_.async_accept(
+      [this, self = shared_from_this()](const error_code& ecode, net_tcp::socket socket)
+      {
+        if (ecode == boost::asio::error::operation_aborted) {
+          return;
+        }
+
+        if (ecode) {
+          // Accepting again at once would spin while the error lasts, e.g. out of descriptors.
+          retry_timer_.expires_after(kAcceptRetryDelay);
+          retry_timer_.async_wait(
+              [this, self = shared_from_this()](const error_code& ecode_wait)
+              {
+                if (!ecode_wait && tcp_acceptor_.is_open()) {
+                  DoAccept();
+                }
+              });
+          return;
+        }
+
+        DoReadRequest(std::make_shared<Connection>(std::move(socket)));
+        DoAccept();
+      });
+}
+
+void MetricsServer::DoReadRequest(const std::shared_ptr<Connection>& connection) {
+  boost::asio::async_read_until(
+      connection->socket, boost::asio::dynamic_buffer(connection->request, kMaxRequestSize),
+      "\r\n\r\n",
+      [this, self = shared_from_this(), connection](const error_code& ecode, size_t)
+      {
+        if (ecode == boost::asio::error::not_found) {
+          DoSendResponse(connection, "413 Payload Too Large", "");
+        } else if (ecode) {
+          return;
+        } else if (connection->request.compare(0, 13, "GET /metrics ") == 0 ||
+                   connection->request.compare(0, 13, "GET /metrics?") == 0) {
+          DoSendResponse(connection, "200 OK", common::Metrics::Export());
+        } else {
+          DoSendResponse(connection, "404 Not Found", "");
+        }
+      });
+}
+
+void MetricsServer::DoSendResponse(const std::shared_ptr<Connection>& connection,
+                                   const char* status, const std::string& body) {
+  connection->response.append("HTTP/1.1 ").append(status).append("\r\n");
+  connection->response.append("Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n");
+  connection->response.append("Content-Length: ").append(std::to_string(body.size()));
+  connection->response.append("\r\nConnection: close\r\n\r\n").append(body);
+
+  boost::asio::async_write(connection->socket, boost::asio::buffer(connection->response),
+                           [connection](const error_code&, size_t)
+                           {
+                             error_code ecode;
+                             connection->socket.shutdown(net_tcp::socket::shutdown_both, ecode);
+                             connection->socket.close(ecode);
+                           });
+}
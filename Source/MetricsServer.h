@@ -0,0 +1,65 @@
+#ifndef METRICS_SERVER_H_
+#define METRICS_SERVER_H_
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include "Types.h"
+
+// A plain HTTP listener which answers 'GET /metrics' with the counters of the process in the
+// Prometheus text format. Every request is answered on its own connection, which is closed
+// afterwards.
+class MetricsServer final : public std::enable_shared_from_this<MetricsServer> {
+  MetricsServer(boost::asio::io_context& context, const net_tcp::endpoint& endpoint);
+
+ public:
+  ~MetricsServer() = default;
+
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+  MetricsServer(MetricsServer&&) noexcept = delete;
+  MetricsServer& operator=(MetricsServer&&) noexcept = delete;
+
+  // Creates an instance of the class listening on the endpoint.
+  static std::shared_ptr<MetricsServer> Create(boost::asio::io_context& context,
+                                               const net_tcp::endpoint& endpoint);
+
+  // Starts the listener. Returns false if it could not be opened.
+  bool Start();
+
+  // Stops the listener.
+  void Stop();
+
+ private:
+  // Maximum size of a request, a longer one is answered with an error.
+  static constexpr size_t kMaxRequestSize = 8192;
+  // Delay before accepting again after a failure, e.g. when out of file descriptors.
+  static constexpr std::chrono::milliseconds kAcceptRetryDelay{100};
+
+  // A connection of a scraper.
+  struct Connection {
+    explicit Connection(net_tcp::socket&& socket) : socket{std::move(socket)} {}
+
+    net_tcp::socket socket;
+    std::string request;
+    std::string response;
+  };
+
+  // Accepts the next connection.
+  void DoAccept();
+
+  // Reads the request of the connection, then answers it.
+  void DoReadRequest(const std::shared_ptr<Connection>& connection);
+
+  // Sends the response and closes the connection.
+  void DoSendResponse(const std::shared_ptr<Connection>& connection, const char* status,
+                      const std::string& body);
+
+  net_tcp::endpoint tcp_endpoint_;
+  net_tcp::acceptor tcp_acceptor_;
+  boost::asio::steady_timer retry_timer_;
+};
+
+#endif  // !METRICS_SERVER_H_
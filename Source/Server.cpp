@@ -1,14 +1,18 @@
 #include "Server.h"
-#include <boost/format.hpp>
-#include <boost/log/trivial.hpp>
-#include <limits>
+#include <algorithm>
+#include <vector>
 #include "Common/Logger.h"
+#include "Common/Metrics.h"
 #include "Session/AbstractSession.h"
 #include "Session/Socks4/Socks4.h"
 #include "Session/Socks5/Socks5.h"
 
 Server::Server(boost::asio::io_context& context, const net_tcp::endpoint& endpoint, Version version)
-    : version_{version}, tcp_endpoint_{endpoint}, tcp_acceptor_{context}, sessions_{} {}
+    : version_{version},
+      tcp_endpoint_{endpoint},
+      tcp_acceptor_{context},
+      retry_timer_{context},
+      sessions_{} {}
 
 std::shared_ptr<Server> Server::Create(boost::asio::io_context& context,
                                        const net_tcp::endpoint& endpoint, Version version) {
@@ -18,41 +22,48 @@ std::shared_ptr<Server> Server::Create(boost::asio::io_context& context,
 void Server::Start() {
   if (!IsOpen()) {
     tcp_acceptor_.open(tcp_endpoint_.protocol());
+    tcp_acceptor_.set_option(net_tcp::acceptor::reuse_address(true));
+#if defined(SO_REUSEPORT)
+    // Each worker has its own acceptor on the same address.
+    tcp_acceptor_.set_option(reuse_port(true));
+#endif
     tcp_acceptor_.bind(tcp_endpoint_);
     tcp_acceptor_.listen();
+    tcp_acceptor_.non_blocking(true);
   }
 
   tcp_acceptor_.async_accept(
       [this, self = shared_from_this()](const error_code& ecode, net_tcp::socket socket)
       {
-        if (ecode) {
-          WLOGGER(error) << (boost::format("Failed to accept incoming connection: %d, %s.") %
-                             ecode.value() % ecode.message())
-                                .str();
+        if (ecode == boost::asio::error::operation_aborted) {
+          return;  // The listener was stopped.
+        } else if (ecode) {
+          WLOGGER(error) << "Failed to accept incoming connection: " << ecode.value() << ", "
+                         << ecode.message() << ".";
 
+          // Out of descriptors the listener would fail again at once, so it waits for sessions to
+          // close before accepting again.
+          retry_timer_.expires_after(kAcceptRetryDelay);
+          retry_timer_.async_wait(
+              [this, self = shared_from_this()](const error_code& ecode_wait)
+              {
+                if (!ecode_wait && IsOpen()) {
+                  Start();
+                }
+              });
         } else {
-          if (auto index = GenerateSessionId(); index != session::AbstractSession::kInvalidId) {
-            std::shared_ptr<session::AbstractSession> session;
-
-            switch (version_) {
-              case Version::kSocks4: {
-                WLOGGER(info) << "Receiving an incoming SOCKS4 client.";
-                session = session::socks4::Socks4Session::Create(index, shared_from_this(),
-                                                                 std::move(socket));
-                break;
-              }
-              case Version::kSocks5: {
-                WLOGGER(info) << "Receiving an incoming SOCKS5 client.";
-                session = session::socks5::Socks5Session::Create(index, shared_from_this(),
-                                                                 std::move(socket));
-                break;
-              }
+          CreateSession(std::move(socket));
+
+          // Takes the rest of the backlog without waiting for another completion, so a burst of
+          // connections costs one wakeup instead of one per connection.
+          for (size_t cx = 1; cx < kAcceptBatchSize; ++cx) {
+            error_code ecode_accept;
+            auto pending = tcp_acceptor_.accept(ecode_accept);
+            if (ecode_accept) {
+              break;
             }
 
-            sessions_[index] = session;
-            session->Start();
-          } else {
-            WLOGGER(info) << "Error generating the client's UID.";
+            CreateSession(std::move(pending));
           }
 
           Start();
@@ -63,10 +74,15 @@ void Server::Start() {
 void Server::Stop() {
   error_code ecode;
   tcp_acceptor_.close(ecode);
+  retry_timer_.cancel();
+
+  // Stopping a session may call DeleteSession, so the sessions are detached from the table first.
+  std::vector<std::shared_ptr<session::AbstractSession>> sessions(sessions_.begin(),
+                                                                  sessions_.end());
+  sessions_.Clear();
 
-  for (size_t cx = 0; cx < sessions_.size(); cx++) {
-    sessions_[cx]->Stop();
-    DeleteSession(cx);
+  for (auto& session : sessions) {
+    session->Stop();
   }
 }
 
@@ -75,19 +91,81 @@ bool Server::IsOpen() const {
 }
 
 void Server::DeleteSession(session_id id) {
-  sessions_.erase(id);
-  BOOST_LOG_TRIVIAL(info) << boost::format("Session %d deleted.") % id;
+  // Closing the sockets cancels the pending operations of the session, so their handlers
+  // release the session.
+  if (auto slot = sessions_.Find(id)) {
+    auto session = std::move(*slot);
+    sessions_.Erase(id);
+    session->Stop();
+  }
+
+  LOGGER(info) << "Session " << id << " deleted.";
 }
 
-Server::session_id Server::GenerateSessionId() {
-  static session_id id = 0;
-  static constexpr session_id limit = std::numeric_limits<session_id>::max();
+bool Server::KillSession(session_id id) {
+  if (!sessions_.Find(id)) {
+    return false;
+  }
 
-  for (; id < limit; ++id) {
-    if (sessions_.find(id) == sessions_.end()) {
-      return id;
+  DeleteSession(id);
+  return true;
+}
+
+Server::Version Server::GetVersion() const noexcept {
+  return version_;
+}
+
+net_tcp::endpoint Server::GetLocalEndpoint() const {
+  error_code ecode;
+  const auto endpoint = tcp_acceptor_.local_endpoint(ecode);
+  return ecode ? tcp_endpoint_ : endpoint;
+}
+
+size_t Server::GetSessionCount() const noexcept {
+  return sessions_.Size();
+}
+
+size_t Server::DescribeSessions(size_t first, size_t count, std::string_view prefix,
+                                std::string& output) const {
+  const auto last = std::min(sessions_.Size(), first + count);
+
+  for (auto iterator = sessions_.begin() + first; iterator < sessions_.begin() + last;
+       ++iterator) {
+    if (*iterator) {
+      output.append(prefix);
+      (*iterator)->Describe(output);
+      output.push_back('\n');
     }
   }
 
-  return session::AbstractSession::kInvalidId;
+  return last;
+}
+
+void Server::CreateSession(net_tcp::socket&& socket) {
+  // The slot is reserved first, since the session needs its ID.
+  if (auto index = sessions_.Insert(nullptr); index != session::AbstractSession::kInvalidId) {
+    std::shared_ptr<session::AbstractSession> session;
+
+    switch (version_) {
+      case Version::kSocks4: {
+        WLOGGER(info) << "Receiving an incoming SOCKS4 client.";
+        common::Metrics::Add(common::Metrics::Counter::kSocks4Accepted);
+        session =
+            session::socks4::Socks4Session::Create(index, shared_from_this(), std::move(socket));
+        break;
+      }
+      case Version::kSocks5: {
+        WLOGGER(info) << "Receiving an incoming SOCKS5 client.";
+        common::Metrics::Add(common::Metrics::Counter::kSocks5Accepted);
+        session =
+            session::socks5::Socks5Session::Create(index, shared_from_this(), std::move(socket));
+        break;
+      }
+    }
+
+    *sessions_.Find(index) = session;
+    session->Start();
+  } else {
+    WLOGGER(info) << "Error generating the client's UID.";
+  }
 }
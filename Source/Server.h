@@ -2,8 +2,12 @@
 #define SERVER_H_
 
 #include <boost/asio/io_context.hpp>
-#include <map>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
 #include <memory>
+#include <string>
+#include <string_view>
+#include "Common/SlotMap.h"
 #include "Session/AbstractSession.h"
 #include "Types.h"
 
@@ -42,14 +46,41 @@ class Server final : public std::enable_shared_from_this<Server> {
   // Closes the connection and deletes the specified session.
   void DeleteSession(session_id id);
 
+  // Deletes the session if it exists. Returns false if it does not.
+  bool KillSession(session_id id);
+
+  // Returns the SOCKS version of the server.
+  Version GetVersion() const noexcept;
+
+  // Returns the address of the listener, with the port chosen by the system if it was 0.
+  net_tcp::endpoint GetLocalEndpoint() const;
+
+  // Returns the number of sessions.
+  size_t GetSessionCount() const noexcept;
+
+  // Appends a line for each of up to 'count' sessions, starting at the position 'first' in the
+  // table, to the output. The ID of a session is preceded by the prefix.
+  // Returns the position after the last described session. A deleted session is replaced by the
+  // last one in the table, so sessions deleted or created between two calls may be missed.
+  size_t DescribeSessions(size_t first, size_t count, std::string_view prefix,
+                          std::string& output) const;
+
  private:
-  // Generates a unique session ID. Returns the kInvalidId in case of failure.
-  session_id GenerateSessionId();
+  // Maximum number of connections accepted per completion of the accept operation.
+  static constexpr size_t kAcceptBatchSize = 64;
+  // Delay before accepting again after a failure, e.g. when out of file descriptors.
+  static constexpr std::chrono::milliseconds kAcceptRetryDelay{100};
+
+  // Creates and starts a session for the accepted connection.
+  void CreateSession(net_tcp::socket&& socket);
 
   Version version_;
   net_tcp::endpoint tcp_endpoint_;
   net_tcp::acceptor tcp_acceptor_;
-  std::map<session_id, std::shared_ptr<session::AbstractSession>> sessions_;
+  boost::asio::steady_timer retry_timer_;
+  // The server and all of its sessions live on the thread of a single worker, so the sessions
+  // need no synchronization. The keys of the table are the session IDs.
+  common::SlotMap<std::shared_ptr<session::AbstractSession>> sessions_;
 };
 
 #endif  // SERVER_H_
@@ -1,7 +1,13 @@
 #include "Session/AbstractSession.h"
+#include <algorithm>
 #include <boost/asio/write.hpp>
-#include <boost/format.hpp>
-#include "Common/Logger.h"
+#if defined(COMMON_HAS_SPLICE)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <cstring>
+#include <sstream>
+#include "Common/HandlerAllocator.h"
 #include "Server.h"
 
 namespace session {
@@ -11,65 +17,474 @@ AbstractSession::AbstractSession(session_id id, const std::weak_ptr<Server>& ser
     : session_id_{id},
       tcp_socket_client_{std::move(client_socket)},
       config_{Configuration::GetInstance()},
+      buffer_{kTcpBufferSize},
       server_{server},
-      tunneling_started_{false} {}
+      created_{std::chrono::steady_clock::now()},
+      phase_started_{created_},
+      session_counter_{common::Metrics::Counter::kCount},
+      trace_{},
+      tunneling_started_{false},
+      upload_{},
+      download_{},
+      timer_{tcp_socket_client_.get_executor(), [this]() { OnTimeout(); }},
+      timeout_{Timeout::kHandshake},
+      active_{created_} {
+  ArmTimeout(Timeout::kHandshake);
+}
+
+AbstractSession::~AbstractSession() {
+  if (session_counter_ != common::Metrics::Counter::kCount) {
+    common::Metrics::Subtract(session_counter_);
+  }
+
+  if (trace_ && common::Trace::IsEnabled()) {
+    trace_->Flush();
+
+    common::TraceRecord record{};
+    record.time = common::Trace::GetTime(common::Trace::Clock::now());
+    record.session = trace_->GetSession();
+    record.event = common::TraceEvent::kClose;
+    common::Trace::Record(record);
+  }
+
+#if defined(COMMON_HAS_SPLICE)
+  for (auto direction : {&upload_, &download_}) {
+    common::Pipe::Release(std::move(direction->pipe), direction->pending);
+  }
+#endif
+}
 
-void AbstractSession::DoTunnelingTraffic(net_tcp::socket& source, net_tcp::socket& dest,
-                                         boost::span<char> buffer) {
+void AbstractSession::DoTunnelingTraffic(net_tcp::socket& client, net_tcp::socket& application) {
+  upload_.source = &client;
+  upload_.dest = &application;
+  download_.source = &application;
+  download_.dest = &client;
   tunneling_started_ = true;
-  DoTunnelingReceive(source, dest, buffer);
-  DoTunnelingReceive(dest, source, buffer);
-}
-
-void AbstractSession::DoTunnelingReceive(net_tcp::socket& source, net_tcp::socket& dest,
-                                         boost::span<char> buffer) {
-  source.async_read_some(
-      boost::asio::buffer(buffer.data(), buffer.size()),
-      [this, self = shared_from_this(), &source, &dest, buffer](const error_code& ecode,
-                                                                size_t size)
-      {
-        if (ecode) {
-          if (tunneling_started_) {
-            tunneling_started_ = false;
-            DeleteSession(ecode == boost::asio::error::eof ? log_level::info : log_level::error,
-                          (boost::format("Error reading data: %s.") % ecode.message()).str());
-          }
-        } else {
-          DoTunnelingSend(source, dest, buffer, size);
+
+  for (auto direction : {&upload_, &download_}) {
+    error_code ecode;
+    direction->source->non_blocking(true, ecode);
+    if (ecode) {
+      DoTunnelingError("Error configuring the socket", ecode);
+      return;
+    }
+
+#if defined(COMMON_HAS_SPLICE)
+    if (config_->GetGeneral().splice) {
+      direction->pipe = common::Pipe::Acquire();
+    }
+#endif
+  }
+
+  ArmTimeout(Timeout::kTunnel);
+  upload_.active = active_;
+  download_.active = active_;
+
+  // A client which does not wait for the replies may have sent the first data of the tunnel
+  // with the request. It is sent to the application before anything else of the upload.
+  // The handshake is over then, its buffer is no longer needed.
+  QueueEarlyData(upload_, buffer_.GetRemaining());
+  buffer_.Release();
+
+  DoTunnelingWait(upload_);
+  DoTunnelingWait(download_);
+}
+
+void AbstractSession::QueueEarlyData(TunnelDirection& direction, boost::span<const char> data) {
+  if (data.empty()) {
+    return;
+  }
+
+#if defined(COMMON_HAS_SPLICE)
+  if (direction.pipe.IsOpen()) {
+    // The pipe is empty and the data is smaller than its capacity, it is written at once.
+    const auto size = ::write(direction.pipe.GetWriteDescriptor(), data.data(), data.size());
+    if (size == static_cast<ssize_t>(data.size())) {
+      direction.pending = data.size();
+      return;
+    }
+
+    common::Pipe::Release(std::move(direction.pipe), std::max<ssize_t>(size, 0));
+  }
+#endif
+
+  direction.buffer = common::BufferPool::Borrow(std::max(kTunnelBufferSize, data.size()));
+  std::memcpy(direction.buffer.data(), data.data(), data.size());
+  direction.offset = 0;
+  direction.pending = data.size();
+}
+
+void AbstractSession::DoTunnelingWait(TunnelDirection& direction) {
+  auto& socket = direction.pending == 0 ? *direction.source : *direction.dest;
+  const auto wait_type =
+      direction.pending == 0 ? net_tcp::socket::wait_read : net_tcp::socket::wait_write;
+
+  socket.async_wait(
+      wait_type,
+      common::BindHandlerAllocator(
+          [this, self = shared_from_this(), &direction](const error_code& ecode)
+          {
+            direction.active = active_ = std::chrono::steady_clock::now();
+
+            if (ecode) {
+              DoTunnelingError("Error waiting for the socket", ecode);
+#if defined(COMMON_HAS_SPLICE)
+            } else if (direction.pipe.IsOpen()) {
+              DoSpliceTransfer(direction);
+#endif
+            } else {
+              DoTunnelingTransfer(direction);
+            }
+          }));
+}
+
+void AbstractSession::DoTunnelingTransfer(TunnelDirection& direction) {
+  for (size_t burst = 0; burst < kTunnelingBurst; ++burst) {
+    error_code ecode;
+
+    if (direction.pending == 0) {
+      if (!direction.buffer) {
+        direction.buffer = common::BufferPool::Borrow(kTunnelBufferSize);
+      }
+
+      const auto size = direction.source->read_some(
+          boost::asio::buffer(direction.buffer.data(), direction.buffer.size()), ecode);
+      if (ecode == boost::asio::error::would_block) {
+        break;
+      }
+
+      if (ecode == boost::asio::error::eof) {
+        direction.buffer.Reset();
+        DoTunnelingShutdown(direction);
+        return;
+      }
+
+      if (ecode) {
+        DoTunnelingError("Error reading data", ecode);
+        return;
+      }
+
+      direction.offset = 0;
+      direction.pending = size;
+    }
+
+    const auto size = direction.dest->write_some(
+        boost::asio::buffer(direction.buffer.data() + direction.offset, direction.pending),
+        ecode);
+    if (ecode == boost::asio::error::would_block) {
+      break;
+    }
+
+    if (ecode) {
+      DoTunnelingError("Error sending data", ecode);
+      return;
+    }
+
+    direction.offset += size;
+    direction.pending -= size;
+    CountRelayed(direction, size);
+  }
+
+  if (direction.pending == 0) {
+    direction.buffer.Reset();
+  }
+
+  DoTunnelingWait(direction);
+}
+
+#if defined(COMMON_HAS_SPLICE)
+void AbstractSession::DoSpliceTransfer(TunnelDirection& direction) {
+  const int source = direction.source->native_handle();
+  const int dest = direction.dest->native_handle();
+
+  for (size_t burst = 0; burst < kTunnelingBurst; ++burst) {
+    if (direction.pending == 0) {
+      const auto size = ::splice(source, nullptr, direction.pipe.GetWriteDescriptor(), nullptr,
+                                 kSpliceSize, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (size == 0) {
+        DoTunnelingShutdown(direction);
+        return;
+      }
+
+      if (size < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
         }
-      });
-}
-
-void AbstractSession::DoTunnelingSend(net_tcp::socket& source, net_tcp::socket& dest,
-                                      boost::span<char> buffer, size_t size_to_send) {
-  boost::asio::async_write(
-      dest, boost::asio::buffer(buffer.data(), size_to_send),
-      [this, self = shared_from_this(), &source, &dest, buffer](const error_code& ecode,
-                                                                size_t size)
-      {
-        if (ecode) {
-          if (tunneling_started_) {
-            tunneling_started_ = false;
-            DeleteSession(ecode == boost::asio::error::eof ? log_level::info : log_level::error,
-                          (boost::format("Error sending data: %s.") % ecode.message()).str());
-          }
+
+        if ((errno == EINVAL || errno == ENOSYS) && !direction.spliced) {
+          // The sockets do not support splicing, switching to the copy relay.
+          common::Pipe::Release(std::move(direction.pipe), 0);
+          DoTunnelingTransfer(direction);
         } else {
-          DoTunnelingReceive(source, dest, buffer);
+          DoTunnelingError("Error reading data",
+                           error_code(errno, boost::asio::error::get_system_category()));
         }
-      });
+        return;
+      }
+
+      direction.pending = static_cast<size_t>(size);
+      direction.spliced = true;
+    }
+
+    const auto size = ::splice(direction.pipe.GetReadDescriptor(), nullptr, dest, nullptr,
+                               direction.pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (size < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+
+      DoTunnelingError("Error sending data",
+                       error_code(errno, boost::asio::error::get_system_category()));
+      return;
+    }
+
+    direction.pending -= static_cast<size_t>(size);
+    CountRelayed(direction, static_cast<size_t>(size));
+  }
+
+  DoTunnelingWait(direction);
 }
+#endif
 
-void AbstractSession::LogMessage(log_level level, const std::string& message) const {
-  BOOST_LOG_STREAM_WITH_PARAMS(::boost::log::trivial::logger::get(),
-                               (boost::log::keywords::severity = level))
-      << "[" << session_id_ << "]: " << message;
+void AbstractSession::CountRelayed(TunnelDirection& direction, size_t size) noexcept {
+  if (direction.relayed == 0 && &direction == &download_) {
+    if (session_counter_ == common::Metrics::Counter::kSocks4Connect) {
+      RecordPhase(common::Metrics::Latency::kSocks4FirstByte);
+    } else if (session_counter_ == common::Metrics::Counter::kSocks5Connect) {
+      RecordPhase(common::Metrics::Latency::kSocks5FirstByte);
+    }
+  }
+
+  direction.relayed += size;
+  common::Metrics::Add(GetBytesCounter(direction), size);
+  TraceTransfer(&direction == &upload_ ? common::TraceDirection::kUpload
+                                       : common::TraceDirection::kDownload,
+                size);
+}
+
+void AbstractSession::DoTunnelingShutdown(TunnelDirection& direction) {
+  error_code ecode;
+  direction.dest->shutdown(net_tcp::socket::shutdown_send, ecode);
+  direction.finished = true;
+
+  if (tunneling_started_ && upload_.finished && download_.finished) {
+    tunneling_started_ = false;
+    SESSION_LOGGER(info) << "The tunnel was closed by both sides.";
+    DeleteSession();
+  }
+}
+
+void AbstractSession::DoTunnelingError(const char* message, const error_code& ecode) {
+  if (tunneling_started_) {
+    tunneling_started_ = false;
+    SESSION_LOGGER(error) << message << ": " << ecode.message() << ".";
+    DeleteSession();
+  }
+}
+
+void AbstractSession::ArmTimeout(Timeout timeout) {
+  const auto& timeouts = config_->GetTimeouts();
+  uint32_t seconds = 0;
+
+  switch (timeout) {
+    case Timeout::kHandshake:
+      seconds = timeouts.handshake;
+      break;
+    case Timeout::kConnect:
+      seconds = timeouts.connect;
+      break;
+    case Timeout::kTunnel:
+      // The earlier of both, CheckActivity tells them apart.
+      seconds = timeouts.idle == 0          ? timeouts.write_stall
+                : timeouts.write_stall == 0 ? timeouts.idle
+                                            : std::min(timeouts.idle, timeouts.write_stall);
+      break;
+    case Timeout::kUdp:
+      seconds = timeouts.idle;
+      break;
+  }
+
+  timeout_ = timeout;
+  active_ = std::chrono::steady_clock::now();
+  if (seconds == 0) {
+    timer_.Cancel();
+  } else {
+    timer_.Arm(std::chrono::seconds(seconds));
+  }
+}
+
+void AbstractSession::OnConnectTimeout() {
+  SESSION_LOGGER(warning) << "The command did not connect in " << config_->GetTimeouts().connect
+                          << " seconds.";
+  DeleteSession();
+}
+
+void AbstractSession::OnTimeout() {
+  switch (timeout_) {
+    case Timeout::kHandshake:
+      common::Metrics::Add(common::Metrics::Counter::kTimeoutHandshake);
+      SESSION_LOGGER(warning) << "The request was not received in "
+                              << config_->GetTimeouts().handshake << " seconds.";
+      DeleteSession();
+      break;
+    case Timeout::kConnect:
+      common::Metrics::Add(common::Metrics::Counter::kTimeoutConnect);
+      OnConnectTimeout();
+      break;
+    case Timeout::kTunnel:
+    case Timeout::kUdp:
+      CheckActivity();
+      break;
+  }
+}
+
+void AbstractSession::CheckActivity() {
+  using Clock = std::chrono::steady_clock;
+
+  const auto& timeouts = config_->GetTimeouts();
+  const auto now = Clock::now();
+  auto remaining = Clock::duration::max();
+
+  if (timeout_ == Timeout::kTunnel && timeouts.write_stall != 0) {
+    // A direction which has no pending data is checked again after the whole timeout, a stall
+    // which begins in between is noticed within twice the timeout.
+    const std::chrono::seconds write_stall{timeouts.write_stall};
+    remaining = write_stall;
+
+    for (auto direction : {&upload_, &download_}) {
+      if (direction->pending == 0) {
+        continue;
+      }
+
+      const auto stalled = now - direction->active;
+      if (stalled >= write_stall) {
+        tunneling_started_ = false;
+        common::Metrics::Add(common::Metrics::Counter::kTimeoutWriteStall);
+        SESSION_LOGGER(warning) << "The " << (direction == &upload_ ? "application" : "client")
+                                << " did not accept data for " << timeouts.write_stall
+                                << " seconds.";
+        DeleteSession();
+        return;
+      }
+
+      remaining = std::min(remaining, write_stall - stalled);
+    }
+  }
+
+  if (timeouts.idle != 0) {
+    const std::chrono::seconds idle{timeouts.idle};
+    const auto elapsed = now - active_;
+    if (elapsed >= idle) {
+      tunneling_started_ = false;
+      common::Metrics::Add(common::Metrics::Counter::kTimeoutIdle);
+      SESSION_LOGGER(info) << "No data was relayed for " << timeouts.idle << " seconds.";
+      DeleteSession();
+      return;
+    }
+
+    remaining = std::min(remaining, idle - elapsed);
+  }
+
+  if (remaining != Clock::duration::max()) {
+    timer_.Arm(remaining);
+  }
+}
+
+void AbstractSession::CountSessionAs(common::Metrics::Counter counter) noexcept {
+  if (session_counter_ != common::Metrics::Counter::kCount) {
+    common::Metrics::Subtract(session_counter_);
+  }
+
+  session_counter_ = counter;
+  common::Metrics::Add(session_counter_);
+}
+
+void AbstractSession::RecordPhase(common::Metrics::Latency latency) noexcept {
+  const auto now = std::chrono::steady_clock::now();
+  common::Metrics::Record(latency, now - phase_started_);
+  phase_started_ = now;
+}
+
+void AbstractSession::TraceRequest(uint8_t protocol, uint8_t command,
+                                   common::TraceAddressType address_type,
+                                   std::string_view destination, uint16_t port,
+                                   size_t user_length) {
+  if (!common::Trace::IsEnabled()) {
+    return;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  trace_ = std::make_shared<common::TraceFlow>(common::Trace::CreateSessionId());
+
+  common::TraceRecord record{};
+  record.time = common::Trace::GetTime(created_);
+  record.session = trace_->GetSession();
+  record.event = common::TraceEvent::kRequest;
+  record.request.protocol = protocol;
+  record.request.command = command;
+  record.request.address_type = address_type;
+  record.request.name_length = static_cast<uint8_t>(
+      address_type == common::TraceAddressType::kDomainName ? destination.size() : 0);
+  record.request.user_length = static_cast<uint8_t>(std::min<size_t>(user_length, UINT8_MAX));
+  record.request.port = port;
+  record.request.handshake = static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(now - created_).count());
+  record.request.destination =
+      common::Trace::HashDestination(destination.data(), destination.size());
+  common::Trace::Record(record);
 }
 
-void AbstractSession::DeleteSession(log_level level, const std::string& message) const {
-  if (!message.empty()) {
-    LogMessage(level, message);
+void AbstractSession::Describe(std::string& output) const {
+  using Counter = common::Metrics::Counter;
+
+  const char* kind = "- -";
+  switch (session_counter_) {
+    case Counter::kSocks4Handshake: kind = "socks4 -"; break;
+    case Counter::kSocks4Connect: kind = "socks4 connect"; break;
+    case Counter::kSocks4Bind: kind = "socks4 bind"; break;
+    case Counter::kSocks5Handshake: kind = "socks5 -"; break;
+    case Counter::kSocks5Connect: kind = "socks5 connect"; break;
+    case Counter::kSocks5Bind: kind = "socks5 bind"; break;
+    case Counter::kSocks5UdpAssociate: kind = "socks5 udp-associate"; break;
+    default: break;
+  }
+
+  const char* state = "request";
+  if (session_counter_ == Counter::kSocks4Handshake ||
+      session_counter_ == Counter::kSocks5Handshake) {
+    state = "handshake";
+  } else if (tunneling_started_) {
+    state = "tunneling";
+  } else if (session_counter_ == Counter::kSocks5UdpAssociate) {
+    state = "associated";
   }
 
+  error_code ecode;
+  const auto client = tcp_socket_client_.remote_endpoint(ecode);
+  const auto application = GetApplicationEndpoint();
+  const auto age = std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::steady_clock::now() - created_);
+
+  std::ostringstream stream;
+  stream << session_id_ << ' ' << kind << ' ';
+  if (ecode) {
+    stream << '-';
+  } else {
+    stream << client;
+  }
+  stream << ' ';
+  if (application.port() == 0) {
+    stream << '-';
+  } else {
+    stream << application;
+  }
+  stream << ' ' << age.count() << ' ' << upload_.relayed << ' ' << download_.relayed << ' '
+         << state;
+
+  output.append(stream.str());
+}
+
+void AbstractSession::DeleteSession() const {
   if (auto lock = server_.lock()) {
     lock->DeleteSession(session_id_);
   }
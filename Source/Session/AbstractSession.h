@@ -4,26 +4,40 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/udp.hpp>
 #include <boost/core/span.hpp>
-#include <boost/log/trivial.hpp>
+#include <chrono>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Common/BufferPool.h"
+#include "Common/Logger.h"
+#include "Common/Metrics.h"
+#include "Common/Pipe.h"
+#include "Common/TimingWheel.h"
+#include "Common/Trace.h"
 #include "Configuration.h"
+#include "Session/HandshakeBuffer.h"
 #include "Types.h"
 
 // Forward declaration
 class Server;
 
+// Streams a message of the session to the log, prefixed with its id. The operands are only
+// evaluated if the level is enabled.
+#define SESSION_LOGGER(level) LOGGER(level) << "[" << session_id_ << "]: "
+
 namespace session {
 
 class AbstractSession : public std::enable_shared_from_this<AbstractSession> {
  public:
   // Type of session ID.
-  using session_id = size_t;
+  using session_id = uint64_t;
 
   // A value indicating an invalid session ID
   static constexpr session_id kInvalidId = -1;
 
   AbstractSession(session_id id, const std::weak_ptr<Server>& server, net_tcp::socket&& client_socket);
-  virtual ~AbstractSession() = default;
+  virtual ~AbstractSession();
 
   AbstractSession(const AbstractSession&) = delete;
   AbstractSession& operator=(const AbstractSession&) = delete;
@@ -37,41 +51,166 @@ class AbstractSession : public std::enable_shared_from_this<AbstractSession> {
   // After that, the session is no longer usable, regardless of calling Start again.
   virtual void Stop() = 0;
 
- protected:
-  using log_level = boost::log::trivial::severity_level;
+  // Appends the description of the session to the output: the ID, protocol, command, client,
+  // destination, age in seconds, bytes received from the client, bytes sent to the client and
+  // state, separated by spaces.
+  void Describe(std::string& output) const;
 
+ protected:
   const net_tcp::endpoint kEmptyTcpEndpoint;
   const net_udp::endpoint kEmptyUdpEndpoint;
 
   static constexpr size_t kTcpBufferSize = 4096;
   static constexpr size_t kUdpBufferSize = 65535;
-
-  // Performs tunneling of traffic between source <-> dest.
-  void DoTunnelingTraffic(net_tcp::socket& source, net_tcp::socket& dest, boost::span<char> buffer);
-
-  // Reads data from the source socket to the buffer, then sends it to the dest socket.
-  void DoTunnelingReceive(net_tcp::socket& source, net_tcp::socket& dest, boost::span<char> buffer);
-
-  // Sends the specified data size from the buffer and sends it to the dest socket,
-  // after which it calls the DoTunnelingReceive method.
-  void DoTunnelingSend(net_tcp::socket& source, net_tcp::socket& dest, boost::span<char> buffer,
-                       size_t size_to_send);
-
-  // Outputs message to the log.
-  void LogMessage(log_level level, const std::string& message) const;
-
-  // Deletes session from the server.
-  // It has optional parameters for log output. If the 'message' is empty, the log will not
-  // be recorded.
-  void DeleteSession(log_level level = log_level::info, const std::string& message = "") const;
+  static constexpr size_t kTunnelBufferSize = 16384;
+
+  // Performs full-duplex tunneling of traffic between client <-> application.
+  // Each direction is pumped independently of the other. When one side finishes sending (EOF),
+  // the other side is shut down for sending and the opposite direction keeps working until it
+  // finishes as well.
+  // The tunnel waits for readiness of the sockets and borrows a buffer from the thread pool only
+  // while data is moving, so an idle tunnel does not hold buffer memory. The data the client
+  // sent after the request is relayed first, then the handshake buffer is released.
+  void DoTunnelingTraffic(net_tcp::socket& client, net_tcp::socket& application);
+
+  // The deadlines of the phases of a session, the configured timeouts.
+  enum class Timeout {
+    kHandshake,  // Until the request is read, armed when the session is created.
+    kConnect,    // Until the command has connected the application.
+    kTunnel,     // No data in the tunnel, or a socket does not accept the pending data.
+    kUdp,        // No datagrams in the UDP association.
+  };
+
+  // Arms the timer of the session for the phase, or disarms it if the phase has no timeout.
+  // The activity of the tunnel or the association starts now.
+  void ArmTimeout(Timeout timeout);
+
+  // Disarms the timer of the session.
+  void CancelTimeout() noexcept { timer_.Cancel(); }
+
+  // Records a transfer of the UDP association, the idle timeout starts again. It is only
+  // checked when the timer expires, so a transfer costs a store.
+  void MarkActive(std::chrono::steady_clock::time_point now) noexcept { active_ = now; }
+
+  // Returns the activity of the session, for a relay which records the transfers of the
+  // association itself. The pointer is valid as long as the session.
+  std::chrono::steady_clock::time_point* GetActivity() noexcept { return &active_; }
+
+  // Called when the command did not connect the application in time. Deletes the session.
+  virtual void OnConnectTimeout();
+
+  // Counts the session in the gauge of its protocol and command, instead of the previous one.
+  void CountSessionAs(common::Metrics::Counter counter) noexcept;
+
+  // Records the time since the end of the previous phase, or since the session was created, as
+  // the latency of the phase. The phase ends now.
+  void RecordPhase(common::Metrics::Latency latency) noexcept;
+
+  // Records the request in the trace, if it is enabled, and traces the transfers of the session
+  // from then on. The destination is the address in network byte order or the domain name, only
+  // its keyed hash is recorded.
+  void TraceRequest(uint8_t protocol, uint8_t command, common::TraceAddressType address_type,
+                    std::string_view destination, uint16_t port, size_t user_length);
+
+  // Adds a transfer to the trace, if the session is traced.
+  void TraceTransfer(common::TraceDirection direction, size_t bytes,
+                     size_t datagrams = 0) noexcept {
+    if (trace_) {
+      trace_->Add(direction, bytes, datagrams);
+    }
+  }
+
+  // Returns the trace flow of the session, nullptr if it is not traced.
+  const std::shared_ptr<common::TraceFlow>& GetTraceFlow() const noexcept { return trace_; }
+
+  // Returns the endpoint of the application, or an empty endpoint if there is none (yet).
+  virtual net_tcp::endpoint GetApplicationEndpoint() const = 0;
+
+  // Deletes session from the server. The reason is expected to be logged by the caller.
+  void DeleteSession() const;
 
   session_id session_id_;
   net_tcp::socket tcp_socket_client_;
   std::shared_ptr<Configuration> config_;
+  HandshakeBuffer buffer_;  // Handshake buffer.
 
  private:
+  // State of one direction of the tunnel.
+  struct TunnelDirection {
+    net_tcp::socket* source = nullptr;  // Socket to read data from.
+    net_tcp::socket* dest = nullptr;    // Socket to write data to.
+    common::PooledBuffer buffer;        // Borrowed buffer, held only while it has unsent data.
+    size_t offset = 0;                  // Offset of the unsent data in the buffer.
+    size_t pending = 0;                 // Data read from the source, but not yet sent to the dest.
+    bool finished = false;              // The source has sent EOF and the dest is shut down.
+    uint64_t relayed = 0;               // Bytes written to the dest.
+    std::chrono::steady_clock::time_point active;  // The last time a socket was ready.
+#if defined(COMMON_HAS_SPLICE)
+    common::Pipe pipe;                  // In-kernel buffer of the splice relay.
+    bool spliced = false;               // At least one splice from the source has succeeded.
+#endif
+  };
+
+  // Maximum size of data moved by one splice call.
+  static constexpr size_t kSpliceSize = 65536;
+
+  // Maximum number of read/write iterations of a direction before yielding to other sessions.
+  static constexpr size_t kTunnelingBurst = 16;
+
+  // Waits until the direction can move data: the source is readable if there is no pending
+  // data, otherwise the dest is writable. Then passes control to the DoTunnelingTransfer or
+  // DoSpliceTransfer method.
+  void DoTunnelingWait(TunnelDirection& direction);
+
+  // Makes the data the pending data of the direction, in its pipe or in a borrowed buffer.
+  void QueueEarlyData(TunnelDirection& direction, boost::span<const char> data);
+
+  // Reads data from the source socket into a borrowed buffer and writes it to the dest socket
+  // until one of the sockets would block. The buffer is kept only if the dest is not ready to
+  // accept all the data.
+  void DoTunnelingTransfer(TunnelDirection& direction);
+
+#if defined(COMMON_HAS_SPLICE)
+  // Moves data source -> pipe -> dest with splice(2) until one of the sockets would block.
+  // Falls back to the copy relay if the sockets do not support splicing.
+  void DoSpliceTransfer(TunnelDirection& direction);
+#endif
+
+  // Propagates EOF of the direction to its dest socket. Deletes the session when both
+  // directions are finished.
+  void DoTunnelingShutdown(TunnelDirection& direction);
+
+  // Counts the bytes written to the dest of the direction. The first bytes of the application
+  // end the time to first byte of a CONNECT tunnel.
+  void CountRelayed(TunnelDirection& direction, size_t size) noexcept;
+
+  // Returns the counter of the bytes relayed in the direction.
+  common::Metrics::Counter GetBytesCounter(const TunnelDirection& direction) const noexcept {
+    return &direction == &upload_ ? common::Metrics::Counter::kUploadBytes
+                                  : common::Metrics::Counter::kDownloadBytes;
+  }
+
+  // Stops tunneling and deletes the session, if it was not done earlier.
+  void DoTunnelingError(const char* message, const error_code& ecode);
+
+  // Handles the expired timer of the session.
+  void OnTimeout();
+
+  // Deletes the session if the tunnel or the association has timed out, otherwise arms the
+  // timer for the earliest time it can.
+  void CheckActivity();
+
   std::weak_ptr<Server> server_;
+  std::chrono::steady_clock::time_point created_;
+  std::chrono::steady_clock::time_point phase_started_;  // The end of the last recorded phase.
+  common::Metrics::Counter session_counter_;  // kCount until the session is started.
+  std::shared_ptr<common::TraceFlow> trace_;  // Set if the session is traced.
   bool tunneling_started_;
+  TunnelDirection upload_;    // client -> application
+  TunnelDirection download_;  // application -> client
+  common::TimingWheel::Timer timer_;
+  Timeout timeout_;                                // The phase the timer is armed for.
+  std::chrono::steady_clock::time_point active_;  // The last transfer of the session.
 };
 
 }  // namespace session
@@ -0,0 +1,26 @@
+#include "Session/HandshakeBuffer.h"
+#include <cstring>
+
+namespace session {
+
+HandshakeBuffer::HandshakeBuffer(size_t capacity) noexcept
+    : storage_{},
+      capacity_{capacity},
+      size_{0},
+      message_size_{0} {}
+
+void HandshakeBuffer::Release() noexcept {
+  storage_.reset();
+  size_ = 0;
+  message_size_ = 0;
+}
+
+void HandshakeBuffer::Consume() noexcept {
+  if (message_size_ != 0) {
+    std::memmove(storage_.get(), storage_.get() + message_size_, size_ - message_size_);
+    size_ -= message_size_;
+    message_size_ = 0;
+  }
+}
+
+}  // namespace session
@@ -0,0 +1,109 @@
+#ifndef SESSION_HANDSHAKE_BUFFER_H_
+#define SESSION_HANDSHAKE_BUFFER_H_
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/core/span.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "Common/HandlerAllocator.h"
+#include "Types.h"
+
+namespace session {
+
+// The bytes a client sent during the handshake, parsed a message at a time as they arrive.
+// The message of the current stage is at the front of the buffer. The bytes after it are kept
+// for the next stage: the next messages of a client which does not wait for the replies, or the
+// first data of the tunnel. A message may also arrive in several reads. The storage is
+// allocated once, by the first read.
+class HandshakeBuffer {
+ public:
+  // Returns the size of the message at the front of the data, kIncomplete if more data is needed
+  // or kInvalid if the data is not a valid message. The size is not larger than the data.
+  using GetSizeFunction = size_t (*)(boost::span<const char> data);
+
+  static constexpr size_t kIncomplete = 0;
+  static constexpr size_t kInvalid = SIZE_MAX;
+
+  explicit HandshakeBuffer(size_t capacity) noexcept;
+
+  HandshakeBuffer(const HandshakeBuffer&) = delete;
+  HandshakeBuffer& operator=(const HandshakeBuffer&) = delete;
+  HandshakeBuffer(HandshakeBuffer&&) noexcept = delete;
+  HandshakeBuffer& operator=(HandshakeBuffer&&) noexcept = delete;
+
+  // Consumes the message of the previous stage, then reads from the socket until a complete
+  // message is at the front, unless it is there already. The callback gets invalid_argument if
+  // the message is invalid, and message_size if it does not fit into the buffer.
+  template <typename TCallback>
+  void DoReadMessage(net_tcp::socket& socket, GetSizeFunction get_size, TCallback callback);
+
+  // Returns the message of the current stage.
+  char* data() noexcept { return storage_.get(); }
+  boost::span<char> GetMessage() noexcept { return {storage_.get(), message_size_}; }
+
+  // Returns the bytes received after the message of the current stage.
+  boost::span<char> GetRemaining() noexcept {
+    return {storage_.get() + message_size_, size_ - message_size_};
+  }
+
+  // Frees the storage, the handshake is over.
+  void Release() noexcept;
+
+ private:
+  // Moves the bytes after the message to the front.
+  void Consume() noexcept;
+
+  // Reads until the data holds a complete message.
+  template <typename TCallback>
+  void DoRead(net_tcp::socket& socket, GetSizeFunction get_size, TCallback callback);
+
+  std::unique_ptr<char[]> storage_;
+  size_t capacity_;
+  size_t size_;          // The received bytes.
+  size_t message_size_;  // The message of the current stage.
+};
+
+template <typename TCallback>
+inline void HandshakeBuffer::DoReadMessage(net_tcp::socket& socket, GetSizeFunction get_size,
+                                           TCallback callback) {
+  if (!storage_) {
+    storage_.reset(new char[capacity_]);
+  }
+
+  Consume();
+  DoRead(socket, get_size, std::move(callback));
+}
+
+template <typename TCallback>
+inline void HandshakeBuffer::DoRead(net_tcp::socket& socket, GetSizeFunction get_size,
+                                    TCallback callback) {
+  const auto size = get_size({storage_.get(), size_});
+  if (size == kInvalid) {
+    callback(boost::asio::error::invalid_argument);
+  } else if (size != kIncomplete) {
+    message_size_ = size;
+    callback(error_code{});
+  } else if (size_ == capacity_) {
+    callback(boost::asio::error::message_size);
+  } else {
+    socket.async_read_some(
+        boost::asio::buffer(storage_.get() + size_, capacity_ - size_),
+        common::BindHandlerAllocator(
+            [this, &socket, get_size, callback = std::move(callback)](const error_code& ecode,
+                                                                     size_t size) mutable
+            {
+              if (ecode) {
+                callback(ecode);
+              } else {
+                size_ += size;
+                DoRead(socket, get_size, std::move(callback));
+              }
+            }));
+  }
+}
+
+}  // namespace session
+
+#endif  // !SESSION_HANDSHAKE_BUFFER_H_
@@ -2,29 +2,55 @@
 #include <boost/asio/write.hpp>
 #include <boost/core/span.hpp>
 #include <boost/endian.hpp>
-#include <boost/format.hpp>
-#include <boost/log/trivial.hpp>
+#include <cstring>
+#include "Common/HandlerAllocator.h"
 #include "Common/Strings.h"
 #include "Configuration.h"
 
 namespace session::socks4 {
 namespace {
 
-// A function to check the transmitted buffer for the correctness of the SOCKS4 message.
-bool IsValidMessage(const boost::span<char> data) {
+// A function to check the transmitted buffer for the correctness of the SOCKS4 request. The
+// command is checked by the session, which rejects an unknown one.
+bool IsValidMessage(const boost::span<const char> data) {
   if (data.size() >= sizeof(Message)) {
     auto raw_header = reinterpret_cast<const Message*>(data.data());
 
-    return raw_header->version == 0x4 &&
-               (raw_header->command >= static_cast<uint8_t>(Command::kConnect) &&
-                raw_header->command <= static_cast<uint8_t>(Command::kBind)) ||
-           (raw_header->status >= static_cast<uint8_t>(ReplyCode::kGranted) &&
-            raw_header->status <= static_cast<uint8_t>(ReplyCode::kClientConflict));
+    return raw_header->version == 0x4;
   }
 
   return false;
 }
 
+// For version 4A, if the client cannot resolve the destination host's domain name to find its IP
+// address, it should set the first three bytes of DST-IP to NULL and the last byte to a non-zero
+// value. (This corresponds to IP address 0.0.0.x, with x nonzero.)
+bool IsDomainAddress(uint32_t address) {
+  return (boost::endian::big_to_native(address) ^ 0x000000ff) < 0xff;
+}
+
+// Returns the size of the request at the front of the data, like
+// HandshakeBuffer::GetSizeFunction: the header, the USER-ID and the domain name of SOCKS4A, each
+// string ending with NULL.
+size_t GetRequestSize(boost::span<const char> data) {
+  if (data.size() < sizeof(Message)) {
+    return HandshakeBuffer::kIncomplete;
+  }
+
+  if (!IsValidMessage(data)) {
+    return HandshakeBuffer::kInvalid;
+  }
+
+  auto end = static_cast<const char*>(
+      std::memchr(data.data() + sizeof(Message), '\0', data.size() - sizeof(Message)));
+  if (end != nullptr && IsDomainAddress(reinterpret_cast<const Message*>(data.data())->address)) {
+    ++end;
+    end = static_cast<const char*>(std::memchr(end, '\0', data.data() + data.size() - end));
+  }
+
+  return end == nullptr ? HandshakeBuffer::kIncomplete : end + 1 - data.data();
+}
+
 }  // namespace
 
 Socks4Session::Socks4Session(session_id id, const std::weak_ptr<Server>& server,
@@ -32,7 +58,8 @@ Socks4Session::Socks4Session(session_id id, const std::weak_ptr<Server>& server,
     : AbstractSession(id, server, std::move(client_socket)),
       tcp_socket_application_{tcp_socket_client_.get_executor()},
       tcp_acceptor_bind_{tcp_socket_client_.get_executor()},
-      buffer_{},
+      connector_{},
+      reply_{},
       user_id_{} {}
 
 std::shared_ptr<Socks4Session> Socks4Session::Create(session_id id, const std::weak_ptr<Server>& server,
@@ -46,26 +73,38 @@ void Socks4Session::Start() {
   //            | VN | CD | DSTPORT | DSTIP   | USERID       | NULL |
   //            +----+----+----+----+----+----+----+----+....+------+
   // #of bytes :  1    1       2         4      variable        1
-  buffer_.resize(kTcpBufferSize);
-  tcp_socket_client_.async_read_some(
-      boost::asio::buffer(buffer_),
-      [this, self = shared_from_this()](const error_code& ecode, size_t size)
+  CountSessionAs(common::Metrics::Counter::kSocks4Handshake);
+  buffer_.DoReadMessage(
+      tcp_socket_client_, GetRequestSize,
+      [this, self = shared_from_this()](const error_code& ecode)
       {
-        if (ecode) {
-          DeleteSession(
-              log_level::error,
-              (boost::format("Error reading the authentication message: %s.") % ecode.message())
-                  .str());
-        } else if (!IsValidMessage({buffer_.data(), size})) {
-          DeleteSession(log_level::error, "Invalid authentication message.");
+        if (ecode == boost::asio::error::invalid_argument ||
+            ecode == boost::asio::error::message_size) {
+          SESSION_LOGGER(error) << "Invalid authentication message.";
+          DeleteSession();
+        } else if (ecode) {
+          SESSION_LOGGER(error) << "Error reading the authentication message: " << ecode.message()
+                                << ".";
+          DeleteSession();
         } else {
+          RecordPhase(common::Metrics::Latency::kSocks4Request);
           DoProcessAuthentication();
         }
       });
 }
 
+net_tcp::endpoint Socks4Session::GetApplicationEndpoint() const {
+  error_code ecode;
+  auto endpoint = tcp_socket_application_.remote_endpoint(ecode);
+  return ecode ? net_tcp::endpoint{} : endpoint;
+}
+
 void Socks4Session::Stop() {
   error_code ecode;
+  CancelTimeout();
+  if (connector_) {
+    connector_->Cancel();
+  }
   tcp_acceptor_bind_.close(ecode);
   tcp_socket_client_.close(ecode);
   tcp_socket_application_.close(ecode);
@@ -73,11 +112,11 @@ void Socks4Session::Stop() {
 
 void Socks4Session::DoProcessAuthentication() {
   // Extracting the USER-ID from the message.
-  user_id_ = common::GetStringFromArray(buffer_, sizeof(Message));
+  user_id_ = common::GetStringFromArray(buffer_.GetMessage(), sizeof(Message));
 
   if (!config_->GetSocks4().user_id.empty() && user_id_ != config_->GetSocks4().user_id) {
-    DoSendReplyAndDeleteSession(ReplyCode::kClientConflict, kEmptyTcpEndpoint, log_level::error,
-                                (boost::format("Incorrect USER-ID '%s'.") % user_id_).str());
+    SESSION_LOGGER(error) << "Incorrect USER-ID '" << user_id_ << "'.";
+    DoSendReplyAndDeleteSession(ReplyCode::kClientConflict, kEmptyTcpEndpoint);
   } else {
     DoExecuteCommand();
   }
@@ -85,14 +124,28 @@ void Socks4Session::DoProcessAuthentication() {
 
 void Socks4Session::DoExecuteCommand() {
   auto message = reinterpret_cast<const Message*>(buffer_.data());
+  if (common::Trace::IsEnabled()) {
+    const auto port = boost::endian::big_to_native(message->port);
+    if (IsDomainAddress(message->address)) {
+      const auto address =
+          common::GetStringFromArray(buffer_.GetMessage(), sizeof(Message) + user_id_.length() + 1);
+      TraceRequest(4, message->command, common::TraceAddressType::kDomainName, address, port,
+                   user_id_.length());
+    } else {
+      TraceRequest(4, message->command, common::TraceAddressType::kIPv4,
+                   {reinterpret_cast<const char*>(&message->address), sizeof(message->address)},
+                   port, user_id_.length());
+    }
+  }
+
   switch (static_cast<Command>(message->command)) {
     case Command::kConnect:
       // The client connects to the SOCKS server and sends a CONNECT request when
       // it wants to establish a connection to an application server.
       if (!config_->GetSocks4().enable_connect) {
-        DoSendReplyAndDeleteSession(
-            ReplyCode::kRejected, kEmptyTcpEndpoint, log_level::error,
-            "The CONNECT command is disabled in the application configuration.");
+        SESSION_LOGGER(error)
+            << "The CONNECT command is disabled in the application configuration.";
+        DoSendReplyAndDeleteSession(ReplyCode::kRejected, kEmptyTcpEndpoint);
       } else {
         DoConnectCommand();
       }
@@ -114,54 +167,65 @@ void Socks4Session::DoExecuteCommand() {
       // The purpose of SOCKS BIND operation is to support such a sequence
       // but using a socket on the SOCKS server rather than on the client.
       if (!config_->GetSocks4().enable_bind) {
-        DoSendReplyAndDeleteSession(
-            ReplyCode::kRejected, kEmptyTcpEndpoint, log_level::error,
-            "The BIND command is disabled in the application configuration.");
+        SESSION_LOGGER(error) << "The BIND command is disabled in the application configuration.";
+        DoSendReplyAndDeleteSession(ReplyCode::kRejected, kEmptyTcpEndpoint);
       } else {
         DoBindCommand();
       }
       break;
+    default:
+      SESSION_LOGGER(error) << "Unknown command.";
+      DoSendReplyAndDeleteSession(ReplyCode::kRejected, kEmptyTcpEndpoint);
+      break;
   }
 }
 
 void Socks4Session::DoConnectCommand() {
+  CountSessionAs(common::Metrics::Counter::kSocks4Connect);
+  ArmTimeout(Timeout::kConnect);
   DoResolveAddress(
-      [this, self = shared_from_this()](const error_code& ecode, const net_tcp::endpoint& endpoint)
+      [this, self = shared_from_this()](const error_code& ecode, const std::string& host,
+                                        std::vector<net_tcp::endpoint> endpoints)
       {
+        // The session was deleted while the name was resolved, by a timeout or the admin.
+        if (!tcp_socket_client_.is_open()) {
+          return;
+        }
+
+        RecordPhase(common::Metrics::Latency::kSocks4Resolve);
         if (ecode) {
-          DoSendReplyAndDeleteSession(
-              ReplyCode::kConnectionFailed, kEmptyTcpEndpoint, log_level::error,
-              (boost::format("Domain Name resolution error: %s.") % ecode.message()).str());
+          SESSION_LOGGER(error) << "Domain Name resolution error: " << ecode.message() << ".";
+          DoSendReplyAndDeleteSession(ReplyCode::kConnectionFailed, kEmptyTcpEndpoint);
         } else {
-          tcp_socket_application_.async_connect(
-              endpoint,
-              [this, self, endpoint](const error_code& ecode)
+          connector_ = common::HappyEyeballs::Create(tcp_socket_client_.get_executor());
+          connector_->Connect(
+              host, std::move(endpoints),
+              [this, self](const error_code& ecode, net_tcp::socket&& socket,
+                           const net_tcp::endpoint& endpoint)
               {
+                connector_.reset();
+                RecordPhase(common::Metrics::Latency::kSocks4Connect);
+
                 if (ecode) {
-                  DoSendReplyAndDeleteSession(
-                      ReplyCode::kConnectionFailed, kEmptyTcpEndpoint, log_level::error,
-                      (boost::format("Server connection error [%s:%d]: %s.") %
-                       endpoint.address().to_string() % endpoint.port() % ecode.message())
-                          .str());
+                  SESSION_LOGGER(error) << "Server connection error ["
+                                        << endpoint.address().to_string() << ":" << endpoint.port()
+                                        << "]: " << ecode.message() << ".";
+                  DoSendReplyAndDeleteSession(ReplyCode::kConnectionFailed, kEmptyTcpEndpoint);
                 } else {
+                  tcp_socket_application_ = std::move(socket);
+
                   DoSendReply(
-                      ReplyCode::kGranted, tcp_socket_application_.remote_endpoint(),
-                      [this, self]()
+                      ReplyCode::kGranted, endpoint,
+                      [this, self, endpoint]()
                       {
-                        LogMessage(
-                            log_level::info,
-                            (boost::format(
-                                 "Running the CONNECT command, client=%s:%d, server=%s:%d.") %
-                             tcp_socket_client_.remote_endpoint().address().to_string() %
-                             tcp_socket_client_.remote_endpoint().port() %
-                             tcp_socket_application_.remote_endpoint().address().to_string() %
-                             tcp_socket_application_.remote_endpoint().port())
-                                .str());
-
-                        DoTunnelingTraffic(tcp_socket_client_, tcp_socket_application_,
-                                           boost::span<char>{buffer_.data(), buffer_.size()});
-                        DoTunnelingTraffic(tcp_socket_application_, tcp_socket_client_,
-                                           boost::span<char>{buffer_.data(), buffer_.size()});
+                        RecordPhase(common::Metrics::Latency::kSocks4Reply);
+
+                        error_code ecode;
+                        SESSION_LOGGER(info) << "Running the CONNECT command, client="
+                                             << tcp_socket_client_.remote_endpoint(ecode)
+                                             << ", server=" << endpoint << ".";
+
+                        DoTunnelingTraffic(tcp_socket_client_, tcp_socket_application_);
                       });
                 }
               });
@@ -170,6 +234,8 @@ void Socks4Session::DoConnectCommand() {
 }
 
 void Socks4Session::DoBindCommand() {
+  CountSessionAs(common::Metrics::Counter::kSocks4Bind);
+  ArmTimeout(Timeout::kConnect);
   // Configures the listener to receive incoming connections and sends its local address
   // to the client.
   tcp_acceptor_bind_.open(net_tcp::v4());
@@ -182,82 +248,69 @@ void Socks4Session::DoBindCommand() {
       {
         tcp_acceptor_bind_.async_accept(
             tcp_socket_application_,
-            [this, self](const error_code& ecode)
-            {
-              error_code ecode_ignore;
-              tcp_acceptor_bind_.close(ecode_ignore);
-
-              if (ecode) {
-                DoSendReplyAndDeleteSession(
-                    ReplyCode::kConnectionFailed, kEmptyTcpEndpoint, log_level::error,
-                    (boost::format("Failed to accept incoming connection in BIND command: %s.") %
-                     ecode.message())
-                        .str());
-              } else {
-                DoSendReply(
-                    ReplyCode::kGranted, tcp_socket_application_.remote_endpoint(),
-                    [this, self]()
-                    {
-                      LogMessage(
-                          log_level::info,
-                          (boost::format("Running the BIND command, client=%s:%d, server=%s:%d.") %
-                           tcp_socket_client_.remote_endpoint().address().to_string() %
-                           tcp_socket_client_.remote_endpoint().port() %
-                           tcp_socket_application_.remote_endpoint().address().to_string() %
-                           tcp_socket_application_.remote_endpoint().port())
-                              .str());
-
-                      DoTunnelingTraffic(tcp_socket_client_, tcp_socket_application_,
-                                         boost::span<char>{buffer_.data(), buffer_.size()});
-                      DoTunnelingTraffic(tcp_socket_application_, tcp_socket_client_,
-                                         boost::span<char>{buffer_.data(), buffer_.size()});
-                    });
-              }
-            });
+            common::BindHandlerAllocator(
+                [this, self](const error_code& ecode)
+                {
+                  error_code ecode_ignore;
+                  tcp_acceptor_bind_.close(ecode_ignore);
+
+                  if (ecode == boost::asio::error::operation_aborted) {
+                    return;  // The session was stopped or has timed out.
+                  }
+
+                  if (ecode) {
+                    SESSION_LOGGER(error)
+                        << "Failed to accept incoming connection in BIND command: "
+                        << ecode.message() << ".";
+                    DoSendReplyAndDeleteSession(ReplyCode::kConnectionFailed, kEmptyTcpEndpoint);
+                  } else {
+                    DoSendReply(
+                        ReplyCode::kGranted, tcp_socket_application_.remote_endpoint(ecode_ignore),
+                        [this, self]()
+                        {
+                          error_code ecode;
+                          SESSION_LOGGER(info)
+                              << "Running the BIND command, client="
+                              << tcp_socket_client_.remote_endpoint(ecode)
+                              << ", server=" << tcp_socket_application_.remote_endpoint(ecode)
+                              << ".";
+
+                          DoTunnelingTraffic(tcp_socket_client_, tcp_socket_application_);
+                        });
+                  }
+                }));
       });
 }
 
-void Socks4Session::DoSendReply(ReplyCode code, const net_tcp::endpoint& endpoint,
-                                Callback callback) {
-  Message message{0x0, static_cast<uint8_t>(code), boost::endian::native_to_big(endpoint.port()),
-                  boost::endian::native_to_big(endpoint.address().to_v4().to_uint())};
+void Socks4Session::OnConnectTimeout() {
+  // The pending connect or accept is abandoned, the client is told the command has failed.
+  error_code ecode;
+  if (connector_) {
+    connector_->Cancel();
+    connector_.reset();
+  }
+  tcp_acceptor_bind_.close(ecode);
 
-  boost::asio::async_write(
-      tcp_socket_client_, boost::asio::buffer(&message, sizeof(message)),
-      [this, self = shared_from_this(), callback](const error_code& ecode, size_t)
-      {
-        if (ecode) {
-          DeleteSession(
-              log_level::error,
-              (boost::format("Error sending a response to the client: %s") % ecode.message())
-                  .str());
-        } else {
-          callback();
-        }
-      });
+  SESSION_LOGGER(warning) << "The command did not connect in " << config_->GetTimeouts().connect
+                          << " seconds.";
+  DoSendReplyAndDeleteSession(ReplyCode::kConnectionFailed, kEmptyTcpEndpoint);
 }
 
-void Socks4Session::DoSendReplyAndDeleteSession(ReplyCode code, const net_tcp::endpoint& endpoint,
-                                                log_level level, const std::string& message) {
-  DoSendReply(code, endpoint,
-              [this, self = shared_from_this(), level, message]()
-              { DeleteSession(level, message); });
+void Socks4Session::DoSendReplyAndDeleteSession(ReplyCode code,
+                                                const net_tcp::endpoint& endpoint) {
+  DoSendReply(code, endpoint, [this, self = shared_from_this()]() { DeleteSession(); });
 }
 
-void Socks4Session::DoResolveAddress(common::DomainResolverCallbackTCP callback) {
+void Socks4Session::DoResolveAddress(common::DomainEndpointsCallbackTCP callback) {
   auto message = reinterpret_cast<const Message*>(buffer_.data());
-  // For version 4A, if the client cannot resolve the destination host's domain name to find its IP address,
-  // it should set the first three bytes of DST-IP to NULL and the last byte to a non-zero value. (This corresponds
-  // to IP address 0.0.0.x, with x nonzero.
-  if ((boost::endian::big_to_native(message->address) ^ 0x000000ff) < 0xff) {
-    const auto address =
-        common::GetStringFromArray(buffer_, sizeof(Message) + user_id_.length() + 1 /* \0 char */);
+  if (IsDomainAddress(message->address)) {
+    const auto address = common::GetStringFromArray(
+        buffer_.GetMessage(), sizeof(Message) + user_id_.length() + 1 /* \0 char */);
     const auto service = boost::endian::big_to_native(message->port);
 
-    common::ResolveDomainAddress<net_tcp::resolver>(tcp_socket_client_.get_executor(), address,
-                                                    service, callback);
+    common::ResolveDomainEndpoints(tcp_socket_client_.get_executor(), address, service, callback);
   } else {
-    callback({}, common::GetIPv4Endpoint(message->address, message->port));
+    callback({}, {}, {common::GetIPv4Endpoint(message->address, message->port)});
   }
 }
 
@@ -1,16 +1,18 @@
 #ifndef SESSION_SOCKS4_H_
 #define SESSION_SOCKS4_H_
 
+#include <boost/asio/write.hpp>
+#include <boost/endian.hpp>
 #include <vector>
 #include "Common/AddressResolve.h"
+#include "Common/HandlerAllocator.h"
+#include "Common/HappyEyeballs.h"
 #include "Session/AbstractSession.h"
 #include "Session/Socks4/Socks4Types.h"
 
 namespace session::socks4 {
 
 class Socks4Session final : public AbstractSession {
-  using Callback = std::function<void()>;
-
   Socks4Session(session_id id, const std::weak_ptr<Server>& server,
                 net_tcp::socket&& client_socket);
 
@@ -29,6 +31,12 @@ class Socks4Session final : public AbstractSession {
   void Stop() override;
 
  private:
+  // Returns the endpoint of the application, empty until the command has connected it.
+  net_tcp::endpoint GetApplicationEndpoint() const override;
+
+  // Abandons the pending connect or accept and replies with a failure.
+  void OnConnectTimeout() override;
+
   // The method that processes the first message from the client.
   // The main task is to verify the correctness of the header, extract and process
   // the USER-ID (user authentication).
@@ -49,24 +57,46 @@ class Socks4Session final : public AbstractSession {
   // Sends a response to the client, then passes control to the callback function.
   // In case of failure, deletes the current session without transferring control to the
   // callback function.
-  void DoSendReply(ReplyCode code, const net_tcp::endpoint& endpoint, Callback callback);
+  template <typename TCallback>
+  void DoSendReply(ReplyCode code, const net_tcp::endpoint& endpoint, TCallback callback);
 
   // Sends a response to the client and deletes the current session.
-  // It has 2 optional parameters 'log_level' and 'message' for log output.
-  // If the 'message' parameter is empty, the log will not be recorded.
-  void DoSendReplyAndDeleteSession(ReplyCode code, const net_tcp::endpoint& endpoint,
-                                   log_level level = log_level::info,
-                                   const std::string& message = "");
+  // The reason is expected to be logged by the caller.
+  void DoSendReplyAndDeleteSession(ReplyCode code, const net_tcp::endpoint& endpoint);
 
   // Extracts and processes the target application address from the request.
-  void DoResolveAddress(common::DomainResolverCallbackTCP callback);
+  // The callback receives all addresses of a domain name, or the single literal address.
+  void DoResolveAddress(common::DomainEndpointsCallbackTCP callback);
 
   net_tcp::socket tcp_socket_application_;
   net_tcp::acceptor tcp_acceptor_bind_;
-  std::vector<char> buffer_;
+  std::shared_ptr<common::HappyEyeballs> connector_;  // Alive while the CONNECT is in progress.
+  Message reply_;
   std::string user_id_;
 };
 
+template <typename TCallback>
+inline void Socks4Session::DoSendReply(ReplyCode code, const net_tcp::endpoint& endpoint,
+                                       TCallback callback) {
+  reply_ = {0x0, static_cast<uint8_t>(code), boost::endian::native_to_big(endpoint.port()),
+            boost::endian::native_to_big(endpoint.address().to_v4().to_uint())};
+  common::Metrics::CountSocks4Reply(reply_.status);
+
+  boost::asio::async_write(
+      tcp_socket_client_, boost::asio::buffer(&reply_, sizeof(reply_)),
+      common::BindHandlerAllocator(
+          [this, self = shared_from_this(), callback](const error_code& ecode, size_t)
+          {
+            if (ecode) {
+              SESSION_LOGGER(error) << "Error sending a response to the client: "
+                                    << ecode.message();
+              DeleteSession();
+            } else {
+              callback();
+            }
+          }));
+}
+
 }  // namespace session::socks4
 
 #endif  // !SESSION_SOCKS4_H_
@@ -3,6 +3,7 @@
 
 #include <boost/asio/ip/tcp.hpp>
 #include <memory>
+#include "Session/HandshakeBuffer.h"
 #include "Types.h"
 
 namespace session::socks5::detail {
@@ -17,8 +18,9 @@ class AbstractAuth : public std::enable_shared_from_this<AbstractAuth> {
   AbstractAuth(net_tcp::socket& client_socket) : tcp_socket_client_{client_socket} {};
   virtual ~AbstractAuth() = default;
 
-  // Starts the authentication process.
-  virtual void Execute(Callback callback) = 0;
+  // Starts the authentication process. The messages of the client are read through the
+  // handshake buffer of the session.
+  virtual void Execute(HandshakeBuffer& buffer, Callback callback) = 0;
 
  protected:
   net_tcp::socket& tcp_socket_client_;
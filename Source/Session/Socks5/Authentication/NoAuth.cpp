@@ -8,7 +8,7 @@ std::shared_ptr<NoAuth> NoAuth::Create(net_tcp::socket& client_socket) {
   return std::shared_ptr<NoAuth>(new NoAuth(client_socket));
 }
 
-void NoAuth::Execute(Callback callback) {
+void NoAuth::Execute(HandshakeBuffer&, Callback callback) {
   callback({});
 }
 
@@ -20,7 +20,7 @@ class NoAuth final : public AbstractAuth {
   static std::shared_ptr<NoAuth> Create(net_tcp::socket& client_socket);
 
   // Starts the authentication process.
-  void Execute(Callback callback) override;
+  void Execute(HandshakeBuffer& buffer, Callback callback) override;
 };
 
 }  // namespace session::socks5::detail
@@ -1,56 +1,72 @@
 #include "UsernamePassword.h"
 #include <boost/asio/write.hpp>
 #include <boost/core/span.hpp>
+#include "Common/HandlerAllocator.h"
 #include "Configuration.h"
 
 namespace session::socks5::detail {
 
-namespace {
-
-bool IsValidMessage(boost::span<char> data) {
-  return true;
-}
-
-}  // namespace
-
-UsernamePassword::UsernamePassword(net_tcp::socket& client_socket) : AbstractAuth(client_socket) {}
+UsernamePassword::UsernamePassword(net_tcp::socket& client_socket)
+    : AbstractAuth(client_socket), reply_{} {}
 
 std::shared_ptr<UsernamePassword> UsernamePassword::Create(net_tcp::socket& client_socket) {
   return std::shared_ptr<UsernamePassword>(new UsernamePassword(client_socket));
 }
 
-void UsernamePassword::Execute(Callback callback) {
-  buffer_.resize(kSizeOfNegotiation);
-  tcp_socket_client_.async_read_some(
-      boost::asio::buffer(buffer_),
-      [this, self = shared_from_this(), callback](const error_code& ecode, size_t size)
+void UsernamePassword::Execute(HandshakeBuffer& buffer, Callback callback) {
+  buffer.DoReadMessage(
+      tcp_socket_client_, &UsernamePassword::GetNegotiationSize,
+      [this, self = shared_from_this(), &buffer, callback](const error_code& ecode)
       {
-        if (ecode) {
-          callback(ecode);
-        } else if (!IsValidMessage({buffer_.data(), size})) {
+        if (ecode == boost::asio::error::invalid_argument ||
+            ecode == boost::asio::error::message_size) {
           callback(boost::asio::error::access_denied);
+        } else if (ecode) {
+          callback(ecode);
         } else {
-          auto [username, password] = GetCredentials();
+          auto [username, password] = GetCredentials(buffer.GetMessage());
           bool success = username == Configuration::GetInstance()->GetSocks5().username &&
                          password == Configuration::GetInstance()->GetSocks5().password;
-          uint8_t reply[2]{0, !success};  // [0] - version, must be 0. [1] - status, 0 for success.
+
+          reply_[0] = 0;         // Version, must be 0.
+          reply_[1] = !success;  // Status, 0 for success.
 
           boost::asio::async_write(
-              tcp_socket_client_, boost::asio::buffer(reply),
-              [this, self, success, callback](const error_code& ecode, size_t)
-              { callback(success ? ecode : boost::asio::error::access_denied); });
+              tcp_socket_client_, boost::asio::buffer(reply_),
+              common::BindHandlerAllocator(
+                  [this, self, success, callback](const error_code& ecode, size_t)
+                  { callback(success ? ecode : boost::asio::error::access_denied); }));
         }
       });
 }
 
-UsernamePassword::Credentials UsernamePassword::GetCredentials() const {
-  const char* username_begin = buffer_.data() + sizeof(uint8_t) * 2;
-  const uint8_t username_len = *reinterpret_cast<const uint8_t*>(buffer_.data() + sizeof(uint8_t));
+size_t UsernamePassword::GetNegotiationSize(boost::span<const char> data) {
+  // +-----+------+----------+------+----------+
+  // | VER | ULEN |  UNAME   | PLEN |  PASSWD  |
+  // +-----+------+----------+------+----------+
+  if (data.size() < sizeof(uint8_t) * 2) {
+    return HandshakeBuffer::kIncomplete;
+  }
+
+  const uint8_t username_len = static_cast<uint8_t>(data[1]);
+  const size_t password_len_offset = sizeof(uint8_t) * 2 + username_len;
+  if (data.size() <= password_len_offset) {
+    return HandshakeBuffer::kIncomplete;
+  }
+
+  const uint8_t password_len = static_cast<uint8_t>(data[password_len_offset]);
+  const size_t size = password_len_offset + sizeof(uint8_t) + password_len;
+  return data.size() >= size ? size : HandshakeBuffer::kIncomplete;
+}
+
+UsernamePassword::Credentials UsernamePassword::GetCredentials(boost::span<const char> data) {
+  const char* username_begin = data.data() + sizeof(uint8_t) * 2;
+  const uint8_t username_len = *reinterpret_cast<const uint8_t*>(data.data() + sizeof(uint8_t));
 
   const char* password_begin = username_begin + username_len + sizeof(uint8_t);
   const uint8_t password_len = *reinterpret_cast<const uint8_t*>(username_begin + username_len);
 
-  return {std::string(username_begin, username_len), std::string(password_begin, password_len)};
+  return {{username_begin, username_len}, {password_begin, password_len}};
 }
 
-}  // namespace session::socks5::detail
\ No newline at end of file
+}  // namespace session::socks5::detail
@@ -1,19 +1,21 @@
 #ifndef SESSSION_SOCKS5_AUTH_USER_PASSWORD_H_
 #define SESSSION_SOCKS5_AUTH_USER_PASSWORD_H_
 
-#include <vector>
+#include <boost/core/span.hpp>
+#include <string_view>
 #include "AbstractAuth.h"
 
 namespace session::socks5::detail {
 
 class UsernamePassword final : public AbstractAuth {
-  static constexpr size_t kSizeOfNegotiation = 513;
-
+ public:
+  // The credentials point into the negotiation message.
   struct Credentials {
-    std::string username;
-    std::string password;
+    std::string_view username;
+    std::string_view password;
   };
 
+ private:
   UsernamePassword(net_tcp::socket& client_socket);
 
  public:
@@ -28,13 +30,17 @@ class UsernamePassword final : public AbstractAuth {
   static std::shared_ptr<UsernamePassword> Create(net_tcp::socket& client_socket);
 
   // Starts the authentication process.
-  void Execute(Callback callback) override;
+  void Execute(HandshakeBuffer& buffer, Callback callback) override;
 
- private:
-  // Extracts credentials from the buffer.
-  Credentials GetCredentials() const;
+  // Returns the size of the negotiation message at the front of the data, like
+  // HandshakeBuffer::GetSizeFunction.
+  static size_t GetNegotiationSize(boost::span<const char> data);
+
+  // Extracts credentials from the negotiation message.
+  static Credentials GetCredentials(boost::span<const char> data);
 
-  std::vector<char> buffer_;
+ private:
+  uint8_t reply_[2];
 };
 
 }  // namespace session::socks5::detail
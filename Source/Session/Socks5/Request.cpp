@@ -0,0 +1,126 @@
+#include "Request.h"
+#include <boost/endian.hpp>
+#include <cstring>
+#include "Common/AddressResolve.h"
+#include "Session/HandshakeBuffer.h"
+
+namespace session::socks5::detail {
+
+size_t GetGreetingSize(boost::span<const char> data) {
+  // +-----+----------+----------+
+  // | VER | NMETHODS |  METHODS |
+  // +-----+----------+----------+
+  if (data.size() < sizeof(AuthenticationMessage)) {
+    return HandshakeBuffer::kIncomplete;
+  }
+
+  auto message = reinterpret_cast<const AuthenticationMessage*>(data.data());
+  if (message->version != 0x5 || message->count == 0) {
+    return HandshakeBuffer::kInvalid;
+  }
+
+  const auto size = sizeof(AuthenticationMessage) + message->count;
+  return data.size() >= size ? size : HandshakeBuffer::kIncomplete;
+}
+
+size_t GetRequestSize(boost::span<const char> data) {
+  // +-----+-----+-------+------+----------+----------+
+  // | VER | CMD |  RSV  | ATYP | DST.ADDR | DST.PORT |
+  // +-----+-----+-------+------+----------+----------+
+  if (data.size() < sizeof(TcpMessage)) {
+    return HandshakeBuffer::kIncomplete;
+  }
+
+  // The command is checked by the session, which replies to an unknown one.
+  auto message = reinterpret_cast<const TcpMessage*>(data.data());
+  if (message->version != 0x5) {
+    return HandshakeBuffer::kInvalid;
+  }
+
+  size_t size = sizeof(TcpMessage);
+  switch (static_cast<AddressType>(message->address_type)) {
+    case AddressType::kIPv4:
+      size += sizeof(AddressV4);
+      break;
+    case AddressType::kIPv6:
+      size += sizeof(AddressV6);
+      break;
+    case AddressType::kDomainName:
+      if (data.size() < size + sizeof(AddressDomain)) {
+        return HandshakeBuffer::kIncomplete;
+      }
+      size += sizeof(AddressDomain) +
+              reinterpret_cast<const AddressDomain*>(data.data() + sizeof(TcpMessage))->length +
+              sizeof(uint16_t);
+      break;
+    default:
+      // The length of the address is unknown, the header is the message and the session replies
+      // that the address type is not supported.
+      return size;
+  }
+
+  return data.size() >= size ? size : HandshakeBuffer::kIncomplete;
+}
+
+bool GetRequestDestination(uint8_t address_type, const char* address_begin,
+                           RequestDestination& destination) {
+  destination.type = static_cast<AddressType>(address_type);
+
+  switch (destination.type) {
+    case AddressType::kIPv4: {
+      auto ipv4 = reinterpret_cast<const AddressV4*>(address_begin);
+      destination.endpoint = common::GetIPv4Endpoint(ipv4->address, ipv4->port);
+      destination.domain = {};
+      return true;
+    }
+    case AddressType::kIPv6: {
+      auto ipv6 = reinterpret_cast<const AddressV6*>(address_begin);
+      destination.endpoint = common::GetIPv6Endpoint(ipv6->address, ipv6->port);
+      destination.domain = {};
+      return true;
+    }
+    case AddressType::kDomainName: {
+      auto domain = reinterpret_cast<const AddressDomain*>(address_begin);
+      auto name = address_begin + sizeof(AddressDomain);
+      uint16_t port;
+
+      std::memcpy(&port, name + domain->length, sizeof(port));
+      destination.endpoint = {};
+      destination.endpoint.port(boost::endian::big_to_native(port));
+      destination.domain = {name, domain->length};
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+size_t WriteReply(ReplyCode code, const net_tcp::endpoint& endpoint, char* buffer) {
+  auto raw_message = reinterpret_cast<TcpMessage*>(buffer);
+  auto port = boost::endian::native_to_big(endpoint.port());
+  const auto address = endpoint.address();
+  size_t size = sizeof(TcpMessage);
+
+  raw_message->version = 0x5;
+  raw_message->status = static_cast<uint8_t>(code);
+  raw_message->reserved = 0x0;
+  raw_message->address_type =
+      static_cast<uint8_t>(address.is_v4() ? AddressType::kIPv4 : AddressType::kIPv6);
+
+  if (address.is_v4()) {
+    auto bytes = boost::endian::native_to_big(address.to_v4().to_uint());
+
+    std::memcpy(buffer + size, &bytes, sizeof(bytes));
+    size += sizeof(bytes);
+  } else {
+    auto bytes = address.to_v6().to_bytes();
+
+    std::memcpy(buffer + size, bytes.data(), bytes.size());
+    size += bytes.size();
+  }
+
+  std::memcpy(buffer + size, &port, sizeof(port));
+  return size + sizeof(port);
+}
+
+}  // namespace session::socks5::detail
@@ -0,0 +1,43 @@
+#ifndef SESSION_SOCKS5_REQUEST_H_
+#define SESSION_SOCKS5_REQUEST_H_
+
+#include <boost/core/span.hpp>
+#include <cstddef>
+#include <string_view>
+#include "Session/Socks5/Socks5Types.h"
+#include "Types.h"
+
+namespace session::socks5::detail {
+
+// The size of the largest reply with an address (IPv6).
+constexpr size_t kMaxReplySize = sizeof(TcpMessage) + sizeof(AddressV6);
+
+// Returns the size of the method selection message of the client at the front of the data, like
+// HandshakeBuffer::GetSizeFunction.
+size_t GetGreetingSize(boost::span<const char> data);
+
+// Returns the size of the request at the front of the data, like
+// HandshakeBuffer::GetSizeFunction. A request with an unknown command is framed like the others,
+// one with an unknown address type is only its header, both are answered by the session.
+size_t GetRequestSize(boost::span<const char> data);
+
+// The destination of a request.
+struct RequestDestination {
+  AddressType type;
+  net_tcp::endpoint endpoint;  // Only the port is set if the destination is a domain name.
+  std::string_view domain;     // Points into the request, set if the destination is a domain name.
+};
+
+// Reads the destination which follows the header of a request (TcpMessage or UdpMessage) with
+// the address type, the size of the request is checked by the caller.
+// Returns false if the address type is unknown.
+bool GetRequestDestination(uint8_t address_type, const char* address_begin,
+                           RequestDestination& destination);
+
+// Writes the reply with the code and the endpoint into the buffer of kMaxReplySize bytes.
+// Returns the size of the reply.
+size_t WriteReply(ReplyCode code, const net_tcp::endpoint& endpoint, char* buffer);
+
+}  // namespace session::socks5::detail
+
+#endif  // !SESSION_SOCKS5_REQUEST_H_
@@ -1,88 +1,41 @@
 #include "Socks5.h"
 #include <boost/asio/write.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/endian.hpp>
+#include <algorithm>
 #include <set>
 #include "../../Common/Strings.h"
 #include "Authentication/AbstractAuth.h"
 #include "Authentication/NoAuth.h"
 #include "Authentication/UsernamePassword.h"
+#include "Udp/Header.h"
+#include "Udp/Segments.h"
 
 namespace session::socks5 {
 namespace {
 
-// Checks the SOCKS5 authentication message for correctness.
-bool IsValidAuthMessage(const boost::span<char> data) {
-  if (data.size() > sizeof(AuthenticationMessage)) {
-    auto header = reinterpret_cast<const AuthenticationMessage*>(data.data());
-
-    return header->version == 0x5 && header->count > 0 &&
-           (data.size() - sizeof(AuthenticationMessage)) >= header->count;
-  }
-
-  return false;
-}
-
-// Checks the SOCKS5 TCP message for correctness.
-bool IsValidTcpMessage(const boost::span<char> data) {
-  if (data.size() > sizeof(TcpMessage)) {
-    auto raw_message = reinterpret_cast<const TcpMessage*>(data.data());
-    if (raw_message->version == 0x5 &&
-        raw_message->command >= static_cast<uint8_t>(Command::kConnect) &&
-        raw_message->command <= static_cast<uint8_t>(Command::kUdpAssociate)) {
-      switch (static_cast<AddressType>(raw_message->address_type)) {
-        case AddressType::kIPv4:
-          return data.size() >= sizeof(TcpMessage) + sizeof(AddressV4);
-        case AddressType::kIPv6:
-          return data.size() >= sizeof(TcpMessage) + sizeof(AddressV6);
-        case AddressType::kDomainName:
-          return data.size() >= sizeof(TcpMessage) + sizeof(AddressDomain);
-      }
-    }
-  }
-
-  return false;
-}
-
-std::shared_ptr<std::vector<uint8_t>> CreateUdpMessage(const net_udp::endpoint& endpoint) {
-  auto message = std::make_shared<std::vector<uint8_t>>(std::vector<uint8_t>(sizeof(UdpMessage)));
-  auto raw_message = reinterpret_cast<UdpMessage*>(message->data());
-
-  raw_message->reserved = 0x0;
-  raw_message->fragment = 0;
-  raw_message->address_type =
-      static_cast<uint8_t>(endpoint.address().is_v4() ? AddressType::kIPv4 : AddressType::kIPv6);
-
-  if (endpoint.address().is_v4()) {
-    auto address = boost::endian::native_to_big(endpoint.address().to_v4().to_uint());
-
-    message->insert(message->end(), reinterpret_cast<uint8_t*>(&address),
-                    reinterpret_cast<uint8_t*>(&address) + sizeof(address));
-  } else {
-    auto address = endpoint.address().to_v6().to_bytes();
-
-    message->insert(message->end(), reinterpret_cast<uint8_t*>(address.data()),
-                    reinterpret_cast<uint8_t*>(address.data()) + address.size());
-  }
-
-  auto service = boost::endian::native_to_big(endpoint.port());
-
-  message->insert(message->end(), reinterpret_cast<uint8_t*>(&service),
-                  reinterpret_cast<uint8_t*>(&service) + sizeof(service));
-
-  return message;
-}
+static_assert(detail::kMaxUdpHeaderSize <= common::UdpBatch::kHeadroom,
+              "The SOCKS5 UDP header must fit into the headroom of the received datagrams.");
 
 }  // namespace
 
 Socks5Session::Socks5Session(session_id id, const std::weak_ptr<Server>& server,
                              net_tcp::socket&& socket)
     : AbstractSession(id, server, std::move(socket)),
-      buffer_{},
       tcp_socket_application_{tcp_socket_client_.get_executor()},
       tcp_acceptor_bind_{tcp_socket_client_.get_executor()},
       udp_socket_{tcp_socket_client_.get_executor()},
+      connector_{},
+      reply_{},
       udp_endpoint_client_{},
-      udp_endpoint_application_{} {}
+      udp_destinations_{},
+      udp_send_queue_{config_->GetSocks5().udp_queue_size,
+                      config_->GetSocks5().udp_drop_policy == "oldest"
+                          ? detail::UdpSendQueue::DropPolicy::kOldest
+                          : detail::UdpSendQueue::DropPolicy::kTail},
+      udp_write_waiting_{false},
+      udp_offload_{false},
+      udp_relay_{} {}
 
 std::shared_ptr<Socks5Session> Socks5Session::Create(session_id id,
                                                      const std::weak_ptr<Server>& server,
@@ -97,30 +50,46 @@ void Socks5Session::Start() {
   // +-----+----------+----------+
   // |	1  |	1 	  | 1 to 255 |
   // +-----+----------+----------+
-  buffer_.resize(kTcpBufferSize);
-  tcp_socket_client_.async_read_some(
-      boost::asio::buffer(buffer_),
-      [this, self = shared_from_this()](const error_code& ecode, size_t size)
+  CountSessionAs(common::Metrics::Counter::kSocks5Handshake);
+  buffer_.DoReadMessage(
+      tcp_socket_client_, detail::GetGreetingSize,
+      [this, self = shared_from_this()](const error_code& ecode)
       {
-        if (ecode) {
-          DeleteSession(
-              log_level::error,
-              (boost::format("Error reading the authentication message: %s.") % ecode.message())
-                  .str());
-        } else if (!IsValidAuthMessage({buffer_.data(), size})) {
-          DeleteSession(log_level::error, "Invalid authentication message.");
+        if (ecode == boost::asio::error::invalid_argument ||
+            ecode == boost::asio::error::message_size) {
+          SESSION_LOGGER(error) << "Invalid authentication message.";
+          DeleteSession();
+        } else if (ecode) {
+          SESSION_LOGGER(error) << "Error reading the authentication message: " << ecode.message()
+                                << ".";
+          DeleteSession();
         } else {
+          RecordPhase(common::Metrics::Latency::kSocks5Greeting);
           DoProcessAuthentication();
         }
       });
 }
 
+net_tcp::endpoint Socks5Session::GetApplicationEndpoint() const {
+  error_code ecode;
+  auto endpoint = tcp_socket_application_.remote_endpoint(ecode);
+  return ecode ? net_tcp::endpoint{} : endpoint;
+}
+
 void Socks5Session::Stop() {
   error_code ecode;
+  CancelTimeout();
+  if (connector_) {
+    connector_->Cancel();
+  }
   tcp_acceptor_bind_.close(ecode);
   tcp_socket_client_.close(ecode);
   tcp_socket_application_.close(ecode);
   udp_socket_.close(ecode);
+  if (udp_relay_) {
+    udp_relay_->Unregister(session_id_);
+    udp_relay_.reset();
+  }
 }
 
 void Socks5Session::DoProcessAuthentication() {
@@ -146,31 +115,33 @@ void Socks5Session::DoProcessAuthentication() {
   }
 
   if (!auth_executor) {
-    DeleteSession(log_level::error, "A suitable authentication method was not found.");
+    SESSION_LOGGER(error) << "A suitable authentication method was not found.";
+    DeleteSession();
   } else {
     boost::asio::async_write(
         tcp_socket_client_, boost::asio::buffer(buffer_.data(), sizeof(AuthenticationMessage)),
-        [this, self = shared_from_this(), auth_executor](const error_code& ecode, size_t size)
-        {
-          if (ecode) {
-            DeleteSession(
-                log_level::error,
-                (boost::format("Failed to send authentication method: %s.") % ecode.message())
-                    .str());
-          } else {
-            auth_executor->Execute(
-                [this, self](const error_code& ecode)
-                {
-                  if (ecode) {
-                    DeleteSession(
-                        log_level::error,
-                        (boost::format("Authentication error: %s.") % ecode.message()).str());
-                  } else {
-                    DoExecuteCommand_();
-                  }
-                });
-          }
-        });
+        common::BindHandlerAllocator(
+            [this, self = shared_from_this(), auth_executor](const error_code& ecode, size_t)
+            {
+              if (ecode) {
+                SESSION_LOGGER(error) << "Failed to send authentication method: "
+                                      << ecode.message() << ".";
+                DeleteSession();
+              } else {
+                auth_executor->Execute(
+                    buffer_,
+                    [this, self](const error_code& ecode)
+                    {
+                      if (ecode) {
+                        SESSION_LOGGER(error) << "Authentication error: " << ecode.message() << ".";
+                        DeleteSession();
+                      } else {
+                        RecordPhase(common::Metrics::Latency::kSocks5Authentication);
+                        DoExecuteCommand_();
+                      }
+                    });
+              }
+            }));
   }
 }
 
@@ -182,24 +153,38 @@ void Socks5Session::DoExecuteCommand_() {
   // +-----+-----+-------+------+----------+----------+
   // |	1  |  1  | X'00' |   1  | Variable |	2     |
   // +-----+-----+-------+------+----------+----------+
-  tcp_socket_client_.async_read_some(
-      boost::asio::buffer(buffer_),
-      [this, self = shared_from_this()](const error_code& ecode, size_t size)
+  buffer_.DoReadMessage(
+      tcp_socket_client_, detail::GetRequestSize,
+      [this, self = shared_from_this()](const error_code& ecode)
       {
-        if (ecode) {
-          DeleteSession(
-              log_level::error,
-              (boost::format("Error reading the command request: %s.") % ecode.message()).str());
-        } else if (!IsValidTcpMessage({buffer_.data(), size})) {
-          DeleteSession(log_level::error, "Invalid command message.");
+        if (ecode == boost::asio::error::invalid_argument ||
+            ecode == boost::asio::error::message_size) {
+          SESSION_LOGGER(error) << "Invalid command message.";
+          DeleteSession();
+        } else if (ecode) {
+          SESSION_LOGGER(error) << "Error reading the command request: " << ecode.message() << ".";
+          DeleteSession();
         } else {
+          RecordPhase(common::Metrics::Latency::kSocks5Request);
+          if (common::Trace::IsEnabled()) {
+            TraceRequest_();
+          }
+
           auto message = reinterpret_cast<const TcpMessage*>(buffer_.data());
+          const auto address_type = static_cast<AddressType>(message->address_type);
+          if (address_type != AddressType::kIPv4 && address_type != AddressType::kIPv6 &&
+              address_type != AddressType::kDomainName) {
+            SESSION_LOGGER(error) << "Unknown address type.";
+            DoSendReplyAndDeleteSession_(ReplyCode::kUnknownAddress, kEmptyTcpEndpoint);
+            return;
+          }
+
           switch (static_cast<Command>(message->command)) {
             case Command::kConnect:
               if (!config_->GetSocks5().enable_connect) {
-                DoSendReplyAndDeleteSession_(
-                    ReplyCode::kNotAllowed, kEmptyTcpEndpoint, log_level::error,
-                    "The CONNECT command is disabled in the application configuration.");
+                SESSION_LOGGER(error)
+                    << "The CONNECT command is disabled in the application configuration.";
+                DoSendReplyAndDeleteSession_(ReplyCode::kNotAllowed, kEmptyTcpEndpoint);
               } else {
                 DoConnectCommand();
               }
@@ -211,9 +196,9 @@ void Socks5Session::DoExecuteCommand_() {
               // status reports, but may use a server-to-client connection for
               // transferring data on demand (e.g. LS, GET, PUT).
               if (!config_->GetSocks5().enable_bind) {
-                DoSendReplyAndDeleteSession_(
-                    ReplyCode::kNotAllowed, kEmptyTcpEndpoint, log_level::error,
-                    "The BIND command is disabled in the application configuration.");
+                SESSION_LOGGER(error)
+                    << "The BIND command is disabled in the application configuration.";
+                DoSendReplyAndDeleteSession_(ReplyCode::kNotAllowed, kEmptyTcpEndpoint);
               } else {
                 DoBindCommand_();
               }
@@ -224,60 +209,105 @@ void Socks5Session::DoExecuteCommand_() {
               // DST.PORT fields contain the address and port that the client expects
               // to use to send UDP datagrams on for the association.
               if (!config_->GetSocks5().enable_udp) {
-                DoSendReplyAndDeleteSession_(
-                    ReplyCode::kNotAllowed, kEmptyTcpEndpoint, log_level::error,
-                    "The UDP-ASSOCIATE command is disabled in the application configuration.");
+                SESSION_LOGGER(error)
+                    << "The UDP-ASSOCIATE command is disabled in the application configuration.";
+                DoSendReplyAndDeleteSession_(ReplyCode::kNotAllowed, kEmptyTcpEndpoint);
               } else {
                 DoUdpAssociateCommand_();
               }
               break;
             default:
-              DoSendReplyAndDeleteSession_(ReplyCode::kUnknownCommand, kEmptyTcpEndpoint,
-                                           log_level::error, "Unknown command.");
+              SESSION_LOGGER(error) << "Unknown command.";
+              DoSendReplyAndDeleteSession_(ReplyCode::kUnknownCommand, kEmptyTcpEndpoint);
               break;
           }
         }
       });
 }
 
+void Socks5Session::OnConnectTimeout() {
+  // The pending connect or accept is abandoned, the client is told the command has failed.
+  error_code ecode;
+  if (connector_) {
+    connector_->Cancel();
+    connector_.reset();
+  }
+  tcp_acceptor_bind_.close(ecode);
+
+  SESSION_LOGGER(warning) << "The command did not connect in " << config_->GetTimeouts().connect
+                          << " seconds.";
+  DoSendReplyAndDeleteSession_(ReplyCode::kTTL, kEmptyTcpEndpoint);
+}
+
+void Socks5Session::TraceRequest_() {
+  auto message = reinterpret_cast<const TcpMessage*>(buffer_.data());
+  const auto address_begin = buffer_.data() + sizeof(TcpMessage);
+  detail::RequestDestination destination;
+  if (!detail::GetRequestDestination(message->address_type, address_begin, destination)) {
+    return;
+  }
+
+  // The hash is of the address bytes as sent, or of the name.
+  std::string_view address = destination.domain;
+  if (destination.type == AddressType::kIPv4) {
+    address = {address_begin, sizeof(AddressV4::address)};
+  } else if (destination.type == AddressType::kIPv6) {
+    address = {address_begin, sizeof(AddressV6::address)};
+  }
+
+  const auto& socks5 = config_->GetSocks5();
+  const bool authenticated = !socks5.username.empty() && !socks5.password.empty();
+  TraceRequest(5, message->command, static_cast<common::TraceAddressType>(destination.type),
+               address, destination.endpoint.port(), authenticated ? socks5.username.size() : 0);
+}
+
 void Socks5Session::DoConnectCommand() {
-  DoResolveAddress_(
-      [this, self = shared_from_this()](const error_code& ecode, const net_tcp::endpoint& endpoint)
+  CountSessionAs(common::Metrics::Counter::kSocks5Connect);
+  ArmTimeout(Timeout::kConnect);
+  DoResolveEndpoints_(
+      buffer_.GetMessage(),
+      [this, self = shared_from_this()](const error_code& ecode, const std::string& host,
+                                        std::vector<net_tcp::endpoint> endpoints)
       {
+        // The session was deleted while the name was resolved, by a timeout or the admin.
+        if (!tcp_socket_client_.is_open()) {
+          return;
+        }
+
+        RecordPhase(common::Metrics::Latency::kSocks5Resolve);
         if (ecode) {
-          DoSendReplyAndDeleteSession_(
-              ReplyCode::kErrorHost, kEmptyTcpEndpoint, log_level::error,
-              (boost::format("Domain Name resolution error: %s.") % ecode.message()).str());
+          SESSION_LOGGER(error) << "Domain Name resolution error: " << ecode.message() << ".";
+          DoSendReplyAndDeleteSession_(ReplyCode::kErrorHost, kEmptyTcpEndpoint);
         } else {
-          tcp_socket_application_.async_connect(
-              endpoint,
-              [this, self, endpoint](const error_code& ecode)
+          connector_ = common::HappyEyeballs::Create(tcp_socket_client_.get_executor());
+          connector_->Connect(
+              host, std::move(endpoints),
+              [this, self](const error_code& ecode, net_tcp::socket&& socket,
+                           const net_tcp::endpoint& endpoint)
               {
+                connector_.reset();
+                RecordPhase(common::Metrics::Latency::kSocks5Connect);
+
                 if (ecode) {
-                  DoSendReplyAndDeleteSession_(
-                      ReplyCode::kErrorNet, kEmptyTcpEndpoint, log_level::error,
-                      (boost::format("Server connection error [%s:%d]: %s.") %
-                       endpoint.address().to_string() % endpoint.port() % ecode.message())
-                          .str());
+                  SESSION_LOGGER(error) << "Server connection error ["
+                                        << endpoint.address().to_string() << ":" << endpoint.port()
+                                        << "]: " << ecode.message() << ".";
+                  DoSendReplyAndDeleteSession_(ReplyCode::kErrorNet, kEmptyTcpEndpoint);
                 } else {
+                  tcp_socket_application_ = std::move(socket);
+
                   DoSendReply_(
-                      ReplyCode::kOk, tcp_socket_application_.remote_endpoint(),
+                      ReplyCode::kOk, endpoint,
                       [this, self, endpoint]()
                       {
-                        LogMessage(
-                            log_level::info,
-                            (boost::format(
-                                 "Running the CONNECT command, client=%s:%d, server=%s:%d.") %
-                             tcp_socket_client_.remote_endpoint().address().to_string() %
-                             tcp_socket_client_.remote_endpoint().port() %
-                             tcp_socket_application_.remote_endpoint().address().to_string() %
-                             tcp_socket_application_.remote_endpoint().port())
-                                .str());
-
-                        DoTunnelingTraffic(tcp_socket_client_, tcp_socket_application_,
-                                           boost::span<char>{buffer_.data(), buffer_.size()});
-                        DoTunnelingTraffic(tcp_socket_application_, tcp_socket_client_,
-                                           boost::span<char>{buffer_.data(), buffer_.size()});
+                        RecordPhase(common::Metrics::Latency::kSocks5Reply);
+
+                        error_code ecode;
+                        SESSION_LOGGER(info) << "Running the CONNECT command, client="
+                                             << tcp_socket_client_.remote_endpoint(ecode)
+                                             << ", server=" << endpoint << ".";
+
+                        DoTunnelingTraffic(tcp_socket_client_, tcp_socket_application_);
                       });
                 }
               });
@@ -285,7 +315,28 @@ void Socks5Session::DoConnectCommand() {
       });
 }
 
+void Socks5Session::DoResolveEndpoints_(boost::span<char> data,
+                                        common::DomainEndpointsCallbackTCP callback) {
+  auto message = reinterpret_cast<const TcpMessage*>(data.data());
+  detail::RequestDestination destination;
+
+  if (!detail::GetRequestDestination(message->address_type, data.data() + sizeof(TcpMessage),
+                                     destination)) {
+    return;
+  }
+
+  if (destination.type == AddressType::kDomainName) {
+    common::ResolveDomainEndpoints(tcp_socket_client_.get_executor(),
+                                   std::string(destination.domain), destination.endpoint.port(),
+                                   callback);
+  } else {
+    callback({}, {}, {destination.endpoint});
+  }
+}
+
 void Socks5Session::DoBindCommand_() {
+  CountSessionAs(common::Metrics::Counter::kSocks5Bind);
+  ArmTimeout(Timeout::kConnect);
   const auto addr_type =
       static_cast<AddressType>(reinterpret_cast<const TcpMessage*>(buffer_.data())->address_type) ==
               AddressType::kIPv6
@@ -303,35 +354,35 @@ void Socks5Session::DoBindCommand_() {
         // After the target application connects, the sequence of actions is identical to the CONNECT command.
         tcp_acceptor_bind_.async_accept(
             tcp_socket_application_,
-            [this, self = shared_from_this()](const error_code& ecode)
-            {
-              error_code ecode_ignore;
-              tcp_acceptor_bind_.close(ecode_ignore);
+            common::BindHandlerAllocator(
+                [this, self = shared_from_this()](const error_code& ecode)
+                {
+                  error_code ecode_ignore;
+                  tcp_acceptor_bind_.close(ecode_ignore);
 
-              if (ecode) {
-                DoSendReplyAndDeleteSession_(
-                    ReplyCode::kRefused, kEmptyTcpEndpoint, log_level::error,
-                    (boost::format("Failed to accept incoming connection: %s.") % ecode.message())
-                        .str());
-              } else {
-                LogMessage(log_level::info,
-                           (boost::format("Running the BIND command, client=%s:%d, server=%s:%d.") %
-                            tcp_socket_client_.remote_endpoint().address().to_string() %
-                            tcp_socket_client_.remote_endpoint().port() %
-                            tcp_socket_application_.remote_endpoint().address().to_string() %
-                            tcp_socket_application_.remote_endpoint().port())
-                               .str());
-
-                DoTunnelingTraffic(tcp_socket_client_, tcp_socket_application_,
-                                   boost::span<char>{buffer_.data(), buffer_.size()});
-                DoTunnelingTraffic(tcp_socket_application_, tcp_socket_client_,
-                                   boost::span<char>{buffer_.data(), buffer_.size()});
-              }
-            });
+                  if (ecode == boost::asio::error::operation_aborted) {
+                    return;  // The session was stopped or has timed out.
+                  }
+
+                  if (ecode) {
+                    SESSION_LOGGER(error) << "Failed to accept incoming connection: "
+                                          << ecode.message() << ".";
+                    DoSendReplyAndDeleteSession_(ReplyCode::kRefused, kEmptyTcpEndpoint);
+                  } else {
+                    SESSION_LOGGER(info)
+                        << "Running the BIND command, client="
+                        << tcp_socket_client_.remote_endpoint(ecode_ignore)
+                        << ", server=" << tcp_socket_application_.remote_endpoint(ecode_ignore)
+                        << ".";
+
+                    DoTunnelingTraffic(tcp_socket_client_, tcp_socket_application_);
+                  }
+                }));
       });
 }
 
 void Socks5Session::DoUdpAssociateCommand_() {
+  CountSessionAs(common::Metrics::Counter::kSocks5UdpAssociate);
   auto addr_type =
       static_cast<AddressType>(reinterpret_cast<const TcpMessage*>(buffer_.data())->address_type) ==
               AddressType::kIPv6
@@ -342,112 +393,315 @@ void Socks5Session::DoUdpAssociateCommand_() {
   // ASSOCIATE request arrived at terminates.
   WaitForCloseTCPConnection(tcp_socket_client_);
 
+  ArmTimeout(Timeout::kUdp);
+
+  if (auto relay = detail::UdpRelay::GetThreadInstance()) {
+    DoUdpAssociateOnRelay_(relay, addr_type == net_udp::v6());
+    return;
+  }
+
   udp_socket_.open(addr_type);
   udp_socket_.bind(net_udp::endpoint(addr_type, 0));
+  udp_socket_.non_blocking(true);
+  udp_offload_ = config_->GetSocks5().udp_offload && common::UdpBatch::EnableOffload(udp_socket_);
   DoSendReply_(ReplyCode::kOk, udp_socket_.local_endpoint(),
                [this, self = shared_from_this()]()
                {
-                 buffer_.resize(kUdpBufferSize);
-                 LogMessage(log_level::info, "Running the UDP-ASSOCIATE command.");
+                 // The handshake is over, its buffer is no longer needed.
+                 buffer_.Release();
+                 SESSION_LOGGER(info) << "Running the UDP-ASSOCIATE command.";
                  DoTunnelingUdpTraffic_();
                });
 }
 
+void Socks5Session::DoUdpAssociateOnRelay_(const std::shared_ptr<detail::UdpRelay>& relay,
+                                           bool is_v6) {
+  // The client may announce the port it sends from, the address is the one of the connection.
+  auto message = reinterpret_cast<const TcpMessage*>(buffer_.data());
+  auto address_begin = buffer_.data() + sizeof(TcpMessage);
+  uint16_t client_port = 0;
+  error_code ecode;
+
+  if (static_cast<AddressType>(message->address_type) == AddressType::kIPv4) {
+    client_port = boost::endian::big_to_native(
+        reinterpret_cast<const AddressV4*>(address_begin)->port);
+  } else if (static_cast<AddressType>(message->address_type) == AddressType::kIPv6) {
+    client_port = boost::endian::big_to_native(
+        reinterpret_cast<const AddressV6*>(address_begin)->port);
+  }
+
+  const auto client_address = tcp_socket_client_.remote_endpoint(ecode).address();
+  if (ecode) {
+    SESSION_LOGGER(error) << "Error reading the address of the client: " << ecode.message() << ".";
+    DeleteSession();
+    return;
+  }
+
+  // The reply waits while another association of the client address without a port has not
+  // received its first datagram.
+  const bool registered = relay->Register(
+      session_id_, client_address, client_port, is_v6, GetTraceFlow(), GetActivity(),
+      [this, weak = weak_from_this()](const net_udp::endpoint& endpoint)
+      {
+        auto self = weak.lock();
+        if (!self) {
+          return;
+        }
+
+        DoSendReply_(ReplyCode::kOk, endpoint,
+                     [this, self]()
+                     {
+                       // The handshake is over, its buffer is no longer needed.
+                       buffer_.Release();
+                       SESSION_LOGGER(info)
+                           << "Running the UDP-ASSOCIATE command on the shared relay.";
+                     });
+      });
+
+  if (!registered) {
+    SESSION_LOGGER(warning) << "The shared UDP relay does not serve the address family.";
+    DoSendReplyAndDeleteSession_(ReplyCode::kError, kEmptyUdpEndpoint);
+    return;
+  }
+
+  udp_relay_ = relay;
+}
+
 void Socks5Session::DoTunnelingUdpTraffic_() {
   // When a UDP relay server decides to relay a UDP datagram, it does so silently, without
   // any notification to the requesting client. Similarly, it will drop datagrams it cannot
   // or will not relay.
-  udp_socket_.async_receive_from(
-      boost::asio::buffer(buffer_, buffer_.size()), udp_endpoint_application_,
-      [this, self = shared_from_this()](const error_code& ecode, size_t readed_size)
-      {
-        if (ecode) {
-          LogMessage(
-              log_level::warning,
-              (boost::format("Failed to receive data from UDP socket: %s.") % ecode.message())
-                  .str());
-        } else {
-          // We need to get the sender address for the first message, since the sender of the first
-          // message is the client.
-          if (udp_endpoint_client_ == net_udp::endpoint(udp_endpoint_client_.protocol(), 0)) {
-            udp_endpoint_client_ = udp_endpoint_application_;
-          }
+  udp_socket_.async_wait(
+      net_udp::socket::wait_read,
+      common::BindHandlerAllocator(
+          [this, self = shared_from_this()](const error_code& ecode)
+          {
+            if (ecode == boost::asio::error::operation_aborted) {
+              return;  // The session is stopped.
+            } else if (ecode) {
+              SESSION_LOGGER(error) << "Failed to wait for data on UDP socket: "
+                                    << ecode.message() << ".";
+              DeleteSession();
+            } else {
+              DoRelayUdpDatagrams_();
+            }
+          }));
+}
 
-          if (udp_endpoint_client_ == udp_endpoint_application_) {  // Process incoming message
-                                                                    // from client.
-            DoResolveAddress_<UdpMessage, net_udp::resolver, net_udp::endpoint>(
-                [this, self, readed_size](const error_code& ecode,
-                                          const net_udp::endpoint& endpoint)
-                {
-                  if (ecode) {
-                    LogMessage(
-                        log_level::warning,
-                        (boost::format("Domain name resolution error from UDP message: %s.") %
-                         ecode)
-                            .str());
-                  } else {
-                    // Calculating offset to data in buffer.
-                    size_t offset_to_data = sizeof(UdpMessage);
-                    if (endpoint.address().is_v4()) {
-                      offset_to_data += sizeof(AddressV4);
-                    } else {
-                      offset_to_data += sizeof(AddressV6);
-                    }
-
-                    // Sending data to application.
-                    udp_socket_.async_send_to(
-                        boost::asio::buffer(buffer_.data() + offset_to_data,
-                                            readed_size - offset_to_data),
-                        endpoint,
-                        [this, self](const error_code& ecode, size_t)
-                        {
-                          if (ecode) {
-                            LogMessage(
-                                log_level::warning,
-                                (boost::format("Error sending UDP message: %s.") % ecode.message())
-                                    .str());
-                          } else {
-                            DoTunnelingUdpTraffic_();
-                          }
-                        });
-                  }
-                });
+void Socks5Session::DoRelayUdpDatagrams_() {
+  // The datagrams are received and sent in batches. The headers of the datagrams sent to the
+  // client are written into the headroom in front of the payload, so nothing is copied.
+  auto& batch = common::UdpBatch::GetThreadInstance();
+  error_code ecode;
 
-          } else {  // Process incoming message from application.
-            auto message = CreateUdpMessage(udp_endpoint_client_);
+  const auto count = batch.Receive(udp_socket_, ecode);
+  if (ecode == boost::asio::error::would_block) {
+    DoTunnelingUdpTraffic_();
+    return;
+  } else if (common::UdpBatch::IsTransientError(ecode)) {
+    // E.g. an application answered an earlier datagram with an ICMP error, the association goes
+    // on.
+    SESSION_LOGGER(debug) << "Failed to receive data from UDP socket: " << ecode.message() << ".";
+    DoTunnelingUdpTraffic_();
+    return;
+  } else if (ecode) {
+    SESSION_LOGGER(error) << "Failed to receive data from UDP socket: " << ecode.message() << ".";
+    DeleteSession();
+    return;
+  }
 
-            // Adding received data to response.
-            message->insert(message->end(), buffer_.begin(), buffer_.begin() + readed_size);
+  batch.Clear(udp_offload_);
+  MarkActive(std::chrono::steady_clock::now());
 
-            // Sending response to client.
-            udp_socket_.async_send_to(
-                boost::asio::buffer(*message), udp_endpoint_client_,
-                [this, self, message](const error_code& ecode, size_t)
-                {
-                  if (ecode) {
-                    LogMessage(
-                        log_level::warning,
-                        (boost::format("Error sending UDP message: %s.") % ecode.message()).str());
-                  } else {
-                    DoTunnelingUdpTraffic_();
-                  }
-                });
+  for (size_t index = 0; index < count; ++index) {
+    const auto& datagram = batch.GetDatagram(index);
+
+    // We need to get the sender address for the first message, since the sender of the
+    // first message is the client.
+    if (udp_endpoint_client_ == net_udp::endpoint(udp_endpoint_client_.protocol(), 0)) {
+      udp_endpoint_client_ = datagram.endpoint;
+    }
+
+    if (datagram.endpoint != udp_endpoint_client_) {
+      // Process incoming message from application, the header carries its address.
+      const auto segments = detail::ForEachApplicationSegment(
+          datagram,
+          [this, &batch](boost::asio::const_buffer header, boost::asio::const_buffer payload)
+          { AddUdpDatagram_(batch, udp_endpoint_client_, header, payload); });
+      TraceTransfer(common::TraceDirection::kDownload, datagram.size, segments);
+      continue;
+    }
+
+    // Process incoming message from client.
+    detail::ForEachClientSegment(
+        datagram,
+        [this, &batch](boost::span<char> header, boost::asio::const_buffer payload)
+        {
+          TraceTransfer(common::TraceDirection::kUpload, payload.size(), 1);
+
+          net_udp::endpoint endpoint;
+          if (detail::GetUdpHeaderEndpoint(header.data(), endpoint)) {
+            AddUdpDatagram_(batch, endpoint, {}, payload);
+          } else {
+            DoRelayUdpDomainDatagram_(header, payload, batch);
           }
+        });
+  }
+
+  DoSendUdpBatch_(batch);
+
+  if (count == common::UdpBatch::kCapacity) {
+    // There may be more datagrams in the socket. Let the other sessions of the thread run first.
+    boost::asio::post(udp_socket_.get_executor(),
+                      common::BindHandlerAllocator([this, self = shared_from_this()]
+                                                   { DoRelayUdpDatagrams_(); }));
+  } else {
+    DoTunnelingUdpTraffic_();
+  }
+}
+
+void Socks5Session::AddUdpDatagram_(common::UdpBatch& batch, const net_udp::endpoint& endpoint,
+                                    boost::asio::const_buffer header,
+                                    boost::asio::const_buffer payload) {
+  // The segments of coalesced datagrams can fill the batch before all of them are relayed.
+  if (!batch.Add(endpoint, header, payload)) {
+    DoSendUdpBatch_(batch);
+    batch.Add(endpoint, header, payload);
+  }
+}
+
+void Socks5Session::DoSendUdpBatch_(common::UdpBatch& batch) {
+  // The datagrams go behind the queued ones, if there are any, to keep their order.
+  size_t first = 0;
+  error_code ecode;
+
+  while (udp_send_queue_.Empty() && first < batch.GetPendingCount()) {
+    first += batch.Send(udp_socket_, first, ecode);
+
+    if (ecode == boost::asio::error::would_block) {
+      break;
+    } else if (ecode) {
+      SESSION_LOGGER(warning) << "Error sending UDP message: " << ecode.message() << ".";
+      udp_send_queue_.CountSendError(batch.GetPending(first).count);
+      ++first;
+    }
+  }
+
+  for (; first < batch.GetPendingCount(); ++first) {
+    const auto& outgoing = batch.GetPending(first);
+    for (size_t segment = 0; segment < outgoing.count; ++segment) {
+      udp_send_queue_.Push(outgoing.endpoint, outgoing.segments[segment].header,
+                           outgoing.segments[segment].payload);
+    }
+  }
+
+  batch.Clear(udp_offload_);
+
+  if (!udp_send_queue_.Empty()) {
+    DoWaitUdpWritable_();
+  }
+}
+
+void Socks5Session::DoRelayUdpDomainDatagram_(boost::span<char> header,
+                                              boost::asio::const_buffer payload,
+                                              common::UdpBatch& batch) {
+  const boost::span<const char> address{header.data() + sizeof(UdpMessage),
+                                        header.size() - sizeof(UdpMessage)};
+  detail::UdpDestinationCache::Destination* resolve;
+
+  if (auto destination = udp_destinations_.Route(address, payload, resolve)) {
+    AddUdpDatagram_(batch, destination->endpoint, {}, payload);
+  }
+  if (resolve) {
+    DoResolveUdpDestination_(header, *resolve);
+  }
+}
+
+void Socks5Session::DoResolveUdpDestination_(
+    boost::span<char> header, detail::UdpDestinationCache::Destination& destination) {
+  destination.resolving = true;
+
+  DoResolveAddress_<UdpMessage, net_udp::resolver, net_udp::endpoint>(
+      header,
+      [this, self = shared_from_this(), address = destination.address](
+          const error_code& ecode, const net_udp::endpoint& endpoint)
+      {
+        const auto pending =
+            udp_destinations_.Complete({address.data(), address.size()}, ecode, endpoint,
+                                       std::chrono::seconds(config_->GetDns().min_ttl));
+        if (ecode) {
+          SESSION_LOGGER(warning) << "Domain name resolution error from UDP message: "
+                                  << ecode.message() << ".";
+          return;
+        }
+
+        // The handler may run inside DoRelayUdpDatagrams_ while the batch of the thread is in
+        // use, so the datagrams are only queued here and sent once the socket is writable.
+        for (const auto& datagram : pending) {
+          udp_send_queue_.Push(endpoint, {}, boost::asio::buffer(datagram));
+        }
+
+        if (!udp_send_queue_.Empty()) {
+          DoWaitUdpWritable_();
         }
       });
 }
 
+void Socks5Session::DoWaitUdpWritable_() {
+  if (udp_write_waiting_) {
+    return;
+  }
+
+  udp_write_waiting_ = true;
+  udp_socket_.async_wait(
+      net_udp::socket::wait_write,
+      common::BindHandlerAllocator(
+          [this, self = shared_from_this()](const error_code& ecode)
+          {
+            udp_write_waiting_ = false;
+
+            if (ecode) {
+              SESSION_LOGGER(warning) << "Failed to wait for UDP socket to be writable: "
+                                      << ecode.message() << ".";
+              return;
+            }
+
+            udp_send_queue_.Flush(udp_socket_, common::UdpBatch::GetThreadInstance());
+            if (!udp_send_queue_.Empty()) {
+              DoWaitUdpWritable_();
+            }
+          }));
+}
+
 void Socks5Session::WaitForCloseTCPConnection(net_tcp::socket& socket) {
-  char dummy;
-  socket.async_read_some(boost::asio::buffer(&dummy, sizeof(dummy)),
-                         [this, self = shared_from_this(), &socket](const error_code& ecode, size_t)
-                         {
-                           if (ecode) {
-                             DeleteSession(log_level::info, "TCP connection was closed.");
-                           } else {
-                             WaitForCloseTCPConnection(socket);
-                           }
-                         });
+  socket.async_wait(
+      net_tcp::socket::wait_read,
+      common::BindHandlerAllocator(
+          [this, self = shared_from_this(), &socket](const error_code& ecode)
+          {
+            // The client is not expected to send anything, a readable socket without data
+            // means the connection was closed. Unexpected data is discarded.
+            error_code ecode_read;
+            bool closed = ecode || socket.available(ecode_read) == 0 || ecode_read;
+
+            if (!closed) {
+              char dummy[64];
+              socket.read_some(boost::asio::buffer(dummy), ecode_read);
+              closed = static_cast<bool>(ecode_read);
+            }
+
+            if (closed && udp_socket_.is_open()) {
+              SESSION_LOGGER(info) << "TCP connection was closed. UDP datagrams dropped: "
+                                   << udp_send_queue_.GetDroppedFull() << " (queue full), "
+                                   << udp_send_queue_.GetDroppedError() << " (send errors).";
+              DeleteSession();
+            } else if (closed) {
+              SESSION_LOGGER(info) << "TCP connection was closed.";
+              DeleteSession();
+            } else {
+              WaitForCloseTCPConnection(socket);
+            }
+          }));
 }
 
 }  // namespace session::socks5
\ No newline at end of file
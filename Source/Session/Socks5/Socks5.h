@@ -2,18 +2,23 @@
 #define SESSION_SOCKS5_H_
 
 #include <boost/asio/write.hpp>
-#include <boost/format.hpp>
-#include <boost/log/trivial.hpp>
+#include <array>
+#include <cstring>
 #include <vector>
 #include "Common/AddressResolve.h"
+#include "Common/HandlerAllocator.h"
+#include "Common/HappyEyeballs.h"
 #include "Session/AbstractSession.h"
+#include "Common/UdpBatch.h"
+#include "Session/Socks5/Request.h"
 #include "Session/Socks5/Socks5Types.h"
+#include "Session/Socks5/Udp/DestinationCache.h"
+#include "Session/Socks5/Udp/Relay.h"
+#include "Session/Socks5/Udp/SendQueue.h"
 
 namespace session::socks5 {
 
 class Socks5Session final : public AbstractSession {
-  using Callback = std::function<void()>;
-
   Socks5Session(session_id id, const std::weak_ptr<Server>& server, net_tcp::socket&& socket);
 
  public:
@@ -31,6 +36,12 @@ class Socks5Session final : public AbstractSession {
   void Stop() override;
 
  private:
+  // Returns the endpoint of the application, empty until the command has connected it.
+  net_tcp::endpoint GetApplicationEndpoint() const override;
+
+  // Abandons the pending connect or accept and replies with a failure.
+  void OnConnectTimeout() override;
+
   // The method of processing user authentication.
   // If successful, it passes control to the DoExecuteCommand_ method.
   void DoProcessAuthentication();
@@ -40,6 +51,9 @@ class Socks5Session final : public AbstractSession {
   // If successful, passes control to the DoConnectCommand_ or DoBindCommand_ or DoUdpAssociateCommand_ method.
   void DoExecuteCommand_();
 
+  // Records the request of the message in the buffer to the trace.
+  void TraceRequest_();
+
   // CONNECT command handler.
   void DoConnectCommand();
 
@@ -49,124 +63,127 @@ class Socks5Session final : public AbstractSession {
   // UDP-ASSOCIATE command handler.
   void DoUdpAssociateCommand_();
 
-  // Extracts and processes the target application address from the request.
+  // Extracts and processes the target application address from the request in the specified
+  // data.
   template <typename TMessage = TcpMessage, typename TResolver = net_tcp::resolver,
             typename TEndpoint = net_tcp::endpoint,
             typename TCallback = common::DomainResolverCallbackTCP>
-  void DoResolveAddress_(TCallback callback);
+  void DoResolveAddress_(boost::span<char> data, TCallback callback);
+
+  // Extracts the target application address of the CONNECT request. The callback receives all
+  // addresses of a domain name, or the single literal address.
+  void DoResolveEndpoints_(boost::span<char> data, common::DomainEndpointsCallbackTCP callback);
 
   // Sends a response to the client, then passes control to the callback function.
   // In case of failure, deletes the current session without transferring control to the
   // callback function.
-  template <typename TEndpoint>
-  void DoSendReply_(ReplyCode code, const TEndpoint& endpoint, Callback callback);
+  template <typename TEndpoint, typename TCallback>
+  void DoSendReply_(ReplyCode code, const TEndpoint& endpoint, TCallback callback);
 
   // Sends a response to the client and deletes the current session.
-  // It has 2 optional parameters 'log_level' and 'message' for log output.
-  // If the 'message' parameter is empty, the log will not be recorded.
+  // The reason is expected to be logged by the caller.
   template <typename TEndpoint>
-  void DoSendReplyAndDeleteSession_(ReplyCode code, const TEndpoint& endpoint,
-                                    log_level level = log_level::info,
-                                    const std::string& message = "");
+  void DoSendReplyAndDeleteSession_(ReplyCode code, const TEndpoint& endpoint);
+
+  // Registers the association with the shared UDP relay of the worker, which relays its
+  // datagrams, and sends the reply with the port of the relay.
+  void DoUdpAssociateOnRelay_(const std::shared_ptr<detail::UdpRelay>& relay, bool is_v6);
 
-  // Tunneling UDP traffic between udp_endpoint_client_ <-> udp_endpoint_application_
+  // Tunneling UDP traffic between udp_endpoint_client_ <-> applications.
+  // Waits until the UDP socket is readable, then passes control to DoRelayUdpDatagrams_.
   // In case of an error, the function will not complete its work.
   void DoTunnelingUdpTraffic_();
 
+  // Receives a batch of datagrams and relays it, then waits for the next one.
+  // The datagrams which cannot be sent right away are queued, the receiving goes on.
+  void DoRelayUdpDatagrams_();
+
+  // Adds the datagram to the batch, sending the batch first if it is full.
+  void AddUdpDatagram_(common::UdpBatch& batch, const net_udp::endpoint& endpoint,
+                       boost::asio::const_buffer header, boost::asio::const_buffer payload);
+
+  // Sends the datagrams of the batch and empties it. The datagrams which cannot be sent right
+  // away are queued.
+  void DoSendUdpBatch_(common::UdpBatch& batch);
+
+  // Waits until the UDP socket is writable, then sends the queued datagrams.
+  // Does nothing if the wait is already in progress.
+  void DoWaitUdpWritable_();
+
+  // Relays the payload of a client datagram addressed by a domain name. The payload is added to
+  // the batch if the name is resolved, otherwise it is queued until the name is resolved.
+  void DoRelayUdpDomainDatagram_(boost::span<char> header, boost::asio::const_buffer payload,
+                                 common::UdpBatch& batch);
+
+  // Resolves the name of the destination from the header of a datagram, then moves the datagrams
+  // queued for it to the send queue.
+  void DoResolveUdpDestination_(boost::span<char> header,
+                                detail::UdpDestinationCache::Destination& destination);
+
   // Waits until the connection is closed on the specified TCP socket, then deletes the current session.
   // Used for the UDP-ASSOCIATE command.
   void WaitForCloseTCPConnection(net_tcp::socket& socket);
 
-  std::vector<char> buffer_;
   net_tcp::socket tcp_socket_application_;
   net_tcp::acceptor tcp_acceptor_bind_;
   net_udp::socket udp_socket_;
+  std::shared_ptr<common::HappyEyeballs> connector_;  // Alive while the CONNECT is in progress.
+  std::array<char, detail::kMaxReplySize> reply_;
 
   net_udp::endpoint udp_endpoint_client_;
-  net_udp::endpoint udp_endpoint_application_;
+  detail::UdpDestinationCache udp_destinations_;
+  detail::UdpSendQueue udp_send_queue_;
+  bool udp_write_waiting_;
+  bool udp_offload_;  // The UDP socket receives coalesced datagrams and sends segmented ones.
+  std::shared_ptr<detail::UdpRelay> udp_relay_;  // Set if the association uses the shared relay.
 };
 
 template <typename TMessage, typename TResolver, typename TEndpoint, typename TCallback>
-inline void Socks5Session::DoResolveAddress_(TCallback callback) {
-  auto message = reinterpret_cast<const TMessage*>(buffer_.data());
-  auto address_begin = buffer_.data() + sizeof(TMessage);
-
-  switch (static_cast<AddressType>(message->address_type)) {
-    case AddressType::kIPv4: {
-      auto ipv4 = reinterpret_cast<const AddressV4*>(address_begin);
-      callback({}, common::GetIPv4Endpoint<TEndpoint>(ipv4->address, ipv4->port));
-      break;
-    }
-    case AddressType::kIPv6: {
-      auto ipv6 = reinterpret_cast<AddressV6*>(address_begin);
-      callback({}, common::GetIPv6Endpoint<TEndpoint>(ipv6->address, ipv6->port));
-      break;
-    }
-    case AddressType::kDomainName: {
-      auto domain = reinterpret_cast<const AddressDomain*>(address_begin);
-      auto address = std::string(address_begin + sizeof(AddressDomain), domain->length);
-      auto service = boost::endian::big_to_native(
-          *reinterpret_cast<uint16_t*>(address_begin + sizeof(AddressDomain) + domain->length));
-
-      common::ResolveDomainAddress<TResolver, TCallback>(tcp_socket_client_.get_executor(), address,
-                                                         service, callback);
-      break;
-    }
-    default:
-      break;
+inline void Socks5Session::DoResolveAddress_(boost::span<char> data, TCallback callback) {
+  auto message = reinterpret_cast<const TMessage*>(data.data());
+  detail::RequestDestination destination;
+
+  if (!detail::GetRequestDestination(message->address_type, data.data() + sizeof(TMessage),
+                                     destination)) {
+    return;
   }
-}
 
-template <typename TEndpoint>
-inline void Socks5Session::DoSendReply_(ReplyCode code, const TEndpoint& endpoint,
-                                        Socks5Session::Callback callback) {
-  auto message = std::make_shared<std::vector<char>>(sizeof(TcpMessage));
-  auto raw_message = reinterpret_cast<TcpMessage*>(message->data());
-  auto port = boost::endian::native_to_big(endpoint.port());
-
-  raw_message->version = 0x5;
-  raw_message->status = static_cast<uint8_t>(code);
-  raw_message->reserved = 0x0;
-  raw_message->address_type =
-      static_cast<uint8_t>(endpoint.address().is_v4() ? AddressType::kIPv4 : AddressType::kIPv6);
-
-  if (endpoint.address().is_v4()) {
-    auto address = boost::endian::native_to_big(endpoint.address().to_v4().to_uint());
-
-    message->insert(message->end(), reinterpret_cast<uint8_t*>(&address),
-                    reinterpret_cast<uint8_t*>(&address) + sizeof(address));
+  if (destination.type == AddressType::kDomainName) {
+    common::ResolveDomainAddress<TResolver, TCallback>(tcp_socket_client_.get_executor(),
+                                                       std::string(destination.domain),
+                                                       destination.endpoint.port(), callback);
   } else {
-    auto address = endpoint.address().to_v6().to_bytes();
-
-    message->insert(message->end(), reinterpret_cast<uint8_t*>(address.data()),
-                    reinterpret_cast<uint8_t*>(address.data()) + address.size());
+    callback({}, TEndpoint(destination.endpoint.address(), destination.endpoint.port()));
   }
+}
 
-  message->insert(message->end(), reinterpret_cast<uint8_t*>(&port),
-                  reinterpret_cast<uint8_t*>(&port) + sizeof(port));
+template <typename TEndpoint, typename TCallback>
+inline void Socks5Session::DoSendReply_(ReplyCode code, const TEndpoint& endpoint,
+                                        TCallback callback) {
+  common::Metrics::CountSocks5Reply(static_cast<uint8_t>(code));
+  const auto reply_size =
+      detail::WriteReply(code, {endpoint.address(), endpoint.port()}, reply_.data());
 
   boost::asio::async_write(
-      tcp_socket_client_, boost::asio::buffer(*message),
-      [this, self = shared_from_this(), callback, message](const error_code& ecode, size_t sended)
-      {
-        if (ecode) {
-          DeleteSession(
-              log_level::error,
-              (boost::format("Error sending a response to the client: %s.") % ecode.message())
-                  .str());
-        } else {
-          callback();
-        }
-      });
+      tcp_socket_client_, boost::asio::buffer(reply_.data(), reply_size),
+      common::BindHandlerAllocator(
+          [this, self = shared_from_this(), callback](const error_code& ecode, size_t)
+          {
+            if (ecode) {
+              SESSION_LOGGER(error) << "Error sending a response to the client: "
+                                    << ecode.message() << ".";
+              DeleteSession();
+            } else {
+              callback();
+            }
+          }));
 }
 
 template <typename TEndpoint>
-inline void Socks5Session::DoSendReplyAndDeleteSession_(ReplyCode code, const TEndpoint& endpoint,
-                                                        log_level level,
-                                                        const std::string& message) {
+inline void Socks5Session::DoSendReplyAndDeleteSession_(ReplyCode code,
+                                                        const TEndpoint& endpoint) {
   DoSendReply_<TEndpoint>(code, endpoint,
-                          [this, self = shared_from_this(), level, message]()
-                          { DeleteSession(level, message); });
+                          [this, self = shared_from_this()]() { DeleteSession(); });
 }
 
 }  // namespace session::socks5
@@ -0,0 +1,126 @@
+#include "DestinationCache.h"
+#include <algorithm>
+#include <cstring>
+#include "Common/Metrics.h"
+
+namespace session::socks5::detail {
+
+UdpDestinationCache::Destination* UdpDestinationCache::Find(
+    boost::span<const char> address) noexcept {
+  for (auto& destination : destinations_) {
+    if (destination->address.size() == address.size() &&
+        std::memcmp(destination->address.data(), address.data(), address.size()) == 0) {
+      return destination.get();
+    }
+  }
+
+  return nullptr;
+}
+
+UdpDestinationCache::Destination* UdpDestinationCache::Insert(boost::span<const char> address) {
+  auto destination = std::make_unique<Destination>();
+  destination->address.assign(address.data(), address.size());
+
+  if (destinations_.size() < kMaxDestinations) {
+    destinations_.push_back(std::move(destination));
+    return destinations_.back().get();
+  }
+
+  // A destination which has never been resolved holds queued datagrams, it is not replaced.
+  auto victim = destinations_.end();
+  for (auto iterator = destinations_.begin(); iterator != destinations_.end(); ++iterator) {
+    const auto& candidate = **iterator;
+
+    if (candidate.resolved && (victim == destinations_.end() || candidate.used < (*victim)->used)) {
+      victim = iterator;
+    }
+  }
+
+  if (victim == destinations_.end()) {
+    return nullptr;
+  }
+
+  *victim = std::move(destination);
+  return victim->get();
+}
+
+void UdpDestinationCache::Erase(const Destination* destination) {
+  destinations_.erase(
+      std::remove_if(destinations_.begin(), destinations_.end(),
+                     [destination](const auto& item) { return item.get() == destination; }),
+      destinations_.end());
+}
+
+UdpDestinationCache::Destination* UdpDestinationCache::Route(boost::span<const char> address,
+                                                             boost::asio::const_buffer payload,
+                                                             Destination*& resolve) {
+  const auto now = Clock::now();
+  auto destination = Find(address);
+  resolve = nullptr;
+
+  if (!destination) {
+    destination = Insert(address);
+    if (!destination) {
+      // All destinations are waiting for the resolver, the datagram is dropped.
+      common::Metrics::Add(common::Metrics::Counter::kUdpDroppedUnresolved);
+      return nullptr;
+    }
+  }
+
+  destination->used = now;
+
+  if (destination->resolved) {
+    // An expired destination keeps being used while its name is resolved again.
+    if (now >= destination->expires && !destination->resolving) {
+      resolve = destination;
+    }
+    return destination;
+  }
+
+  // The datagram waits for the resolver, so it is copied out of the batch.
+  if (destination->pending.size() < kMaxPendingDatagrams) {
+    auto data = static_cast<const char*>(payload.data());
+    destination->pending.emplace_back(data, data + payload.size());
+  } else {
+    common::Metrics::Add(common::Metrics::Counter::kUdpDroppedUnresolved);
+  }
+
+  if (!destination->resolving) {
+    resolve = destination;
+  }
+  return nullptr;
+}
+
+std::deque<std::vector<char>> UdpDestinationCache::Complete(boost::span<const char> address,
+                                                            const error_code& ecode,
+                                                            const net_udp::endpoint& endpoint,
+                                                            std::chrono::seconds ttl) {
+  std::deque<std::vector<char>> pending;
+  auto destination = Find(address);
+  if (!destination) {
+    return pending;
+  }
+
+  const auto now = Clock::now();
+  destination->resolving = false;
+
+  if (ecode) {
+    // A destination resolved before keeps its endpoint until the next attempt.
+    if (destination->resolved) {
+      destination->expires = now + ttl;
+    } else {
+      common::Metrics::Add(common::Metrics::Counter::kUdpDroppedUnresolved,
+                           destination->pending.size());
+      Erase(destination);
+    }
+    return pending;
+  }
+
+  destination->endpoint = endpoint;
+  destination->resolved = true;
+  destination->expires = now + ttl;
+  pending.swap(destination->pending);
+  return pending;
+}
+
+}  // namespace session::socks5::detail
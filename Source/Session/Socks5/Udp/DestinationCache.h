@@ -0,0 +1,72 @@
+#ifndef SESSION_SOCKS5_UDP_DESTINATION_CACHE_H_
+#define SESSION_SOCKS5_UDP_DESTINATION_CACHE_H_
+
+#include <boost/asio/buffer.hpp>
+#include <boost/core/span.hpp>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Types.h"
+
+namespace session::socks5::detail {
+
+// The destinations of the domain-addressed datagrams of a UDP association.
+// Maps the address of the SOCKS5 UDP header (name and port) to the resolved endpoint, so only the
+// first datagram to a name waits for the resolver. The datagrams which arrive while the name is
+// being resolved are queued in their order of arrival.
+class UdpDestinationCache {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // The maximum number of destinations of an association.
+  static constexpr size_t kMaxDestinations = 16;
+  // The maximum number of datagrams queued for a destination which is being resolved,
+  // the datagrams beyond it are dropped.
+  static constexpr size_t kMaxPendingDatagrams = 64;
+
+  struct Destination {
+    std::string address;  // Address type, name and port as they appear in the header.
+    net_udp::endpoint endpoint;
+    Clock::time_point expires;  // The name is resolved again after this moment.
+    Clock::time_point used;
+    bool resolved = false;
+    bool resolving = false;
+    std::deque<std::vector<char>> pending;
+  };
+
+  // Returns the destination with the address, or nullptr.
+  Destination* Find(boost::span<const char> address) noexcept;
+
+  // Adds the destination with the address. If the cache is full, the least recently used
+  // destination is replaced, unless all of them are waiting for the first resolution,
+  // in which case nullptr is returned.
+  Destination* Insert(boost::span<const char> address);
+
+  // Removes the destination.
+  void Erase(const Destination* destination);
+
+  // Looks up the destination of a datagram to the address. Returns the destination to send the
+  // payload to if its name is resolved, otherwise the payload is queued until it is, or dropped,
+  // and nullptr is returned. 'resolve' is set to the destination whose name is to be resolved
+  // now, if any.
+  Destination* Route(boost::span<const char> address, boost::asio::const_buffer payload,
+                     Destination*& resolve);
+
+  // Records the result of the resolution of the address. Returns the datagrams which waited for
+  // the name, to be sent to the endpoint. If the resolution failed, a destination which has
+  // never been resolved is removed with its datagrams.
+  std::deque<std::vector<char>> Complete(boost::span<const char> address,
+                                         const error_code& ecode,
+                                         const net_udp::endpoint& endpoint,
+                                         std::chrono::seconds ttl);
+
+ private:
+  std::vector<std::unique_ptr<Destination>> destinations_;
+};
+
+}  // namespace session::socks5::detail
+
+#endif  // !SESSION_SOCKS5_UDP_DESTINATION_CACHE_H_
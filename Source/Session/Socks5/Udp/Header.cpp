@@ -0,0 +1,90 @@
+#include "Header.h"
+#include <boost/endian.hpp>
+#include <cstring>
+#include "Common/AddressResolve.h"
+
+namespace session::socks5::detail {
+
+size_t GetUdpHeaderSize(const char* data, size_t size) {
+  if (size < sizeof(UdpMessage)) {
+    return 0;
+  }
+
+  auto message = reinterpret_cast<const UdpMessage*>(data);
+  size_t header_size = sizeof(UdpMessage);
+
+  if (message->fragment != 0) {
+    return 0;
+  }
+
+  switch (static_cast<AddressType>(message->address_type)) {
+    case AddressType::kIPv4:
+      header_size += sizeof(AddressV4);
+      break;
+    case AddressType::kIPv6:
+      header_size += sizeof(AddressV6);
+      break;
+    case AddressType::kDomainName:
+      if (size < sizeof(UdpMessage) + sizeof(AddressDomain)) {
+        return 0;
+      }
+      header_size += sizeof(AddressDomain) +
+                     reinterpret_cast<const AddressDomain*>(data + sizeof(UdpMessage))->length +
+                     sizeof(uint16_t);
+      break;
+    default:
+      return 0;
+  }
+
+  return header_size <= size ? header_size : 0;
+}
+
+bool GetUdpHeaderEndpoint(const char* data, net_udp::endpoint& endpoint) {
+  auto message = reinterpret_cast<const UdpMessage*>(data);
+
+  switch (static_cast<AddressType>(message->address_type)) {
+    case AddressType::kIPv4: {
+      auto ipv4 = reinterpret_cast<const AddressV4*>(data + sizeof(UdpMessage));
+      endpoint = common::GetIPv4Endpoint<net_udp::endpoint>(ipv4->address, ipv4->port);
+      return true;
+    }
+    case AddressType::kIPv6: {
+      auto ipv6 = reinterpret_cast<const AddressV6*>(data + sizeof(UdpMessage));
+      endpoint = common::GetIPv6Endpoint<net_udp::endpoint>(ipv6->address, ipv6->port);
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+size_t PrependUdpHeader(const net_udp::endpoint& endpoint, char* payload) {
+  const bool is_v4 = endpoint.address().is_v4();
+  const size_t header_size = sizeof(UdpMessage) + (is_v4 ? sizeof(AddressV4) : sizeof(AddressV6));
+  auto buffer = payload - header_size;
+  auto raw_message = reinterpret_cast<UdpMessage*>(buffer);
+  auto port = boost::endian::native_to_big(endpoint.port());
+  size_t size = sizeof(UdpMessage);
+
+  raw_message->reserved = 0x0;
+  raw_message->fragment = 0;
+  raw_message->address_type =
+      static_cast<uint8_t>(is_v4 ? AddressType::kIPv4 : AddressType::kIPv6);
+
+  if (is_v4) {
+    auto address = boost::endian::native_to_big(endpoint.address().to_v4().to_uint());
+
+    std::memcpy(buffer + size, &address, sizeof(address));
+    size += sizeof(address);
+  } else {
+    auto address = endpoint.address().to_v6().to_bytes();
+
+    std::memcpy(buffer + size, address.data(), address.size());
+    size += address.size();
+  }
+
+  std::memcpy(buffer + size, &port, sizeof(port));
+  return header_size;
+}
+
+}  // namespace session::socks5::detail
@@ -0,0 +1,27 @@
+#ifndef SESSION_SOCKS5_UDP_HEADER_H_
+#define SESSION_SOCKS5_UDP_HEADER_H_
+
+#include <cstddef>
+#include "Session/Socks5/Socks5Types.h"
+#include "Types.h"
+
+namespace session::socks5::detail {
+
+// The size of the largest SOCKS5 UDP header with an address (IPv6).
+constexpr size_t kMaxUdpHeaderSize = sizeof(UdpMessage) + sizeof(AddressV6);
+
+// Returns the size of the header of the SOCKS5 UDP request, or 0 if the datagram is malformed or
+// is a fragment (fragmentation is not supported, such datagrams are dropped).
+size_t GetUdpHeaderSize(const char* data, size_t size);
+
+// Reads the destination from the header of the SOCKS5 UDP request, checked by GetUdpHeaderSize.
+// Returns false if the destination is a domain name.
+bool GetUdpHeaderEndpoint(const char* data, net_udp::endpoint& endpoint);
+
+// Writes the SOCKS5 UDP header with the endpoint into the headroom in front of the payload.
+// Returns the size of the header, which starts at 'payload' minus the size.
+size_t PrependUdpHeader(const net_udp::endpoint& endpoint, char* payload);
+
+}  // namespace session::socks5::detail
+
+#endif  // !SESSION_SOCKS5_UDP_HEADER_H_
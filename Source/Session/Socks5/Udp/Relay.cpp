@@ -0,0 +1,596 @@
+#include "Relay.h"
+#include <boost/asio/error.hpp>
+#include <boost/asio/ip/v6_only.hpp>
+#include <boost/endian.hpp>
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include "Common/AddressResolve.h"
+#include "Common/HandlerAllocator.h"
+#include "Common/Logger.h"
+#include "Common/Metrics.h"
+#include "Configuration.h"
+#include "Header.h"
+#include "Segments.h"
+
+namespace session::socks5::detail {
+namespace {
+
+thread_local std::shared_ptr<UdpRelay> thread_instance;
+
+}  // namespace
+
+size_t UdpRelay::EndpointHash::operator()(const net_udp::endpoint& endpoint) const noexcept {
+  const auto& address = endpoint.address();
+  size_t hash;
+
+  if (address.is_v4()) {
+    hash = std::hash<uint32_t>{}(address.to_v4().to_uint());
+  } else {
+    const auto bytes = address.to_v6().to_bytes();
+    hash = std::hash<std::string_view>{}(
+        {reinterpret_cast<const char*>(bytes.data()), bytes.size()});
+  }
+
+  return hash * 31 + endpoint.port();
+}
+
+UdpRelay::UdpRelay(const boost::asio::any_io_executor& executor, uint16_t port)
+    : executor_{executor},
+      port_{port},
+      outbound_count_{std::max<size_t>(Configuration::GetInstance()->GetSocks5().udp_relay_sockets,
+                                       1)},
+      offload_{Configuration::GetInstance()->GetSocks5().udp_offload},
+      client_v4_{},
+      client_v6_{},
+      outbound_v4_(outbound_count_),
+      outbound_v6_(outbound_count_),
+      associations_{},
+      clients_{},
+      unbound_{},
+      queued_{} {}
+
+std::shared_ptr<UdpRelay> UdpRelay::Create(const boost::asio::any_io_executor& executor,
+                                           uint16_t port) {
+  return std::shared_ptr<UdpRelay>(new UdpRelay(executor, port));
+}
+
+std::shared_ptr<UdpRelay> UdpRelay::GetThreadInstance() {
+  return thread_instance;
+}
+
+void UdpRelay::SetThreadInstance(const std::shared_ptr<UdpRelay>& relay) {
+  thread_instance = relay;
+}
+
+bool UdpRelay::Start() {
+  error_code ecode;
+
+  client_v4_ = OpenSocket(net_udp::endpoint(net_udp::v4(), port_), true, ecode);
+  if (ecode) {
+    WLOGGER(warning) << "Failed to open the IPv4 UDP relay socket at port " << port_ << ": "
+                     << ecode.message() << ".";
+  }
+
+  client_v6_ = OpenSocket(net_udp::endpoint(net_udp::v6(), port_), true, ecode);
+  if (ecode) {
+    WLOGGER(warning) << "Failed to open the IPv6 UDP relay socket at port " << port_ << ": "
+                     << ecode.message() << ".";
+  }
+
+  return client_v4_ || client_v6_;
+}
+
+void UdpRelay::Stop() {
+  error_code ecode;
+
+  for (auto socket : {&client_v4_, &client_v6_}) {
+    if (*socket) {
+      (*socket)->socket.close(ecode);
+    }
+  }
+
+  for (auto pool : {&outbound_v4_, &outbound_v6_}) {
+    for (auto& socket : *pool) {
+      if (socket) {
+        socket->socket.close(ecode);
+      }
+    }
+  }
+}
+
+bool UdpRelay::Register(uint64_t id, const boost::asio::ip::address& client_address,
+                        uint16_t client_port, bool is_v6,
+                        const std::shared_ptr<common::TraceFlow>& trace,
+                        Clock::time_point* active, ReadyCallback on_ready) {
+  auto& client = is_v6 ? client_v6_ : client_v4_;
+  if (!client || associations_.count(id) != 0) {
+    return false;
+  }
+
+  error_code ecode;
+  const auto endpoint = client->socket.local_endpoint(ecode);
+  if (ecode) {
+    return false;
+  }
+
+  // An IPv4 client of a dual-stack listener has a mapped address.
+  auto address = client_address;
+  if (address.is_v6() && address.to_v6().is_v4_mapped()) {
+    address = boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address.to_v6());
+  }
+
+  // Any port of the address binds an association without a port, so two of them waiting at the
+  // same time could take each other's datagrams.
+  const bool queued =
+      client_port == 0 && std::any_of(unbound_.begin(), unbound_.end(),
+                                      [&](const Association* waiting)
+                                      {
+                                        return waiting->client_port == 0 &&
+                                               waiting->is_v6 == is_v6 &&
+                                               waiting->client_address == address;
+                                      });
+
+  auto association = std::make_unique<Association>();
+  association->id = id;
+  association->client_address = address;
+  association->client_port = client_port;
+  association->is_v6 = is_v6;
+  association->active = active;
+  association->trace = trace;
+  association->queued = queued;
+
+  if (queued) {
+    association->on_ready = std::move(on_ready);
+    queued_.push_back(association.get());
+  } else {
+    unbound_.push_back(association.get());
+  }
+  associations_.emplace(id, std::move(association));
+
+  if (!queued) {
+    on_ready(endpoint);
+  }
+  return true;
+}
+
+void UdpRelay::Unregister(uint64_t id) {
+  auto iterator = associations_.find(id);
+  if (iterator == associations_.end()) {
+    return;
+  }
+
+  auto association = iterator->second.get();
+
+  if (association->bound) {
+    clients_.erase(association->client);
+  } else if (association->queued) {
+    queued_.erase(std::remove(queued_.begin(), queued_.end(), association), queued_.end());
+  } else {
+    unbound_.erase(std::remove(unbound_.begin(), unbound_.end(), association), unbound_.end());
+    if (association->client_port == 0) {
+      ReleaseQueued(*association);
+    }
+  }
+
+  for (const auto& [endpoint, binding] : association->applications) {
+    binding.socket->applications.erase(endpoint);
+  }
+
+  associations_.erase(iterator);
+}
+
+std::shared_ptr<UdpRelay::Socket> UdpRelay::OpenSocket(const net_udp::endpoint& endpoint,
+                                                       bool is_client, error_code& ecode) {
+  const auto& config = Configuration::GetInstance()->GetSocks5();
+  auto socket = std::make_shared<Socket>(executor_, config.udp_queue_size,
+                                         config.udp_drop_policy == "oldest"
+                                             ? UdpSendQueue::DropPolicy::kOldest
+                                             : UdpSendQueue::DropPolicy::kTail);
+
+  socket->socket.open(endpoint.protocol(), ecode);
+  if (!ecode && endpoint.address().is_v6()) {
+    // The IPv4 clients use the IPv4 socket, so the endpoints are never mapped addresses.
+    socket->socket.set_option(boost::asio::ip::v6_only(true), ecode);
+  }
+  if (!ecode) {
+    socket->socket.bind(endpoint, ecode);
+  }
+  if (!ecode) {
+    socket->socket.non_blocking(true, ecode);
+  }
+  if (ecode) {
+    return nullptr;
+  }
+
+  // The kernel limits apply, smaller buffers only cost more drops under bursts.
+  error_code ignored;
+  socket->socket.set_option(net_udp::socket::receive_buffer_size(kSocketBufferSize), ignored);
+  socket->socket.set_option(net_udp::socket::send_buffer_size(kSocketBufferSize), ignored);
+
+  socket->is_client = is_client;
+  socket->offload = offload_ && common::UdpBatch::EnableOffload(socket->socket);
+  DoReceive(*socket);
+  return socket;
+}
+
+void UdpRelay::DoReceive(Socket& socket) {
+  socket.socket.async_wait(
+      net_udp::socket::wait_read,
+      common::BindHandlerAllocator(
+          [this, self = shared_from_this(), owner = socket.shared_from_this(),
+           &socket](const error_code& ecode)
+          {
+            if (ecode) {
+              return;  // The relay is stopped or the socket is closed.
+            }
+
+            auto& batch = common::UdpBatch::GetThreadInstance();
+            error_code ecode_receive;
+
+            const auto count = batch.Receive(socket.socket, ecode_receive);
+            if (ecode_receive == boost::asio::error::would_block) {
+              // Another handler has already received the datagrams.
+            } else if (common::UdpBatch::IsTransientError(ecode_receive)) {
+              WLOGGER(debug) << "Failed to receive data from UDP relay socket: "
+                             << ecode_receive.message() << ".";
+            } else if (ecode_receive) {
+              // Waiting again would complete right away with the same error.
+              WLOGGER(error) << "Failed to receive data from UDP relay socket: "
+                             << ecode_receive.message() << ".";
+              return;
+            } else if (socket.is_client) {
+              RelayClientDatagrams(socket, batch, count);
+            } else {
+              RelayApplicationDatagrams(socket, batch, count);
+            }
+
+            // The wait completes right away if more datagrams are waiting, after the other
+            // handlers of the thread.
+            DoReceive(socket);
+          }));
+}
+
+void UdpRelay::RelayClientDatagrams(Socket& socket, common::UdpBatch& batch, size_t count) {
+  const auto now = Clock::now();
+  const bool is_v6 = &socket == client_v6_.get();
+  Socket* target = nullptr;
+
+  batch.Clear();
+
+  for (size_t index = 0; index < count; ++index) {
+    const auto& datagram = batch.GetDatagram(index);
+    auto association = FindClient(datagram.endpoint, is_v6);
+    if (!association) {
+      common::Metrics::Add(common::Metrics::Counter::kUdpDroppedRejected);
+      continue;
+    }
+
+    *association->active = now;
+
+    ForEachClientSegment(
+        datagram,
+        [this, &batch, &target, association](boost::span<char> header,
+                                             boost::asio::const_buffer payload)
+        {
+          if (association->trace) {
+            association->trace->Add(common::TraceDirection::kUpload, payload.size(), 1);
+          }
+
+          net_udp::endpoint endpoint;
+          if (!GetUdpHeaderEndpoint(header.data(), endpoint)) {
+            RelayDomainDatagram(batch, target, *association, header, payload);
+          } else if (auto outbound = BindApplication(*association, endpoint)) {
+            AddDatagram(batch, target, *outbound, endpoint, {}, payload);
+          } else {
+            common::Metrics::Add(common::Metrics::Counter::kUdpDroppedBusy);
+          }
+        });
+  }
+
+  SendBatch(batch, target);
+}
+
+void UdpRelay::RelayApplicationDatagrams(Socket& socket, common::UdpBatch& batch, size_t count) {
+  const auto now = Clock::now();
+  Socket* target = nullptr;
+
+  batch.Clear();
+
+  for (size_t index = 0; index < count; ++index) {
+    const auto& datagram = batch.GetDatagram(index);
+    const auto iterator = socket.applications.find(datagram.endpoint);
+    if (iterator == socket.applications.end() || !iterator->second->bound) {
+      common::Metrics::Add(common::Metrics::Counter::kUdpDroppedRejected);
+      continue;
+    }
+
+    auto& association = *iterator->second;
+    auto& client = association.is_v6 ? *client_v6_ : *client_v4_;
+
+    *association.active = now;
+    if (auto binding = association.applications.find(datagram.endpoint);
+        binding != association.applications.end()) {
+      binding->second.used = now;
+    }
+
+    const auto segments = ForEachApplicationSegment(
+        datagram,
+        [this, &batch, &target, &client, &association](boost::asio::const_buffer header,
+                                                       boost::asio::const_buffer payload)
+        { AddDatagram(batch, target, client, association.client, header, payload); });
+
+    if (association.trace) {
+      association.trace->Add(common::TraceDirection::kDownload, datagram.size, segments);
+    }
+  }
+
+  SendBatch(batch, target);
+}
+
+UdpRelay::Association* UdpRelay::FindClient(const net_udp::endpoint& endpoint, bool is_v6) {
+  if (auto iterator = clients_.find(endpoint); iterator != clients_.end()) {
+    return iterator->second;
+  }
+
+  // The oldest waiting association of the client address takes the endpoint, one which has
+  // announced the port of the endpoint before one without a port.
+  auto bound = unbound_.end();
+  for (auto iterator = unbound_.begin(); iterator != unbound_.end(); ++iterator) {
+    const auto association = *iterator;
+
+    if (association->is_v6 != is_v6 || association->client_address != endpoint.address()) {
+      continue;
+    }
+    if (association->client_port == endpoint.port()) {
+      bound = iterator;
+      break;
+    }
+    if (association->client_port == 0 && bound == unbound_.end()) {
+      bound = iterator;
+    }
+  }
+
+  if (bound == unbound_.end()) {
+    return nullptr;
+  }
+
+  auto association = *bound;
+  association->bound = true;
+  association->client = endpoint;
+  clients_.emplace(endpoint, association);
+  unbound_.erase(bound);
+
+  if (association->client_port == 0) {
+    ReleaseQueued(*association);
+  }
+  return association;
+}
+
+void UdpRelay::ReleaseQueued(const Association& association) {
+  auto iterator = std::find_if(queued_.begin(), queued_.end(),
+                               [&association](const Association* queued)
+                               {
+                                 return queued->is_v6 == association.is_v6 &&
+                                        queued->client_address == association.client_address;
+                               });
+  if (iterator == queued_.end()) {
+    return;
+  }
+
+  auto released = *iterator;
+  queued_.erase(iterator);
+  released->queued = false;
+  unbound_.push_back(released);
+
+  // The callback only starts the reply of the session, the relay is not changed under it.
+  auto& client = released->is_v6 ? client_v6_ : client_v4_;
+  auto on_ready = std::move(released->on_ready);
+  released->on_ready = nullptr;
+
+  error_code ecode;
+  on_ready(client->socket.local_endpoint(ecode));
+}
+
+UdpRelay::Socket* UdpRelay::BindApplication(Association& association,
+                                            const net_udp::endpoint& endpoint) {
+  const auto now = Clock::now();
+
+  if (auto iterator = association.applications.find(endpoint);
+      iterator != association.applications.end()) {
+    iterator->second.used = now;
+    return iterator->second.socket;
+  }
+
+  if (association.applications.size() >= kMaxApplications) {
+    auto oldest = std::min_element(association.applications.begin(),
+                                   association.applications.end(),
+                                   [](const auto& left, const auto& right)
+                                   { return left.second.used < right.second.used; });
+
+    oldest->second.socket->applications.erase(oldest->first);
+    association.applications.erase(oldest);
+  }
+
+  // The first socket of the pool which does not carry the application yet, or carries it for an
+  // association which has not used it for a while. A socket is only opened when every open one
+  // carries it for another association which still uses it.
+  auto& pool = endpoint.address().is_v4() ? outbound_v4_ : outbound_v6_;
+
+  for (auto& socket : pool) {
+    if (!socket) {
+      error_code ecode;
+
+      socket = OpenSocket(net_udp::endpoint(endpoint.protocol(), 0), false, ecode);
+      if (!socket) {
+        WLOGGER(warning) << "Failed to open an outbound UDP relay socket: " << ecode.message()
+                         << ".";
+        return nullptr;
+      }
+    }
+
+    auto [owner, inserted] = socket->applications.emplace(endpoint, &association);
+    if (!inserted) {
+      auto& previous = *owner->second;
+      auto binding = previous.applications.find(endpoint);
+      if (binding != previous.applications.end() && now - binding->second.used < kBindingTimeout) {
+        continue;
+      }
+
+      // The late answers to the previous association reach the new one, as behind a NAT.
+      if (binding != previous.applications.end()) {
+        previous.applications.erase(binding);
+      }
+      owner->second = &association;
+    }
+
+    association.applications.emplace(endpoint, Binding{socket.get(), now});
+    return socket.get();
+  }
+
+  return nullptr;
+}
+
+void UdpRelay::AddDatagram(common::UdpBatch& batch, Socket*& target, Socket& socket,
+                           const net_udp::endpoint& endpoint, boost::asio::const_buffer header,
+                           boost::asio::const_buffer payload) {
+  if (target != &socket) {
+    SendBatch(batch, target);
+    batch.Clear(socket.offload);
+    target = &socket;
+  }
+
+  if (!batch.Add(endpoint, header, payload)) {
+    SendBatch(batch, target);
+    batch.Add(endpoint, header, payload);
+  }
+}
+
+void UdpRelay::SendBatch(common::UdpBatch& batch, Socket* socket) {
+  if (!socket) {
+    return;
+  }
+
+  // The datagrams go behind the queued ones, if there are any, to keep their order.
+  size_t first = 0;
+  error_code ecode;
+
+  while (socket->queue.Empty() && first < batch.GetPendingCount()) {
+    first += batch.Send(socket->socket, first, ecode);
+
+    if (ecode == boost::asio::error::would_block) {
+      break;
+    } else if (ecode) {
+      WLOGGER(warning) << "Error sending UDP message: " << ecode.message() << ".";
+      socket->queue.CountSendError(batch.GetPending(first).count);
+      ++first;
+    }
+  }
+
+  for (; first < batch.GetPendingCount(); ++first) {
+    const auto& outgoing = batch.GetPending(first);
+    for (size_t segment = 0; segment < outgoing.count; ++segment) {
+      socket->queue.Push(outgoing.endpoint, outgoing.segments[segment].header,
+                         outgoing.segments[segment].payload);
+    }
+  }
+
+  batch.Clear(socket->offload);
+
+  if (!socket->queue.Empty()) {
+    DoWaitWritable(*socket);
+  }
+}
+
+void UdpRelay::DoWaitWritable(Socket& socket) {
+  if (socket.write_waiting) {
+    return;
+  }
+
+  socket.write_waiting = true;
+  socket.socket.async_wait(
+      net_udp::socket::wait_write,
+      common::BindHandlerAllocator(
+          [this, self = shared_from_this(), owner = socket.shared_from_this(),
+           &socket](const error_code& ecode)
+          {
+            socket.write_waiting = false;
+            if (ecode) {
+              return;
+            }
+
+            socket.queue.Flush(socket.socket, common::UdpBatch::GetThreadInstance());
+            if (!socket.queue.Empty()) {
+              DoWaitWritable(socket);
+            }
+          }));
+}
+
+void UdpRelay::RelayDomainDatagram(common::UdpBatch& batch, Socket*& target,
+                                   Association& association, boost::span<const char> header,
+                                   boost::asio::const_buffer payload) {
+  const boost::span<const char> address{header.data() + sizeof(UdpMessage),
+                                        header.size() - sizeof(UdpMessage)};
+  UdpDestinationCache::Destination* resolve;
+
+  if (auto destination = association.destinations.Route(address, payload, resolve)) {
+    if (auto outbound = BindApplication(association, destination->endpoint)) {
+      AddDatagram(batch, target, *outbound, destination->endpoint, {}, payload);
+    } else {
+      common::Metrics::Add(common::Metrics::Counter::kUdpDroppedBusy);
+    }
+  }
+  if (resolve) {
+    ResolveDestination(association, header, *resolve);
+  }
+}
+
+void UdpRelay::ResolveDestination(Association& association, boost::span<const char> header,
+                                  UdpDestinationCache::Destination& destination) {
+  const auto name = header.data() + sizeof(UdpMessage) + sizeof(AddressDomain);
+  const auto length = reinterpret_cast<const AddressDomain*>(header.data() + sizeof(UdpMessage))
+                          ->length;
+  uint16_t port;
+
+  std::memcpy(&port, name + length, sizeof(port));
+  destination.resolving = true;
+
+  common::ResolveDomainAddress<net_udp::resolver, common::DomainResolverCallbackUDP>(
+      executor_, std::string(name, length), boost::endian::big_to_native(port),
+      [this, self = shared_from_this(), id = association.id, address = destination.address](
+          const error_code& ecode, const net_udp::endpoint& endpoint)
+      {
+        auto iterator = associations_.find(id);
+        if (iterator == associations_.end()) {
+          return;
+        }
+
+        auto& association = *iterator->second;
+        const auto pending = association.destinations.Complete(
+            {address.data(), address.size()}, ecode, endpoint,
+            std::chrono::seconds(Configuration::GetInstance()->GetDns().min_ttl));
+        if (ecode) {
+          WLOGGER(warning) << "Domain name resolution error from UDP message: " << ecode.message()
+                           << ".";
+          return;
+        }
+        if (pending.empty()) {
+          return;
+        }
+
+        // The handler may run while the batch of the thread is in use, so the datagrams are only
+        // queued here and sent once the socket is writable.
+        if (auto outbound = BindApplication(association, endpoint)) {
+          for (const auto& datagram : pending) {
+            outbound->queue.Push(endpoint, {}, boost::asio::buffer(datagram));
+          }
+          if (!outbound->queue.Empty()) {
+            DoWaitWritable(*outbound);
+          }
+        } else {
+          common::Metrics::Add(common::Metrics::Counter::kUdpDroppedBusy, pending.size());
+        }
+      });
+}
+
+}  // namespace session::socks5::detail
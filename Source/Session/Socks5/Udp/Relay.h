@@ -0,0 +1,193 @@
+#ifndef SESSION_SOCKS5_UDP_RELAY_H_
+#define SESSION_SOCKS5_UDP_RELAY_H_
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/core/span.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "Common/Trace.h"
+#include "Common/UdpBatch.h"
+#include "Session/Socks5/Udp/DestinationCache.h"
+#include "Session/Socks5/Udp/SendQueue.h"
+#include "Types.h"
+
+namespace session::socks5::detail {
+
+// The UDP relay of a worker, shared by the UDP associations of all of its sessions when
+// socks5.udp_relay_port is set. The clients send to a single port per address family, the port of
+// the worker (udp_relay_port + the index of the worker), which the reply to the UDP ASSOCIATE
+// announces. The clients of different workers see different ports. Their associations are told
+// apart by the endpoint of the client. The datagrams to the applications leave through a small
+// pool of sockets, on each of them an application endpoint belongs to a single association, so
+// the answers find their way back. More than one outbound socket is only
+// opened when associations send to the same application endpoint. Like the mapping of a NAT, an
+// endpoint which has been idle for a while is taken over by the next association which needs it,
+// and the datagrams of an association which finds the endpoint busy on every socket of the pool
+// are dropped and counted. The number of descriptors and buffers never grows with the number of
+// associations.
+class UdpRelay final : public std::enable_shared_from_this<UdpRelay> {
+  UdpRelay(const boost::asio::any_io_executor& executor, uint16_t port);
+
+ public:
+  using Clock = std::chrono::steady_clock;
+  using ReadyCallback = std::function<void(const net_udp::endpoint& endpoint)>;
+
+  ~UdpRelay() = default;
+
+  UdpRelay(const UdpRelay&) = delete;
+  UdpRelay(UdpRelay&&) = delete;
+  UdpRelay& operator=(const UdpRelay&) = delete;
+  UdpRelay& operator=(UdpRelay&&) = delete;
+
+  // Creates the relay, the clients send to the specified port.
+  static std::shared_ptr<UdpRelay> Create(const boost::asio::any_io_executor& executor,
+                                          uint16_t port);
+
+  // Returns the relay of the current thread, or nullptr if the associations have their own
+  // sockets.
+  static std::shared_ptr<UdpRelay> GetThreadInstance();
+
+  // Makes the relay the relay of the current thread.
+  static void SetThreadInstance(const std::shared_ptr<UdpRelay>& relay);
+
+  // Opens the client sockets and starts relaying. Returns false if neither could be bound.
+  bool Start();
+
+  // Closes all sockets. The associations are expected to be unregistered by their sessions.
+  void Stop();
+
+  // Adds the association of the session. The first datagram from the client address (and the
+  // port, if it is not 0) binds the association to the endpoint of the client. Every transfer of
+  // the association is stored to 'active', the activity of the session, whose idle timeout
+  // expires it. The datagrams are added to the trace flow of the session, if it is traced.
+  // 'on_ready' is called with the endpoint of the client socket of the family for the reply,
+  // right away unless the association has no port and another one of the client address without
+  // a port is still waiting for its first datagram. Then it is queued, and called once that one
+  // is bound or removed, so the first datagram from a new port always belongs to the single
+  // announced association. Returns false if the family is not served.
+  bool Register(uint64_t id, const boost::asio::ip::address& client_address, uint16_t client_port,
+                bool is_v6, const std::shared_ptr<common::TraceFlow>& trace,
+                Clock::time_point* active, ReadyCallback on_ready);
+
+  // Removes the association of the session.
+  void Unregister(uint64_t id);
+
+ private:
+  // The maximum number of applications an association sends to at the same time, the least
+  // recently used one is forgotten beyond it.
+  static constexpr size_t kMaxApplications = 256;
+  // The buffer sizes requested for the sockets, which carry the traffic of many associations.
+  static constexpr int kSocketBufferSize = 4 * 1024 * 1024;
+  // How long an association keeps an application endpoint of an outbound socket without
+  // datagrams, before another association can take it over.
+  static constexpr std::chrono::seconds kBindingTimeout{30};
+
+  struct EndpointHash {
+    size_t operator()(const net_udp::endpoint& endpoint) const noexcept;
+  };
+
+  struct Association;
+
+  // A socket of the relay.
+  struct Socket : std::enable_shared_from_this<Socket> {
+    Socket(const boost::asio::any_io_executor& executor, size_t queue_size,
+           UdpSendQueue::DropPolicy policy)
+        : socket{executor}, queue{queue_size, policy} {}
+
+    net_udp::socket socket;
+    UdpSendQueue queue;
+    bool is_client = false;
+    bool offload = false;
+    bool write_waiting = false;
+    // The associations by the endpoints of their applications, for the outbound sockets.
+    std::unordered_map<net_udp::endpoint, Association*, EndpointHash> applications;
+  };
+
+  // The outbound socket an association uses for an application.
+  struct Binding {
+    Socket* socket;
+    Clock::time_point used;
+  };
+
+  struct Association {
+    uint64_t id;
+    boost::asio::ip::address client_address;
+    uint16_t client_port;
+    bool is_v6;
+    bool bound = false;   // The endpoint of the client is known.
+    bool queued = false;  // Waits for another association of the address without a port.
+    net_udp::endpoint client;
+    Clock::time_point* active;  // The activity of the session, valid while registered.
+    ReadyCallback on_ready;  // Set while the association is queued.
+    UdpDestinationCache destinations;
+    std::unordered_map<net_udp::endpoint, Binding, EndpointHash> applications;
+    std::shared_ptr<common::TraceFlow> trace;  // Set if the session is traced.
+  };
+
+  // Opens the socket bound to the endpoint and starts receiving on it.
+  std::shared_ptr<Socket> OpenSocket(const net_udp::endpoint& endpoint, bool is_client,
+                                     error_code& ecode);
+
+  // Waits until the socket is readable, then relays the received datagrams.
+  void DoReceive(Socket& socket);
+
+  // Relays the datagrams the client socket received to the applications.
+  void RelayClientDatagrams(Socket& socket, common::UdpBatch& batch, size_t count);
+
+  // Relays the datagrams the outbound socket received to the clients.
+  void RelayApplicationDatagrams(Socket& socket, common::UdpBatch& batch, size_t count);
+
+  // Returns the association of the client endpoint, binding a waiting association to it.
+  Association* FindClient(const net_udp::endpoint& endpoint, bool is_v6);
+
+  // Announces the oldest queued association of the address of the association without a port,
+  // which no longer waits for its first datagram.
+  void ReleaseQueued(const Association& association);
+
+  // Returns the outbound socket the association sends to the application through, or nullptr if
+  // every socket of the pool carries the application for another association or no socket could
+  // be opened.
+  Socket* BindApplication(Association& association, const net_udp::endpoint& endpoint);
+
+  // Adds the datagram to the batch, which is sent through 'target'. The batch is sent first if
+  // it belongs to another socket or is full.
+  void AddDatagram(common::UdpBatch& batch, Socket*& target, Socket& socket,
+                   const net_udp::endpoint& endpoint, boost::asio::const_buffer header,
+                   boost::asio::const_buffer payload);
+
+  // Sends the batch through the socket and empties it, the datagrams which cannot be sent right
+  // away are queued.
+  void SendBatch(common::UdpBatch& batch, Socket* socket);
+
+  // Waits until the socket is writable, then sends its queue.
+  void DoWaitWritable(Socket& socket);
+
+  // Relays the datagram of the association to a domain name, resolving the name if needed.
+  void RelayDomainDatagram(common::UdpBatch& batch, Socket*& target, Association& association,
+                           boost::span<const char> header, boost::asio::const_buffer payload);
+
+  // Resolves the name of the destination of the association.
+  void ResolveDestination(Association& association, boost::span<const char> header,
+                          UdpDestinationCache::Destination& destination);
+
+  boost::asio::any_io_executor executor_;
+  uint16_t port_;
+  size_t outbound_count_;  // The maximum number of outbound sockets per address family.
+  bool offload_;
+  std::shared_ptr<Socket> client_v4_;
+  std::shared_ptr<Socket> client_v6_;
+  std::vector<std::shared_ptr<Socket>> outbound_v4_;  // Opened when first needed.
+  std::vector<std::shared_ptr<Socket>> outbound_v6_;
+  std::unordered_map<uint64_t, std::unique_ptr<Association>> associations_;
+  std::unordered_map<net_udp::endpoint, Association*, EndpointHash> clients_;
+  std::vector<Association*> unbound_;  // In the order of registration.
+  std::vector<Association*> queued_;   // In the order of registration.
+};
+
+}  // namespace session::socks5::detail
+
+#endif  // !SESSION_SOCKS5_UDP_RELAY_H_
@@ -0,0 +1,62 @@
+#ifndef SESSION_SOCKS5_UDP_SEGMENTS_H_
+#define SESSION_SOCKS5_UDP_SEGMENTS_H_
+
+#include <boost/asio/buffer.hpp>
+#include <boost/core/span.hpp>
+#include <algorithm>
+#include <cstddef>
+#include "Common/Metrics.h"
+#include "Common/UdpBatch.h"
+#include "Session/Socks5/Udp/Header.h"
+
+namespace session::socks5::detail {
+
+// Calls 'relay(header, payload)' for each segment of a datagram received from a client. Each
+// segment of a coalesced datagram has its own SOCKS5 UDP header, the segments with an invalid
+// header are dropped.
+template <typename TRelay>
+void ForEachClientSegment(const common::UdpBatch::Datagram& datagram, TRelay&& relay) {
+  for (size_t offset = 0; offset < datagram.size; offset += datagram.segment_size) {
+    const auto data = datagram.data + offset;
+    const auto size = std::min(datagram.segment_size, datagram.size - offset);
+    const auto header_size = GetUdpHeaderSize(data, size);
+    if (header_size == 0) {
+      common::Metrics::Add(common::Metrics::Counter::kUdpDroppedRejected);
+      continue;
+    }
+
+    common::Metrics::Add(common::Metrics::Counter::kUdpUploadDatagrams);
+    relay(boost::span<char>{data, header_size},
+          boost::asio::const_buffer{data + header_size, size - header_size});
+  }
+}
+
+// Calls 'relay(header, payload)' for each segment of a datagram received from an application,
+// after writing the SOCKS5 UDP header of the sender into the headroom. The segments of a
+// coalesced datagram share the header: the first payload starts with it, the others are sent
+// behind it. Returns the number of segments.
+template <typename TRelay>
+size_t ForEachApplicationSegment(const common::UdpBatch::Datagram& datagram, TRelay&& relay) {
+  const auto header_size = PrependUdpHeader(datagram.endpoint, datagram.data);
+  const boost::asio::const_buffer header{datagram.data - header_size, header_size};
+  size_t segments = 1;
+
+  common::Metrics::Add(common::Metrics::Counter::kUdpDownloadDatagrams);
+  relay(boost::asio::const_buffer{},
+        boost::asio::const_buffer{datagram.data - header_size,
+                                  header_size + std::min(datagram.segment_size, datagram.size)});
+
+  for (size_t offset = datagram.segment_size; offset < datagram.size;
+       offset += datagram.segment_size, ++segments) {
+    common::Metrics::Add(common::Metrics::Counter::kUdpDownloadDatagrams);
+    relay(header, boost::asio::const_buffer{
+                      datagram.data + offset,
+                      std::min(datagram.segment_size, datagram.size - offset)});
+  }
+
+  return segments;
+}
+
+}  // namespace session::socks5::detail
+
+#endif  // !SESSION_SOCKS5_UDP_SEGMENTS_H_
@@ -0,0 +1,93 @@
+#include "SendQueue.h"
+#include <algorithm>
+#include <boost/asio/error.hpp>
+#include <cstring>
+#include "Common/Metrics.h"
+
+namespace session::socks5::detail {
+
+UdpSendQueue::UdpSendQueue(size_t capacity, DropPolicy policy)
+    : capacity_{std::max<size_t>(capacity, 1)},
+      policy_{policy},
+      items_{},
+      head_{0},
+      size_{0},
+      dropped_full_{0},
+      dropped_error_{0} {}
+
+void UdpSendQueue::Push(const net_udp::endpoint& endpoint, boost::asio::const_buffer header,
+                        boost::asio::const_buffer payload) {
+  if (size_ == capacity_) {
+    ++dropped_full_;
+    common::Metrics::Add(common::Metrics::Counter::kUdpDroppedFull);
+
+    if (policy_ == DropPolicy::kTail) {
+      return;
+    }
+
+    Pop(1);
+  }
+
+  if (items_.empty()) {
+    items_.resize(capacity_);
+  }
+
+  auto& item = items_[(head_ + size_++) % capacity_];
+  item.endpoint = endpoint;
+  item.size = header.size() + payload.size();
+  item.buffer = common::BufferPool::Borrow(item.size);
+  std::memcpy(item.buffer.data(), header.data(), header.size());
+  std::memcpy(item.buffer.data() + header.size(), payload.data(), payload.size());
+
+  common::Metrics::Add(common::Metrics::Counter::kUdpQueuedDatagrams);
+}
+
+error_code UdpSendQueue::Flush(net_udp::socket& socket, common::UdpBatch& batch) {
+  error_code ecode;
+
+  while (size_ != 0) {
+    batch.Clear();
+    for (size_t index = 0; index < size_ && index < common::UdpBatch::kCapacity; ++index) {
+      const auto& item = items_[(head_ + index) % capacity_];
+      batch.Add(item.endpoint, {}, boost::asio::buffer(item.buffer.data(), item.size));
+    }
+
+    Pop(batch.Send(socket, 0, ecode));
+
+    if (ecode == boost::asio::error::would_block) {
+      break;
+    } else if (ecode) {
+      CountSendError();
+      Pop(1);
+      ecode.clear();
+    }
+  }
+
+  batch.Clear();
+  return ecode;
+}
+
+void UdpSendQueue::CountSendError(size_t count) noexcept {
+  dropped_error_ += count;
+  common::Metrics::Add(common::Metrics::Counter::kUdpDroppedError, count);
+}
+
+UdpSendQueue::Statistics UdpSendQueue::GetStatistics() {
+  return {common::Metrics::Get(common::Metrics::Counter::kUdpQueuedDatagrams),
+          common::Metrics::Get(common::Metrics::Counter::kUdpDroppedFull),
+          common::Metrics::Get(common::Metrics::Counter::kUdpDroppedError)};
+}
+
+void UdpSendQueue::Pop(size_t count) {
+  for (; count != 0 && size_ != 0; --count, --size_) {
+    items_[head_].buffer.Reset();
+    head_ = (head_ + 1) % capacity_;
+  }
+
+  if (size_ == 0) {
+    head_ = 0;
+    std::vector<Item>().swap(items_);
+  }
+}
+
+}  // namespace session::socks5::detail
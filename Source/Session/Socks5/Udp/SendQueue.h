@@ -0,0 +1,79 @@
+#ifndef SESSION_SOCKS5_UDP_SEND_QUEUE_H_
+#define SESSION_SOCKS5_UDP_SEND_QUEUE_H_
+
+#include <boost/asio/buffer.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Common/BufferPool.h"
+#include "Common/UdpBatch.h"
+#include "Types.h"
+
+namespace session::socks5::detail {
+
+// The datagrams of a UDP association which could not be sent because the send buffer of the
+// socket was full. They are sent in order once the socket becomes writable, while the association
+// keeps receiving. The queue is bounded; when it is full, a datagram is dropped according to the
+// drop policy. The memory of the queue is only held while it is not empty.
+class UdpSendQueue {
+ public:
+  enum class DropPolicy {
+    kTail,    // The new datagram is dropped.
+    kOldest,  // The oldest queued datagram is dropped to make room for the new one.
+  };
+
+  // Counters of all associations of the process.
+  struct Statistics {
+    uint64_t queued;         // Datagrams which had to wait in a queue.
+    uint64_t dropped_full;   // Datagrams dropped because a queue was full.
+    uint64_t dropped_error;  // Datagrams dropped because of a send error.
+  };
+
+  UdpSendQueue(size_t capacity, DropPolicy policy);
+
+  // Copies the datagram made of the header and the payload to the end of the queue.
+  void Push(const net_udp::endpoint& endpoint, boost::asio::const_buffer header,
+            boost::asio::const_buffer payload);
+
+  // Returns true if the queue is empty.
+  bool Empty() const noexcept { return size_ == 0; }
+
+  // Sends the queued datagrams through the batch and the non-blocking socket, until the queue is
+  // empty or the socket would block. A datagram which fails with another error is dropped.
+  // Returns the error which stopped the sending (would_block), or success.
+  error_code Flush(net_udp::socket& socket, common::UdpBatch& batch);
+
+  // Counts the datagrams dropped because of a send error outside of the queue.
+  void CountSendError(size_t count = 1) noexcept;
+
+  // Returns the number of datagrams dropped because the queue was full.
+  uint64_t GetDroppedFull() const noexcept { return dropped_full_; }
+
+  // Returns the number of datagrams dropped because of send errors.
+  uint64_t GetDroppedError() const noexcept { return dropped_error_; }
+
+  // Returns the counters of all associations.
+  static Statistics GetStatistics();
+
+ private:
+  struct Item {
+    net_udp::endpoint endpoint;
+    common::PooledBuffer buffer;
+    size_t size;
+  };
+
+  // Removes the datagrams from the front of the queue.
+  void Pop(size_t count);
+
+  size_t capacity_;
+  DropPolicy policy_;
+  std::vector<Item> items_;  // A ring buffer, allocated only while the queue is not empty.
+  size_t head_;
+  size_t size_;
+  uint64_t dropped_full_;
+  uint64_t dropped_error_;
+};
+
+}  // namespace session::socks5::detail
+
+#endif  // !SESSION_SOCKS5_UDP_SEND_QUEUE_H_
@@ -9,4 +9,9 @@ using net_udp = boost::asio::ip::udp;
 
 using error_code = boost::system::error_code;
 
+#if defined(SO_REUSEPORT)
+// Allows several sockets to be bound to the same address, the kernel balances the load between them.
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
 #endif  // !TYPES_H_
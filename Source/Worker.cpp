@@ -0,0 +1,131 @@
+#include "Worker.h"
+#include <boost/asio/post.hpp>
+#include <cstdint>
+#include "Common/Logger.h"
+#include "Configuration.h"
+
+using namespace boost;
+
+Worker::Worker(size_t index)
+    : index_{index},
+      context_{1},
+      work_guard_{context_.get_executor()},
+      servers_{},
+      udp_relay_{},
+      thread_{} {}
+
+Worker::~Worker() {
+  Stop();
+}
+
+std::shared_ptr<Worker> Worker::Create(size_t index) {
+  return std::shared_ptr<Worker>(new Worker(index));
+}
+
+void Worker::Start() {
+  for (auto version : {Server::Version::kSocks4, Server::Version::kSocks5}) {
+    if (auto server = CreateAndStartServer(version)) {
+      servers_.push_back(server);
+    }
+  }
+
+  udp_relay_ = CreateAndStartUdpRelay();
+
+  thread_ = std::thread(
+      [this]()
+      {
+        session::socks5::detail::UdpRelay::SetThreadInstance(udp_relay_);
+        context_.run();
+      });
+}
+
+void Worker::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+
+  asio::post(context_,
+             [this]()
+             {
+               for (auto& server : servers_) {
+                 server->Stop();
+               }
+
+               servers_.clear();
+               if (udp_relay_) {
+                 udp_relay_->Stop();
+               }
+               work_guard_.reset();
+             });
+
+  thread_.join();
+}
+
+size_t Worker::GetIndex() const {
+  return index_;
+}
+
+asio::io_context& Worker::GetContext() {
+  return context_;
+}
+
+const std::vector<std::shared_ptr<Server>>& Worker::GetServers() const noexcept {
+  return servers_;
+}
+
+std::shared_ptr<Server> Worker::CreateAndStartServer(Server::Version version) {
+  auto config = Configuration::GetInstance();
+  const auto name = version == Server::Version::kSocks4 ? "SOCKS4" : "SOCKS5";
+
+  if ((version == Server::Version::kSocks4 && !config->GetSocks4().enable) ||
+      (version == Server::Version::kSocks5 && !config->GetSocks5().enable)) {
+    WLOGGER(info) << name << " disabled in configuration.";
+    return nullptr;
+  }
+
+  net_tcp::endpoint endpoint;
+
+  endpoint.address(asio::ip::address::from_string(version == Server::Version::kSocks4
+                                                      ? config->GetSocks4().address
+                                                      : config->GetSocks5().address));
+  endpoint.port(version == Server::Version::kSocks4 ? config->GetSocks4().port
+                                                    : config->GetSocks5().port);
+
+  auto server = Server::Create(context_, endpoint, version);
+  server->Start();
+  if (!server->IsOpen()) {
+    WLOGGER(error) << name << " was not running on worker " << index_ << ".";
+    return nullptr;
+  }
+
+  WLOGGER(info) << name << " running at " << endpoint.address().to_string() << ":"
+                << endpoint.port() << " on worker " << index_ << ".";
+  return server;
+}
+
+std::shared_ptr<session::socks5::detail::UdpRelay> Worker::CreateAndStartUdpRelay() {
+  const auto& config = Configuration::GetInstance()->GetSocks5();
+
+  if (!config.enable || !config.enable_udp || config.udp_relay_port == 0) {
+    return nullptr;
+  }
+
+  // The relays do not share a port like the TCP listeners: a datagram has to reach the worker of
+  // its association, which the kernel cannot tell from the datagram. The reply of an
+  // association carries the port of its worker.
+  if (config.udp_relay_port + index_ > UINT16_MAX) {
+    WLOGGER(error) << "SOCKS5 UDP relay port " << config.udp_relay_port + index_
+                   << " of worker " << index_ << " is out of range.";
+    return nullptr;
+  }
+
+  const auto port = static_cast<uint16_t>(config.udp_relay_port + index_);
+  auto relay = session::socks5::detail::UdpRelay::Create(context_.get_executor(), port);
+  if (!relay->Start()) {
+    WLOGGER(error) << "SOCKS5 UDP relay was not running on worker " << index_ << ".";
+    return nullptr;
+  }
+
+  WLOGGER(info) << "SOCKS5 UDP relay running at port " << port << " on worker " << index_ << ".";
+  return relay;
+}
@@ -0,0 +1,61 @@
+#ifndef WORKER_H_
+#define WORKER_H_
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "Server.h"
+#include "Session/Socks5/Udp/Relay.h"
+
+// A worker runs its own io_context on its own thread and owns a listener for every enabled
+// SOCKS server. All workers listen on the same addresses (SO_REUSEPORT), so the kernel spreads
+// incoming connections between them, and a session never leaves the thread that accepted it.
+class Worker final {
+  explicit Worker(size_t index);
+
+ public:
+  ~Worker();
+
+  Worker(const Worker&) = delete;
+  Worker& operator=(const Worker&) = delete;
+  Worker(Worker&&) noexcept = delete;
+  Worker& operator=(Worker&&) noexcept = delete;
+
+  // Creates an instance of the worker with the specified index.
+  static std::shared_ptr<Worker> Create(size_t index);
+
+  // Starts the listeners and the worker thread.
+  void Start();
+
+  // Stops the listeners and all sessions, then waits for the worker thread to finish.
+  void Stop();
+
+  // Returns the index of the worker.
+  size_t GetIndex() const;
+
+  // Returns the io_context served by the worker.
+  boost::asio::io_context& GetContext();
+
+  // Returns the running servers. Only to be used on the thread of the worker.
+  const std::vector<std::shared_ptr<Server>>& GetServers() const noexcept;
+
+ private:
+  // Creates and starts the listener of the specified SOCKS version.
+  // Returns nullptr if the server is disabled or failed to start.
+  std::shared_ptr<Server> CreateAndStartServer(Server::Version version);
+
+  // Creates and starts the shared UDP relay of the worker, if it is enabled.
+  // Returns nullptr if the relay is disabled or failed to start.
+  std::shared_ptr<session::socks5::detail::UdpRelay> CreateAndStartUdpRelay();
+
+  size_t index_;
+  boost::asio::io_context context_;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard_;
+  std::vector<std::shared_ptr<Server>> servers_;
+  std::shared_ptr<session::socks5::detail::UdpRelay> udp_relay_;  // Set if the relay is shared.
+  std::thread thread_;
+};
+
+#endif  // !WORKER_H_
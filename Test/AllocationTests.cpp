@@ -0,0 +1,96 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include "Allocations.h"
+#include "Loopback.h"
+
+// Fails if a SOCKS5 session on the loopback allocates more than its budget. The server runs on
+// the thread of the test, so every allocation counted is one of the server.
+
+using namespace bench;
+
+namespace {
+
+// Round trips through an established tunnel, which must not allocate at all.
+constexpr size_t kRelayCycles = 1000;
+// Whole CONNECT sessions: a pipelined handshake, a round trip and the close.
+constexpr size_t kSessionCycles = 100;
+// The allocations of a whole session, as BM_Socks5ConnectSession reports them. Lower it when a
+// change saves one; a change which needs more has to raise it on purpose.
+constexpr uint64_t kMaxSessionAllocations = 14;
+
+bool TestRelayCycle() {
+  Loopback loopback;
+  net_tcp::socket client{loopback.GetContext()};
+  net_tcp::socket application{loopback.GetContext()};
+
+  if (!loopback.Connect(client, application)) {
+    std::cerr << "relay cycle: the CONNECT failed.\n";
+    return false;
+  }
+
+  for (size_t cycle = 0; cycle < Loopback::kWarmupCycles; ++cycle) {
+    loopback.RoundTrip(client, application);
+  }
+
+  const auto started = GetAllocationCount();
+  for (size_t cycle = 0; cycle < kRelayCycles; ++cycle) {
+    if (!loopback.RoundTrip(client, application)) {
+      std::cerr << "relay cycle: the tunnel failed.\n";
+      return false;
+    }
+  }
+  const auto allocations = GetAllocationCount() - started;
+
+  loopback.Close(client, application);
+
+  std::cout << "relay cycle: " << allocations << " allocations in " << kRelayCycles
+            << " round trips.\n";
+  if (allocations != 0) {
+    std::cerr << "relay cycle: the relay allocated in the steady state.\n";
+    return false;
+  }
+
+  return true;
+}
+
+bool TestSession() {
+  Loopback loopback;
+  net_tcp::socket client{loopback.GetContext()};
+  net_tcp::socket application{loopback.GetContext()};
+
+  for (size_t cycle = 0; cycle < Loopback::kWarmupCycles; ++cycle) {
+    loopback.Connect(client, application);
+    loopback.Close(client, application);
+  }
+
+  const auto started = GetAllocationCount();
+  for (size_t cycle = 0; cycle < kSessionCycles; ++cycle) {
+    if (!loopback.Connect(client, application) || !loopback.RoundTrip(client, application)) {
+      std::cerr << "session: the CONNECT failed.\n";
+      return false;
+    }
+
+    loopback.Close(client, application);
+  }
+  const auto allocations = GetAllocationCount() - started;
+
+  std::cout << "session: " << allocations << " allocations in " << kSessionCycles
+            << " sessions, at most " << kMaxSessionAllocations << " per session allowed.\n";
+  if (allocations > kMaxSessionAllocations * kSessionCycles) {
+    std::cerr << "session: a session allocates more than " << kMaxSessionAllocations
+              << " times.\n";
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  // Both run, so a failure of the first does not hide the result of the second.
+  const bool relay = TestRelayCycle();
+  const bool session = TestSession();
+  return relay && session ? EXIT_SUCCESS : EXIT_FAILURE;
+}